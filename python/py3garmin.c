@@ -21,8 +21,10 @@
 #include "garmin.h"
 #include <Python.h>
 #include <stdio.h>
+#include <string.h>
 
 int verbose = 0;
+int cache   = 0;
 
 /* Toggle the state of the verbose flag and return the new value */
 
@@ -41,12 +43,34 @@ get_verbose(PyObject *obj, PyObject *args)
   return PyBool_FromLong(verbose);
 }
 
+/* Toggle the use of cached unit capabilities and return the new value */
+
+static PyObject *
+toggle_cache(PyObject *obj, PyObject *args)
+{
+  cache = (int)!cache;
+  return PyBool_FromLong(cache);
+}
+
+/* Return whether cached unit capabilities are used */
+
+static PyObject *
+get_cache(PyObject *obj, PyObject *args)
+{
+  return PyBool_FromLong(cache);
+}
+
 /* Initialize the garmin unit and hanlde errors */
 
 bool
 initialize_garmin(garmin_unit *garmin)
 {
-  int init_code = garmin_init(garmin, verbose);
+  int init_code;
+
+  memset(garmin, 0, sizeof(garmin_unit));
+  garmin->verbose   = verbose;
+  garmin->use_cache = cache;
+  init_code         = garmin_connect(garmin);
 
   switch (init_code) {
   case 0:
@@ -93,13 +117,113 @@ get_info(PyObject *obj, PyObject *args)
   return Py_BuildValue("N", dict);
 }
 
+/* A lap by its lap index, or the points of a track by its track index */
+
+typedef struct {
+  uint32            index;
+  uint32            order;
+  garmin_list_node *first;
+  garmin_list_node *end;
+} run_index_entry;
+
+static int
+compare_index_entries(const void *a, const void *b)
+{
+  const run_index_entry *x = a;
+  const run_index_entry *y = b;
+
+  if (x->index != y->index)
+    return (x->index < y->index) ? -1 : 1;
+  return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+/* The first entry whose index is 'index' or more */
+
+static uint32
+find_index_entry(run_index_entry *e, uint32 count, uint32 index)
+{
+  uint32 lo = 0;
+  uint32 hi = count;
+
+  while (lo < hi) {
+    uint32 mid = lo + (hi - lo) / 2;
+    if (e[mid].index < index)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/* Index the laps by lap index */
+
+static run_index_entry *
+index_laps(garmin_list *laps, uint32 *count)
+{
+  run_index_entry * e = calloc(laps->elements + 1, sizeof(run_index_entry));
+  garmin_list_node *m;
+  uint32            l_idx;
+  uint32            i;
+
+  *count = 0;
+  if (e == NULL)
+    return NULL;
+
+  for (m = laps->head, i = 0; m != NULL; m = m->next, i++) {
+    if (get_lap_index(m->data, &l_idx) != 0) {
+      e[*count].index = l_idx;
+      e[*count].order = i;
+      e[*count].first = m;
+      (*count)++;
+    }
+  }
+  qsort(e, *count, sizeof(run_index_entry), compare_index_entries);
+
+  return e;
+}
+
+/* Index the tracks by track index: the points of a track are the nodes
+   after its D311 header, up to the next header */
+
+static run_index_entry *
+index_tracks(garmin_list *tracks, uint32 *count)
+{
+  run_index_entry * e = calloc(tracks->elements + 1, sizeof(run_index_entry));
+  garmin_list_node *o;
+  uint32            i;
+
+  *count = 0;
+  if (e == NULL)
+    return NULL;
+
+  for (o = tracks->head, i = 0; o != NULL; o = o->next, i++) {
+    if (o->data != NULL && o->data->type == data_D311) {
+      if (*count > 0)
+        e[*count - 1].end = o;
+      e[*count].index = ((D311 *)o->data->data)->index;
+      e[*count].order = i;
+      e[*count].first = o->next;
+      e[*count].end   = NULL;
+      (*count)++;
+    }
+  }
+  qsort(e, *count, sizeof(run_index_entry), compare_index_entries);
+
+  return e;
+}
+
 /* Return all run data from the attached garmin unit as python dictionary */
 
 static PyObject *
 get_runs(PyObject *obj, PyObject *args)
 {
-  garmin_unit garmin;
-  PyObject *  result = NULL;
+  garmin_unit      garmin;
+  PyObject *       result    = NULL;
+  run_index_entry *lap_index = NULL;
+  run_index_entry *trk_index = NULL;
+  uint32           lap_count = 0;
+  uint32           trk_count = 0;
 
   if (!initialize_garmin(&garmin))
     return NULL;
@@ -169,6 +293,7 @@ get_runs(PyObject *obj, PyObject *args)
   uint32            f_lap;
   uint32            l_lap;
   uint32            l_idx;
+  uint32            k;
   time_type         start;
 
   /* Print some debug output if requested. */
@@ -181,6 +306,18 @@ get_runs(PyObject *obj, PyObject *args)
     }
   }
 
+  /*
+    Index the laps and the tracks once, rather than going through both
+    lists for every run and lap.
+  */
+
+  lap_index = index_laps(laps, &lap_count);
+  trk_index = index_tracks(tracks, &trk_count);
+  if (lap_index == NULL || trk_index == NULL) {
+    PyErr_NoMemory();
+    goto out;
+  }
+
   /* For each run, get its laps and track points. */
 
   PyObject *dict = PyDict_New();
@@ -233,119 +370,116 @@ get_runs(PyObject *obj, PyObject *args)
       if (verbose != 0)
         printf("[garmin] run: track [%d], laps [%d:%d]\n", trk, f_lap, l_lap);
 
-      for (m = laps->head; m != NULL; m = m->next) {
-        if (get_lap_index(m->data, &l_idx) != 0) {
-          if (l_idx >= f_lap && l_idx <= l_lap) {
-            PyObject *lap = PyDict_New();
-
-            if (verbose != 0)
-              printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
-                     l_idx,
-                     f_lap,
-                     l_lap);
-
-            start = 0;
-            get_lap_start_time(m->data, &start);
-
-            if (start != 0) {
-              if (l_idx == f_lap)
-                f_lap_start = start;
-
-              PyDict_SetItem(lap,
-                             PyUnicode_FromString("start_time"),
-                             Py_BuildValue("i", (int)start));
-              PyDict_SetItem(lap,
-                             PyUnicode_FromString("type"),
-                             Py_BuildValue("i", (int)m->data->type));
-
-              if (m->data->type == data_D1015) {
-                D1015 *d1015;
-                d1015 = m->data->data;
-                PyDict_SetItem(lap,
-                               PyUnicode_FromString("duration"),
-                               Py_BuildValue("i", d1015->total_time));
-                PyDict_SetItem(lap,
-                               PyUnicode_FromString("distance"),
-                               Py_BuildValue("f", d1015->total_dist));
-                PyDict_SetItem(lap,
-                               PyUnicode_FromString("max_speed"),
-                               Py_BuildValue("f", d1015->max_speed));
-              }
+      /* The run's track, if there is one */
+
+      run_index_entry *track = NULL;
+
+      k = find_index_entry(trk_index, trk_count, trk);
+      if (k < trk_count && trk_index[k].index == trk)
+        track = &trk_index[k];
+
+      for (k = find_index_entry(lap_index, lap_count, f_lap);
+           k < lap_count && lap_index[k].index <= l_lap;
+           k++) {
+        m     = lap_index[k].first;
+        l_idx = lap_index[k].index;
+
+        PyObject *lap = PyDict_New();
+
+        if (verbose != 0)
+          printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
+                 l_idx,
+                 f_lap,
+                 l_lap);
+
+        start = 0;
+        get_lap_start_time(m->data, &start);
+
+        if (start != 0) {
+          if (l_idx == f_lap)
+            f_lap_start = start;
+
+          PyDict_SetItem(lap,
+                         PyUnicode_FromString("start_time"),
+                         Py_BuildValue("i", (int)start));
+          PyDict_SetItem(lap,
+                         PyUnicode_FromString("type"),
+                         Py_BuildValue("i", (int)m->data->type));
+
+          if (m->data->type == data_D1015) {
+            D1015 *d1015;
+            d1015 = m->data->data;
+            PyDict_SetItem(lap,
+                           PyUnicode_FromString("duration"),
+                           Py_BuildValue("i", d1015->total_time));
+            PyDict_SetItem(lap,
+                           PyUnicode_FromString("distance"),
+                           Py_BuildValue("f", d1015->total_dist));
+            PyDict_SetItem(lap,
+                           PyUnicode_FromString("max_speed"),
+                           Py_BuildValue("f", d1015->max_speed));
+          }
 
-              PyObject *points = PyList_New(0);
-
-              bool have_track = 0;
-              bool done       = 0;
-
-              for (o = tracks->head; o != NULL; o = o->next) {
-                if (o->data != NULL) {
-                  if (o->data->type == data_D311) {
-                    if (!have_track) {
-                      D311 *d311;
-                      d311 = o->data->data;
-                      if (d311->index == trk)
-                        have_track = 1;
-                    } else /* We've reached the end of the track */
-                      done = 1;
-                  }
-
-                  else if (o->data->type == data_D304 && have_track) {
-                    D304 *d304;
-                    d304            = o->data->data;
-                    PyObject *point = PyDict_New();
-
-                    if (d304->posn.lat != 2147483647 &&
-                        d304->posn.lon != 2147483647) {
-                      PyDict_SetItem(point,
-                                     PyUnicode_FromString("position"),
-                                     Py_BuildValue("(ff)",
-                                                   SEMI2DEG(d304->posn.lat),
-                                                   SEMI2DEG(d304->posn.lon)));
-                      PyDict_SetItem(point,
-                                     PyUnicode_FromString("type"),
-                                     Py_BuildValue("i", (int)o->data->type));
-                      PyDict_SetItem(
-                        point,
-                        PyUnicode_FromString("time"),
-                        Py_BuildValue("f", (float)(d304->time + TIME_OFFSET)));
-                      PyDict_SetItem(point,
-                                     PyUnicode_FromString("distance"),
-                                     Py_BuildValue("f", d304->distance));
-                      PyDict_SetItem(point,
-                                     PyUnicode_FromString("altitude"),
-                                     Py_BuildValue("f", d304->alt));
-                      PyDict_SetItem(point,
-                                     PyUnicode_FromString("heart_rate"),
-                                     Py_BuildValue("i", d304->heart_rate));
-
-                      if (d304->cadence != 255)
-                        PyDict_SetItem(point,
-                                       PyUnicode_FromString("cadence"),
-                                       Py_BuildValue("i", d304->cadence));
-
-                      PyList_Append(points, Py_BuildValue("N", point));
-                    }
-                  }
-
-                  else if (have_track)
-                    printf("get_track: point type %d invalid!\n",
-                           o->data->type);
+          PyObject *points = PyList_New(0);
+
+          if (track != NULL) {
+            for (o = track->first; o != track->end; o = o->next) {
+              if (o->data == NULL)
+                continue;
+
+              if (o->data->type == data_D304) {
+                D304 *d304;
+                d304            = o->data->data;
+                PyObject *point = PyDict_New();
+
+                if (d304->posn.lat != 2147483647 &&
+                    d304->posn.lon != 2147483647) {
+                  PyDict_SetItem(point,
+                                 PyUnicode_FromString("position"),
+                                 Py_BuildValue("(ff)",
+                                               SEMI2DEG(d304->posn.lat),
+                                               SEMI2DEG(d304->posn.lon)));
+                  PyDict_SetItem(point,
+                                 PyUnicode_FromString("type"),
+                                 Py_BuildValue("i", (int)o->data->type));
+                  PyDict_SetItem(
+                    point,
+                    PyUnicode_FromString("time"),
+                    Py_BuildValue("f", (float)(d304->time + TIME_OFFSET)));
+                  PyDict_SetItem(point,
+                                 PyUnicode_FromString("distance"),
+                                 Py_BuildValue("f", d304->distance));
+                  PyDict_SetItem(point,
+                                 PyUnicode_FromString("altitude"),
+                                 Py_BuildValue("f", d304->alt));
+                  PyDict_SetItem(point,
+                                 PyUnicode_FromString("heart_rate"),
+                                 Py_BuildValue("i", d304->heart_rate));
+
+                  if (d304->cadence != 255)
+                    PyDict_SetItem(point,
+                                   PyUnicode_FromString("cadence"),
+                                   Py_BuildValue("i", d304->cadence));
+
+                  PyList_Append(points, Py_BuildValue("N", point));
                 }
-
-                if (done)
-                  break;
               }
-              PyDict_SetItem(lap,
-                             PyUnicode_FromString("points"),
-                             Py_BuildValue("N", points));
-            } else
-              PyErr_Warn(PyExc_Warning, "Start time of first lap not found.");
-
-            PyDict_SetItem(rlaps,
-                           PyUnicode_FromFormat("%d", (int)l_idx),
-                           Py_BuildValue("N", lap));
+
+              else
+                printf("get_track: point type %d invalid!\n",
+                       o->data->type);
+            }
           }
-        }
+
+          PyDict_SetItem(lap,
+                         PyUnicode_FromString("points"),
+                         Py_BuildValue("N", points));
+        } else
+          PyErr_Warn(PyExc_Warning, "Start time of first lap not found.");
+
+        PyDict_SetItem(rlaps,
+                       PyUnicode_FromFormat("%d", (int)l_idx),
+                       Py_BuildValue("N", lap));
       }
       PyDict_SetItem(
         run, PyUnicode_FromString("laps"), Py_BuildValue("N", rlaps));
@@ -358,6 +492,8 @@ get_runs(PyObject *obj, PyObject *args)
   result = Py_BuildValue("N", dict);
 
 out:
+  free(lap_index);
+  free(trk_index);
   if (data != NULL)
     garmin_free_data(data);
   garmin_close(&garmin);
@@ -366,6 +502,88 @@ out:
   return result;
 }
 
+/* A float field of a track point, or None if the unit doesn't have it */
+
+static PyObject *
+track_float(float32 v)
+{
+  if (v >= 1.0e24)
+    Py_RETURN_NONE;
+  return PyFloat_FromDouble(v);
+}
+
+/* Return the track points of a .gmn file as a dictionary of lists, one per
+   field, with None where a point has no value for the field */
+
+static PyObject *
+load_track(PyObject *obj, PyObject *args)
+{
+  const char *  filename;
+  garmin_track *track;
+  uint32        i;
+
+  if (!PyArg_ParseTuple(args, "s", &filename))
+    return NULL;
+
+  if ((track = garmin_load_track(filename)) == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "Unable to load the track.");
+    return NULL;
+  }
+
+  PyObject *time       = PyList_New(track->count);
+  PyObject *lat        = PyList_New(track->count);
+  PyObject *lon        = PyList_New(track->count);
+  PyObject *alt        = PyList_New(track->count);
+  PyObject *distance   = PyList_New(track->count);
+  PyObject *heart_rate = PyList_New(track->count);
+  PyObject *cadence    = PyList_New(track->count);
+
+  for (i = 0; i < track->count; i++) {
+    PyList_SET_ITEM(
+      time, i, PyLong_FromUnsignedLong(track->time[i] + TIME_OFFSET));
+    if (GARMIN_TRACK_VALID(track, i)) {
+      PyList_SET_ITEM(lat, i, PyFloat_FromDouble(SEMI2DEG(track->lat[i])));
+      PyList_SET_ITEM(lon, i, PyFloat_FromDouble(SEMI2DEG(track->lon[i])));
+    } else {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(lat, i, Py_None);
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(lon, i, Py_None);
+    }
+    PyList_SET_ITEM(alt, i, track_float(track->alt[i]));
+    PyList_SET_ITEM(distance, i, track_float(track->distance[i]));
+    PyList_SET_ITEM(heart_rate, i, PyLong_FromLong(track->heart_rate[i]));
+    if (track->cadence[i] != 0xff) {
+      PyList_SET_ITEM(cadence, i, PyLong_FromLong(track->cadence[i]));
+    } else {
+      Py_INCREF(Py_None);
+      PyList_SET_ITEM(cadence, i, Py_None);
+    }
+  }
+
+  PyObject *result = Py_BuildValue("{s:i,s:N,s:N,s:N,s:N,s:N,s:N,s:N}",
+                                   "type",
+                                   (int)track->type,
+                                   "time",
+                                   time,
+                                   "lat",
+                                   lat,
+                                   "lon",
+                                   lon,
+                                   "alt",
+                                   alt,
+                                   "distance",
+                                   distance,
+                                   "heart_rate",
+                                   heart_rate,
+                                   "cadence",
+                                   cadence);
+
+  garmin_track_free(track);
+
+  return result;
+}
+
 /* Assign python names to the exported functions */
 
 static PyMethodDef MethodTable[] = {
@@ -379,6 +597,15 @@ static PyMethodDef MethodTable[] = {
    METH_VARARGS,
    "Return the current state of the verbose flag, True if turned on, False "
    "else."},
+  {"toggle_cache",
+   toggle_cache,
+   METH_VARARGS,
+   "Toggle the use of unit capabilities cached by an earlier connect and "
+   "return its new state."},
+  {"get_cache",
+   get_cache,
+   METH_VARARGS,
+   "Return True if cached unit capabilities are used, False else."},
   {"get_info",
    get_info,
    METH_VARARGS,
@@ -387,6 +614,11 @@ static PyMethodDef MethodTable[] = {
    get_runs,
    METH_VARARGS,
    "Return a dictionary with all runs stored on the attached unit."},
+  {"load_track",
+   load_track,
+   METH_VARARGS,
+   "Return the track points of a .gmn file as a dictionary of lists, one per "
+   "field."},
   {NULL, NULL, 0, NULL}};
 
 static struct PyModuleDef moduledef = {
@@ -0,0 +1,169 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+
+
+/*
+   An arena hands out zeroed memory from a few large blocks and gives it
+   all back at once.  While a thread has an arena in use (see
+   garmin_arena_use), everything garmin_unpack and the protocol readers
+   allocate for the data they decode comes from it: the garmin_data
+   wrappers, the D-structs, their strings and the list nodes.  Such data
+   is released with garmin_arena_free; garmin_free_data leaves it alone.
+*/
+
+#define ARENA_ALIGN       16
+#define ARENA_FIRST_BLOCK (64 * 1024)
+#define ARENA_MAX_BLOCK   (1024 * 1024)
+
+
+typedef struct garmin_arena_block {
+  struct garmin_arena_block *  next;
+  size_t                       size;
+  size_t                       used;
+} garmin_arena_block;
+
+
+/* The block header is padded so that the memory after it stays aligned. */
+
+#define ARENA_HEADER \
+  ((sizeof(garmin_arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+
+struct garmin_arena {
+  garmin_arena_block *  blocks;     /* the newest block first */
+  size_t                next_size;  /* size of the next block */
+};
+
+
+static _Thread_local garmin_arena * gArena = NULL;
+
+
+garmin_arena *
+garmin_arena_new ( void )
+{
+  garmin_arena * a = calloc(1,sizeof(garmin_arena));
+
+  if ( a != NULL ) a->next_size = ARENA_FIRST_BLOCK;
+
+  return a;
+}
+
+
+/* Release everything that was allocated from the arena, and the arena. */
+
+void
+garmin_arena_free ( garmin_arena * a )
+{
+  garmin_arena_block * b;
+  garmin_arena_block * x;
+
+  if ( a == NULL ) return;
+
+  if ( gArena == a ) gArena = NULL;
+
+  for ( b = a->blocks; b != NULL; b = x ) {
+    x = b->next;
+    free(b);
+  }
+  free(a);
+}
+
+
+/* Allocate 'size' bytes of zeroed memory from the arena. */
+
+void *
+garmin_arena_alloc ( garmin_arena * a, size_t size )
+{
+  garmin_arena_block * b = a->blocks;
+  size_t               need;
+  void *               p;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if ( b == NULL || b->size - b->used < size ) {
+
+    /*
+       Start a new block.  Blocks grow up to a limit; anything bigger than
+       that gets a block of its own.
+    */
+
+    need = a->next_size;
+    if ( need < size ) need = size;
+    if ( (b = calloc(1,ARENA_HEADER + need)) == NULL ) return NULL;
+    b->size = need;
+
+    if ( a->blocks != NULL && size > a->next_size ) {
+      /* Keep filling the current block after this one-off. */
+      b->next = a->blocks->next;
+      a->blocks->next = b;
+    } else {
+      b->next = a->blocks;
+      a->blocks = b;
+    }
+    if ( a->next_size < ARENA_MAX_BLOCK ) a->next_size *= 2;
+  }
+
+  p = (uint8 *)b + ARENA_HEADER + b->used;
+  b->used += size;
+
+  return p;
+}
+
+
+/*
+   Make 'a' the arena of the calling thread (or none, if NULL) and return
+   the one it replaces, so that it can be put back afterwards.
+*/
+
+garmin_arena *
+garmin_arena_use ( garmin_arena * a )
+{
+  garmin_arena * old = gArena;
+
+  gArena = a;
+
+  return old;
+}
+
+
+/* The arena of the calling thread, if any. */
+
+garmin_arena *
+garmin_arena_current ( void )
+{
+  return gArena;
+}
+
+
+/*
+   Allocate zeroed memory for 'count' objects of 'size' bytes, from the
+   arena of the calling thread if it has one and with calloc otherwise.
+*/
+
+void *
+garmin_arena_calloc ( size_t count, size_t size )
+{
+  return ( gArena != NULL ) ?
+    garmin_arena_alloc(gArena,count * size) : calloc(count,size);
+}
@@ -23,58 +23,23 @@
 #include "garmin.h"
 
 
-#ifdef WORDS_BIGENDIAN
-#define ENDIAN_FOR(i,x)     for ( i = sizeof(x)-1; i >= 0; i-- )
-#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
-#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
-#else /* WORDS_BIGENDIAN */
-#define ENDIAN_FOR(i,x)     for ( i = 0; i < (int)sizeof(x); i++ )
-#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
-#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
-#endif /* WORDS_BIGENDIAN */
-
-#define DEF_ENDIAN_GET(x)          \
-  x                                \
-  get_##x ( const uint8 * d )      \
-  {                                \
-    x       v;                     \
-    uint8 * b;                     \
-    int     i;                     \
-                                   \
-    b = (uint8 *)&v;               \
-    ENDIAN_GET(i,x,d,b);           \
-                                   \
-    return v;                      \
-  }
-
-
-#define DEF_ENDIAN_PUT(x)          \
-  void                             \
-  put_##x ( uint8 * d, const x v ) \
-  {                                \
-    uint8 * b;                     \
-    int     i;                     \
-                                   \
-    b = (uint8 *)&v;               \
-    ENDIAN_PUT(i,x,b,d);           \
-  }
-
-
-/* Here are the definitions for the get/put functions. */
+/* The out-of-line copies of the inline get/put functions in garmin.h. */
 
-DEF_ENDIAN_GET(uint16)
-DEF_ENDIAN_GET(sint16)
-DEF_ENDIAN_GET(uint32)
-DEF_ENDIAN_GET(sint32)
-DEF_ENDIAN_GET(float32)
-DEF_ENDIAN_GET(float64)
+extern inline uint16   get_uint16  ( const uint8 * d );
+extern inline sint16   get_sint16  ( const uint8 * d );
+extern inline uint32   get_uint32  ( const uint8 * d );
+extern inline sint32   get_sint32  ( const uint8 * d );
+extern inline uint64_t get_uint64  ( const uint8 * d );
+extern inline float32  get_float32 ( const uint8 * d );
+extern inline float64  get_float64 ( const uint8 * d );
 
-DEF_ENDIAN_PUT(uint16)
-DEF_ENDIAN_PUT(sint16)
-DEF_ENDIAN_PUT(uint32)
-DEF_ENDIAN_PUT(sint32)
-DEF_ENDIAN_PUT(float32)
-DEF_ENDIAN_PUT(float64)
+extern inline void     put_uint16  ( uint8 * d, const uint16   v );
+extern inline void     put_sint16  ( uint8 * d, const sint16   v );
+extern inline void     put_uint32  ( uint8 * d, const uint32   v );
+extern inline void     put_sint32  ( uint8 * d, const sint32   v );
+extern inline void     put_uint64  ( uint8 * d, const uint64_t v );
+extern inline void     put_float32 ( uint8 * d, const float32  v );
+extern inline void     put_float64 ( uint8 * d, const float64  v );
 
 
 /*
@@ -123,7 +88,7 @@ get_vstring ( uint8 ** buf )
 
   do { bytes++; } while ( *cursor++ );
 
-  ret = calloc(bytes, sizeof(char));
+  ret = garmin_arena_calloc(bytes, sizeof(char));
   strncpy(ret,start,bytes-1);
 
   *buf += bytes;
@@ -0,0 +1,246 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+   Times the get/put functions in garmin.h against the byte at a time
+   copies they replaced, over unaligned 32-bit fields.  Built with
+   WORDS_BIGENDIAN defined, it times the byte swapping paths instead; the
+   values are then wrong for a little-endian host, but both versions
+   agree on them, which is all that is checked.  Not installed: run it
+   with "meson test --benchmark".
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "garmin.h"
+
+
+/* This file has its own copies, made with its own idea of byte order. */
+
+extern inline uint32   get_uint32  ( const uint8 * d );
+extern inline uint64_t get_uint64  ( const uint8 * d );
+extern inline float32  get_float32 ( const uint8 * d );
+extern inline void     put_uint32  ( uint8 * d, const uint32   v );
+extern inline void     put_uint64  ( uint8 * d, const uint64_t v );
+extern inline void     put_float32 ( uint8 * d, const float32  v );
+
+
+/*
+   The functions as they were before, out of line in byte_util.c, which
+   noinline stands in for here.
+*/
+
+#ifdef WORDS_BIGENDIAN
+#define ENDIAN_FOR(i,x)     for ( i = sizeof(x)-1; i >= 0; i-- )
+#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
+#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
+#else /* WORDS_BIGENDIAN */
+#define ENDIAN_FOR(i,x)     for ( i = 0; i < (int)sizeof(x); i++ )
+#define ENDIAN_GET(i,x,y,z) ENDIAN_FOR(i,x) *z++ = y[i]
+#define ENDIAN_PUT(i,x,y,z) ENDIAN_FOR(i,x) z[i] = *y++
+#endif /* WORDS_BIGENDIAN */
+
+#define DEF_ENDIAN_GET(x)                                 \
+  static __attribute__((noinline)) x                      \
+  old_get_##x ( const uint8 * d )                         \
+  {                                                       \
+    x       v;                                            \
+    uint8 * b;                                            \
+    int     i;                                            \
+                                                          \
+    b = (uint8 *)&v;                                      \
+    ENDIAN_GET(i,x,d,b);                                  \
+                                                          \
+    return v;                                             \
+  }
+
+#define DEF_ENDIAN_PUT(x)                                 \
+  static __attribute__((noinline)) void                   \
+  old_put_##x ( uint8 * d, const x v )                    \
+  {                                                       \
+    uint8 * b;                                            \
+    int     i;                                            \
+                                                          \
+    b = (uint8 *)&v;                                      \
+    ENDIAN_PUT(i,x,b,d);                                  \
+  }
+
+DEF_ENDIAN_GET(uint32)
+DEF_ENDIAN_GET(float32)
+DEF_ENDIAN_PUT(uint32)
+DEF_ENDIAN_PUT(float32)
+
+
+#define BENCH_FIELDS  (1 << 20)  /* 4 MB of 32-bit fields */
+#define BENCH_ROUNDS  50
+
+
+static double
+bench_now ( void )
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void
+bench_report ( const char * name, double old_time, double new_time )
+{
+  double mb = (double)BENCH_FIELDS * 4 * BENCH_ROUNDS / (1024 * 1024);
+
+  printf("%-12s  old %8.0f MB/s  new %8.0f MB/s\n",
+         name,mb / old_time,mb / new_time);
+}
+
+
+/*
+   Each pass over the buffer is a function of its own, so that the
+   compiler treats the old and new versions alike and can't merge the
+   rounds.  A get pass counts the fields that aren't zero into a volatile,
+   so that none of the work can be left out.
+*/
+
+static volatile uint32 bench_count;
+
+#define DEF_BENCH_GET(get)                                \
+  static __attribute__((noinline)) void                   \
+  bench_##get ( const uint8 * d )                         \
+  {                                                       \
+    uint32 count = 0;                                     \
+    int    i;                                             \
+                                                          \
+    for ( i = 0; i < BENCH_FIELDS; i++ ) {                \
+      count += ( get(d + 4 * i) != 0 );                   \
+    }                                                     \
+                                                          \
+    bench_count += count;                                 \
+  }
+
+#define DEF_BENCH_PUT(x,put)                              \
+  static __attribute__((noinline)) void                   \
+  bench_##put ( uint8 * d, int r )                        \
+  {                                                       \
+    int    i;                                             \
+                                                          \
+    for ( i = 0; i < BENCH_FIELDS; i++ ) {                \
+      put(d + 4 * i,(x)(i + r));                          \
+    }                                                     \
+  }
+
+DEF_BENCH_GET(old_get_uint32)
+DEF_BENCH_GET(get_uint32)
+DEF_BENCH_GET(old_get_float32)
+DEF_BENCH_GET(get_float32)
+DEF_BENCH_PUT(uint32,old_put_uint32)
+DEF_BENCH_PUT(uint32,put_uint32)
+DEF_BENCH_PUT(float32,old_put_float32)
+DEF_BENCH_PUT(float32,put_float32)
+
+
+/* Time BENCH_ROUNDS passes, in seconds. */
+
+#define BENCH_TIME(time,pass)                             \
+  do {                                                    \
+    double t = bench_now();                               \
+    int    r;                                             \
+                                                          \
+    for ( r = 0; r < BENCH_ROUNDS; r++ ) {                \
+      pass;                                               \
+    }                                                     \
+    time = bench_now() - t;                               \
+  } while ( 0 )
+
+
+int
+main ( void )
+{
+  uint8 *  buf;
+  uint8 *  out;
+  uint8 *  d;
+  uint32   old_count = 0;
+  uint32   new_count = 0;
+  double   old_time;
+  double   new_time;
+  int      ok = 1;
+  int      i;
+
+  /* One byte in, so that no field is aligned. */
+
+  buf = malloc(BENCH_FIELDS * 4 + 1);
+  out = malloc(BENCH_FIELDS * 4 + 1);
+  if ( buf == NULL || out == NULL ) {
+    printf("out of memory\n");
+    return 1;
+  }
+  d = buf + 1;
+  for ( i = 0; i < BENCH_FIELDS * 4; i++ ) d[i] = (uint8)(i * 131 + 7);
+  memset(out,0,BENCH_FIELDS * 4 + 1);
+
+#ifdef WORDS_BIGENDIAN
+  printf("byte order: swapped\n");
+#else
+  printf("byte order: native\n");
+#endif
+
+  bench_count = 0;
+  BENCH_TIME(old_time,bench_old_get_uint32(d));
+  old_count = bench_count;
+  bench_count = 0;
+  BENCH_TIME(new_time,bench_get_uint32(d));
+  new_count = bench_count;
+  bench_report("get_uint32",old_time,new_time);
+  if ( old_count != new_count ) ok = 0;
+
+  bench_count = 0;
+  BENCH_TIME(old_time,bench_old_get_float32(d));
+  old_count = bench_count;
+  bench_count = 0;
+  BENCH_TIME(new_time,bench_get_float32(d));
+  new_count = bench_count;
+  bench_report("get_float32",old_time,new_time);
+  if ( old_count != new_count ) ok = 0;
+
+  BENCH_TIME(old_time,bench_old_put_uint32(out + 1,r));
+  memcpy(buf,out,BENCH_FIELDS * 4 + 1);
+  BENCH_TIME(new_time,bench_put_uint32(out + 1,r));
+  bench_report("put_uint32",old_time,new_time);
+  if ( memcmp(buf,out,BENCH_FIELDS * 4 + 1) != 0 ) ok = 0;
+
+  BENCH_TIME(old_time,bench_old_put_float32(out + 1,r));
+  memcpy(buf,out,BENCH_FIELDS * 4 + 1);
+  BENCH_TIME(new_time,bench_put_float32(out + 1,r));
+  bench_report("put_float32",old_time,new_time);
+  if ( memcmp(buf,out,BENCH_FIELDS * 4 + 1) != 0 ) ok = 0;
+
+  free(buf);
+  free(out);
+
+  if ( ok == 0 ) {
+    printf("the old and new functions disagree!\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,342 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "garmin.h"
+
+
+/*
+   The capabilities a unit reports in the A000/A001 handshake (product
+   data, extended data and the protocols and data types it speaks) are
+   cached per unit id in $XDG_CACHE_HOME/garmintools/<unit id>, so that a
+   connect can skip the handshake.  The file is plain text, one "key value"
+   pair per line, with the protocol and data type fields of garmin_unit
+   listed in the table below.
+*/
+
+#define CACHE_VERSION  1
+
+
+typedef struct cache_field {
+  const char *  name;
+  size_t        offset;
+} cache_field;
+
+
+#define CACHE_FIELD(f)  { #f, offsetof(garmin_unit,f) }
+
+static const cache_field cache_fields[] = {
+  CACHE_FIELD(protocol.physical),
+  CACHE_FIELD(protocol.link),
+  CACHE_FIELD(protocol.command),
+  CACHE_FIELD(protocol.waypoint.waypoint),
+  CACHE_FIELD(protocol.waypoint.category),
+  CACHE_FIELD(protocol.waypoint.proximity),
+  CACHE_FIELD(protocol.route),
+  CACHE_FIELD(protocol.track),
+  CACHE_FIELD(protocol.almanac),
+  CACHE_FIELD(protocol.date_time),
+  CACHE_FIELD(protocol.flightbook),
+  CACHE_FIELD(protocol.position),
+  CACHE_FIELD(protocol.pvt),
+  CACHE_FIELD(protocol.lap),
+  CACHE_FIELD(protocol.run),
+  CACHE_FIELD(protocol.workout.workout),
+  CACHE_FIELD(protocol.workout.occurrence),
+  CACHE_FIELD(protocol.workout.limits),
+  CACHE_FIELD(protocol.fitness),
+  CACHE_FIELD(protocol.course.course),
+  CACHE_FIELD(protocol.course.lap),
+  CACHE_FIELD(protocol.course.track),
+  CACHE_FIELD(protocol.course.point),
+  CACHE_FIELD(protocol.course.limits),
+  CACHE_FIELD(datatype.waypoint.waypoint),
+  CACHE_FIELD(datatype.waypoint.category),
+  CACHE_FIELD(datatype.waypoint.proximity),
+  CACHE_FIELD(datatype.route.header),
+  CACHE_FIELD(datatype.route.waypoint),
+  CACHE_FIELD(datatype.route.link),
+  CACHE_FIELD(datatype.track.header),
+  CACHE_FIELD(datatype.track.data),
+  CACHE_FIELD(datatype.almanac),
+  CACHE_FIELD(datatype.date_time),
+  CACHE_FIELD(datatype.flightbook),
+  CACHE_FIELD(datatype.position),
+  CACHE_FIELD(datatype.pvt),
+  CACHE_FIELD(datatype.lap),
+  CACHE_FIELD(datatype.run),
+  CACHE_FIELD(datatype.workout.workout),
+  CACHE_FIELD(datatype.workout.occurrence),
+  CACHE_FIELD(datatype.workout.limits),
+  CACHE_FIELD(datatype.fitness),
+  CACHE_FIELD(datatype.course.course),
+  CACHE_FIELD(datatype.course.lap),
+  CACHE_FIELD(datatype.course.track.header),
+  CACHE_FIELD(datatype.course.track.data),
+  CACHE_FIELD(datatype.course.point),
+  CACHE_FIELD(datatype.course.limits),
+  { NULL, 0 }
+};
+
+
+/* All the fields in the table are enums. */
+
+#define CACHE_VALUE(g,f)  (*(int *)((char *)(g) + (f)->offset))
+
+
+/*
+   Work out the cache file of the unit, creating its directory if asked
+   to.  Returns 0 if there is no sensible place for it.
+*/
+
+static int
+garmin_cache_path ( garmin_unit * garmin,
+                    char *        path,
+                    size_t        size,
+                    int           create )
+{
+  const char * base;
+  const char * home;
+
+  if ( (base = getenv("XDG_CACHE_HOME")) != NULL && base[0] == '/' ) {
+    snprintf(path,size,"%s/garmintools",base);
+  } else if ( (home = getenv("HOME")) != NULL && home[0] != 0 ) {
+    snprintf(path,size,"%s/.cache",home);
+    if ( create ) mkdir(path,0700);
+    snprintf(path,size,"%s/.cache/garmintools",home);
+  } else {
+    return 0;
+  }
+
+  if ( create && mkdir(path,0700) == -1 && errno != EEXIST ) {
+    return 0;
+  }
+
+  snprintf(path + strlen(path),size - strlen(path),"/%u",garmin->id);
+
+  return 1;
+}
+
+
+/* Add a string to a NULL-terminated list of them. */
+
+static char **
+garmin_cache_append ( char ** list, const char * s )
+{
+  int     n;
+  char ** l;
+
+  for ( n = 0; list != NULL && list[n] != NULL; n++ );
+  if ( (l = realloc(list,(n+2) * sizeof(char *))) != NULL ) {
+    l[n]   = strdup(s);
+    l[n+1] = NULL;
+  } else {
+    l = list;
+  }
+
+  return l;
+}
+
+
+/* Throw away whatever capabilities the unit has been given. */
+
+static void
+garmin_cache_forget ( garmin_unit * garmin )
+{
+  char ** s;
+
+  free(garmin->product.product_description);
+  for ( s = garmin->product.additional_data; s != NULL && *s != NULL; s++ ) {
+    free(*s);
+  }
+  free(garmin->product.additional_data);
+  for ( s = garmin->extended.ext_data; s != NULL && *s != NULL; s++ ) {
+    free(*s);
+  }
+  free(garmin->extended.ext_data);
+
+  memset(&garmin->product,0,sizeof(garmin->product));
+  memset(&garmin->extended,0,sizeof(garmin->extended));
+  memset(&garmin->protocol,0,sizeof(garmin->protocol));
+  memset(&garmin->datatype,0,sizeof(garmin->datatype));
+}
+
+
+/*
+   Fill in the capabilities of the unit (whose id must be known) from its
+   cache file.  Returns 1 if they were found, 0 if the handshake has to be
+   done after all.
+*/
+
+int
+garmin_load_capabilities ( garmin_unit * garmin )
+{
+  char                 path[BUFSIZ];
+  char                 line[BUFSIZ];
+  char *               value;
+  const cache_field *  f;
+  FILE *               fp;
+  int                  version = 0;
+  int                  have_product = 0;
+  size_t               len;
+
+  if ( garmin->id == 0 ||
+       garmin_cache_path(garmin,path,sizeof(path),0) == 0 ||
+       (fp = fopen(path,"r")) == NULL ) {
+    return 0;
+  }
+
+  while ( fgets(line,sizeof(line),fp) != NULL ) {
+    len = strlen(line);
+    if ( len > 0 && line[len-1] == '\n' ) line[len-1] = 0;
+    if ( line[0] == '#' || (value = strchr(line,' ')) == NULL ) continue;
+    *value++ = 0;
+
+    if ( strcmp(line,"version") == 0 ) {
+      version = atoi(value);
+    } else if ( strcmp(line,"product_id") == 0 ) {
+      garmin->product.product_id = atoi(value);
+      have_product = 1;
+    } else if ( strcmp(line,"software_version") == 0 ) {
+      garmin->product.software_version = atoi(value);
+    } else if ( strcmp(line,"product_description") == 0 ) {
+      free(garmin->product.product_description);
+      garmin->product.product_description = strdup(value);
+    } else if ( strcmp(line,"additional_data") == 0 ) {
+      garmin->product.additional_data =
+        garmin_cache_append(garmin->product.additional_data,value);
+    } else if ( strcmp(line,"ext_data") == 0 ) {
+      garmin->extended.ext_data =
+        garmin_cache_append(garmin->extended.ext_data,value);
+    } else {
+      for ( f = cache_fields; f->name != NULL; f++ ) {
+        if ( strcmp(line,f->name) == 0 ) {
+          CACHE_VALUE(garmin,f) = atoi(value);
+          break;
+        }
+      }
+    }
+  }
+  fclose(fp);
+
+  if ( version != CACHE_VERSION || have_product == 0 ||
+       garmin->product.product_description == NULL ) {
+    /* Not ours, or from another garmintools version.  Start over. */
+    garmin_cache_forget(garmin);
+    return 0;
+  }
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] using cached capabilities from %s\n",path);
+  }
+
+  return 1;
+}
+
+
+/* Is the cache file of the unit already up to date? */
+
+static int
+garmin_cache_current ( garmin_unit * garmin )
+{
+  garmin_unit          cached;
+  const cache_field *  f;
+  int                  same;
+
+  memset(&cached,0,sizeof(cached));
+  cached.id = garmin->id;
+  if ( garmin_load_capabilities(&cached) == 0 ) return 0;
+
+  same = ( cached.product.product_id == garmin->product.product_id &&
+           cached.product.software_version ==
+           garmin->product.software_version &&
+           garmin->product.product_description != NULL &&
+           strcmp(cached.product.product_description,
+                  garmin->product.product_description) == 0 );
+
+  for ( f = cache_fields; same && f->name != NULL; f++ ) {
+    same = ( CACHE_VALUE(&cached,f) == CACHE_VALUE(garmin,f) );
+  }
+
+  garmin_cache_forget(&cached);
+
+  return same;
+}
+
+
+/*
+   Write the capabilities of the unit to its cache file, unless they are
+   there already.  Returns 1 if the cache is up to date, 0 otherwise.
+*/
+
+int
+garmin_save_capabilities ( garmin_unit * garmin )
+{
+  char                 path[BUFSIZ];
+  char                 temp[BUFSIZ];
+  const cache_field *  f;
+  char **              s;
+  FILE *               fp;
+
+  if ( garmin->id == 0 || garmin->product.product_description == NULL ||
+       garmin_cache_path(garmin,path,sizeof(path),1) == 0 ) {
+    return 0;
+  }
+
+  if ( garmin_cache_current(garmin) != 0 ) return 1;
+
+  /* Write a new file and move it into place, so readers never see half. */
+
+  snprintf(temp,sizeof(temp),"%s.%d",path,(int)getpid());
+  if ( (fp = fopen(temp,"w")) == NULL ) return 0;
+
+  fprintf(fp,"# garmintools capabilities of unit %u\n",garmin->id);
+  fprintf(fp,"version %d\n",CACHE_VERSION);
+  fprintf(fp,"product_id %d\n",garmin->product.product_id);
+  fprintf(fp,"software_version %d\n",garmin->product.software_version);
+  fprintf(fp,"product_description %s\n",
+          garmin->product.product_description);
+  for ( s = garmin->product.additional_data; s != NULL && *s != NULL; s++ ) {
+    fprintf(fp,"additional_data %s\n",*s);
+  }
+  for ( s = garmin->extended.ext_data; s != NULL && *s != NULL; s++ ) {
+    fprintf(fp,"ext_data %s\n",*s);
+  }
+  for ( f = cache_fields; f->name != NULL; f++ ) {
+    fprintf(fp,"%s %d\n",f->name,CACHE_VALUE(garmin,f));
+  }
+
+  if ( fclose(fp) != 0 || rename(temp,path) != 0 ) {
+    unlink(temp);
+    return 0;
+  }
+
+  if ( garmin->verbose != 0 ) {
+    printf("[garmin] saved capabilities in %s\n",path);
+  }
+
+  return 1;
+}
@@ -23,18 +23,21 @@
 #include "garmin.h"
 
 
-static uint32 gListId = 0;
+/* List ids are shared by every session, which may run on its own thread. */
+
+static _Atomic uint32 gListId = 0;
 
 
 garmin_data *
 garmin_alloc_data ( garmin_datatype type )
 {
-  garmin_data * d = calloc(1, sizeof(garmin_data));
+  garmin_data * d = garmin_arena_calloc(1, sizeof(garmin_data));
 
-  d->type = type;
+  d->type  = type;
+  d->arena = garmin_arena_current();
 
 #define CASE_DATA(x) \
-  case data_D##x: d->data = calloc(1,sizeof(D##x)); break
+  case data_D##x: d->data = garmin_arena_calloc(1,sizeof(D##x)); break
 
   switch ( type ) {
   case data_Dlist: d->data = garmin_alloc_list(); break;
@@ -106,13 +109,60 @@ garmin_alloc_list ( void )
 {
   garmin_list * l;
 
-  l = calloc(1,sizeof(garmin_list));
+  l = garmin_arena_calloc(1,sizeof(garmin_list));
   l->id = ++gListId;
+  l->arena = garmin_arena_current();
 
   return l;
 }
 
 
+/*
+   Make room for at least 'elements' nodes in the list, so that appending
+   that many doesn't have to grow it again.  Returns 1, or 0 if out of
+   memory.
+*/
+
+int
+garmin_list_reserve ( garmin_list * list, uint32 elements )
+{
+  garmin_list_node * nodes;
+  int                i;
+
+  if ( elements <= (uint32)list->capacity ) return 1;
+
+  /* Arena memory can't be reallocated, so copy the nodes to a new array. */
+
+  if ( list->arena != NULL ) {
+    if ( (nodes = garmin_arena_alloc(list->arena,
+                                     elements *
+                                     sizeof(garmin_list_node))) == NULL ) {
+      return 0;
+    }
+    if ( list->elements > 0 ) {
+      memcpy(nodes,list->nodes,list->elements * sizeof(garmin_list_node));
+    }
+  } else if ( (nodes = realloc(list->nodes,
+                               elements * sizeof(garmin_list_node))) == NULL ) {
+    return 0;
+  }
+
+  /* The nodes may have moved, so link them up again. */
+
+  for ( i = 0; i + 1 < list->elements; i++ ) {
+    nodes[i].next = &nodes[i+1];
+  }
+  list->nodes    = nodes;
+  list->capacity = elements;
+  if ( list->elements > 0 ) {
+    list->head = &nodes[0];
+    list->tail = &nodes[list->elements-1];
+  }
+
+  return 1;
+}
+
+
 garmin_list *
 garmin_list_append ( garmin_list * list, garmin_data * data )
 {
@@ -121,13 +171,18 @@ garmin_list_append ( garmin_list * list, garmin_data * data )
 
   if ( data != NULL ) {
     if ( l == NULL ) l = garmin_alloc_list();
-    n = calloc(1, sizeof(garmin_list_node));
 
+    if ( l->elements == l->capacity &&
+         garmin_list_reserve(l,l->capacity ? 2 * l->capacity : 8) == 0 ) {
+      return l;
+    }
+
+    n = &l->nodes[l->elements];
     n->data = data;
     n->next = NULL;
 
-    if ( l->head == NULL ) l->head = n;
     if ( l->tail != NULL ) l->tail->next = n;
+    l->head = &l->nodes[0];
     l->tail = n;
 
     l->elements++;
@@ -142,14 +197,12 @@ garmin_list_data ( garmin_data * data, uint32 which )
 {
   garmin_data *       ret = NULL;
   garmin_list *       list;
-  garmin_list_node *  n;
-  unsigned int        i;
 
   if ( data                 != NULL       &&
        data->type           == data_Dlist &&
-       (list = data->data)  != NULL ) {
-    for ( i = 0, n = list->head; i < which && n != NULL; i++, n = n->next );
-    if ( n != NULL ) ret = n->data;
+       (list = data->data)  != NULL       &&
+       which < (uint32)list->elements ) {
+    ret = list->nodes[which].data;
   }
 
   return ret;
@@ -159,15 +212,13 @@ garmin_list_data ( garmin_data * data, uint32 which )
 void
 garmin_free_list ( garmin_list * l )
 {
-  garmin_list_node * n;
-  garmin_list_node * x;
+  int i;
 
-  if ( l != NULL ) {
-    for ( n = l->head; n != NULL; n = x ) {
-      x = n->next;
-      garmin_free_data(n->data);
-      free(n);
+  if ( l != NULL && l->arena == NULL ) {
+    for ( i = 0; i < l->elements; i++ ) {
+      garmin_free_data(l->nodes[i].data);
     }
+    free(l->nodes);
     free(l);
   }
 }
@@ -176,14 +227,8 @@ garmin_free_list ( garmin_list * l )
 void
 garmin_free_list_only ( garmin_list * l )
 {
-  garmin_list_node * n;
-  garmin_list_node * x;
-
-  if ( l != NULL ) {
-    for ( n = l->head; n != NULL; n = x ) {
-      x = n->next;
-      free(n);
-    }
+  if ( l != NULL && l->arena == NULL ) {
+    free(l->nodes);
     free(l);
   }
 }
@@ -203,6 +248,13 @@ garmin_free_data ( garmin_data * d )
   D312 *   d312;
   D650 *   d650;
 
+  /*
+     Data decoded into an arena is freed with the arena, whichever arena
+     (if any) is in use now.
+  */
+
+  if ( d != NULL && d->arena != NULL ) return;
+
   if ( d != NULL ) {
     if ( d->data != NULL ) {
       if ( d->type == data_Dlist ) {
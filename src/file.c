@@ -0,0 +1,481 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "garmin.h"
+
+
+/*
+   A .gmn file opened with garmin_open_file is mapped into memory rather
+   than read, and only its chunk headers are checked up front.  Each chunk,
+   and each element of a list, is a handle (a garmin_lazy) that knows its
+   type and where its packed bytes are, and decodes them the first time
+   garmin_lazy_data is called.  Since every list element is stored with
+   its size, getting to the third element of a list only means stepping
+   over the first two; nothing in them is decoded.
+
+   So a caller that only wants the run and the laps of a run file never
+   decodes its track points.  Everything decoded is kept in an arena that
+   belongs to the file, and goes away with garmin_close_file.
+
+   garmin_file_part goes straight to the run, laps or track of a run file,
+   using the index of a version 2 file if there is one.
+
+   A compressed list of track points (see points.c) is expanded the first
+   time anything about it is asked for, and from then on is a list.
+*/
+
+struct garmin_lazy {
+  garmin_file *    file;
+  garmin_datatype  type;
+  uint8 *          pos;        /* the packed data          */
+  uint32           size;       /* bytes at pos             */
+  int              elements;   /* list elements, or -1     */
+  garmin_lazy *    children;   /* list elements, once seen */
+  garmin_data *    data;       /* decoded, once asked for  */
+  uint8 *          expanded;   /* a compressed list, expanded */
+};
+
+
+struct garmin_file {
+  uint8 *          map;
+  size_t           length;
+  garmin_arena *   arena;
+  int              chunks;
+  garmin_lazy *    chunk;
+  garmin_index     index;      /* of a version 2 file      */
+  int              indexed;
+  garmin_lazy      part[GARMIN_INDEX_PARTS];
+};
+
+
+/* Bytes in front of each list element: list id, type and size. */
+
+#define ELEMENT_HEADER  12
+
+
+static void
+garmin_lazy_init ( garmin_lazy *  h,
+                   garmin_file *  file,
+                   uint32         type,
+                   uint8 *        pos,
+                   uint32         size )
+{
+  h->file     = file;
+  h->type     = type;
+  h->pos      = pos;
+  h->size     = size;
+  h->elements = -1;
+}
+
+
+/*
+   Open a .gmn file, checking that it is made of whole chunks.  Nothing is
+   decoded yet.  Returns NULL (having said why) if the file can't be used.
+*/
+
+garmin_file *
+garmin_open_file ( const char * filename )
+{
+  garmin_file * f = NULL;
+  struct stat   sb;
+  uint8 *       map;
+  uint8 *       pos;
+  uint8 *       end;
+  uint32        chunk;
+  int           chunks = 0;
+  garmin_index  index;
+  int           indexed;
+  int           fd;
+  int           i;
+
+  if ( (fd = open(filename,O_RDONLY)) == -1 ) {
+    fprintf(stderr,"%s: open: %s\n",filename,strerror(errno));
+    return NULL;
+  }
+
+  if ( fstat(fd,&sb) == -1 ) {
+    fprintf(stderr,"%s: fstat: %s\n",filename,strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  if ( sb.st_size == 0 ) {
+    fprintf(stderr,"garmin_open_file: %s: empty file\n",filename);
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  if ( map == MAP_FAILED ) {
+    fprintf(stderr,"%s: mmap: %s\n",filename,strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  indexed = garmin_index_read(fd,&index);
+  close(fd);
+
+  /* Walk the chunk headers twice: once to check and count, once to fill. */
+
+  end = ( indexed ) ? map + index.offset : map + sb.st_size;
+  for ( pos = map; pos < end; pos += GARMIN_HEADER + 8 + chunk ) {
+    if ( end - pos < GARMIN_HEADER + 8 ||
+         memcmp(pos,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) != 0 ) {
+      fprintf(stderr,"garmin_open_file: %s: not a .gmn file\n",filename);
+      munmap(map,sb.st_size);
+      return NULL;
+    }
+    chunk = get_uint32(pos + GARMIN_HEADER + 4);
+    if ( chunk > (uint32)(end - pos - GARMIN_HEADER - 8) ) {
+      fprintf(stderr,"garmin_open_file: %s: truncated\n",filename);
+      munmap(map,sb.st_size);
+      return NULL;
+    }
+    chunks++;
+  }
+
+  if ( (f = calloc(1,sizeof(garmin_file))) == NULL ||
+       (f->chunk = calloc(chunks,sizeof(garmin_lazy))) == NULL ||
+       (f->arena = garmin_arena_new()) == NULL ) {
+    fprintf(stderr,"garmin_open_file: %s: out of memory\n",filename);
+    if ( f != NULL ) free(f->chunk);
+    free(f);
+    munmap(map,sb.st_size);
+    return NULL;
+  }
+
+  f->map     = map;
+  f->length  = sb.st_size;
+  f->chunks  = chunks;
+  f->index   = index;
+  f->indexed = indexed;
+
+  for ( pos = map, i = 0; i < chunks; i++ ) {
+    chunk = get_uint32(pos + GARMIN_HEADER + 4);
+    garmin_lazy_init(&f->chunk[i],f,get_uint32(pos + GARMIN_HEADER),
+                     pos + GARMIN_HEADER + 8,chunk);
+    pos += GARMIN_HEADER + 8 + chunk;
+  }
+
+  return f;
+}
+
+
+/* Free the handles below a handle (the handle itself is in its parent). */
+
+static void
+garmin_lazy_free ( garmin_lazy * h )
+{
+  int i;
+
+  for ( i = 0; i < h->elements; i++ ) {
+    garmin_lazy_free(&h->children[i]);
+  }
+  free(h->children);
+  free(h->expanded);
+}
+
+
+/* Free the file and everything that was decoded from it. */
+
+void
+garmin_close_file ( garmin_file * f )
+{
+  int i;
+
+  if ( f == NULL ) return;
+
+  for ( i = 0; i < f->chunks; i++ ) {
+    garmin_lazy_free(&f->chunk[i]);
+  }
+  for ( i = 0; i < GARMIN_INDEX_PARTS; i++ ) {
+    garmin_lazy_free(&f->part[i]);
+  }
+  garmin_arena_free(f->arena);
+  munmap(f->map,f->length);
+  free(f->chunk);
+  free(f);
+}
+
+
+/* The number of chunks in the file (usually one). */
+
+int
+garmin_file_chunks ( garmin_file * f )
+{
+  return f->chunks;
+}
+
+
+/* A handle for chunk 'which' of the file, or NULL if there is none. */
+
+garmin_lazy *
+garmin_file_chunk ( garmin_file * f, int which )
+{
+  return ( which >= 0 && which < f->chunks ) ? &f->chunk[which] : NULL;
+}
+
+
+/*
+   Turn a compressed list of track points into the list it stands for.  If
+   it can't be expanded, it is left with no type and no data.
+*/
+
+static void
+garmin_lazy_expand ( garmin_lazy * h )
+{
+  uint32 used;
+  uint32 size;
+
+  if ( h->type != GARMIN_POINTS_TYPE ) return;
+
+  h->expanded = garmin_expand_points(h->pos,h->pos + h->size,&used,&size);
+  if ( h->expanded != NULL && used == h->size ) {
+    h->type = data_Dlist;
+    h->pos  = h->expanded;
+    h->size = size;
+  } else {
+    fprintf(stderr,"garmin_lazy_expand: corrupt list of track points\n");
+    free(h->expanded);
+    h->expanded = NULL;
+    h->type     = data_Dnil;
+    h->size     = 0;
+  }
+}
+
+
+/* The type of the data behind a handle, without decoding it. */
+
+garmin_datatype
+garmin_lazy_type ( garmin_lazy * h )
+{
+  garmin_lazy_expand(h);
+
+  return h->type;
+}
+
+
+/*
+   The packed bytes behind a handle, straight from the file (or, for a
+   compressed list, as expanded).
+*/
+
+const uint8 *
+garmin_lazy_bytes ( garmin_lazy * h, uint32 * size )
+{
+  garmin_lazy_expand(h);
+  *size = h->size;
+
+  return h->pos;
+}
+
+
+/*
+   Find the elements of a list by stepping over them.  Returns 0 if the
+   list is corrupt (it then has no elements).
+*/
+
+static int
+garmin_lazy_index ( garmin_lazy * h )
+{
+  uint8 *  pos = h->pos;
+  uint8 *  end = h->pos + h->size;
+  uint32   elements;
+  uint32   size;
+  uint32   i;
+
+  h->elements = 0;
+
+  if ( h->size < 8 ) return 0;
+
+  elements = get_uint32(pos + 4);
+  pos += 8;
+
+  /* Every element needs a header, which bounds a believable count. */
+
+  if ( elements > (uint32)(end - pos) / ELEMENT_HEADER ) return 0;
+  if ( elements == 0 ) return 1;
+
+  if ( (h->children = calloc(elements,sizeof(garmin_lazy))) == NULL ) {
+    return 0;
+  }
+
+  for ( i = 0; i < elements; i++ ) {
+    if ( end - pos < ELEMENT_HEADER ) break;
+    size = get_uint32(pos + 8);
+    if ( size > (uint32)(end - pos - ELEMENT_HEADER) ) break;
+    garmin_lazy_init(&h->children[i],h->file,get_uint32(pos + 4),
+                     pos + ELEMENT_HEADER,size);
+    pos += ELEMENT_HEADER + size;
+  }
+
+  if ( i < elements ) {
+    fprintf(stderr,"garmin_lazy_index: list element %u is truncated\n",i);
+    free(h->children);
+    h->children = NULL;
+    return 0;
+  }
+
+  h->elements = elements;
+
+  return 1;
+}
+
+
+/* The number of elements of a list handle (0 for anything else). */
+
+int
+garmin_lazy_elements ( garmin_lazy * h )
+{
+  garmin_lazy_expand(h);
+  if ( h->type != data_Dlist ) return 0;
+  if ( h->elements < 0 ) garmin_lazy_index(h);
+
+  return h->elements;
+}
+
+
+/* A handle for element 'which' of a list handle, or NULL if there is none. */
+
+garmin_lazy *
+garmin_lazy_element ( garmin_lazy * h, int which )
+{
+  if ( which < 0 || which >= garmin_lazy_elements(h) ) return NULL;
+
+  return &h->children[which];
+}
+
+
+/*
+   The data behind a handle, decoded the first time it is asked for.  It
+   belongs to the file: don't free it, and don't use it after the file is
+   closed.  Returns NULL if the data can't be decoded.
+*/
+
+garmin_data *
+garmin_lazy_data ( garmin_lazy * h )
+{
+  garmin_arena * old;
+  uint8 *        pos;
+
+  garmin_lazy_expand(h);
+
+  if ( h->data == NULL ) {
+    old = garmin_arena_use(h->file->arena);
+    pos = h->pos;
+    h->data = garmin_unpack(&pos,h->type);
+    garmin_arena_use(old);
+
+    if ( h->data != NULL && pos - h->pos != h->size ) {
+      fprintf(stderr,"garmin_lazy_data: unpacked %d bytes (expecting %u)\n",
+              (int)(pos - h->pos),h->size);
+      h->data = NULL;
+    }
+  }
+
+  return h->data;
+}
+
+
+/* Is 'h' a list whose first or second element has a type 'want' accepts? */
+
+static int
+garmin_lazy_holds ( garmin_lazy * h, int (*want)( uint32 type ) )
+{
+  garmin_lazy * e;
+  int           i;
+
+  for ( i = 0; i < 2 && (e = garmin_lazy_element(h,i)) != NULL; i++ ) {
+    if ( want(garmin_lazy_type(e)) ) return 1;
+  }
+
+  return 0;
+}
+
+
+static int
+garmin_is_run ( uint32 type )
+{
+  return type == data_D1000 || type == data_D1009 || type == data_D1010;
+}
+
+
+static int
+garmin_is_lap ( uint32 type )
+{
+  return type == data_D906  || type == data_D1001 ||
+         type == data_D1011 || type == data_D1015;
+}
+
+
+static int
+garmin_is_point ( uint32 type )
+{
+  return type >= data_D300 && type <= data_D304;
+}
+
+
+/*
+   A handle for the run, the list of laps or the list of track points of
+   a run file, or NULL if it doesn't have one.  A version 2 file says
+   where they are in its index; in a version 1 file they are looked for
+   among the elements of the first chunk.
+*/
+
+garmin_lazy *
+garmin_file_part ( garmin_file * f, garmin_part part )
+{
+  garmin_lazy * h;
+  garmin_lazy * top;
+  garmin_lazy * e;
+  int           i;
+
+  if ( part < 0 || part >= GARMIN_INDEX_PARTS ) return NULL;
+  h = &f->part[part];
+
+  if ( h->file == NULL ) {
+    if ( f->indexed ) {
+      if ( f->index.part[part].type != 0 ) {
+        garmin_lazy_init(h,f,f->index.part[part].type,
+                         f->map + f->index.part[part].offset,
+                         f->index.part[part].size);
+      }
+    } else if ( (top = garmin_file_chunk(f,0)) != NULL ) {
+      for ( i = 0; (e = garmin_lazy_element(top,i)) != NULL; i++ ) {
+        if ( (part == GARMIN_PART_RUN   && garmin_is_run(garmin_lazy_type(e))) ||
+             (part == GARMIN_PART_LAPS  && garmin_lazy_holds(e,garmin_is_lap)) ||
+             (part == GARMIN_PART_TRACK && garmin_lazy_holds(e,garmin_is_point)) ) {
+          garmin_lazy_init(h,f,e->type,e->pos,e->size);
+          break;
+        }
+      }
+    }
+  }
+
+  return ( h->file != NULL ) ? h : NULL;
+}
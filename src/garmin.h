@@ -22,6 +22,8 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <libusb.h>
 #include <math.h>
 #include <stdint.h>
@@ -1448,14 +1450,31 @@ typedef enum {
 } garmin_datatype;
 
 
+/* A region that decoded data can be allocated from (see arena.c). */
+
+typedef struct garmin_arena garmin_arena;
+
+
 /* Garmin data of any type, including lists of {data, lists}. */
 
 typedef struct garmin_data {
   garmin_datatype   type;
   void *            data;
+  garmin_arena *    arena;     /* owner, or NULL if on the heap */
 } garmin_data;
 
 
+/* A .gmn file that is decoded piece by piece, as it is used (see file.c). */
+
+typedef struct garmin_file garmin_file;
+typedef struct garmin_lazy garmin_lazy;
+
+
+/* A .gmn file read one record at a time (see reader.c). */
+
+typedef struct garmin_reader garmin_reader;
+
+
 /* A garmin list node (contains data and a 'next' pointer) */
 
 typedef struct garmin_list_node {
@@ -1464,16 +1483,49 @@ typedef struct garmin_list_node {
 } garmin_list_node;
 
 
-/* A singly linked list of garmin data (can be a list of lists) */
+/*
+   A list of garmin data (can be a list of lists).  The nodes are kept in
+   order in one array, so the list can be walked either as nodes[0] to
+   nodes[elements-1] or from head along the next pointers.  The array moves
+   when the list grows, so a node must not be held across an append.
+*/
 
 typedef struct garmin_list {
   int                                id;
   int                                elements;
   garmin_list_node *                 head;
   garmin_list_node *                 tail;
+  garmin_list_node *                 nodes;
+  int                                capacity;  /* nodes allocated */
+  garmin_arena *                     arena;     /* owner, or NULL   */
 } garmin_list;
 
 
+/*
+   The points of a track (D300 to D304) in columns, one array per field
+   (see track.c).  lat and lon are in semicircles.  A point whose lat and
+   lon are both 0x7fffffff marks a pause and has no position; its bit in
+   'valid' is clear.  Fields the point type doesn't have are 1.0e25 (alt,
+   distance), 0 (heart_rate) or 0xff (cadence).
+*/
+
+typedef struct garmin_track {
+  garmin_datatype   type;        /* type of the first point       */
+  uint32            count;       /* number of points              */
+  uint32            capacity;    /* points allocated              */
+  uint32 *          time;
+  sint32 *          lat;
+  sint32 *          lon;
+  float32 *         alt;
+  float32 *         distance;
+  uint8 *           heart_rate;
+  uint8 *           cadence;
+  uint8 *           valid;       /* one bit per point, LSB first  */
+} garmin_track;
+
+#define GARMIN_TRACK_VALID(t,i)  (((t)->valid[(i) >> 3] >> ((i) & 7)) & 1)
+
+
 /* ------------------------------------------------------------------------- */
 /* 3.2   USB Protocol                                                        */
 /* ------------------------------------------------------------------------- */
@@ -1822,9 +1874,56 @@ typedef enum {
 /* ========================================================================= */
 
 #define GARMIN_MAGIC    "<@gArMiN@>"  /* appears at the start of all files. */
-#define GARMIN_VERSION  100           /* version 1.00 */
+#define GARMIN_VERSION  200           /* version 2.00 */
 #define GARMIN_HEADER   20            /* bytes needed for file header. */
 
+/*
+   A version 2 file is a version 1 file with one more chunk at the end: an
+   index (see index.c) of type GARMIN_INDEX_TYPE.  Its payload is
+
+     uint32  stride                 points between time samples
+     uint32  parts                  GARMIN_INDEX_PARTS
+     struct { uint32 type, offset, size } part[parts]
+     uint32  samples
+     struct { uint32 time, left, offset } sample[samples]
+     uint32  offset of the index chunk
+     char    GARMIN_INDEX_MAGIC[4]
+
+   Offsets are from the start of the file.  A part's offset is where its
+   packed data starts; a sample's is where the list element of a track
+   point starts, 'left' being the elements from there to the end of its
+   list.  The last 8 bytes of the file lead to the index.
+*/
+
+#define GARMIN_INDEX_TYPE    0xffff
+#define GARMIN_INDEX_MAGIC   "gIdX"
+#define GARMIN_INDEX_STRIDE  64
+#define GARMIN_INDEX_PARTS   3
+#define GARMIN_INDEX_TRAILER 8
+
+/*
+   A list of track points may be stored compressed (see points.c), as a
+   list element of type GARMIN_POINTS_TYPE.  Its payload is
+
+     uint32  list id
+     uint32  elements               in the list, points and all
+     uint32  head                   elements stored before the points
+     head list elements, stored as in any list
+     uint32  point type             D300 to D304
+     for each 4 byte field of the point type, for each point:
+       varint                       lat, lon and time: the zigzagged
+                                    difference from the previous point;
+                                    float fields: the bits XORed with the
+                                    previous point's
+     for each 1 byte field of the point type, for each point:
+       uint8
+
+   A varint is 7 bits a byte, low bits first, with the top bit set on all
+   but the last byte.  The first point's "previous point" is all zeros.
+*/
+
+#define GARMIN_POINTS_TYPE   0xfffe
+
 
 /* ========================================================================= */
 /* Data structures                                                           */
@@ -1926,15 +2025,97 @@ typedef struct garmin_datatypes {
 } garmin_datatypes;
 
 
+/* Maximum number of attached units considered by garmin_connect. */
+
+#define GARMIN_MAX_DEVICES      16
+
+/* Number of USB IN transfers kept in flight while reading records. */
+
+#define GARMIN_USB_QUEUE_DEPTH  8
+
+/* Size of the transfers used to read the bulk endpoint. */
+
+#define GARMIN_USB_BULK_SIZE    16384
+
+
+struct garmin_usb_io;
+
+
 typedef struct garmin_usb {
+  libusb_context *          ctx;        /* each unit has its own context */
   libusb_device_handle *    handle;
   int                       bulk_out;
   int                       bulk_in;
+  int                       bulk_in_size;
   int                       intr_in;
   int                       read_bulk;
+  struct garmin_usb_io *    io;         /* asynchronous read state */
+  uint8                     bus;        /* bus and address of the device,  */
+  uint8                     address;    /* or 0 to open the first found.   */
+  uint32                    unit_id;    /* unit id to select, or 0 for any */
 } garmin_usb;
 
 
+/* A Garmin device attached to the USB, as returned by garmin_enumerate. */
+
+typedef struct garmin_device {
+  uint8                     bus;
+  uint8                     address;
+} garmin_device;
+
+
+struct garmin_unit;
+
+
+/*
+   A transport moves packets between the host and the unit.  The libusb
+   transport is used unless another one has been installed, for instance
+   by garmin_capture or garmin_replay.  open returns 1 on success, read
+   and write return the number of bytes transferred or -1 on error.  read
+   points *p at a packet owned by the transport, which stays valid until
+   the next read.
+*/
+
+typedef struct garmin_transport {
+  const char *  name;
+  int        (* open)    ( struct garmin_unit * garmin );
+  int        (* close)   ( struct garmin_unit * garmin );
+  int        (* read)    ( struct garmin_unit * garmin, garmin_packet ** p );
+  int        (* write)   ( struct garmin_unit * garmin, garmin_packet * p );
+  int        (* queue)   ( struct garmin_unit * garmin, int count );
+  void       (* cancel)  ( struct garmin_unit * garmin );
+  void       (* release) ( struct garmin_unit * garmin );
+} garmin_transport;
+
+
+/* Where a record handed to a garmin_sink stands in its transfer. */
+
+typedef struct garmin_record {
+  garmin_pid                 pid;       /* packet id of the record        */
+  int                        position;  /* 0, 1 or 2: pid1, pid2 or pid3,
+                                           or -1 when the transfer starts */
+  int                        index;     /* records before this one        */
+  int                        expected;  /* records announced by the unit  */
+} garmin_record;
+
+
+/*
+   A sink receives the records of a transfer one at a time and owns the
+   garmin_data it is given.  Before the first record it is called once
+   with NULL data, position -1 and the pid of the first record of the
+   grammar.  It returns one of the following.
+*/
+
+#define GARMIN_SINK_CONTINUE  0   /* go on with the next record            */
+#define GARMIN_SINK_SKIP      1   /* don't unpack records up to the next   */
+                                  /* one in position 0 (e.g. a track hdr)  */
+#define GARMIN_SINK_STOP      2   /* abort the transfer                    */
+
+typedef int (* garmin_sink) ( garmin_data *          data,
+                              const garmin_record *  record,
+                              void *                 user );
+
+
 typedef struct garmin_unit {
   uint32                     id;
   garmin_product             product;
@@ -1943,9 +2124,53 @@ typedef struct garmin_unit {
   garmin_datatypes           datatype;
   garmin_usb                 usb;
   int                        verbose;   /* this may become a 'flags' field. */
+  const garmin_transport *   transport;      /* NULL selects the USB */
+  void *                     transport_data;
+  garmin_sink                sink;      /* set while garmin_stream runs */
+  void *                     sink_data;
+  int                        use_cache; /* skip the A000/A001 handshake */
+                                        /* if the unit is in the cache  */
+  int                        compress;  /* save runs GARMIN_SAVE_COMPRESS */
 } garmin_unit;
 
 
+/* A live stream of PVT fixes from a unit (see pvt.c). */
+
+typedef struct garmin_pvt_stream garmin_pvt_stream;
+
+
+/* A bounded queue for handing work between threads (see queue.c). */
+
+typedef struct garmin_queue garmin_queue;
+
+
+/* The parts of a run file that a version 2 index points at. */
+
+typedef enum {
+  GARMIN_PART_RUN   = 0,
+  GARMIN_PART_LAPS  = 1,
+  GARMIN_PART_TRACK = 2
+} garmin_part;
+
+
+/* The index of a version 2 file, as read by garmin_index_read. */
+
+typedef struct garmin_index_part {
+  uint32            type;        /* 0 if the file doesn't have it */
+  uint32            offset;
+  uint32            size;
+} garmin_index_part;
+
+typedef struct garmin_index {
+  uint32            offset;      /* of the index chunk            */
+  uint32            stride;
+  garmin_index_part part[GARMIN_INDEX_PARTS];
+  uint32            track_id;    /* list id of the track part     */
+  uint32            samples;
+  uint32            sample_offset;
+} garmin_index;
+
+
 typedef enum {
   GET_WAYPOINTS,
   GET_WAYPOINT_CATEGORIES,
@@ -1987,23 +2212,193 @@ garmin_pid  garmin_gpid ( link_protocol     link,
 /* ------------------------------------------------------------------------- */
 
 garmin_data * garmin_load          ( const char *     filename );
+garmin_data * garmin_load_arena    ( const char *     filename,
+                                     garmin_arena *   arena );
 garmin_data * garmin_unpack_packet ( garmin_packet *  p,
                                      garmin_datatype  type );
 garmin_data * garmin_unpack        ( uint8 **         buf,
                                      garmin_datatype  type );
+uint32        garmin_unpack_array  ( uint8 **         buf,
+                                     const uint8 *    end,
+                                     garmin_datatype  type,
+                                     uint32           count,
+                                     void *           array );
 
 
 /* ------------------------------------------------------------------------- */
 /* pack.c                                                                    */
 /* ------------------------------------------------------------------------- */
 
-uint32 garmin_save ( garmin_data * data,
+/*
+   With GARMIN_SAVE_COMPRESS, lists of track points are stored compressed
+   (see points.c).  Files saved that way can only be read by versions that
+   know the format.
+*/
+
+#define GARMIN_SAVE_COMPRESS  1
+
+int    garmin_save ( garmin_data * data,
                      const char *  filename,
-                     const char *  dir );
+                     const char *  dir,
+                     int           flags );
+int    garmin_save_flush ( void );
 uint32 garmin_pack ( garmin_data * data,
                      uint8 **      buf );
 
 
+/* ------------------------------------------------------------------------- */
+/* points.c                                                                  */
+/* ------------------------------------------------------------------------- */
+
+uint32  garmin_compress_points ( uint8 *        rec,
+                                 uint32         bytes );
+uint8 * garmin_expand_points   ( const uint8 *  pos,
+                                 const uint8 *  end,
+                                 uint32 *       used,
+                                 uint32 *       size );
+
+
+/* ------------------------------------------------------------------------- */
+/* writer.c                                                                  */
+/* ------------------------------------------------------------------------- */
+
+/*
+   A garmin_writer gathers output in a buffer of its own and hands it to
+   stdio a buffer at a time, so printing a record is a few copies instead
+   of a dozen fprintf calls.  Strings, indentation, integers and fixed
+   point numbers are formatted straight into the buffer by the inline
+   functions below; anything else can go through garmin_write_printf.
+
+   garmin_writer_init sets one up over a buffer the caller has (on the
+   stack, say); garmin_writer_open allocates one of GARMIN_WRITER_SIZE
+   bytes.  Nothing reaches the FILE until the buffer fills or the writer
+   is flushed or closed.
+
+   Times are written in ISO 8601 form by garmin_write_time.  Track points
+   come a second or a few apart, so the text of the last time is kept
+   (one for each style) and, as long as the next time is in the same
+   minute, only its seconds are rewritten; gmtime or localtime is only
+   called again when the minute changes.  garmin_format_time does the
+   same with a cache of the caller's.
+*/
+
+#define GARMIN_WRITER_SIZE  65536
+
+typedef enum {
+  GARMIN_TIME_LOCAL,     /* 2007-04-20T23:55:01-07:00 */
+  GARMIN_TIME_UTC,       /* 2007-04-20T23:55:01+00:00 */
+  GARMIN_TIME_UTC_Z,     /* 2007-04-20T23:55:01Z      */
+  GARMIN_TIME_UTC_BARE,  /* 2007-04-20T23:55:01       */
+  GARMIN_TIME_STYLES
+} garmin_time_style;
+
+typedef struct garmin_time_cache {
+  time_t  base;      /* the time at the start of the minute in text */
+  int     sec;       /* where the seconds are in text */
+  int     len;       /* 0 if nothing is cached */
+  char    text[40];
+} garmin_time_cache;
+
+typedef struct garmin_writer {
+  FILE *             fp;
+  char *             buf;
+  size_t             size;
+  size_t             used;
+  int                failed;    /* a write to fp failed */
+  int                owned;     /* buf was allocated by garmin_writer_open */
+  garmin_time_cache  times[GARMIN_TIME_STYLES];
+} garmin_writer;
+
+void            garmin_writer_init  ( garmin_writer *  w,
+                                      FILE *           fp,
+                                      char *           buf,
+                                      size_t           size );
+garmin_writer * garmin_writer_open  ( FILE *           fp );
+int             garmin_writer_flush ( garmin_writer *  w );
+int             garmin_writer_close ( garmin_writer *  w );
+
+void            garmin_write_spill  ( garmin_writer *  w,
+                                      const char *     s,
+                                      size_t           n );
+void            garmin_write_fixed  ( garmin_writer *  w,
+                                      double           x,
+                                      int              prec );
+void            garmin_write_printf ( garmin_writer *  w,
+                                      const char *     fmt,
+                                      ... )
+                  __attribute__ ((format (printf,2,3)));
+void            garmin_write_time   ( garmin_writer *    w,
+                                      time_t             t,
+                                      garmin_time_style  style );
+const char *    garmin_format_time  ( garmin_time_cache *  c,
+                                      time_t               t,
+                                      garmin_time_style    style );
+
+inline void
+garmin_write_mem ( garmin_writer * w, const char * s, size_t n )
+{
+  if ( n <= w->size - w->used ) {
+    memcpy(w->buf + w->used,s,n);
+    w->used += n;
+  } else {
+    garmin_write_spill(w,s,n);
+  }
+}
+
+inline void
+garmin_write_str ( garmin_writer * w, const char * s )
+{
+  garmin_write_mem(w,s,strlen(s));
+}
+
+inline void
+garmin_write_char ( garmin_writer * w, char c )
+{
+  if ( w->used == w->size ) garmin_writer_flush(w);
+  w->buf[w->used++] = c;
+}
+
+inline void
+garmin_write_spaces ( garmin_writer * w, int n )
+{
+  if ( n > 0 && (size_t)n <= w->size - w->used ) {
+    memset(w->buf + w->used,' ',n);
+    w->used += n;
+  } else {
+    while ( n-- > 0 ) garmin_write_char(w,' ');
+  }
+}
+
+inline void
+garmin_write_uint ( garmin_writer * w, uint32 v )
+{
+  char  d[10];
+  int   n = sizeof(d);
+
+  do {
+    d[--n] = '0' + v % 10;
+    v /= 10;
+  } while ( v != 0 );
+
+  garmin_write_mem(w,d + n,sizeof(d) - n);
+}
+
+inline void
+garmin_write_int ( garmin_writer * w, sint32 v )
+{
+  if ( v < 0 ) {
+    garmin_write_char(w,'-');
+    garmin_write_uint(w,-(uint32)v);
+  } else {
+    garmin_write_uint(w,v);
+  }
+}
+
+/* A string literal, whose length is known when compiling. */
+
+#define garmin_write_lit(w,s)  garmin_write_mem(w,"" s,sizeof(s) - 1)
+
+
 /* ------------------------------------------------------------------------- */
 /* print.c                                                                   */
 /* ------------------------------------------------------------------------- */
@@ -2012,6 +2407,16 @@ void garmin_print_data      ( garmin_data * data, FILE * fp, int spaces );
 void garmin_print_protocols ( garmin_unit * unit, FILE * fp, int spaces );
 void garmin_print_info      ( garmin_unit * unit, FILE * fp, int spaces );
 
+void garmin_write_data      ( garmin_data *    data,
+                              garmin_writer *  out,
+                              int              spaces );
+void garmin_write_protocols ( garmin_unit *    unit,
+                              garmin_writer *  out,
+                              int              spaces );
+void garmin_write_info      ( garmin_unit *    unit,
+                              garmin_writer *  out,
+                              int              spaces );
+
 
 /* ------------------------------------------------------------------------- */
 /* command.c                                                                 */
@@ -2063,20 +2468,47 @@ garmin_data * garmin_read_via        ( garmin_unit *    garmin,
                                        appl_protocol    protocol );
 garmin_data * garmin_get             ( garmin_unit *    garmin,
                                        garmin_get_type  what );
+garmin_data * garmin_stream          ( garmin_unit *    garmin,
+                                       garmin_get_type  what,
+                                       garmin_sink      sink,
+                                       void *           user );
 int           garmin_init            ( garmin_unit *    garmin,
                                        int              verbose );
+int           garmin_connect         ( garmin_unit *    garmin );
+
+
+/* ------------------------------------------------------------------------- */
+/* cache.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+int           garmin_load_capabilities ( garmin_unit * garmin );
+int           garmin_save_capabilities ( garmin_unit * garmin );
+
+
+/* ------------------------------------------------------------------------- */
+/* pvt.c                                                                     */
+/* ------------------------------------------------------------------------- */
+
+garmin_pvt_stream * garmin_pvt_start   ( garmin_unit *        garmin,
+                                         int                  size );
+int                 garmin_pvt_poll    ( garmin_pvt_stream *  s,
+                                         D800 *               fix );
+int                 garmin_pvt_wait    ( garmin_pvt_stream *  s,
+                                         D800 *               fix,
+                                         int                  timeout );
+uint32              garmin_pvt_dropped ( garmin_pvt_stream *  s );
+void                garmin_pvt_stop    ( garmin_pvt_stream *  s );
 
 
 /* ------------------------------------------------------------------------- */
 /* usb_comm.c                                                                */
 /* ------------------------------------------------------------------------- */
 
-int     garmin_open           ( garmin_unit * garmin );
+extern const garmin_transport garmin_usb_transport;
+
+int     garmin_enumerate      ( garmin_device * devices, int max );
 int     garmin_shutdown       ( garmin_unit * garmin );
-int     garmin_close          ( garmin_unit * garmin );
 uint32  garmin_start_session  ( garmin_unit * garmin );
-int     garmin_read           ( garmin_unit * garmin, garmin_packet * p );
-int     garmin_write          ( garmin_unit * garmin, garmin_packet * p );
 uint8   garmin_packet_type    ( garmin_packet * p );
 uint16  garmin_packet_id      ( garmin_packet * p );
 uint32  garmin_packet_size    ( garmin_packet * p );
@@ -2091,23 +2523,161 @@ int     garmin_packetize      ( garmin_packet *  p,
                                 uint8 *          data );
 
 
+/* ------------------------------------------------------------------------- */
+/* transport.c                                                               */
+/* ------------------------------------------------------------------------- */
+
+int     garmin_open           ( garmin_unit * garmin );
+int     garmin_close          ( garmin_unit * garmin );
+int     garmin_read           ( garmin_unit * garmin, garmin_packet * p );
+int     garmin_read_packet    ( garmin_unit * garmin, garmin_packet ** p );
+int     garmin_write          ( garmin_unit * garmin, garmin_packet * p );
+int     garmin_queue_reads    ( garmin_unit * garmin, int count );
+void    garmin_cancel_reads   ( garmin_unit * garmin );
+int     garmin_capture        ( garmin_unit * garmin, const char * path );
+int     garmin_replay         ( garmin_unit * garmin, const char * path );
+
+
 /* ------------------------------------------------------------------------- */
 /* byte_util.c                                                               */
 /* ------------------------------------------------------------------------- */
 
-uint16   get_uint16  ( const uint8 * d );
-sint16   get_sint16  ( const uint8 * d );
-uint32   get_uint32  ( const uint8 * d );
-sint32   get_sint32  ( const uint8 * d );
-float32  get_float32 ( const uint8 * d );
-float64  get_float64 ( const uint8 * d );
+/*
+   Packed fields are little-endian and need not be aligned.  The get/put
+   functions are inline: each is a memcpy, which compiles to a single
+   unaligned load or store, plus a byte swap on a big-endian host.
+   byte_util.c holds the out-of-line copies, and byte_util_bench.c times
+   them against the byte at a time copies they replaced.
+*/
+
+#if defined(WORDS_BIGENDIAN) || \
+    (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define GARMIN_LE16(x)  __builtin_bswap16(x)
+#define GARMIN_LE32(x)  __builtin_bswap32(x)
+#define GARMIN_LE64(x)  __builtin_bswap64(x)
+#else
+#define GARMIN_LE16(x)  (x)
+#define GARMIN_LE32(x)  (x)
+#define GARMIN_LE64(x)  (x)
+#endif
+
+inline uint16
+get_uint16 ( const uint8 * d )
+{
+  uint16 v;
+
+  memcpy(&v,d,sizeof(v));
+
+  return GARMIN_LE16(v);
+}
+
+inline uint32
+get_uint32 ( const uint8 * d )
+{
+  uint32 v;
 
-void     put_uint16  ( uint8 * d, const uint16  v );
-void     put_sint16  ( uint8 * d, const sint16  v );
-void     put_uint32  ( uint8 * d, const uint32  v );
-void     put_sint32  ( uint8 * d, const sint32  v );
-void     put_float32 ( uint8 * d, const float32 v );
-void     put_float64 ( uint8 * d, const float64 v );
+  memcpy(&v,d,sizeof(v));
+
+  return GARMIN_LE32(v);
+}
+
+inline uint64_t
+get_uint64 ( const uint8 * d )
+{
+  uint64_t v;
+
+  memcpy(&v,d,sizeof(v));
+
+  return GARMIN_LE64(v);
+}
+
+inline sint16
+get_sint16 ( const uint8 * d )
+{
+  return (sint16)get_uint16(d);
+}
+
+inline sint32
+get_sint32 ( const uint8 * d )
+{
+  return (sint32)get_uint32(d);
+}
+
+inline float32
+get_float32 ( const uint8 * d )
+{
+  uint32  u = get_uint32(d);
+  float32 v;
+
+  memcpy(&v,&u,sizeof(v));
+
+  return v;
+}
+
+inline float64
+get_float64 ( const uint8 * d )
+{
+  uint64_t u = get_uint64(d);
+  float64  v;
+
+  memcpy(&v,&u,sizeof(v));
+
+  return v;
+}
+
+inline void
+put_uint16 ( uint8 * d, const uint16 v )
+{
+  uint16 u = GARMIN_LE16(v);
+
+  memcpy(d,&u,sizeof(u));
+}
+
+inline void
+put_uint32 ( uint8 * d, const uint32 v )
+{
+  uint32 u = GARMIN_LE32(v);
+
+  memcpy(d,&u,sizeof(u));
+}
+
+inline void
+put_uint64 ( uint8 * d, const uint64_t v )
+{
+  uint64_t u = GARMIN_LE64(v);
+
+  memcpy(d,&u,sizeof(u));
+}
+
+inline void
+put_sint16 ( uint8 * d, const sint16 v )
+{
+  put_uint16(d,(uint16)v);
+}
+
+inline void
+put_sint32 ( uint8 * d, const sint32 v )
+{
+  put_uint32(d,(uint32)v);
+}
+
+inline void
+put_float32 ( uint8 * d, const float32 v )
+{
+  uint32 u;
+
+  memcpy(&u,&v,sizeof(u));
+  put_uint32(d,u);
+}
+
+inline void
+put_float64 ( uint8 * d, const float64 v )
+{
+  uint64_t u;
+
+  memcpy(&u,&v,sizeof(u));
+  put_uint64(d,u);
+}
 
 char *   get_string  ( garmin_packet * p, int * offset );
 char *   get_vstring ( uint8 ** buf );
@@ -2123,6 +2693,8 @@ garmin_data * garmin_alloc_data     ( garmin_datatype type );
 garmin_list * garmin_alloc_list     ( void );
 garmin_list * garmin_list_append    ( garmin_list * list,
                                       garmin_data * data );
+int           garmin_list_reserve   ( garmin_list * list,
+                                      uint32        elements );
 garmin_data * garmin_list_data      ( garmin_data * data,
                                       uint32        which );
 void          garmin_free_list      ( garmin_list * l );
@@ -2131,6 +2703,86 @@ void          garmin_free_data      ( garmin_data * d );
 uint32        garmin_data_size      ( garmin_data * d );
 
 
+/* ------------------------------------------------------------------------- */
+/* file.c                                                                    */
+/* ------------------------------------------------------------------------- */
+
+garmin_file *    garmin_open_file     ( const char *  filename );
+void             garmin_close_file    ( garmin_file * f );
+int              garmin_file_chunks   ( garmin_file * f );
+garmin_lazy *    garmin_file_chunk    ( garmin_file * f, int which );
+garmin_lazy *    garmin_file_part     ( garmin_file * f, garmin_part part );
+garmin_datatype  garmin_lazy_type     ( garmin_lazy * h );
+const uint8 *    garmin_lazy_bytes    ( garmin_lazy * h, uint32 * size );
+int              garmin_lazy_elements ( garmin_lazy * h );
+garmin_lazy *    garmin_lazy_element  ( garmin_lazy * h, int which );
+garmin_data *    garmin_lazy_data     ( garmin_lazy * h );
+
+
+/* ------------------------------------------------------------------------- */
+/* index.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+uint8 *  garmin_index_build ( const uint8 *   buf,
+                              uint32          len,
+                              uint32 *        size );
+int      garmin_index_read  ( int             fd,
+                              garmin_index *  idx );
+int      garmin_index_find  ( int             fd,
+                              garmin_index *  idx,
+                              uint32          t,
+                              uint32 *        time,
+                              uint32 *        left,
+                              uint32 *        offset );
+
+
+/* ------------------------------------------------------------------------- */
+/* reader.c                                                                  */
+/* ------------------------------------------------------------------------- */
+
+garmin_reader *  garmin_reader_open      ( const char *    filename );
+int              garmin_reader_next      ( garmin_reader * r,
+                                           garmin_data **  data );
+int              garmin_reader_seek_time ( garmin_reader * r, uint32 t );
+garmin_datatype  garmin_reader_type      ( garmin_reader * r );
+int              garmin_reader_depth     ( garmin_reader * r );
+uint32           garmin_reader_list_id   ( garmin_reader * r );
+uint32           garmin_reader_elements  ( garmin_reader * r );
+void             garmin_reader_close     ( garmin_reader * r );
+
+
+/* ------------------------------------------------------------------------- */
+/* track.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+garmin_track * garmin_track_new  ( garmin_data *  data );
+garmin_track * garmin_load_track ( const char *   filename );
+void           garmin_track_free ( garmin_track * t );
+
+
+/* ------------------------------------------------------------------------- */
+/* arena.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+garmin_arena * garmin_arena_new     ( void );
+void           garmin_arena_free    ( garmin_arena * a );
+void *         garmin_arena_alloc   ( garmin_arena * a, size_t size );
+garmin_arena * garmin_arena_use     ( garmin_arena * a );
+garmin_arena * garmin_arena_current ( void );
+void *         garmin_arena_calloc  ( size_t count, size_t size );
+
+
+/* ------------------------------------------------------------------------- */
+/* queue.c                                                                   */
+/* ------------------------------------------------------------------------- */
+
+garmin_queue * garmin_queue_new   ( int            capacity );
+int            garmin_queue_push  ( garmin_queue * q, void * item );
+void *         garmin_queue_pop   ( garmin_queue * q );
+void           garmin_queue_close ( garmin_queue * q );
+void           garmin_queue_free  ( garmin_queue * q );
+
+
 /* ------------------------------------------------------------------------- */
 /* symbol_name.c                                                             */
 /* ------------------------------------------------------------------------- */
@@ -2150,6 +2802,7 @@ int           get_run_track_lap_info ( garmin_data * run,
                                        uint32      * last_lap_index );
 
 void          garmin_save_runs       ( garmin_unit * garmin );
+void          garmin_save_all_runs   ( garmin_unit * garmin );
 
 
 #ifdef __cplusplus
@@ -20,39 +20,62 @@
 
 #include "config.h"
 
+#include "garmin.h"
+
+#include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 extern int
 garmin_dump(int argc, char *argv[]);
 
 extern int
-garmin_tcx(int argc, char *argv[], const char *output_file, bool verbose);
+garmin_dump_file(const char *file, garmin_writer *out);
+
+extern int
+garmin_tcx_file(const char *file, garmin_writer *out);
+
+extern int
+garmin_gpx_file(const char *file, garmin_writer *out);
+
+extern int
+garmin_gmap_file(const char *file, garmin_writer *out);
 
 extern int
-garmin_gchart(int argc, char *argv[], const char *output_file, bool verbose);
+garmin_tcx(int argc, char *argv[], bool verbose);
 
 extern int
-garmin_gpx(int argc, char *argv[], const char *output_file, bool verbose);
+garmin_gchart(int argc, char *argv[]);
 
 extern int
-garmin_gmap(int argc, char *argv[], const char *output_file, bool verbose);
+garmin_gpx(int argc, char *argv[], bool verbose);
+
+extern int
+garmin_gmap(int argc, char *argv[], bool verbose);
 
 static int verbose = 0;
 
 static void
 print_usage(const char *name)
 {
-  fprintf(stderr, "Usage: %s [-v] -f FORMAT [-o FILE] FILE...\n\n", name);
+  fprintf(stderr,
+          "Usage: %s [-v] -f FORMAT [-j N] [-o DIR] FILE...\n\n",
+          name);
   fprintf(stderr,
           "  -f, --format: Output format to convert to. Can be one of\n");
   fprintf(
     stderr,
     "                dump, gpx, tcx, gmap, gchart. Default is \"dump\"\n");
-  fprintf(stderr, "  -o, --output: Name of the file to write the output to\n");
+  fprintf(stderr,
+          "  -o, --output: Write each FILE to a file of its own in DIR\n");
+  fprintf(stderr,
+          "  -j, --jobs:   Convert N files at once (0: one per CPU)\n");
 }
 
 typedef enum {
@@ -71,18 +94,363 @@ char *const format_list[] = {[GARMIN_OUTPUT_FORMAT_NONE]   = "none",
                              [GARMIN_OUTPUT_FORMAT_GMAP]   = "gmap",
                              [GARMIN_OUTPUT_FORMAT_GCHART] = "gchart"};
 
+// How a batch converts one file in each format
+typedef struct {
+  int (*convert)(const char *file, garmin_writer *out);
+  const char *extension;
+  const char *head; // before the output of the files (or of each file)
+  const char *tail; // and after it
+} convert_format_t;
+
+static const convert_format_t convert_formats[] = {
+  [GARMIN_OUTPUT_FORMAT_DUMP]   = {garmin_dump_file,
+                                   "xml",
+                                   "<?xml version=\"1.0\"?>\n<garmin>\n",
+                                   "</garmin>\n"},
+  [GARMIN_OUTPUT_FORMAT_TCX]    = {garmin_tcx_file, "tcx", NULL, NULL},
+  [GARMIN_OUTPUT_FORMAT_GPX]    = {garmin_gpx_file, "gpx", NULL, NULL},
+  [GARMIN_OUTPUT_FORMAT_GMAP]   = {garmin_gmap_file, "xml", NULL, NULL},
+  [GARMIN_OUTPUT_FORMAT_GCHART] = {NULL, NULL, NULL, NULL},
+};
+
+typedef enum {
+  CONVERT_QUEUED,
+  CONVERT_DONE,
+  CONVERT_FAILED
+} convert_state_t;
+
+typedef struct {
+  const char *    input;
+  char *          output; // the file to write, or NULL for stdout
+  char *          temp;   // written first, then renamed to output
+  char *          text;   // what goes to stdout
+  size_t          size;
+  convert_state_t state;
+} convert_job_t;
+
+typedef struct {
+  const convert_format_t *format;
+  convert_job_t *         jobs;
+  garmin_queue *          queue;
+  pthread_mutex_t         lock;
+  pthread_cond_t          done;
+} convert_batch_t;
+
+/*
+ * Convert one file, either to its own file in the output directory or into
+ * memory for the main thread to write to stdout in order.  A file is
+ * written under a temporary name and renamed when it is complete, so a
+ * failed or interrupted conversion never leaves a partial file behind.
+ */
+static int
+convert_job(const convert_format_t *format, convert_job_t *job)
+{
+  garmin_writer *out;
+  FILE *         fp;
+  int            ok;
+
+  if (job->output != NULL) {
+    fp = fopen(job->temp, "wb");
+  } else {
+    fp = open_memstream(&job->text, &job->size);
+  }
+  if (fp == NULL) {
+    fprintf(stderr,
+            "%s: %s\n",
+            job->output != NULL ? job->temp : job->input,
+            strerror(errno));
+    return 0;
+  }
+
+  if ((out = garmin_writer_open(fp)) == NULL) {
+    fclose(fp);
+    ok = 0;
+  } else {
+    if (job->output != NULL && format->head != NULL) {
+      garmin_write_str(out, format->head);
+    }
+    ok = format->convert(job->input, out);
+    if (job->output != NULL && format->tail != NULL) {
+      garmin_write_str(out, format->tail);
+    }
+    if (garmin_writer_close(out) == 0) {
+      ok = 0;
+    }
+    if (fclose(fp) != 0) {
+      ok = 0;
+    }
+  }
+
+  if (job->output != NULL) {
+    if (ok && rename(job->temp, job->output) == -1) {
+      fprintf(stderr, "%s: %s\n", job->output, strerror(errno));
+      ok = 0;
+    }
+    if (!ok) {
+      unlink(job->temp);
+    }
+  }
+
+  return ok;
+}
+
+static void *
+convert_worker(void *arg)
+{
+  convert_batch_t *batch = arg;
+  convert_job_t *  job;
+  int              ok;
+
+  while ((job = garmin_queue_pop(batch->queue)) != NULL) {
+    ok = convert_job(batch->format, job);
+    pthread_mutex_lock(&batch->lock);
+    job->state = ok ? CONVERT_DONE : CONVERT_FAILED;
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+  }
+
+  return NULL;
+}
+
+/*
+ * Wait for job 'i' to finish, then write its output (if it went to memory)
+ * and report it.  Jobs are finished off in the order they were given, so
+ * the output and the progress report come out the same however many
+ * threads there are.
+ */
+static int
+convert_finish(convert_batch_t *batch, int i, int n)
+{
+  convert_job_t *job = &batch->jobs[i];
+
+  pthread_mutex_lock(&batch->lock);
+  while (job->state == CONVERT_QUEUED) {
+    pthread_cond_wait(&batch->done, &batch->lock);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  if (job->text != NULL) {
+    fwrite(job->text, job->size, 1, stdout);
+    free(job->text);
+    job->text = NULL;
+  }
+
+  if (job->state == CONVERT_FAILED) {
+    fprintf(stderr, "[%d/%d] %s: failed\n", i + 1, n, job->input);
+  } else if (job->output != NULL) {
+    fprintf(stderr, "[%d/%d] %s -> %s\n", i + 1, n, job->input, job->output);
+  } else if (verbose) {
+    fprintf(stderr, "[%d/%d] %s\n", i + 1, n, job->input);
+  }
+
+  return job->state == CONVERT_DONE;
+}
+
+static int
+convert_compare_output(const void *a, const void *b)
+{
+  const convert_job_t *x = *(convert_job_t *const *)a;
+  const convert_job_t *y = *(convert_job_t *const *)b;
+
+  return strcmp(x->output, y->output);
+}
+
+/*
+ * Name the output file of each job: the input's name, less the directory
+ * and any .gmn, with the format's extension, in 'dir'.  Two inputs with
+ * the same name would overwrite one another, so that is an error.
+ */
+static int
+convert_name_outputs(convert_job_t *jobs,
+                     int            n,
+                     const char *   dir,
+                     const char *   extension)
+{
+  convert_job_t **sorted;
+  const char *    name;
+  size_t          length;
+  size_t          size;
+  int             ok = 1;
+  int             i;
+
+  if (mkdir(dir, 0777) == -1 && errno != EEXIST) {
+    fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+    return 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    name   = strrchr(jobs[i].input, '/');
+    name   = (name != NULL) ? name + 1 : jobs[i].input;
+    length = strlen(name);
+    if (length > 4 && strcmp(name + length - 4, ".gmn") == 0) {
+      length -= 4;
+    }
+
+    size           = strlen(dir) + length + strlen(extension) + 32;
+    jobs[i].output = malloc(size);
+    jobs[i].temp   = malloc(size);
+    if (jobs[i].output == NULL || jobs[i].temp == NULL) {
+      fprintf(stderr, "garmin_convert: out of memory\n");
+      return 0;
+    }
+    snprintf(jobs[i].output,
+             size,
+             "%s/%.*s.%s",
+             dir,
+             (int)length,
+             name,
+             extension);
+    snprintf(jobs[i].temp,
+             size,
+             "%s/.%.*s.%s.%d",
+             dir,
+             (int)length,
+             name,
+             extension,
+             (int)getpid());
+  }
+
+  if ((sorted = malloc(n * sizeof(convert_job_t *))) == NULL) {
+    fprintf(stderr, "garmin_convert: out of memory\n");
+    return 0;
+  }
+  for (i = 0; i < n; i++) {
+    sorted[i] = &jobs[i];
+  }
+  qsort(sorted, n, sizeof(convert_job_t *), convert_compare_output);
+  for (i = 1; i < n; i++) {
+    if (strcmp(sorted[i - 1]->output, sorted[i]->output) == 0) {
+      fprintf(stderr,
+              "%s and %s would both be written to %s\n",
+              sorted[i - 1]->input,
+              sorted[i]->input,
+              sorted[i]->output);
+      ok = 0;
+    }
+  }
+  free(sorted);
+
+  return ok;
+}
+
+/*
+ * Convert 'files' on 'threads' threads, to files of their own in 'dir' or
+ * (if it is NULL) to stdout.  The main thread hands the files to the
+ * workers through a queue and finishes them off in order; it doesn't get
+ * more than a few files ahead of the oldest unfinished one, so the output
+ * held in memory for stdout stays bounded.
+ */
+static int
+convert_batch(const convert_format_t *format,
+              int                     n,
+              char **                 files,
+              const char *            dir,
+              int                     threads)
+{
+  convert_batch_t batch;
+  pthread_t *     workers;
+  int             started = 0;
+  int             window  = threads * 4;
+  int             next    = 0;
+  int             ok      = 1;
+  int             i;
+
+  memset(&batch, 0, sizeof(batch));
+  batch.format = format;
+  batch.jobs   = calloc(n, sizeof(convert_job_t));
+  batch.queue  = garmin_queue_new(threads);
+  workers      = calloc(threads, sizeof(pthread_t));
+  if (batch.jobs == NULL || batch.queue == NULL || workers == NULL) {
+    fprintf(stderr, "garmin_convert: out of memory\n");
+    ok = 0;
+    goto done;
+  }
+
+  for (i = 0; i < n; i++) {
+    batch.jobs[i].input = files[i];
+    batch.jobs[i].state = CONVERT_QUEUED;
+  }
+
+  if (dir != NULL &&
+      convert_name_outputs(batch.jobs, n, dir, format->extension) == 0) {
+    ok = 0;
+    goto done;
+  }
+
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.done, NULL);
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&workers[started], NULL, convert_worker, &batch) ==
+        0) {
+      started++;
+    }
+  }
+
+  if (started == 0) {
+    fprintf(stderr, "garmin_convert: failed to start a thread\n");
+    ok = 0;
+  } else {
+    if (dir == NULL && format->head != NULL) {
+      fputs(format->head, stdout);
+    }
+
+    for (i = 0; i < n; i++) {
+      while (i - next >= window) {
+        ok &= convert_finish(&batch, next++, n);
+      }
+      garmin_queue_push(batch.queue, &batch.jobs[i]);
+    }
+    garmin_queue_close(batch.queue);
+    while (next < n) {
+      ok &= convert_finish(&batch, next++, n);
+    }
+
+    if (dir == NULL && format->tail != NULL) {
+      fputs(format->tail, stdout);
+    }
+    if (fflush(stdout) != 0) {
+      ok = 0;
+    }
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  pthread_cond_destroy(&batch.done);
+  pthread_mutex_destroy(&batch.lock);
+
+done:
+  if (batch.jobs != NULL) {
+    for (i = 0; i < n; i++) {
+      free(batch.jobs[i].output);
+      free(batch.jobs[i].temp);
+    }
+  }
+  free(batch.jobs);
+  free(workers);
+  garmin_queue_free(batch.queue);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int
-garmin_convert(int argc, char *argv[], const char *output_file)
+garmin_convert(int argc, char *argv[])
 {
-  garmin_output_format_t format = GARMIN_OUTPUT_FORMAT_DUMP;
+  garmin_output_format_t format      = GARMIN_OUTPUT_FORMAT_DUMP;
+  const char *           output_file = NULL;
+  int                    jobs        = 1;
+  char *                 end;
 
   static struct option options[] = {{"verbose", no_argument, &verbose, 1},
                                     {"format", required_argument, 0, 'f'},
+                                    {"output", required_argument, 0, 'o'},
+                                    {"jobs", required_argument, 0, 'j'},
                                     {0, 0, 0, 0}};
 
   while (true) {
     int option_index = -1;
-    int c            = getopt_long(argc, argv, ":hvf:", options, &option_index);
+    int c = getopt_long(argc, argv, ":hvf:o:j:", options, &option_index);
     if (c == -1)
       break;
 
@@ -115,6 +483,20 @@ garmin_convert(int argc, char *argv[], const char *output_file)
     case 'o':
       output_file = optarg;
       break;
+    case 'j':
+      jobs = (int)strtol(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || jobs < 0) {
+        fprintf(stderr, "Invalid number of jobs specified: %s\n", optarg);
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      if (jobs == 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (jobs < 1) {
+          jobs = 1;
+        }
+      }
+      break;
     case '?':
       // Ignore all unknown options, we will pass them on to the subcommand
       break;
@@ -128,17 +510,36 @@ garmin_convert(int argc, char *argv[], const char *output_file)
   int    new_argc = argc - offset;
   char **new_argv = argv + offset;
 
+  // Several threads, or a file for each input: convert in a batch
+  if (jobs > 1 || output_file != NULL) {
+    if (convert_formats[format].convert == NULL) {
+      fprintf(stderr,
+              "%s: -j and -o are not supported for this format\n",
+              format_list[format]);
+      return EXIT_FAILURE;
+    }
+    if (new_argc < 2) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    return convert_batch(&convert_formats[format],
+                         new_argc - 1,
+                         new_argv + 1,
+                         output_file,
+                         jobs);
+  }
+
   switch (format) {
   case GARMIN_OUTPUT_FORMAT_DUMP:
     return garmin_dump(new_argc, new_argv);
   case GARMIN_OUTPUT_FORMAT_TCX:
-    return garmin_tcx(new_argc, new_argv, output_file, verbose);
+    return garmin_tcx(new_argc, new_argv, verbose);
   case GARMIN_OUTPUT_FORMAT_GCHART:
-    return garmin_gchart(new_argc, new_argv, output_file, verbose);
+    return garmin_gchart(new_argc, new_argv);
   case GARMIN_OUTPUT_FORMAT_GPX:
-    return garmin_gpx(new_argc, new_argv, output_file, verbose);
+    return garmin_gpx(new_argc, new_argv, verbose);
   case GARMIN_OUTPUT_FORMAT_GMAP:
-    return garmin_gmap(new_argc, new_argv, output_file, verbose);
+    return garmin_gmap(new_argc, new_argv, verbose);
   default:
     fprintf(stderr, "%s: Not yet implemented\n", format_list[format]);
     break;
@@ -38,11 +38,40 @@ print_usage(const char *name)
   fprintf(stderr, "  -v, --verbose Be more verbose\n");
 }
 
+/*
+   Write one file as an <activity>.  Returns 1, or 0 if it couldn't be
+   opened or turned out to be corrupt.
+
+   Lists print nothing of their own, so each record can go out as read.
+   The reader reports errors on stderr, and the writer is flushed once,
+   when the file is done.
+*/
+
+int
+garmin_dump_file ( const char * file, garmin_writer * out )
+{
+  garmin_data *   data;
+  garmin_reader * reader;
+  int             ret;
+
+  if ( (reader = garmin_reader_open(file)) == NULL ) return 0;
+
+  garmin_write_lit(out,"<activity>\n");
+  while ( (ret = garmin_reader_next(reader,&data)) > 0 ) {
+    if ( data != NULL ) garmin_write_data(data,out,0);
+  }
+  garmin_write_lit(out,"</activity>\n");
+  garmin_reader_close(reader);
+  garmin_writer_flush(out);
+
+  return ret == 0;
+}
+
 int
 garmin_dump ( int argc, const char ** argv )
 {
-  garmin_data * data;
-  int           i;
+  garmin_writer * out;
+  int             i;
 
   static struct option options[] = {{"help", no_argument, 0, 'h'},
                                     {"verbose", no_argument, &verbose, 1},
@@ -80,17 +109,17 @@ garmin_dump ( int argc, const char ** argv )
     exit(EXIT_SUCCESS);
   }
 
-  printf("<?xml version=\"1.0\"?>\n");
-  printf("<garmin>\n");
+  if ( (out = garmin_writer_open(stdout)) == NULL ) {
+    fprintf(stderr, "garmin_dump: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  garmin_write_lit(out,"<?xml version=\"1.0\"?>\n");
+  garmin_write_lit(out,"<garmin>\n");
   for ( i = 1; i < argc; i++ ) {
-    if ( (data = garmin_load(argv[i])) != NULL ) {
-      printf("<activity>\n");
-      garmin_print_data(data,stdout,0);
-      printf("</activity>\n");
-      garmin_free_data(data);
-    }
+    garmin_dump_file(argv[i],out);
   }
-  printf("</garmin>\n");
+  garmin_write_lit(out,"</garmin>\n");
 
-  return EXIT_SUCCESS;
+  return garmin_writer_close(out) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -94,15 +94,12 @@ gchart_e_encode ( float32 num, float32 max, char * str )
 
 
 static void
-get_gchart_max_data ( garmin_data *  data,
+get_gchart_max_data ( garmin_track * track,
                       D304 *         max,
                       int *          datapoints_num,
                       uint32 *       min_time )
 {
-  garmin_list *       dlist;
-  garmin_list_node *  node;
-  garmin_data *       point;
-  D304 *              d304;
+  uint32              n;
 
   max->time = 0;
   max->distance = 0;
@@ -110,50 +107,39 @@ get_gchart_max_data ( garmin_data *  data,
   max->heart_rate = 0;
   max->cadence = 0;
 
-  if ( data != NULL ) {
-    data = garmin_list_data(data,2);
-    if ( data->type == data_Dlist ) {
-      dlist = data->data;
-
-      (*datapoints_num)=0;
-      for ( node = dlist->head; node != NULL; node = node->next ) {
-        point = node->data;
-        if ( point->type == data_D304 ) {
-          (*datapoints_num)++;
-          d304 = point->data;
-          if ( d304->distance > max->distance && d304->distance < 1.0e24 )
-            max->distance = d304->distance;
-          if ( d304->alt > max->alt && d304->alt < 1.0e24)
-            max->alt = d304->alt;
-          if ( d304->time > max->time ) max->time = d304->time;
-          if ( d304->time < (*min_time) ) (*min_time) = d304->time;
-          if ( d304->heart_rate > max->heart_rate )
-            max->heart_rate = d304->heart_rate;
-          if ( d304->cadence > max->cadence ) max->cadence = d304->cadence;
-        }
-      }
+  /* The charts need distances, which only D304 points have. */
+
+  if ( track != NULL && track->type == data_D304 ) {
+    (*datapoints_num)=track->count;
+    for ( n = 0; n < track->count; n++ ) {
+      if ( track->distance[n] > max->distance && track->distance[n] < 1.0e24 )
+        max->distance = track->distance[n];
+      if ( track->alt[n] > max->alt && track->alt[n] < 1.0e24)
+        max->alt = track->alt[n];
+      if ( track->time[n] > max->time ) max->time = track->time[n];
+      if ( track->time[n] < (*min_time) ) (*min_time) = track->time[n];
+      if ( track->heart_rate[n] > max->heart_rate )
+        max->heart_rate = track->heart_rate[n];
+      if ( track->cadence[n] > max->cadence ) max->cadence = track->cadence[n];
     }
   }
 }
 
 
 static int
-get_gchart_data ( garmin_data *  data,
+get_gchart_data ( garmin_track * track,
                   gchart_conf *  conf,
                   D304 *         max,
                   int            datapoints_num,
                   d304strs*      encoded_strings,
                   int            min_time )
 {
-  garmin_list *       dlist;
-  garmin_list_node *  node;
-  garmin_data *       point;
-  D304 *              d304;
   D304_ext            total;
   int           ok     = 0;
   int j = 0;
   int i = 0;
   int np = 0;
+  uint32 n;
 
   total.time = 0;
   total.distance = 0;
@@ -161,103 +147,92 @@ get_gchart_data ( garmin_data *  data,
   total.heart_rate = 0;
   total.cadence = 0;
 
-  if ( data != NULL ) {
-    data = garmin_list_data(data,2);
-    if ( data->type == data_Dlist ) {
-      dlist = data->data;
-
-      np = (int)ceil(datapoints_num / (conf->width / conf->pixperdp));
-      i=1;
+  if ( track != NULL && track->type == data_D304 ) {
+    np = (int)ceil(datapoints_num / (conf->width / conf->pixperdp));
+    i=1;
 
-      /* Add check to make sure we won't overflow our string length */
+    /* Add check to make sure we won't overflow our string length */
 
-      /* printf("summarizing: "); */
-      for ( node = dlist->head; node != NULL; node = node->next ) {
-        point = node->data;
-        if ( point->type == data_D304 ) {
-
-          d304 = point->data;
-
-          total.time += d304->time;
-          /* printf("--------- %d %d %lld\n", d304->time, j, total.time); */
-          total.distance += d304->distance;
-          total.alt += d304->alt;
+    /* printf("summarizing: "); */
+    for ( n = 0; n < track->count; n++ ) {
+      total.time += track->time[n];
+      /* printf("--------- %d %d %lld\n", d304->time, j, total.time); */
+      total.distance += track->distance[n];
+      total.alt += track->alt[n];
 #if 0
-          total.heart_rate += d304->heart_rate;
-          total.cadence += d304->cadence;
+      total.heart_rate += track->heart_rate[n];
+      total.cadence += track->cadence[n];
 #endif
 
-          if ( d304->posn.lat == 0x7fffffff && d304->posn.lon == 0x7fffffff )
-            continue;
+      if ( !GARMIN_TRACK_VALID(track,n) )
+        continue;
 
-          if ( ++j % np == 0 ) {
-            char str[3] = { 0 };
-            int d=(total.distance == 0) ? 0 : (int)total.distance/np;
-            int a=(total.alt == 0) ? 0 : (int)total.alt/np;
-            int t=(total.time == 0) ? 0 : (int)(total.time/np);
+      if ( ++j % np == 0 ) {
+        char str[3] = { 0 };
+        int d=(total.distance == 0) ? 0 : (int)total.distance/np;
+        int a=(total.alt == 0) ? 0 : (int)total.alt/np;
+        int t=(total.time == 0) ? 0 : (int)(total.time/np);
 #if 0
-            /* printf("--------- %d -- np: %d\n", t, np); */
-            int h=(total.heart_rate == 0) ? 0 : total.heart_rate/np;
-            int c=(total.cadence == 0) ? 0 : total.cadence/np;
+        /* printf("--------- %d -- np: %d\n", t, np); */
+        int h=(total.heart_rate == 0) ? 0 : total.heart_rate/np;
+        int c=(total.cadence == 0) ? 0 : total.cadence/np;
 #endif
-            switch (conf->encode_method) {
-            case EXT_ENC:
-              gchart_e_encode(t - min_time, max->time - min_time, str);
-              encoded_strings->time_len +=
-                sprintf(encoded_strings->time + encoded_strings->time_len, "%s", str);
-
-              gchart_e_encode(d, max->distance, str);
-              encoded_strings->distance_len +=
-                sprintf(encoded_strings->distance + encoded_strings->distance_len, "%s", str);
-
-              gchart_e_encode(a, max->alt, str);
-              encoded_strings->alt_len +=
-                sprintf(encoded_strings->alt + encoded_strings->alt_len, "%s", str);
-              break;
-            case TXT_ENC:
-              /* printf("-- Encoding time: %d (%d) of %d (%d)\n", t, t-min_time, max->time, max->time - min_time); */
-              encoded_strings->time_len +=
-                sprintf(encoded_strings->time + encoded_strings->time_len, "%.1f,",
-                        gchart_t_encode(t- min_time, max->time - min_time));
-
-              encoded_strings->distance_len +=
-                sprintf(encoded_strings->distance + encoded_strings->distance_len, "%.1f,",
-                        gchart_t_encode(d, max->distance));
-
-              encoded_strings->alt_len +=
-                sprintf(encoded_strings->alt + encoded_strings->alt_len, "%.1f,",
-                        gchart_t_encode(a, max->alt));
-              break;
-        default:
+        switch (conf->encode_method) {
+        case EXT_ENC:
+          gchart_e_encode(t - min_time, max->time - min_time, str);
+          encoded_strings->time_len +=
+            sprintf(encoded_strings->time + encoded_strings->time_len, "%s", str);
+
+          gchart_e_encode(d, max->distance, str);
+          encoded_strings->distance_len +=
+            sprintf(encoded_strings->distance + encoded_strings->distance_len, "%s", str);
+
+          gchart_e_encode(a, max->alt, str);
+          encoded_strings->alt_len +=
+            sprintf(encoded_strings->alt + encoded_strings->alt_len, "%s", str);
+          break;
+        case TXT_ENC:
+          /* printf("-- Encoding time: %d (%d) of %d (%d)\n", t, t-min_time, max->time, max->time - min_time); */
+          encoded_strings->time_len +=
+            sprintf(encoded_strings->time + encoded_strings->time_len, "%.1f,",
+                    gchart_t_encode(t- min_time, max->time - min_time));
+
+          encoded_strings->distance_len +=
+            sprintf(encoded_strings->distance + encoded_strings->distance_len, "%.1f,",
+                    gchart_t_encode(d, max->distance));
+
+          encoded_strings->alt_len +=
+            sprintf(encoded_strings->alt + encoded_strings->alt_len, "%.1f,",
+                    gchart_t_encode(a, max->alt));
           break;
-            }
-
-            /* printf(" = %.1d\n", d); */
-            /* printf("summarizing: "); */
-            total.time = 0;
-            total.distance = 0;
-            total.alt = 0;
-            total.heart_rate = 0;
-            total.cadence = 0;
-            j=0;
-          }
-          /* printf("%.1f, ", d304->distance); */
-
-          i++;
+    default:
+      break;
         }
+
+        /* printf(" = %.1d\n", d); */
+        /* printf("summarizing: "); */
+        total.time = 0;
+        total.distance = 0;
+        total.alt = 0;
+        total.heart_rate = 0;
+        total.cadence = 0;
+        j=0;
       }
-      if (conf->encode_method == TXT_ENC) {
-        /* Remove the trailing commas */
-        encoded_strings->time[encoded_strings->time_len - 1]='\0';
-        encoded_strings->distance[encoded_strings->distance_len - 1]='\0';
-        encoded_strings->alt[encoded_strings->alt_len - 1]='\0';
+      /* printf("%.1f, ", track->distance[n]); */
+
+      i++;
+    }
+    if (conf->encode_method == TXT_ENC) {
+      /* Remove the trailing commas */
+      encoded_strings->time[encoded_strings->time_len - 1]='\0';
+      encoded_strings->distance[encoded_strings->distance_len - 1]='\0';
+      encoded_strings->alt[encoded_strings->alt_len - 1]='\0';
 #if 0
-        encoded_strings->heart_rate[encoded_strings->heart_rate_len - 1]='\0';
-        encoded_strings->cadence[encoded_strings->cadence_len - 1]='\0';
+      encoded_strings->heart_rate[encoded_strings->heart_rate_len - 1]='\0';
+      encoded_strings->cadence[encoded_strings->cadence_len - 1]='\0';
 #endif
-      }
-      ok = 1;
     }
+    ok = 1;
   }
 
   return ok;
@@ -265,7 +240,7 @@ get_gchart_data ( garmin_data *  data,
 
 
 static void
-print_gchart_data ( garmin_data *  data,
+print_gchart_data ( garmin_track * track,
                     FILE *         fp,
                     gchart_conf *  conf)
 {
@@ -284,7 +259,7 @@ print_gchart_data ( garmin_data *  data,
   enc_strs.time = str_t;
   enc_strs.time_len = 0;
 
-  get_gchart_max_data ( data, &max, &datapoints_num, &min_time);
+  get_gchart_max_data ( track, &max, &datapoints_num, &min_time);
   /*
     fprintf(fp, "-- max_d: %f\n", max.distance);
     fprintf(fp, "-- max_a: %f\n", max.alt);
@@ -292,7 +267,7 @@ print_gchart_data ( garmin_data *  data,
     fprintf(fp, "-- min_t: %d\n", min_time);
   */
 
-  get_gchart_data(data, conf, &max, datapoints_num, &enc_strs, min_time);
+  get_gchart_data(track, conf, &max, datapoints_num, &enc_strs, min_time);
 
   /* Distance vs Alt */
   fprintf(fp, "http://chart.apis.google.com/chart?cht=lxy&chtt=Distance+vs.+Alt&chs=%dx%d&chd=", conf->width, conf->height);
@@ -332,7 +307,7 @@ int
 garmin_gchart(int argc, char **argv)
 {
   int i=0;
-  garmin_data * data;
+  garmin_track * track;
   gchart_conf conf;
 
   /* Set the defaults */
@@ -400,9 +375,9 @@ garmin_gchart(int argc, char **argv)
          conf.pixperdp);
 
   for (i = optind; i < argc; i++) {
-    if ( (data = garmin_load(argv[i])) != NULL ) {
-      print_gchart_data(data,stdout,&conf);
-      garmin_free_data(data);
+    if ( (track = garmin_load_track(argv[i])) != NULL ) {
+      print_gchart_data(track,stdout,&conf);
+      garmin_track_free(track);
     }
   }
 
@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 static int verbose = 0;
+static int cached  = 0;
 
 void
 print_usage(const char *name)
@@ -35,6 +36,8 @@ print_usage(const char *name)
   fprintf(stderr, "\nShow information about the connected device\n");
   fprintf(stderr, "  -h, --help    Provide help\n");
   fprintf(stderr, "  -v, --verbose Be more verbose\n");
+  fprintf(stderr, "  -c, --cached  Use the capabilities cached from an "
+                  "earlier connect\n");
 }
 
 int
@@ -46,10 +49,11 @@ garmin_info ( int argc, char ** argv )
 
   static struct option options[] = {{"help", no_argument, 0, 'h'},
                                     {"verbose", no_argument, &verbose, 1},
+                                    {"cached", no_argument, &cached, 1},
                                     {0, 0, 0, 0}};
 
   while (true) {
-    int c = getopt_long(argc, argv, "hv", options, NULL);
+    int c = getopt_long(argc, argv, "hvc", options, NULL);
     if (c == -1)
       break;
 
@@ -59,6 +63,9 @@ garmin_info ( int argc, char ** argv )
     case 'v':
       verbose = 1;
       break;
+    case 'c':
+      cached = 1;
+      break;
     default:
       print_usage(argv[0]);
       exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
@@ -70,7 +77,11 @@ garmin_info ( int argc, char ** argv )
     exit(EXIT_SUCCESS);
   }
 
-  if ( garmin_init(&garmin,verbose) != 0 ) {
+  memset(&garmin,0,sizeof(garmin));
+  garmin.verbose   = verbose;
+  garmin.use_cache = cached;
+
+  if ( garmin_connect(&garmin) != 0 ) {
     /* Now print the info. */
     garmin_print_info(&garmin,stdout,0);
     garmin_close (&garmin);
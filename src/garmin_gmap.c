@@ -52,7 +52,7 @@ static unsigned long M[32] = {
 
 
 static int
-get_gmap_data ( garmin_data *    data,
+get_gmap_data ( garmin_track *   track,
                 char **          points,
                 char **          levels,
                 position_type *  center,
@@ -60,12 +60,8 @@ get_gmap_data ( garmin_data *    data,
                 position_type *  sw,
                 position_type *  ne )
 {
-  garmin_list *       dlist;
-  garmin_list_node *  node;
-  garmin_data *       point;
   char *              pp;
   char *              lp;
-  D304 *              d304;
   int                 ilat5;
   int                 ilon5;
   int                 llat5;
@@ -82,98 +78,87 @@ get_gmap_data ( garmin_data *    data,
   int                 i;
   int                 j;
   int                 x;
+  uint32              n;
 
-  if ( data != NULL ) {
-    data = garmin_list_data(data,2);
+  if ( track == NULL ) {
 
-    if ( data == NULL ) {
+    printf("get_gmap_data: NULL track pointer\n");
 
-      printf("get_gmap_data: no track points found\n");
+  } else if ( track->count == 0 ) {
 
-    } else if ( data->type == data_Dlist ) {
+    printf("get_gmap_data: no track points found\n");
 
-      dlist = data->data;
-
-      *points = calloc(12 * dlist->elements, sizeof(char));
-      *levels = calloc(2 * dlist->elements, sizeof(char));
+  } else {
 
-      pp = *points;
-      lp = *levels;
+    *points = calloc(12 * track->count + 1, sizeof(char));
+    *levels = calloc(2 * track->count + 1, sizeof(char));
 
-      j = 0;
-      llat5 = 0;
-      llon5 = 0;
+    pp = *points;
+    lp = *levels;
 
-      for ( node = dlist->head; node != NULL; node = node->next ) {
-        point = node->data;
-        if ( point->type == data_D304 ) {
+    j = 0;
+    llat5 = 0;
+    llon5 = 0;
 
-          d304 = point->data;
+    for ( n = 0; n < track->count; n++ ) {
 
-          if ( d304->posn.lat == 0x7fffffff && d304->posn.lon == 0x7fffffff )
-            continue;
+      if ( !GARMIN_TRACK_VALID(track,n) ) continue;
 
-          lat = SEMI2DEG(d304->posn.lat);
-          lon = SEMI2DEG(d304->posn.lon);
+      lat = SEMI2DEG(track->lat[n]);
+      lon = SEMI2DEG(track->lon[n]);
 
-          if ( j == 0 ) {
-            start->lat = d304->posn.lat;
-            start->lon = d304->posn.lon;
-          }
+      if ( j == 0 ) {
+        start->lat = track->lat[n];
+        start->lon = track->lon[n];
+      }
 
-          if ( lat < minlat ) minlat = lat;
-          if ( lat > maxlat ) maxlat = lat;
-          if ( lon < minlon ) minlon = lon;
-          if ( lon > maxlon ) maxlon = lon;
+      if ( lat < minlat ) minlat = lat;
+      if ( lat > maxlat ) maxlat = lat;
+      if ( lon < minlon ) minlon = lon;
+      if ( lon > maxlon ) maxlon = lon;
 
-          ilat5 = floor(lat * 1.0e5);
-          ilon5 = floor(lon * 1.0e5);
-          dlat5 = (abs(ilat5-llat5)<<1)-(ilat5<llat5);
-          dlon5 = (abs(ilon5-llon5)<<1)-(ilon5<llon5);
+      ilat5 = floor(lat * 1.0e5);
+      ilon5 = floor(lon * 1.0e5);
+      dlat5 = (abs(ilat5-llat5)<<1)-(ilat5<llat5);
+      dlon5 = (abs(ilon5-llon5)<<1)-(ilon5<llon5);
 
-          if ( dlat5 || dlon5 ) {
+      if ( dlat5 || dlon5 ) {
 
-            /* Encode the point. */
+        /* Encode the point. */
 
-            for (x = dlat5, i = FIVEBITCHUNKS(x); i > 0; x >>= 5, i--, pp++)
-              if ((*pp = ((x&0x1f)|((i>1)?0x20:0))+0x3f) == '\\') *++pp = '\\';
-            for (x = dlon5, i = FIVEBITCHUNKS(x); i > 0; x >>= 5, i--, pp++)
-              if ((*pp = ((x&0x1f)|((i>1)?0x20:0))+0x3f) == '\\') *++pp = '\\';
+        for (x = dlat5, i = FIVEBITCHUNKS(x); i > 0; x >>= 5, i--, pp++)
+          if ((*pp = ((x&0x1f)|((i>1)?0x20:0))+0x3f) == '\\') *++pp = '\\';
+        for (x = dlon5, i = FIVEBITCHUNKS(x); i > 0; x >>= 5, i--, pp++)
+          if ((*pp = ((x&0x1f)|((i>1)?0x20:0))+0x3f) == '\\') *++pp = '\\';
 
-            /* Compute the zoom level at which to show this point. */
+        /* Compute the zoom level at which to show this point. */
 
-            for (i = 0, *lp = 0x40; i<32 && (j&M[i])==M[i]; i++, (*lp)++);
-            lp++;
+        for (i = 0, *lp = 0x40; i<32 && (j&M[i])==M[i]; i++, (*lp)++);
+        lp++;
 
-            *pp = 0;
-            *lp = 0;
+        *pp = 0;
+        *lp = 0;
 
-            j++;
-          }
-          llat5 = ilat5;
-          llon5 = ilon5;
-        }
+        j++;
       }
+      llat5 = ilat5;
+      llon5 = ilon5;
+    }
 
-      **levels = *(lp-1) = 'P';
+    if ( lp > *levels ) **levels = *(lp-1) = 'P';
 
-      /* Now we can fill in the center coordinate and bounding box. */
+    /* Now we can fill in the center coordinate and bounding box. */
 
-      center->lat = DEG2SEMI((minlat+maxlat)/2.0);
-      center->lon = DEG2SEMI((minlon+maxlon)/2.0);
+    center->lat = DEG2SEMI((minlat+maxlat)/2.0);
+    center->lon = DEG2SEMI((minlon+maxlon)/2.0);
 
-      ne->lat = DEG2SEMI(maxlat);
-      ne->lon = DEG2SEMI(maxlon);
+    ne->lat = DEG2SEMI(maxlat);
+    ne->lon = DEG2SEMI(maxlon);
 
-      sw->lat = DEG2SEMI(minlat);
-      sw->lon = DEG2SEMI(minlon);
+    sw->lat = DEG2SEMI(minlat);
+    sw->lon = DEG2SEMI(minlon);
 
-      ok = 1;
-    } else {
-      printf("get_gmap_data: invalid track point list\n");
-    }
-  } else {
-    printf("get_gmap_data: NULL data pointer\n");
+    ok = 1;
   }
 
   return ok;
@@ -181,54 +166,61 @@ get_gmap_data ( garmin_data *    data,
 
 
 static void
-print_spaces ( FILE * fp, int spaces )
-{
-  int i;
-
-  for ( i = 0; i < spaces; i++ ) {
-    fprintf(fp," ");
-  }
-}
-
-
-static void
-print_open_tag ( const char * tag, FILE * fp, int spaces )
+print_open_tag ( const char * tag, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>\n",tag);
+  garmin_write_spaces(out,spaces);
+  garmin_write_char(out,'<');
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
 static void
-print_close_tag ( const char * tag, FILE * fp, int spaces )
+print_close_tag ( const char * tag, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"</%s>\n",tag);
+  garmin_write_spaces(out,spaces);
+  garmin_write_lit(out,"</");
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
 static void
-print_string_tag ( const char * tag, const char * val, FILE * fp, int spaces )
+print_string_tag ( const char *     tag,
+                   const char *     val,
+                   garmin_writer *  out,
+                   int              spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>%s</%s>\n",tag,val,tag);
+  garmin_write_spaces(out,spaces);
+  garmin_write_char(out,'<');
+  garmin_write_str(out,tag);
+  garmin_write_char(out,'>');
+  garmin_write_str(out,val);
+  garmin_write_lit(out,"</");
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
 static void
 print_position ( const char *           tag,
                  const position_type *  p,
-                 FILE *                 fp,
+                 garmin_writer *        out,
                  int                    spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s lat=\"%f\" lon=\"%f\"/>\n",
-          tag,SEMI2DEG(p->lat),SEMI2DEG(p->lon));
+  garmin_write_spaces(out,spaces);
+  garmin_write_char(out,'<');
+  garmin_write_str(out,tag);
+  garmin_write_lit(out," lat=\"");
+  garmin_write_fixed(out,SEMI2DEG(p->lat),6);
+  garmin_write_lit(out,"\" lon=\"");
+  garmin_write_fixed(out,SEMI2DEG(p->lon),6);
+  garmin_write_lit(out,"\"/>\n");
 }
 
 
 static void
-print_gmap_data ( garmin_data * data, FILE * fp, int spaces )
+print_gmap_data ( garmin_track * track, garmin_writer * out, int spaces )
 {
   char *         points = NULL;
   char *         levels = NULL;
@@ -237,20 +229,20 @@ print_gmap_data ( garmin_data * data, FILE * fp, int spaces )
   position_type  sw    = {0};
   position_type  ne    = {0};
 
-  if ( get_gmap_data(data,&points,&levels,&center,&start,&sw,&ne) != 0 ) {
-
-    print_open_tag("gmap_data",fp,spaces);
-    print_open_tag("coordinates",fp,spaces+1);
-    print_position("start",&start,fp,spaces+2);
-    print_position("center",&center,fp,spaces+2);
-    print_position("southwest",&sw,fp,spaces+2);
-    print_position("northeast",&ne,fp,spaces+2);
-    print_close_tag("coordinates",fp,spaces+1);
-    print_open_tag("polyline",fp,spaces+1);
-    print_string_tag("points",points,fp,spaces+2);
-    print_string_tag("levels",levels,fp,spaces+2);
-    print_close_tag("polyline",fp,spaces+1);
-    print_close_tag("gmap_data",fp,spaces);
+  if ( get_gmap_data(track,&points,&levels,&center,&start,&sw,&ne) != 0 ) {
+
+    print_open_tag("gmap_data",out,spaces);
+    print_open_tag("coordinates",out,spaces+1);
+    print_position("start",&start,out,spaces+2);
+    print_position("center",&center,out,spaces+2);
+    print_position("southwest",&sw,out,spaces+2);
+    print_position("northeast",&ne,out,spaces+2);
+    print_close_tag("coordinates",out,spaces+1);
+    print_open_tag("polyline",out,spaces+1);
+    print_string_tag("points",points,out,spaces+2);
+    print_string_tag("levels",levels,out,spaces+2);
+    print_close_tag("polyline",out,spaces+1);
+    print_close_tag("gmap_data",out,spaces);
 
     if ( points != NULL ) free(points);
     if ( levels != NULL ) free(levels);
@@ -267,11 +259,26 @@ print_usage(const char *name)
   fprintf(stderr, "  -v, --verbose Be more verbose\n");
 }
 
+/* Convert one file.  Returns 1, or 0 if it couldn't be loaded. */
+
+int
+garmin_gmap_file ( const char * file, garmin_writer * out )
+{
+  garmin_track * track;
+
+  if ( (track = garmin_load_track(file)) == NULL ) return 0;
+
+  print_gmap_data(track,out,0);
+  garmin_track_free(track);
+
+  return 1;
+}
+
 int
-garmin_gmap(int argc, char **argv, const char *output_file, bool verbose)
+garmin_gmap(int argc, char **argv, bool verbose)
 {
-  garmin_data * data;
-  int           i;
+  garmin_writer * out;
+  int             i;
 
   if (argc < 2) {
     print_usage("garmintool convert -f gmap");
@@ -283,12 +290,15 @@ garmin_gmap(int argc, char **argv, const char *output_file, bool verbose)
     exit(EXIT_SUCCESS);
   }
 
+  if ( (out = garmin_writer_open(stdout)) == NULL ) {
+    fprintf(stderr, "garmin_gmap: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
   for ( i = 1; i < argc; i++ ) {
-    if ( (data = garmin_load(argv[i])) != NULL ) {
-      print_gmap_data(data,stdout,0);
-      garmin_free_data(data);
-    }
+    garmin_gmap_file(argv[i],out);
+    garmin_writer_flush(out);
   }
 
-  return 0;
+  return garmin_writer_close(out) ? 0 : 1;
 }
@@ -49,24 +49,21 @@ get_gpx_data ( garmin_data *    fulldata,
                position_type *  sw,
                position_type *  ne )
 {
-  garmin_list *       dlist;
-  garmin_list_node *  node;
+  garmin_track *      track;
   garmin_list_node *  lapnode;
-  garmin_data *       point;
-  D304 *              d304;
   route_point *       rp;
   float               minlat =   90.0;
   float               maxlat =  -90.0;
   float               minlon =  180.0;
   float               maxlon = -180.0;
   int                 ok     = 0;
-  garmin_data *                data;
   garmin_list *     glaps;
   route_point*     points;
   int               laps;
   int curlapnum = 0;
   D1015 *lapdata = NULL;
   int pause = 0;
+  uint32 n;
 
   if ( fulldata != NULL ) {
 
@@ -84,94 +81,81 @@ get_gpx_data ( garmin_data *    fulldata,
     lapnode=glaps->head;
     lapdata=lapnode->data->data;
 
-    data = garmin_list_data(fulldata, 2); // get track points
+    track = garmin_track_new(garmin_list_data(fulldata, 2)); // get track points
 
-    if ( data == NULL ) {
+    if ( track == NULL || track->count == 0 ) {
 
       printf("get_gpx_data: no track points found\n");
       free(*tracks);
       *tracks = NULL;
 
-    } else if ( data->type == data_Dlist ) {
-
-      dlist = data->data;
+    } else {
 
-      points = calloc(dlist->elements+1+(laps*2), sizeof(route_point));
+      points = calloc(track->count+1+(laps*2), sizeof(route_point));
       (*tracks)[curlapnum]=points;
       rp = points;
 
       pause=0;
 
-      for ( node = dlist->head; node != NULL; node = node->next ) {
-        point = node->data;
-
-        switch (point->type) {
-          case data_D304: // position point
-          case data_D303:
+      for ( n = 0; n < track->count; n++ ) {
 
-            d304 = point->data;
+        if ( !GARMIN_TRACK_VALID(track,n) ) {
+          pause++;
+          continue;
+        }
 
-            if ( d304->posn.lat == 0x7fffffff && d304->posn.lon == 0x7fffffff ) {
-              pause++;
-              continue;
+        rp->lap=0;
+        if (lapdata!=NULL) {
+          if (track->time[n] >= lapdata->start_time) {
+            if (curlapnum>0) {
+              rp->t=0; // end previous lap
+              rp++;
+              (*tracks)[curlapnum]=rp; // new track
             }
-
-            rp->lap=0;
-            if (lapdata!=NULL) {
-              if (d304->time >= lapdata->start_time) {
-                if (curlapnum>0) {
-                  rp->t=0; // end previous lap
-                  rp++;
-                  (*tracks)[curlapnum]=rp; // new track
-                }
-                curlapnum++;
-
-                rp->lap=curlapnum;
-                if (d304->time != lapdata->start_time) {
-                  // if lap start point doesn't exist, create it
-                  rp->lat = SEMI2DEG(lapdata->begin.lat);
-                  rp->lon = SEMI2DEG(lapdata->begin.lon);
-
-                  rp->elev = d304->alt; // lap data doesn't contain alt :(
-                  rp->hr=d304->heart_rate;
-                  rp->cad=d304->cadence;
-
-                  rp->t = lapdata->start_time;
-                  rp++;
-                  rp->lap=0;
-                  rp->pause=0;
-                }
-                lapnode=lapnode->next;
-                if (lapnode!=NULL)
-                  lapdata=lapnode->data->data;
-                else
-                  lapdata=NULL; // last lap
-              }
+            curlapnum++;
+
+            rp->lap=curlapnum;
+            if (track->time[n] != lapdata->start_time) {
+              // if lap start point doesn't exist, create it
+              rp->lat = SEMI2DEG(lapdata->begin.lat);
+              rp->lon = SEMI2DEG(lapdata->begin.lon);
+
+              rp->elev = track->alt[n]; // lap data doesn't contain alt :(
+              rp->hr=track->heart_rate[n];
+              rp->cad=track->cadence[n];
+
+              rp->t = lapdata->start_time;
+              rp++;
+              rp->lap=0;
+              rp->pause=0;
             }
+            lapnode=lapnode->next;
+            if (lapnode!=NULL)
+              lapdata=lapnode->data->data;
+            else
+              lapdata=NULL; // last lap
+          }
+        }
 
-            rp->lat = SEMI2DEG(d304->posn.lat);
-            rp->lon = SEMI2DEG(d304->posn.lon);
-            rp->elev = d304->alt;
-            rp->t = d304->time;
-            rp->hr=d304->heart_rate;
-            rp->cad=d304->cadence;
+        rp->lat = SEMI2DEG(track->lat[n]);
+        rp->lon = SEMI2DEG(track->lon[n]);
+        rp->elev = track->alt[n];
+        rp->t = track->time[n];
+        rp->hr=track->heart_rate[n];
+        rp->cad=track->cadence[n];
 
 
-            if (pause==2) {
-              rp->pause=1;
-              pause=0;
-            } else rp->pause=0;
+        if (pause==2) {
+          rp->pause=1;
+          pause=0;
+        } else rp->pause=0;
 
-            if ( rp->lat < minlat ) minlat = rp->lat;
-            if ( rp->lat > maxlat ) maxlat = rp->lat;
-            if ( rp->lon < minlon ) minlon = rp->lon;
-            if ( rp->lon > maxlon ) maxlon = rp->lon;
+        if ( rp->lat < minlat ) minlat = rp->lat;
+        if ( rp->lat > maxlat ) maxlat = rp->lat;
+        if ( rp->lon < minlon ) minlon = rp->lon;
+        if ( rp->lon > maxlon ) maxlon = rp->lon;
 
-            ++rp;
-            break;
-          default: //printf("unknown frame %i\n", point->type);
-            ;
-        }
+        ++rp;
       }
       rp->t = 0;
 
@@ -184,9 +168,8 @@ get_gpx_data ( garmin_data *    fulldata,
       sw->lon = DEG2SEMI(minlon);
 
       ok = 1;
-    } else {
-      printf("get_gpx_data: invalid track point list\n");
     }
+    garmin_track_free(track);
   } else {
     printf("get_gpx_data: NULL data pointer\n");
   }
@@ -196,47 +179,32 @@ get_gpx_data ( garmin_data *    fulldata,
 
 
 static void
-print_spaces ( FILE * fp, int spaces )
-{
-  int i;
-
-  for ( i = 0; i < spaces; i++ ) {
-    fprintf(fp," ");
-  }
-}
-
-
-static void
-print_open_tag ( const char * tag, FILE * fp, int spaces )
+print_open_tag ( const char * tag, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>\n",tag);
+  garmin_write_spaces(out,spaces);
+  garmin_write_char(out,'<');
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
 static void
-print_close_tag ( const char * tag, FILE * fp, int spaces )
+print_close_tag ( const char * tag, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"</%s>\n",tag);
+  garmin_write_spaces(out,spaces);
+  garmin_write_lit(out,"</");
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
 static void
-print_string_tag ( const char * tag, const char * val, FILE * fp, int spaces )
-{
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>%s</%s>\n",tag,val,tag);
-}
-
-
-static void
-print_gpx_header ( FILE *               fp,
+print_gpx_header ( garmin_writer *      out,
                    int                  spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  fprintf(fp,"<gpx version=\"1.1\"\n"
+  garmin_write_spaces(out,spaces);
+  garmin_write_lit(out,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  garmin_write_lit(out,"<gpx version=\"1.1\"\n"
     "creator=\"Garmin Forerunner Tools - https://github.com/phako/garmintools\"\n"
     "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
     "xmlns:gpxtpx=\"http://www.garmin.com/xmlschemas/TrackPointExtension/v1\"\n"
@@ -249,74 +217,90 @@ print_gpx_header ( FILE *               fp,
 
 static void
 print_time_tag ( const time_t           t,
-                 FILE *                 fp,
+                 garmin_writer *        out,
                  int                    spaces )
 {
-  char buf[512] = { 0 };
-  struct tm *tmp;
-
-  tmp = gmtime(&t);
-  strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", tmp);
-  print_string_tag("time",buf,fp,spaces);
+  garmin_write_spaces(out,spaces);
+  garmin_write_lit(out,"<time>");
+  garmin_write_time(out,t,GARMIN_TIME_UTC_Z);
+  garmin_write_lit(out,"</time>\n");
 }
 
 static void
 print_bounds_tag ( const position_type * sw,
                    const position_type * ne,
-                   FILE *                fp,
+                   garmin_writer *       out,
                    int                   spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<bounds minlat=\"%f\" minlon=\"%f\" maxlat=\"%f\" maxlon=\"%f\" />\n",
-      SEMI2DEG(sw->lat), SEMI2DEG(sw->lon),
-      SEMI2DEG(ne->lat), SEMI2DEG(ne->lon));
+  garmin_write_spaces(out,spaces);
+  garmin_write_lit(out,"<bounds minlat=\"");
+  garmin_write_fixed(out,SEMI2DEG(sw->lat),6);
+  garmin_write_lit(out,"\" minlon=\"");
+  garmin_write_fixed(out,SEMI2DEG(sw->lon),6);
+  garmin_write_lit(out,"\" maxlat=\"");
+  garmin_write_fixed(out,SEMI2DEG(ne->lat),6);
+  garmin_write_lit(out,"\" maxlon=\"");
+  garmin_write_fixed(out,SEMI2DEG(ne->lon),6);
+  garmin_write_lit(out,"\" />\n");
 }
 
 static void
-print_route_points ( route_point * points,
-                     FILE *        fp,
-                     int           spaces )
+print_route_points ( route_point *   points,
+                     garmin_writer * out,
+                     int             spaces )
 {
   route_point * rp = points;
   while (rp->t > 0) {
-    print_spaces(fp, spaces);
-    fprintf(fp, "<trkpt lat=\"%f\" lon=\"%f\">\n", rp->lat, rp->lon);
-    print_spaces(fp, spaces+2);
-    fprintf(fp, "<ele>%f</ele>\n", rp->elev);
-    print_time_tag(rp->t + TIME_OFFSET, fp, spaces+2);
+    garmin_write_spaces(out, spaces);
+    garmin_write_lit(out, "<trkpt lat=\"");
+    garmin_write_fixed(out, rp->lat, 6);
+    garmin_write_lit(out, "\" lon=\"");
+    garmin_write_fixed(out, rp->lon, 6);
+    garmin_write_lit(out, "\">\n");
+    garmin_write_spaces(out, spaces+2);
+    garmin_write_lit(out, "<ele>");
+    garmin_write_fixed(out, rp->elev, 6);
+    garmin_write_lit(out, "</ele>\n");
+    print_time_tag(rp->t + TIME_OFFSET, out, spaces+2);
     if (rp->lap) {
-      print_spaces(fp, spaces+2);
-      fprintf(fp,"<name>Lap %i</name>\n",rp->lap);
+      garmin_write_spaces(out, spaces+2);
+      garmin_write_lit(out, "<name>Lap ");
+      garmin_write_int(out, rp->lap);
+      garmin_write_lit(out, "</name>\n");
     } else if (rp->pause) {
-      print_spaces(fp, spaces+2);
-      fprintf(fp,"<name>Pause</name>\n");
+      garmin_write_spaces(out, spaces+2);
+      garmin_write_lit(out, "<name>Pause</name>\n");
     }
 
     if ((rp->hr != 0) || ((rp->cad != 0xff) && (rp->cad != 0x00))) {
-      print_spaces(fp, spaces+2);
-      fprintf(fp,"<extensions>\n");
-      print_spaces(fp, spaces+2);
-      fprintf(fp,"<gpxtpx:TrackPointExtension>\n");
+      garmin_write_spaces(out, spaces+2);
+      garmin_write_lit(out, "<extensions>\n");
+      garmin_write_spaces(out, spaces+2);
+      garmin_write_lit(out, "<gpxtpx:TrackPointExtension>\n");
       if (rp->hr != 0) {
-        print_spaces(fp, spaces+4);
-        fprintf(fp,"<gpxtpx:hr>%i</gpxtpx:hr>\n",rp->hr);
+        garmin_write_spaces(out, spaces+4);
+        garmin_write_lit(out, "<gpxtpx:hr>");
+        garmin_write_uint(out, rp->hr);
+        garmin_write_lit(out, "</gpxtpx:hr>\n");
       }
       if (rp->cad != 0xff) {
-        print_spaces(fp, spaces+4);
-        fprintf(fp,"<gpxtpx:cad>%i</gpxtpx:cad>\n",rp->cad);
+        garmin_write_spaces(out, spaces+4);
+        garmin_write_lit(out, "<gpxtpx:cad>");
+        garmin_write_uint(out, rp->cad);
+        garmin_write_lit(out, "</gpxtpx:cad>\n");
       }
 
-      print_close_tag("gpxtpx:TrackPointExtension", fp, spaces+2);
-      print_close_tag("extensions", fp, spaces+2);
+      print_close_tag("gpxtpx:TrackPointExtension", out, spaces+2);
+      print_close_tag("extensions", out, spaces+2);
     }
 
-    print_close_tag("trkpt", fp, spaces);
+    print_close_tag("trkpt", out, spaces);
     ++rp;
   }
 }
 
 static void
-print_gpx_data ( garmin_data * data, FILE * fp, int spaces )
+print_gpx_data ( garmin_data * data, garmin_writer * out, int spaces )
 {
   route_point ** laps = NULL;
   route_point * points;
@@ -325,23 +309,23 @@ print_gpx_data ( garmin_data * data, FILE * fp, int spaces )
   int i;
 
   if ( get_gpx_data(data,&laps,&sw,&ne) != 0 ) {
-    print_gpx_header(fp,spaces);
+    print_gpx_header(out,spaces);
 
-    print_open_tag("metadata", fp, spaces);
-    print_time_tag(time(NULL),fp,spaces+2);
-    print_close_tag("metadata", fp, spaces);
+    print_open_tag("metadata", out, spaces);
+    print_time_tag(time(NULL),out,spaces+2);
+    print_close_tag("metadata", out, spaces);
 
-    print_bounds_tag(&sw,&ne,fp,spaces);
+    print_bounds_tag(&sw,&ne,out,spaces);
 
-    print_open_tag("trk",fp,spaces);
+    print_open_tag("trk",out,spaces);
     for (i=0; laps[i]!=NULL; i++) {
       points=laps[i];
-      print_open_tag("trkseg",fp,spaces);
-      print_route_points(points,fp,spaces+2);
-      print_close_tag("trkseg",fp,spaces);
+      print_open_tag("trkseg",out,spaces);
+      print_route_points(points,out,spaces+2);
+      print_close_tag("trkseg",out,spaces);
     }
-    print_close_tag("trk",fp,spaces);
-    print_close_tag("gpx",fp,spaces);
+    print_close_tag("trk",out,spaces);
+    print_close_tag("gpx",out,spaces);
     free(laps[0]);
   }
   free(laps);
@@ -358,11 +342,29 @@ print_usage(const char *name)
   fprintf(stderr, "  -v, --verbose Be more verbose\n");
 }
 
+/* Convert one file.  Returns 1, or 0 if it couldn't be loaded. */
+
 int
-garmin_gpx(int argc, char **argv, const char *output_file, bool verbose)
+garmin_gpx_file ( const char * file, garmin_writer * out )
 {
-  garmin_data * data;
-  int           i;
+  garmin_arena * arena = garmin_arena_new();
+  garmin_data *  data;
+  int            ok = 0;
+
+  if ( (data = garmin_load_arena(file,arena)) != NULL ) {
+    print_gpx_data(data,out,0);
+    ok = 1;
+  }
+  garmin_arena_free(arena);
+
+  return ok;
+}
+
+int
+garmin_gpx(int argc, char **argv, bool verbose)
+{
+  garmin_writer * out;
+  int             i;
 
   if (argc < 2) {
     print_usage("garmintool convert -f gpx");
@@ -374,12 +376,15 @@ garmin_gpx(int argc, char **argv, const char *output_file, bool verbose)
     exit(EXIT_SUCCESS);
   }
 
+  if ( (out = garmin_writer_open(stdout)) == NULL ) {
+    fprintf(stderr, "garmin_gpx: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
   for ( i = 1; i < argc; i++ ) {
-    if ( (data = garmin_load(argv[i])) != NULL ) {
-      print_gpx_data(data,stdout,0);
-      garmin_free_data(data);
-    }
+    garmin_gpx_file(argv[i],out);
+    garmin_writer_flush(out);
   }
 
-  return 0;
+  return garmin_writer_close(out) ? 0 : 1;
 }
@@ -0,0 +1,289 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include "garmin.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* How long to wait for a fix before checking for an interrupt (ms). */
+#define LIVE_POLL_INTERVAL 250
+
+typedef enum { LIVE_NMEA, LIVE_JSON } live_format;
+
+static int                   verbose     = 0;
+static volatile sig_atomic_t interrupted = 0;
+
+static void
+print_usage(const char *name)
+{
+  fprintf(stderr, "Usage : %s [OPTIONS]\n", name);
+  fprintf(stderr, "\nStream live position fixes from the device\n");
+  fprintf(stderr, "  -h, --help             Provide help\n");
+  fprintf(stderr, "  -v, --verbose          Be more verbose\n");
+  fprintf(stderr, "  -f, --format FORMAT    Output nmea (default) or json "
+                  "lines\n");
+  fprintf(stderr, "  -n, --count N          Stop after N fixes\n");
+  fprintf(stderr, "  -u, --unit ID          Use the device with this unit "
+                  "id\n");
+  fprintf(stderr, "      --replay FILE      Replay a recorded session instead "
+                  "of using a device\n");
+}
+
+static void
+on_interrupt(int sig)
+{
+  (void)sig;
+  interrupted = 1;
+}
+
+static double
+rad2deg(float64 r)
+{
+  return r * 180.0 / M_PI;
+}
+
+/*
+   D800 time is the start of the GPS week (in days since 1989-12-31) plus
+   the time of week, in GPS time rather than UTC.
+*/
+static time_t
+fix_time(const D800 *fix, double *frac)
+{
+  double t = fix->tow - fix->leap_scnds;
+  double s = floor(t);
+
+  *frac = t - s;
+  return TIME_OFFSET + (time_t)fix->wn_days * 86400 + (time_t)s;
+}
+
+static int
+fix_valid(const D800 *fix)
+{
+  return fix->fix >= D800_2D && fix->fix <= D800_3D_diff;
+}
+
+/* Print a NMEA 0183 sentence, adding the checksum. */
+static void
+print_sentence(const char *body)
+{
+  unsigned char sum = 0;
+  const char *  c;
+
+  for (c = body; *c != '\0'; c++)
+    sum ^= (unsigned char)*c;
+
+  printf("$%s*%02X\r\n", body, sum);
+}
+
+static void
+format_coord(char *buf, size_t size, double deg, int digits, char pos,
+             char neg)
+{
+  double a = fabs(deg);
+  int    d = (int)a;
+
+  snprintf(buf, size, "%0*d%07.4f,%c", digits, d, (a - d) * 60.0,
+           deg < 0 ? neg : pos);
+}
+
+static void
+print_nmea(const D800 *fix)
+{
+  char      body[128];
+  char      lat[32];
+  char      lon[32];
+  char      clock[16];
+  char      date[8];
+  struct tm tbuf;
+  double    frac;
+  time_t    t     = fix_time(fix, &frac);
+  double    speed = hypot(fix->east, fix->north);
+  double    track = fmod(rad2deg(atan2(fix->east, fix->north)) + 360.0, 360.0);
+  int       valid = fix_valid(fix);
+  int       quality;
+
+  gmtime_r(&t, &tbuf);
+  snprintf(clock, sizeof(clock), "%02d%02d%05.2f", tbuf.tm_hour, tbuf.tm_min,
+           tbuf.tm_sec + frac);
+  strftime(date, sizeof(date), "%d%m%y", &tbuf);
+  format_coord(lat, sizeof(lat), rad2deg(fix->posn.lat), 2, 'N', 'S');
+  format_coord(lon, sizeof(lon), rad2deg(fix->posn.lon), 3, 'E', 'W');
+
+  snprintf(body, sizeof(body), "GPRMC,%s,%c,%s,%s,%.1f,%.1f,%s,,,%c", clock,
+           valid ? 'A' : 'V', lat, lon, speed * 3600.0 / 1852.0, track, date,
+           valid ? (fix->fix >= D800_2D_diff ? 'D' : 'A') : 'N');
+  print_sentence(body);
+
+  if (!valid)
+    quality = 0;
+  else if (fix->fix >= D800_2D_diff)
+    quality = 2;
+  else
+    quality = 1;
+
+  /* alt is above the ellipsoid, msl_hght is the ellipsoid above MSL. */
+  snprintf(body, sizeof(body), "GPGGA,%s,%s,%s,%d,,,%.1f,M,%.1f,M,,", clock,
+           lat, lon, quality, fix->alt + fix->msl_hght, -fix->msl_hght);
+  print_sentence(body);
+}
+
+static void
+print_json(const D800 *fix)
+{
+  static const char *fixes[] = {"unusable", "invalid", "2D",
+                                "3D",       "2D_diff", "3D_diff"};
+  static garmin_time_cache stamp;
+  double                   frac;
+  time_t                   t = fix_time(fix, &frac);
+
+  printf("{\"time\":\"%s.%03dZ\",\"fix\":\"%s\"",
+         garmin_format_time(&stamp, t, GARMIN_TIME_UTC_BARE),
+         (int)(frac * 1000.0),
+         (fix->fix >= 0 && fix->fix <= D800_3D_diff) ? fixes[fix->fix]
+                                                     : "unknown");
+  if (fix_valid(fix)) {
+    printf(",\"lat\":%.7f,\"lon\":%.7f,\"alt\":%.2f", rad2deg(fix->posn.lat),
+           rad2deg(fix->posn.lon), fix->alt + fix->msl_hght);
+    printf(",\"epe\":%.2f,\"eph\":%.2f,\"epv\":%.2f", fix->epe, fix->eph,
+           fix->epv);
+    printf(",\"east\":%.3f,\"north\":%.3f,\"up\":%.3f", fix->east, fix->north,
+           fix->up);
+  }
+  printf("}\n");
+}
+
+int
+garmin_live(int argc, char **argv)
+{
+  garmin_unit        garmin;
+  garmin_pvt_stream *stream;
+  D800               fix;
+  live_format        format = LIVE_NMEA;
+  const char *       replay = NULL;
+  long               count  = 0;
+  long               seen   = 0;
+  uint32             dropped;
+  int                r = 0;
+
+  static struct option options[] = {{"help", no_argument, 0, 'h'},
+                                    {"verbose", no_argument, &verbose, 1},
+                                    {"format", required_argument, 0, 'f'},
+                                    {"count", required_argument, 0, 'n'},
+                                    {"unit", required_argument, 0, 'u'},
+                                    {"replay", required_argument, 0, 'R'},
+                                    {0, 0, 0, 0}};
+
+  memset(&garmin, 0, sizeof(garmin));
+
+  while (true) {
+    int c = getopt_long(argc, argv, "hvf:n:u:", options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 0:
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 'f':
+      if (strcmp(optarg, "nmea") == 0) {
+        format = LIVE_NMEA;
+      } else if (strcmp(optarg, "json") == 0) {
+        format = LIVE_JSON;
+      } else {
+        fprintf(stderr, "unknown format '%s', expected nmea or json\n",
+                optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'n':
+      count = strtol(optarg, NULL, 10);
+      break;
+    case 'u':
+      garmin.usb.unit_id = strtoul(optarg, NULL, 0);
+      break;
+    case 'R':
+      replay = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+  }
+
+  if (argc > 1 && strcmp(argv[1], "help") == 0) {
+    print_usage(argv[0]);
+    exit(EXIT_SUCCESS);
+  }
+
+  garmin.verbose = verbose;
+  if ((replay != NULL && garmin_replay(&garmin, replay) == 0) ||
+      garmin_connect(&garmin) == 0) {
+    fprintf(stderr, "garmin unit could not be opened!\n");
+    garmin_shutdown(&garmin);
+    return EXIT_FAILURE;
+  }
+
+  if ((stream = garmin_pvt_start(&garmin, 0)) == NULL) {
+    garmin_close(&garmin);
+    garmin_shutdown(&garmin);
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, on_interrupt);
+  signal(SIGTERM, on_interrupt);
+
+  /* Print each fix as soon as it arrives; a dashboard reads line by line. */
+  while (!interrupted && (count == 0 || seen < count)) {
+    r = garmin_pvt_wait(stream, &fix, LIVE_POLL_INTERVAL);
+    if (r < 0)
+      break;
+    if (r == 0)
+      continue;
+
+    if (format == LIVE_JSON)
+      print_json(&fix);
+    else
+      print_nmea(&fix);
+    fflush(stdout);
+    seen++;
+  }
+
+  dropped = garmin_pvt_dropped(stream);
+  garmin_pvt_stop(stream);
+  garmin_close(&garmin);
+  garmin_shutdown(&garmin);
+
+  if (dropped != 0 && verbose) {
+    fprintf(stderr, "%u fixes dropped\n", dropped);
+  }
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  return (r < 0 && seen == 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
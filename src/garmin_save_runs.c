@@ -22,32 +22,138 @@
 #include "garmin.h"
 
 #include <getopt.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
-static int verbose = 0;
+static int verbose  = 0;
+static int full     = 0;
+static int compress = 0;
 
 static void
 print_usage(const char *name)
 {
   fprintf(stderr, "Usage : %s [OPTIONS]\n", name);
   fprintf(stderr, "\nDownload excercise information from the device\n");
-  fprintf(stderr, "  -h, --help    Provide help\n");
-  fprintf(stderr, "  -v, --verbose Be more verbose\n");
+  fprintf(stderr, "  -h, --help             Provide help\n");
+  fprintf(stderr, "  -v, --verbose          Be more verbose\n");
+  fprintf(stderr, "  -a, --all              Download from every attached "
+                  "device in parallel\n");
+  fprintf(stderr, "  -d, --device BUS:ADDR  Use the device at this USB "
+                  "bus and address\n");
+  fprintf(stderr, "  -u, --unit ID          Use the device with this unit "
+                  "id\n");
+  fprintf(stderr, "      --full             Download every run, not just the "
+                  "new ones\n");
+  fprintf(stderr, "      --compress         Save track points compressed\n");
+  fprintf(stderr, "      --capture FILE     Record the USB session to FILE\n");
+  fprintf(stderr, "      --replay FILE      Replay a recorded session instead "
+                  "of using a device\n");
+}
+
+static int
+download_unit(garmin_unit *garmin)
+{
+  if (garmin_connect(garmin) == 0) {
+    printf("garmin unit could not be opened!\n");
+    garmin_shutdown(garmin);
+    return 0;
+  }
+
+  /* Read and save the runs. */
+  if (full) {
+    garmin_save_all_runs(garmin);
+  } else {
+    garmin_save_runs(garmin);
+  }
+
+  garmin_close(garmin);
+  garmin_shutdown(garmin);
+
+  return 1;
+}
+
+static void *
+download_thread(void *arg)
+{
+  garmin_unit *garmin = arg;
+
+  return download_unit(garmin) ? garmin : NULL;
+}
+
+/* Run one session per attached device, each on its own thread. */
+static int
+download_all(void)
+{
+  garmin_device devices[GARMIN_MAX_DEVICES];
+  garmin_unit   units[GARMIN_MAX_DEVICES];
+  pthread_t     threads[GARMIN_MAX_DEVICES];
+  int           started[GARMIN_MAX_DEVICES] = {0};
+  int           ok = 1;
+  int           n;
+  int           i;
+
+  n = garmin_enumerate(devices, GARMIN_MAX_DEVICES);
+  if (n == 0) {
+    printf("no garmin units found!\n");
+    return 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    memset(&units[i], 0, sizeof(units[i]));
+    units[i].verbose  = verbose;
+    units[i].compress = compress;
+    units[i].usb.bus     = devices[i].bus;
+    units[i].usb.address = devices[i].address;
+    if (pthread_create(&threads[i], NULL, download_thread, &units[i]) != 0) {
+      fprintf(stderr, "failed to start a session on bus %d, address %d\n",
+              devices[i].bus, devices[i].address);
+      ok = 0;
+    } else {
+      started[i] = 1;
+    }
+  }
+
+  for (i = 0; i < n; i++) {
+    void *result = NULL;
+
+    if (started[i]) {
+      pthread_join(threads[i], &result);
+      if (result == NULL)
+        ok = 0;
+    }
+  }
+
+  return ok;
 }
 
 int
 garmin_download(int argc, char **argv)
 {
   garmin_unit garmin;
+  const char *capture = NULL;
+  const char *replay  = NULL;
+  int         all     = 0;
+  int         ok;
+  unsigned    bus;
+  unsigned    address;
 
   static struct option options[] = {{"help", no_argument, 0, 'h'},
                                     {"verbose", no_argument, &verbose, 1},
+                                    {"all", no_argument, 0, 'a'},
+                                    {"device", required_argument, 0, 'd'},
+                                    {"unit", required_argument, 0, 'u'},
+                                    {"full", no_argument, &full, 1},
+                                    {"compress", no_argument, &compress, 1},
+                                    {"capture", required_argument, 0, 'C'},
+                                    {"replay", required_argument, 0, 'R'},
                                     {0, 0, 0, 0}};
 
+  memset(&garmin, 0, sizeof(garmin));
+
   while (true) {
     int option_index = -1;
-    int c            = getopt_long(argc, argv, "hv", options, &option_index);
+    int c = getopt_long(argc, argv, "hvad:u:", options, &option_index);
     if (c == -1)
       break;
 
@@ -60,6 +166,27 @@ garmin_download(int argc, char **argv)
     case 'v':
       verbose = 1;
       break;
+    case 'a':
+      all = 1;
+      break;
+    case 'd':
+      if (sscanf(optarg, "%u:%u", &bus, &address) != 2 || bus == 0 ||
+          bus > 255 || address == 0 || address > 255) {
+        fprintf(stderr, "invalid device '%s', expected BUS:ADDR\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      garmin.usb.bus     = bus;
+      garmin.usb.address = address;
+      break;
+    case 'u':
+      garmin.usb.unit_id = strtoul(optarg, NULL, 0);
+      break;
+    case 'C':
+      capture = optarg;
+      break;
+    case 'R':
+      replay = optarg;
+      break;
     default:
       print_usage(argv[0]);
       exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
@@ -71,15 +198,20 @@ garmin_download(int argc, char **argv)
     exit(EXIT_SUCCESS);
   }
 
-  if ( garmin_init(&garmin,verbose) != 0 ) {
-    /* Read and save the runs. */
-    garmin_save_runs(&garmin);
+  if (all && (capture != NULL || replay != NULL)) {
+    fprintf(stderr, "--all cannot be combined with --capture or --replay\n");
+    exit(EXIT_FAILURE);
+  }
 
-    garmin_close (&garmin);
-    garmin_shutdown (&garmin);
+  if (all) {
+    ok = download_all();
   } else {
-    printf("garmin unit could not be opened!\n");
+    garmin.verbose  = verbose;
+    garmin.compress = compress;
+    ok = (replay == NULL || garmin_replay(&garmin, replay) != 0) &&
+         (capture == NULL || garmin_capture(&garmin, capture) != 0) &&
+         download_unit(&garmin);
   }
 
-  return 0;
+  return ok ? 0 : 1;
 }
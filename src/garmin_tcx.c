@@ -30,49 +30,20 @@
 #include <time.h>
 #include <unistd.h>
 
+/* For example 2007-04-20T23:55:01+00:00 (see garmin_format_time). */
+
 static void
-print_dtime ( uint32 t, FILE * fp )
+print_dtime ( uint32 t, garmin_writer * out )
 {
-  time_t     tval;
-  struct tm  tmval;
-  char       buf[128] = { 0 };
-  int        len;
-
-  /*
-                                  012345678901234567890123
-     This will make, for example, 2007-04-20T23:55:01-0700, but that date
-     isn't quite ISO 8601 compliant.  We need to stick a ':' in the time
-     zone between the hours and the minutes.
-  */
-
-  tval = t + TIME_OFFSET;
-  gmtime_r(&tval,&tmval);
-  strftime(buf,sizeof(buf)-1,"%FT%T%z",&tmval);
-
-  /*
-     If the last character is a 'Z', don't do anything.  Otherwise, we
-     need to move the last two characters out one and stick a colon in
-     the vacated spot.  Let's not forget the trailing '\0' that needs to
-     be moved as well.
-  */
-
-  len = strlen(buf);
-  if ( len > 0 && buf[len-1] != 'Z' ) {
-    memmove(buf+len-1,buf+len-2,3);
-    buf[len-2] = ':';
-  }
-
-  /* OK.  Done. */
-
-  fprintf(fp,"%s", buf);
+  garmin_write_time(out,t + TIME_OFFSET,GARMIN_TIME_UTC);
 }
 
 
 static void
-print_tcx_header(FILE *fp)
+print_tcx_header(garmin_writer *out)
 {
-    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-    fprintf(fp, "<TrainingCenterDatabase xmlns:xs=\"http://www.w3.org/2001/XMLSchema\"\n"
+    garmin_write_lit(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    garmin_write_lit(out, "<TrainingCenterDatabase xmlns:xs=\"http://www.w3.org/2001/XMLSchema\"\n"
     "xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\"\n"
     "xmlns=\"http://www.garmin.com/xmlschemas/TrainingCenterDatabase/v2\">\n");
 }
@@ -88,76 +59,178 @@ static const char* get_trigger(uint8 trigger_method) {
     }
 };
 
-static void
-print_lap(FILE *fn, garmin_data *lap_data, uint32_t end, garmin_list *points)
+/* The fields of a lap that go into the TCX file, whichever type it was. */
+
+typedef struct {
+    uint32 start_time;
+    uint32 total_time;
+    float32 total_dist;
+    float32 max_speed;
+    uint16 calories;
+    uint8 avg_heart_rate;
+    uint8 max_heart_rate;
+    uint8 intensity;
+    uint8 trigger_method;
+    uint32 order;  /* position in the lap list, to keep the sort stable */
+} tcx_lap;
+
+#define GET_LAP(lap, x)                           \
+    do {                                          \
+        lap->start_time = x->start_time;          \
+        lap->total_time = x->total_time;          \
+        lap->total_dist = x->total_dist;          \
+        lap->max_speed = x->max_speed;            \
+        lap->calories = x->calories;              \
+        lap->avg_heart_rate = x->avg_heart_rate;  \
+        lap->max_heart_rate = x->max_heart_rate;  \
+        lap->intensity = x->intensity;            \
+    } while (0)
+
+static bool
+get_lap(garmin_data *lap_data, tcx_lap *lap)
 {
-    if (lap_data->type != data_D1015) {
+    switch (lap_data->type) {
+    case data_D1001: {
+        D1001 *d1001 = lap_data->data;
+        GET_LAP(lap, d1001);
+        lap->trigger_method = D1011_manual;
+        return true;
+    }
+    case data_D1011: {
+        D1011 *d1011 = lap_data->data;
+        GET_LAP(lap, d1011);
+        lap->trigger_method = d1011->trigger_method;
+        return true;
+    }
+    case data_D1015: {
+        D1015 *d1015 = lap_data->data;
+        GET_LAP(lap, d1015);
+        lap->trigger_method = d1015->trigger_method;
+        return true;
+    }
+    default:
         fprintf(stderr, "Unsupported lap type %d\n", lap_data->type);
+        return false;
     }
+}
+
+#undef GET_LAP
 
-    D1015 *lap = lap_data->data;
-    fprintf(fn, "      <Lap StartTime=\"");
-    print_dtime(lap->start_time, fn);
-    fprintf(fn, "\">\n");
-    fprintf(fn, "        <TotalTimeSeconds>%.2f</TotalTimeSeconds>\n", lap->total_time / 100.0);
-    fprintf(fn, "        <DistanceMeters>%.2f</DistanceMeters>\n", lap->total_dist);
-    fprintf(fn, "        <MaximumSpeed>%.8f</MaximumSpeed>\n", lap->max_speed);
-    fprintf(fn, "        <Calories>%d</Calories>\n", lap->calories);
+static int
+compare_laps(const void *a, const void *b)
+{
+    const tcx_lap *x = a;
+    const tcx_lap *y = b;
+
+    if (x->start_time != y->start_time) {
+        return (x->start_time < y->start_time) ? -1 : 1;
+    }
+
+    return (x->order < y->order) ? -1 : (x->order > y->order);
+}
+
+/*
+ * Print a lap with the track points from its start up to 'end', starting
+ * at point '*next'.  Every point before '*next' is earlier than the lap,
+ * so the laps together make one pass over the track; on return '*next' is
+ * the first point at or after 'end', which the next lap starts from.
+ */
+static void
+print_lap(garmin_writer *out, tcx_lap *lap, uint32_t end, garmin_track *track, uint32 *next)
+{
+    garmin_write_lit(out, "      <Lap StartTime=\"");
+    print_dtime(lap->start_time, out);
+    garmin_write_lit(out, "\">\n");
+    garmin_write_lit(out, "        <TotalTimeSeconds>");
+    garmin_write_fixed(out, lap->total_time / 100.0, 2);
+    garmin_write_lit(out, "</TotalTimeSeconds>\n");
+    garmin_write_lit(out, "        <DistanceMeters>");
+    garmin_write_fixed(out, lap->total_dist, 2);
+    garmin_write_lit(out, "</DistanceMeters>\n");
+    garmin_write_lit(out, "        <MaximumSpeed>");
+    garmin_write_fixed(out, lap->max_speed, 8);
+    garmin_write_lit(out, "</MaximumSpeed>\n");
+    garmin_write_lit(out, "        <Calories>");
+    garmin_write_int(out, lap->calories);
+    garmin_write_lit(out, "</Calories>\n");
     if (lap->avg_heart_rate > 0) {
-        fprintf(fn, "        <AverageHeartRateBpm>\n"
-                    "          <Value>%d</Value>\n"
-                    "        </AverageHeartRateBpm>\n", lap->avg_heart_rate);
+        garmin_write_lit(out, "        <AverageHeartRateBpm>\n"
+                              "          <Value>");
+        garmin_write_int(out, lap->avg_heart_rate);
+        garmin_write_lit(out, "</Value>\n"
+                              "        </AverageHeartRateBpm>\n");
     }
     if (lap->max_heart_rate > 0) {
-        fprintf(fn, "        <MaximumHeartRateBpm>\n"
-                    "          <Value>%d</Value>\n"
-                    "        </MaximumHeartRateBpm>\n", lap->max_heart_rate);
+        garmin_write_lit(out, "        <MaximumHeartRateBpm>\n"
+                              "          <Value>");
+        garmin_write_int(out, lap->max_heart_rate);
+        garmin_write_lit(out, "</Value>\n"
+                              "        </MaximumHeartRateBpm>\n");
     }
-    fprintf(fn, "        <Intensity>%s</Intensity>\n", lap->intensity == 0 ? "Active" : "Rest");
-    fprintf(fn, "        <TriggerMethod>%s</TriggerMethod>\n", get_trigger(lap->trigger_method));
-    if (points != NULL) {
-        fprintf(fn, "        <Track>\n");
-        garmin_data *point;
-        for (garmin_list_node *it = points->head; it != NULL; it = it->next) {
-            point = it->data;
-            if (point->type != data_D304) {
-                continue;
-            }
-            D304 *d304 = point->data;
-            if (d304->time < lap->start_time) {
+    garmin_write_lit(out, "        <Intensity>");
+    garmin_write_str(out, lap->intensity == 0 ? "Active" : "Rest");
+    garmin_write_lit(out, "</Intensity>\n");
+    garmin_write_lit(out, "        <TriggerMethod>");
+    garmin_write_str(out, get_trigger(lap->trigger_method));
+    garmin_write_lit(out, "</TriggerMethod>\n");
+    if (track != NULL) {
+        garmin_write_lit(out, "        <Track>\n");
+        uint32 n;
+        for (n = *next; n < track->count; n++) {
+            if (track->time[n] < lap->start_time) {
                 continue;
             }
 
-            if (d304->time >= end) {
+            if (track->time[n] >= end) {
                 break;
             }
-            fprintf(fn, "          <Trackpoint>\n");
-            fprintf(fn, "              <Time>");
-            print_dtime (d304->time, fn);
-            fprintf(fn, "</Time>\n");
-            if (! (d304->posn.lat == INT32_MAX && d304->posn.lon == INT32_MAX)) {
-                fprintf(fn, "               <Position>\n");
-                fprintf(fn, "                   <LatitudeDegrees>%.8f</LatitudeDegrees>\n", SEMI2DEG (d304->posn.lat));
-                fprintf(fn, "                   <LongitudeDegrees>%.8f</LongitudeDegrees>\n", SEMI2DEG (d304->posn.lon));
-                fprintf(fn, "               </Position>\n");
-                fprintf(fn, "               <AltitudeMeters>%.7f</AltitudeMeters>\n", d304->alt);
-                fprintf(fn, "               <DistanceMeters>%.4f</DistanceMeters>\n", d304->distance);
-                fprintf(fn, "               <HeartRateBpm>\n");
-                fprintf(fn, "                   <Value>%u</Value>\n", d304->heart_rate);
-                fprintf(fn, "               </HeartRateBpm>\n");
-                if (d304->cadence != 0xff) {
-                    fprintf(fn, "               <Cadence>%u</Cadence>\n", d304->cadence);
+            garmin_write_lit(out, "          <Trackpoint>\n");
+            garmin_write_lit(out, "              <Time>");
+            print_dtime (track->time[n], out);
+            garmin_write_lit(out, "</Time>\n");
+            if (GARMIN_TRACK_VALID (track, n)) {
+                garmin_write_lit(out, "               <Position>\n");
+                garmin_write_lit(out, "                   <LatitudeDegrees>");
+                garmin_write_fixed(out, SEMI2DEG (track->lat[n]), 8);
+                garmin_write_lit(out, "</LatitudeDegrees>\n");
+                garmin_write_lit(out, "                   <LongitudeDegrees>");
+                garmin_write_fixed(out, SEMI2DEG (track->lon[n]), 8);
+                garmin_write_lit(out, "</LongitudeDegrees>\n");
+                garmin_write_lit(out, "               </Position>\n");
+                // Points without these fields (D300-D303) have 1.0e25 and 0.
+                if (track->alt[n] < 1.0e24) {
+                    garmin_write_lit(out, "               <AltitudeMeters>");
+                    garmin_write_fixed(out, track->alt[n], 7);
+                    garmin_write_lit(out, "</AltitudeMeters>\n");
+                }
+                if (track->distance[n] < 1.0e24) {
+                    garmin_write_lit(out, "               <DistanceMeters>");
+                    garmin_write_fixed(out, track->distance[n], 4);
+                    garmin_write_lit(out, "</DistanceMeters>\n");
+                }
+                if (track->heart_rate[n] != 0) {
+                    garmin_write_lit(out, "               <HeartRateBpm>\n");
+                    garmin_write_lit(out, "                   <Value>");
+                    garmin_write_uint(out, track->heart_rate[n]);
+                    garmin_write_lit(out, "</Value>\n");
+                    garmin_write_lit(out, "               </HeartRateBpm>\n");
+                }
+                if (track->cadence[n] != 0xff) {
+                    garmin_write_lit(out, "               <Cadence>");
+                    garmin_write_uint(out, track->cadence[n]);
+                    garmin_write_lit(out, "</Cadence>\n");
                 }
             }
-            fprintf(fn, "          </Trackpoint>\n");
+            garmin_write_lit(out, "          </Trackpoint>\n");
         }
-        fprintf(fn, "        </Track>\n");
+        *next = n;
+        garmin_write_lit(out, "        </Track>\n");
     }
-    fprintf(fn, "      </Lap>\n");
+    garmin_write_lit(out, "      </Lap>\n");
 }
 
 static void
-print_tcx_data(garmin_data *data, char *device_information, FILE *fn)
+print_tcx_data(garmin_data *data, char *device_information, garmin_writer *out)
 {
   {
     if (data->type != data_Dlist) {
@@ -171,11 +244,12 @@ print_tcx_data(garmin_data *data, char *device_information, FILE *fn)
           return;
       }
 
-      print_tcx_header(fn);
-      fprintf(fn, "  <Activities>\n");
+      print_tcx_header(out);
+      garmin_write_lit(out, "  <Activities>\n");
       D1009 *d1009 = d->data;
-      fprintf(fn, "    <Activity Sport=\"%s\">\n",
-              d1009->sport_type == D1000_running ? "Running" : (d1009->sport_type == D1000_biking ? "Biking" : "Other"));
+      garmin_write_lit(out, "    <Activity Sport=\"");
+      garmin_write_str(out, d1009->sport_type == D1000_running ? "Running" : (d1009->sport_type == D1000_biking ? "Biking" : "Other"));
+      garmin_write_lit(out, "\">\n");
 
       d = garmin_list_data(data, 1);
       if (d == NULL || d->type != data_Dlist) {
@@ -186,34 +260,51 @@ print_tcx_data(garmin_data *data, char *device_information, FILE *fn)
       garmin_list *laps = d->data;
 
       d = garmin_list_data(data, 2);
-      garmin_list *points = NULL;
+      garmin_track *track = NULL;
 
       if (d != NULL && d->type == data_Dlist) {
-          points = d->data;
+          track = garmin_track_new(d);
       }
 
-      for (garmin_list_node *lap_node = laps->head; lap_node != NULL; lap_node = lap_node->next) {
+      // Each lap ends where the next one we can print starts.
+      tcx_lap *lap = calloc(laps->elements + 1, sizeof(tcx_lap));
+      uint32 count = 0;
+      if (lap != NULL) {
+          for (garmin_list_node *lap_node = laps->head; lap_node != NULL; lap_node = lap_node->next) {
+              if (get_lap(lap_node->data, &lap[count])) {
+                  lap[count].order = count;
+                  count++;
+              }
+          }
+          // print_lap makes one pass over the track, so take the laps in time order.
+          qsort(lap, count, sizeof(tcx_lap), compare_laps);
+      }
+
+      uint32 next = 0;
+      for (uint32 i = 0; i < count; i++) {
           // We need the start time of the first lap as the ID of the activity
-          if (lap_node == laps->head &&
-              lap_node->data->type == data_D1015) {
-              D1015 *lap = lap_node->data->data;
-              fprintf(fn, "      <Id>");
-              print_dtime(lap->start_time, fn);
-              fprintf(fn, "</Id>\n");
+          if (i == 0) {
+              garmin_write_lit(out, "      <Id>");
+              print_dtime(lap[i].start_time, out);
+              garmin_write_lit(out, "</Id>\n");
           }
-         uint32_t end_time = UINT32_MAX;
-          if (lap_node->next != NULL) {
-              end_time = ((D1015 *)lap_node->next->data->data)->start_time;
+          uint32_t end_time = UINT32_MAX;
+          if (i + 1 < count) {
+              end_time = lap[i + 1].start_time;
           }
-          print_lap(fn, lap_node->data, end_time, points);
+          print_lap(out, &lap[i], end_time, track, &next);
       }
+      free(lap);
+      garmin_track_free(track);
 
-      fprintf(fn, "    </Activity>\n");
-      fprintf(fn, "  </Activities>\n");
+      garmin_write_lit(out, "    </Activity>\n");
+      garmin_write_lit(out, "  </Activities>\n");
       if (device_information != NULL) {
-          fprintf(fn, "  %s\n", device_information);
+          garmin_write_lit(out, "  ");
+          garmin_write_str(out, device_information);
+          garmin_write_char(out, '\n');
       }
-      fprintf(fn, "</TrainingCenterDatabase>\n");
+      garmin_write_lit(out, "</TrainingCenterDatabase>\n");
   }
 }
 
@@ -252,12 +343,30 @@ print_usage(const char *name)
           "uploading to other devices or services\n");
 }
 
+/* Convert one file.  Returns 1, or 0 if it couldn't be loaded. */
 int
-garmin_tcx(int argc, char *argv[], const char *output_file, bool verbose)
+garmin_tcx_file(const char *file, garmin_writer *out)
+{
+  garmin_arena *arena = garmin_arena_new();
+  garmin_data * data;
+  int           ok = 0;
+
+  if ((data = garmin_load_arena(file, arena)) != NULL) {
+    char *device_info = read_device_file(file);
+    print_tcx_data(data, device_info, out);
+    free(device_info);
+    ok = 1;
+  }
+  garmin_arena_free(arena);
+
+  return ok;
+}
+
+int
+garmin_tcx(int argc, char *argv[], bool verbose)
 {
   char *old_lc_numeric = setlocale(LC_NUMERIC, NULL);
   setlocale(LC_NUMERIC, "C");
-  garmin_data *data;
 
   if (argc < 2) {
     print_usage("garmintool convert -f tcx");
@@ -269,16 +378,17 @@ garmin_tcx(int argc, char *argv[], const char *output_file, bool verbose)
     exit(EXIT_SUCCESS);
   }
 
-  for (int i = 1; i < argc; i++) {
-    if ((data = garmin_load(argv[i])) != NULL) {
-      char *device_info = read_device_file(argv[i]);
-      print_tcx_data(data, device_info, stdout);
-      free(device_info);
+  garmin_writer *out = garmin_writer_open(stdout);
+  if (out == NULL) {
+    fprintf(stderr, "garmin_tcx: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
 
-      garmin_free_data(data);
-    }
+  for (int i = 1; i < argc; i++) {
+    garmin_tcx_file(argv[i], out);
+    garmin_writer_flush(out);
   }
   setlocale(LC_NUMERIC, old_lc_numeric);
 
-  return 0;
+  return garmin_writer_close(out) ? 0 : 1;
 }
@@ -61,6 +61,8 @@ extern int
 garmin_download(int argc, char *argv[]);
 extern int
 garmin_convert(int argc, char *argv[]);
+extern int
+garmin_live(int argc, char *argv[]);
 
 // Internal command prototypes
 static int
@@ -94,6 +96,7 @@ static garmin_command_dispatch_t commands[] = {
    N_("Convert binary excercise dumps to various output formats")},
   {"dump", garmin_dump, N_("Dump gmn files to human-readable pseudo-XML")},
   {"info", garmin_info, N_("Dump information from the connected device")},
+  {"live", garmin_live, N_("Stream live position fixes as NMEA or JSON")},
   {NULL, NULL, NULL}};
 
 static int
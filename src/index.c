@@ -0,0 +1,371 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+
+
+/*
+   The index at the end of a version 2 file (the layout is in garmin.h)
+   says where the run, the lap list and the track list of a run file are,
+   and has the time of every GARMIN_INDEX_STRIDEth track point along with
+   where that point is.  With it, a reader can go straight to the laps, or
+   find the track point at a given time by a binary search over the
+   samples and a short scan, instead of unpacking the file from the start.
+
+   The index is built from the packed file, so it doesn't matter how the
+   data was put together.  Files without one (version 1) still load; they
+   just can't be searched.  Neither can a compressed track (see points.c),
+   which has no samples, since its points can't be read one at a time.
+*/
+
+#define INDEX_HEAD     (8 + 12 * GARMIN_INDEX_PARTS + 4)
+#define INDEX_SAMPLE   12
+#define ELEMENT_HEADER 12
+
+
+typedef struct index_builder {
+  const uint8 *      file;
+  garmin_index_part  part[GARMIN_INDEX_PARTS];
+  uint8 *            samples;
+  uint32             count;
+  uint32             capacity;
+} index_builder;
+
+
+static int
+index_is_run ( uint32 type )
+{
+  return type == data_D1000 || type == data_D1009 || type == data_D1010;
+}
+
+
+static int
+index_is_lap ( uint32 type )
+{
+  return type == data_D906  || type == data_D1001 ||
+         type == data_D1011 || type == data_D1015;
+}
+
+
+static int
+index_is_point ( uint32 type )
+{
+  return type >= data_D300 && type <= data_D304;
+}
+
+
+static void
+index_set_part ( index_builder * b,
+                 garmin_part     which,
+                 uint32          type,
+                 const uint8 *   pos,
+                 uint32          size )
+{
+  if ( b->part[which].type == 0 ) {
+    b->part[which].type   = type;
+    b->part[which].offset = pos - b->file;
+    b->part[which].size   = size;
+  }
+}
+
+
+static int
+index_add_sample ( index_builder * b,
+                   uint32          time,
+                   uint32          left,
+                   const uint8 *   element )
+{
+  uint8 * p;
+
+  if ( b->count == b->capacity ) {
+    b->capacity = ( b->capacity > 0 ) ? b->capacity * 2 : 256;
+    if ( (p = realloc(b->samples,b->capacity * INDEX_SAMPLE)) == NULL ) {
+      return 0;
+    }
+    b->samples = p;
+  }
+
+  p = b->samples + b->count * INDEX_SAMPLE;
+  put_uint32(p,time);
+  put_uint32(p+4,left);
+  put_uint32(p+8,element - b->file);
+  b->count++;
+
+  return 1;
+}
+
+
+/*
+   Look through a packed list for the parts of a run file.  The first list
+   of laps and the first list with track points in it are the ones that
+   count; only the latter is sampled.
+*/
+
+static int
+index_scan_list ( index_builder * b, const uint8 * pos, uint32 size )
+{
+  const uint8 * end = pos + size;
+  const uint8 * list = pos;
+  uint32        elements;
+  uint32        type;
+  uint32        esize;
+  uint32        i;
+  uint32        points = 0;
+  int           sample;
+
+  if ( size < 8 ) return 0;
+  elements = get_uint32(pos + 4);
+  pos += 8;
+
+  sample = ( b->part[GARMIN_PART_TRACK].type == 0 );
+
+  for ( i = 0; i < elements; i++ ) {
+    if ( end - pos < ELEMENT_HEADER ) return 0;
+    type  = get_uint32(pos + 4);
+    esize = get_uint32(pos + 8);
+    if ( esize > (uint32)(end - pos - ELEMENT_HEADER) ) return 0;
+
+    if ( type == data_Dlist ) {
+      if ( index_scan_list(b,pos + ELEMENT_HEADER,esize) == 0 ) return 0;
+    } else if ( type == GARMIN_POINTS_TYPE ) {
+      index_set_part(b,GARMIN_PART_TRACK,type,pos + ELEMENT_HEADER,esize);
+    } else if ( index_is_run(type) ) {
+      index_set_part(b,GARMIN_PART_RUN,type,pos + ELEMENT_HEADER,esize);
+    } else if ( index_is_lap(type) ) {
+      index_set_part(b,GARMIN_PART_LAPS,data_Dlist,list,size);
+    } else if ( index_is_point(type) && sample && esize >= 12 ) {
+      index_set_part(b,GARMIN_PART_TRACK,data_Dlist,list,size);
+      if ( points++ % GARMIN_INDEX_STRIDE == 0 &&
+           index_add_sample(b,get_uint32(pos + ELEMENT_HEADER + 8),
+                            elements - i,pos) == 0 ) {
+        return 0;
+      }
+    }
+
+    pos += ELEMENT_HEADER + esize;
+  }
+
+  return 1;
+}
+
+
+/*
+   Build the index chunk for the packed file in 'buf' (its 'len' bytes are
+   the whole file so far).  Returns the chunk, to be written after the
+   file, and its size; or NULL if the file couldn't be indexed.
+*/
+
+uint8 *
+garmin_index_build ( const uint8 * buf, uint32 len, uint32 * size )
+{
+  index_builder  b;
+  const uint8 *  pos;
+  uint8 *        chunk = NULL;
+  uint8 *        p;
+  uint32         payload;
+  uint32         csize;
+  int            ok = 1;
+  int            i;
+
+  memset(&b,0,sizeof(b));
+  b.file = buf;
+
+  for ( pos = buf; ok && pos < buf + len; pos += GARMIN_HEADER + 8 + csize ) {
+    if ( buf + len - pos < GARMIN_HEADER + 8 ) {
+      ok = 0;
+      break;
+    }
+    csize = get_uint32(pos + GARMIN_HEADER + 4);
+    if ( csize > (uint32)(buf + len - pos - GARMIN_HEADER - 8) ) {
+      ok = 0;
+    } else if ( get_uint32(pos + GARMIN_HEADER) == data_Dlist ) {
+      ok = index_scan_list(&b,pos + GARMIN_HEADER + 8,csize);
+    }
+  }
+
+  payload = INDEX_HEAD + b.count * INDEX_SAMPLE + GARMIN_INDEX_TRAILER;
+  *size   = GARMIN_HEADER + 8 + payload;
+
+  if ( ok && (chunk = calloc(*size,1)) != NULL ) {
+    p = chunk;
+    strncpy((char *)p,GARMIN_MAGIC,11);
+    put_uint32(p+12,GARMIN_VERSION);
+    put_uint32(p+16,*size - GARMIN_HEADER);
+    put_uint32(p+20,GARMIN_INDEX_TYPE);
+    put_uint32(p+24,payload);
+    p += GARMIN_HEADER + 8;
+
+    put_uint32(p,GARMIN_INDEX_STRIDE);
+    put_uint32(p+4,GARMIN_INDEX_PARTS);
+    p += 8;
+    for ( i = 0; i < GARMIN_INDEX_PARTS; i++, p += 12 ) {
+      put_uint32(p,b.part[i].type);
+      put_uint32(p+4,b.part[i].offset);
+      put_uint32(p+8,b.part[i].size);
+    }
+    put_uint32(p,b.count);
+    p += 4;
+    if ( b.count > 0 ) memcpy(p,b.samples,b.count * INDEX_SAMPLE);
+    p += b.count * INDEX_SAMPLE;
+
+    put_uint32(p,len);
+    memcpy(p+4,GARMIN_INDEX_MAGIC,4);
+  }
+
+  free(b.samples);
+
+  return chunk;
+}
+
+
+/* Read exactly 'size' bytes at 'offset'. */
+
+static int
+index_pread ( int fd, void * buf, uint32 size, uint32 offset )
+{
+  return pread(fd,buf,size,offset) == (ssize_t)size;
+}
+
+
+/*
+   Read the index of an open .gmn file.  Returns 1 if it has one, and 0
+   if it doesn't (a version 1 file) or the index doesn't make sense.
+*/
+
+int
+garmin_index_read ( int fd, garmin_index * idx )
+{
+  uint8        trailer[GARMIN_INDEX_TRAILER];
+  uint8        head[GARMIN_HEADER + 8 + INDEX_HEAD];
+  uint8 *      p;
+  struct stat  sb;
+  uint32       length;
+  uint32       payload;
+  int          i;
+
+  memset(idx,0,sizeof(garmin_index));
+
+  if ( fstat(fd,&sb) == -1 || sb.st_size < (off_t)sizeof(head) ||
+       sb.st_size > 0xffffffffL ) {
+    return 0;
+  }
+  length = sb.st_size;
+
+  if ( index_pread(fd,trailer,sizeof(trailer),length - sizeof(trailer)) == 0 ||
+       memcmp(trailer + 4,GARMIN_INDEX_MAGIC,4) != 0 ) {
+    return 0;
+  }
+
+  idx->offset = get_uint32(trailer);
+  if ( idx->offset > length - sizeof(head) ||
+       index_pread(fd,head,sizeof(head),idx->offset) == 0 ||
+       memcmp(head,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) != 0 ||
+       get_uint32(head + GARMIN_HEADER) != GARMIN_INDEX_TYPE ) {
+    return 0;
+  }
+
+  payload = get_uint32(head + GARMIN_HEADER + 4);
+  p = head + GARMIN_HEADER + 8;
+  idx->stride = get_uint32(p);
+  if ( get_uint32(p+4) != GARMIN_INDEX_PARTS ) return 0;
+  p += 8;
+  for ( i = 0; i < GARMIN_INDEX_PARTS; i++, p += 12 ) {
+    idx->part[i].type   = get_uint32(p);
+    idx->part[i].offset = get_uint32(p+4);
+    idx->part[i].size   = get_uint32(p+8);
+    if ( idx->part[i].offset > idx->offset ||
+         idx->part[i].size > idx->offset - idx->part[i].offset ) {
+      return 0;
+    }
+  }
+  idx->samples       = get_uint32(p);
+  idx->sample_offset = idx->offset + GARMIN_HEADER + 8 + INDEX_HEAD;
+
+  if ( payload != INDEX_HEAD + idx->samples * INDEX_SAMPLE +
+       GARMIN_INDEX_TRAILER ||
+       idx->offset + GARMIN_HEADER + 8 + payload != length ) {
+    return 0;
+  }
+
+  if ( idx->part[GARMIN_PART_TRACK].type == data_Dlist ) {
+    if ( index_pread(fd,trailer,4,idx->part[GARMIN_PART_TRACK].offset) == 0 ) {
+      return 0;
+    }
+    idx->track_id = get_uint32(trailer);
+  }
+
+  return 1;
+}
+
+
+/*
+   Find the last time sample at or before 't' (or the first one, if 't' is
+   before the track starts).  Returns 1 and fills in the point's time, the
+   elements left in its list from it on, and where its list element is; or
+   0 if the file has no samples.
+*/
+
+int
+garmin_index_find ( int             fd,
+                    garmin_index *  idx,
+                    uint32          t,
+                    uint32 *        time,
+                    uint32 *        left,
+                    uint32 *        offset )
+{
+  uint8   s[INDEX_SAMPLE];
+  uint8   best[INDEX_SAMPLE];
+  uint32  lo = 0;
+  uint32  hi = idx->samples;
+  uint32  mid;
+
+  if ( idx->samples == 0 ||
+       index_pread(fd,best,INDEX_SAMPLE,idx->sample_offset) == 0 ) {
+    return 0;
+  }
+
+  /* Invariant: sample lo is at or before t (or is the first); hi is after. */
+
+  while ( hi - lo > 1 ) {
+    mid = lo + (hi - lo) / 2;
+    if ( index_pread(fd,s,INDEX_SAMPLE,
+                     idx->sample_offset + mid * INDEX_SAMPLE) == 0 ) {
+      return 0;
+    }
+    if ( get_uint32(s) <= t ) {
+      lo = mid;
+      memcpy(best,s,INDEX_SAMPLE);
+    } else {
+      hi = mid;
+    }
+  }
+
+  *time   = get_uint32(best);
+  *left   = get_uint32(best + 4);
+  *offset = get_uint32(best + 8);
+
+  return 1;
+}
@@ -25,9 +25,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include "garmin.h"
 
 
+
+static uint32 garmin_pack_record ( garmin_data * data, uint8 ** buf );
+
+
 #define PUTU16(x) do { put_uint16(*pos,x);  *pos += 2; }   while ( 0 )
 #define PUTS16(x) do { put_sint16(*pos,x);  *pos += 2; }   while ( 0 )
 #define PUTU32(x) do { put_uint32(*pos,x);  *pos += 4; }   while ( 0 )
@@ -1136,7 +1142,7 @@ mkpath ( const char *path )
             fprintf(stderr, "failed to chown %s : %m\n", path);
         }
           }
-        } else {
+        } else if ( errno != EEXIST ) {  /* another session may beat us */
           fprintf(stderr,"mkpath: mkdir(%s,%o): %s",path,mode,strerror(errno));
           ok = 0;
           break;
@@ -1153,7 +1159,7 @@ mkpath ( const char *path )
           fprintf(stderr, "failed to chown %s : %m\n", path);
       }
     }
-  } else {
+  } else if ( errno != EEXIST ) {
     fprintf(stderr,"mkpath: mkdir(%s,%o): %s",path,mode,strerror(errno));
     ok = 0;
   }
@@ -1162,95 +1168,379 @@ mkpath ( const char *path )
 }
 
 
-/* ========================================================================= */
-/* garmin_save                                                               */
-/* ========================================================================= */
+/*
+   garmin_save packs the whole file into one buffer that grows as it goes,
+   so the tree is walked once: a list's size is filled in after its
+   elements have been packed, rather than worked out beforehand.  It is
+   kept in one piece because the index (see index.c) is built from it.
+*/
+
+#define PACK_FIRST_SIZE  65536
+
+typedef struct pack_buffer {
+  uint8 *  data;
+  uint32   size;
+  uint32   used;
+  int      failed;
+  int      compress;  /* GARMIN_SAVE_COMPRESS */
+} pack_buffer;
 
-uint32
-garmin_save ( garmin_data * data, const char * filename, const char * dir )
-{
-  int         fd = -1;
-  uint8 *     buf;
-  uint8 *     pos;
-  uint8 *     marker;
-  uint32      bytes  = 0;
-  uint32      packed = 0;
-  uint32      wrote  = 0;
-  struct stat sb;
-  uid_t       owner = -1;
-  gid_t       group = -1;
-  char        path[BUFSIZ] = { 0 };
 
-  if ( (bytes = garmin_data_size(data)) != 0 ) {
+/* Make room for 'more' bytes.  Returns 0 if we ran out of memory. */
 
-    mkpath(dir);
-    if ( stat(dir,&sb) != -1 ) {
-      owner = sb.st_uid;
-      group = sb.st_gid;
+static int
+pack_reserve ( pack_buffer * b, uint32 more )
+{
+  uint8 *  p;
+  uint32   size;
+
+  if ( b->failed ) return 0;
+  if ( more <= b->size - b->used ) return 1;
+
+  size = ( b->size > 0 ) ? b->size : PACK_FIRST_SIZE;
+  while ( size - b->used < more ) {
+    if ( size > 0x7fffffff ) {
+      size = 0;
+      break;
     }
+    size *= 2;
+  }
+
+  if ( size == 0 || (p = realloc(b->data,size)) == NULL ) {
+    printf("garmin_save: out of memory (%u bytes)\n",b->used + more);
+    b->failed = 1;
+    return 0;
+  }
+  b->data = p;
+  b->size = size;
+
+  return 1;
+}
+
+
+/*
+   Pack 'data' onto the end of the buffer, the same way garmin_pack does,
+   but with lists of track points compressed if the buffer says so.
+*/
 
-    snprintf(path,sizeof(path)-1,"%s/%s",dir,filename);
-    if ( stat(path,&sb) != -1 ) {
-      /* Do NOT overwrite if the file is already there. */
-      return 0;
+static void
+garmin_pack_buffer ( garmin_data * data, pack_buffer * b )
+{
+  garmin_list *       list;
+  garmin_list_node *  node;
+  uint8 *             pos;
+  uint32              start;
+  uint32              bytes;
+
+  if ( data == NULL || data->data == NULL ) return;
+
+  if ( data->type == data_Dlist ) {
+    list = data->data;
+    if ( pack_reserve(b,16) == 0 ) return;
+    start = b->used;
+    put_uint32(b->data+start,data_Dlist);
+    put_uint32(b->data+start+8,list->id);
+    put_uint32(b->data+start+12,list->elements);
+    b->used += 16;
+    for ( node = list->head; node != NULL; node = node->next ) {
+      if ( pack_reserve(b,4) == 0 ) return;
+      put_uint32(b->data+b->used,list->id);
+      b->used += 4;
+      garmin_pack_buffer(node->data,b);
+      if ( b->failed ) return;
+    }
+    bytes = b->used - start;
+    put_uint32(b->data+start+4,bytes-8);
+    if ( b->compress ) {
+      b->used = start + garmin_compress_points(b->data+start,bytes);
     }
+  } else if ( (bytes = garmin_data_size(data)) != 0 &&
+              pack_reserve(b,bytes) != 0 ) {
+    pos = b->data + b->used;
+    b->used += garmin_pack_record(data,&pos);
+  }
+}
+
+
+/*
+   Each file is written to a hidden temporary file in its directory, synced
+   and then linked into place, so an interrupted download never leaves a
+   truncated file behind (which the no-overwrite rule would then keep for
+   good).  Syncing the directory entries is what makes the new names
+   stick, but a download writes a month's runs into the same directory, so
+   that is put off until garmin_save moves on to another directory or
+   garmin_save_flush is called.  A run that is lost that way is just not
+   there, and is downloaded again next time.
+
+   The directories are remembered, so each is only made (and its owner
+   looked up) once.  Several units may be saving at once, hence the lock.
+*/
+
+typedef struct save_dir {
+  char *             path;
+  uid_t              owner;
+  gid_t              group;
+  size_t             made;      /* we made it: the length of the part that
+                                   was already there, whose names changed */
+  int                dirty;     /* it has names that haven't been synced   */
+  struct save_dir *  next;
+} save_dir;
+
+static save_dir *       save_dirs = NULL;
+static save_dir *       save_last = NULL;
+static uint32           save_seq  = 0;
+static pthread_mutex_t  save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* fsync a directory.  Returns 0 on error. */
+
+static int
+sync_dir ( const char * path )
+{
+  int fd;
+  int ok = 1;
+
+  if ( (fd = open(path,O_RDONLY)) == -1 ) return 0;
+  if ( fsync(fd) == -1 ) {
+    printf("fsync: %s: %s\n",path,strerror(errno));
+    ok = 0;
+  }
+  close(fd);
 
-    if ( (fd = creat(path,0664)) != -1 ) {
+  return ok;
+}
+
+
+/* Sync the directories with unsynced names.  Call with save_lock held. */
 
-      if (fchown(fd,owner,group) < 0) {
-          fprintf(stderr, "Failed to chown file: %m\n");
+static int
+save_sync_dirs ( void )
+{
+  save_dir * d;
+  char       parent[BUFSIZ];
+  char *     slash;
+  int        ok = 1;
+
+  for ( d = save_dirs; d != NULL; d = d->next ) {
+    if ( d->made ) {
+      strncpy(parent,d->path,sizeof(parent)-1);
+      parent[sizeof(parent)-1] = 0;
+      while ( strlen(parent) > d->made &&
+              (slash = strrchr(parent,'/')) != NULL && slash != parent ) {
+        *slash = 0;
+        sync_dir(parent);
       }
+      d->made = 0;
+    }
+    if ( d->dirty ) {
+      if ( sync_dir(d->path) == 0 ) ok = 0;
+      d->dirty = 0;
+    }
+  }
 
-      /* Allocate the memory and write the file header */
+  return ok;
+}
 
-      if ( (buf = calloc(bytes + GARMIN_HEADER, sizeof(uint8))) != NULL ) {
 
-        /* write GARMIN_MAGIC, GARMIN_VERSION, and bytes. */
+/*
+   Find (or make) the directory 'path'.  If it isn't the one we saved to
+   last, the names in the others are synced first.  Call with save_lock
+   held.  Returns NULL if the directory can't be made.
+*/
 
-        pos = buf;
-        memset(pos,0,GARMIN_HEADER);
-        strncpy((char *)pos,GARMIN_MAGIC,11);
-        put_uint32(pos+12,GARMIN_VERSION);
-        marker = pos+16;
-        pos += GARMIN_HEADER;
-        packed = GARMIN_HEADER;
+static save_dir *
+save_get_dir ( const char * path )
+{
+  save_dir *   d;
+  struct stat  sb;
+  char         there[BUFSIZ];
+  char *       slash;
 
-        /* pack the rest of the data. */
+  for ( d = save_dirs; d != NULL; d = d->next ) {
+    if ( strcmp(d->path,path) == 0 ) break;
+  }
 
-        packed += garmin_pack(data,&pos);
-        put_uint32(marker,packed-GARMIN_HEADER);
+  if ( d == NULL ) {
+    strncpy(there,path,sizeof(there)-1);
+    there[sizeof(there)-1] = 0;
+    while ( stat(there,&sb) == -1 && (slash = strrchr(there,'/')) != NULL ) {
+      *slash = 0;
+    }
+    if ( strcmp(there,path) != 0 ) mkpath(path);
+    if ( stat(path,&sb) == -1 ) return NULL;
+    if ( (d = calloc(1,sizeof(save_dir))) == NULL ||
+         (d->path = strdup(path)) == NULL ) {
+      free(d);
+      return NULL;
+    }
+    d->owner  = sb.st_uid;
+    d->group  = sb.st_gid;
+    d->made   = ( strcmp(there,path) != 0 ) ? strlen(there) : 0;
+    d->next   = save_dirs;
+    save_dirs = d;
+  }
 
-        /* Now write the data to the file and close the file. */
+  if ( save_last != NULL && save_last != d ) save_sync_dirs();
+  save_last = d;
 
-        if ( (wrote = write(fd,buf,packed)) != packed ) {
-          /* write error! */
-          printf("write of %d bytes returned %d: %s\n",
-                 packed,wrote,strerror(errno));
-        }
-        close(fd);
-        fd = -1;
+  return d;
+}
+
+
+/* ========================================================================= */
+/* garmin_save                                                               */
+/*                                                                           */
+/* Save 'data' to 'filename' in 'dir'.  Returns the number of bytes of data  */
+/* written, 0 if the file was already there (it is never overwritten), or   */
+/* -1 if the file couldn't be written.                                       */
+/* ========================================================================= */
 
-        /* Free the buffer. */
+int
+garmin_save ( garmin_data *  data,
+              const char *   filename,
+              const char *   dir,
+              int            flags )
+{
+  int           fd = -1;
+  pack_buffer   b;
+  save_dir *    sd;
+  uint8 *       index = NULL;
+  uint32        isize = 0;
+  int           packed = -1;
+  uint32        seq;
+  ssize_t       wrote;
+  struct iovec  iov[2];
+  struct stat   sb;
+  uid_t         owner = -1;
+  gid_t         group = -1;
+  char          path[BUFSIZ] = { 0 };
+  char          tmp[BUFSIZ] = { 0 };
+
+  snprintf(path,sizeof(path)-1,"%s/%s",dir,filename);
+  if ( stat(path,&sb) != -1 ) {
+    /* Do NOT overwrite if the file is already there. */
+    return 0;
+  }
 
-        free(buf);
+  /* Pack the file header and the data, in one pass. */
+
+  memset(&b,0,sizeof(b));
+  b.compress = ( flags & GARMIN_SAVE_COMPRESS ) != 0;
+  if ( pack_reserve(&b,GARMIN_HEADER) != 0 ) {
+    memset(b.data,0,GARMIN_HEADER);
+    strncpy((char *)b.data,GARMIN_MAGIC,11);
+    put_uint32(b.data+12,GARMIN_VERSION);
+    b.used = GARMIN_HEADER;
+    garmin_pack_buffer(data,&b);
+    put_uint32(b.data+16,b.used-GARMIN_HEADER);
+  }
 
-      } else {
-        /* malloc error */
-        printf("malloc(%d): %s\n",bytes + GARMIN_HEADER, strerror(errno));
-      }
+  if ( b.failed ) {
+    free(b.data);
+    return -1;
+  }
+  if ( b.used == GARMIN_HEADER ) {
+    /* don't write empty data */
+    printf("%s: garmin_data_size was 0\n",path);
+    free(b.data);
+    return -1;
+  }
+
+  pthread_mutex_lock(&save_lock);
+  if ( (sd = save_get_dir(dir)) != NULL ) {
+    owner = sd->owner;
+    group = sd->group;
+  }
+  seq = save_seq++;
+  pthread_mutex_unlock(&save_lock);
+
+  snprintf(tmp,sizeof(tmp)-1,"%s/.%s.%d.%u",dir,filename,(int)getpid(),seq);
+
+  if ( (fd = open(tmp,O_WRONLY|O_CREAT|O_EXCL,0664)) != -1 ) {
+
+    if (fchown(fd,owner,group) < 0) {
+        fprintf(stderr, "Failed to chown file: %m\n");
+    }
+
+    /* Version 2: the index goes after the data, in the same write. */
+
+    iov[0].iov_base = b.data;
+    iov[0].iov_len  = b.used;
+    if ( (index = garmin_index_build(b.data,b.used,&isize)) != NULL ) {
+      iov[1].iov_base = index;
+      iov[1].iov_len  = isize;
     } else {
-      /* problem creating file. */
-      printf("creat: %s: %s\n",path,strerror(errno));
+      isize = 0;
+    }
+
+    if ( (wrote = writev(fd,iov,( index != NULL ) ? 2 : 1)) !=
+         (ssize_t)(b.used + isize) ) {
+      /* write error! */
+      printf("write of %d bytes returned %d: %s\n",
+             b.used + isize,(int)wrote,strerror(errno));
+    } else if ( fdatasync(fd) == -1 ) {
+      printf("fdatasync: %s: %s\n",tmp,strerror(errno));
+    } else {
+      packed = b.used;
+    }
+    free(index);
+    if ( close(fd) == -1 ) {
+      printf("close: %s: %s\n",tmp,strerror(errno));
+      packed = -1;
     }
+
+    /*
+       Put the file in place.  link() won't replace a file that turned up
+       in the meantime; rename() is for filesystems without hard links.
+    */
+
+    if ( packed > 0 ) {
+      if ( link(tmp,path) == -1 ) {
+        if ( errno == EEXIST || stat(path,&sb) != -1 ) {
+          packed = 0;
+        } else if ( rename(tmp,path) == -1 ) {
+          printf("rename: %s: %s\n",path,strerror(errno));
+          packed = -1;
+        }
+      }
+    }
+    unlink(tmp);
+
+    if ( packed > 0 && sd != NULL ) {
+      pthread_mutex_lock(&save_lock);
+      sd->dirty = 1;
+      pthread_mutex_unlock(&save_lock);
+    }
+
   } else {
-    /* don't write empty data */
-    printf("%s: garmin_data_size was 0\n",path);
+    /* problem creating file. */
+    printf("creat: %s: %s\n",tmp,strerror(errno));
   }
 
-  if (fd >= 0)
-    close(fd);
+  free(b.data);
 
-  return bytes;
+  return packed;
+}
+
+
+/* ========================================================================= */
+/* garmin_save_flush                                                         */
+/*                                                                           */
+/* Sync the directories that garmin_save has put new files in since the last */
+/* time, so that the files are there for good.  Call it when done saving.    */
+/* Returns 1 if all went well and 0 if a directory couldn't be synced.       */
+/* ========================================================================= */
+
+int
+garmin_save_flush ( void )
+{
+  int ok;
+
+  pthread_mutex_lock(&save_lock);
+  ok = save_sync_dirs();
+  pthread_mutex_unlock(&save_lock);
+
+  return ok;
 }
 
 
@@ -1265,14 +1555,30 @@ garmin_save ( garmin_data * data, const char * filename, const char * dir )
 
 uint32
 garmin_pack ( garmin_data * data, uint8 ** buf )
+{
+  /*
+     A list always packs to something (its id and element count), so only
+     a single record needs sizing; that keeps this from walking the tree
+     again at every level.
+  */
+
+  if ( data == NULL || data->data == NULL ) return 0;
+  if ( data->type != data_Dlist && garmin_data_size(data) == 0 ) return 0;
+
+  return garmin_pack_record(data,buf);
+}
+
+
+/* Pack a record that is known to have something in it. */
+
+static uint32
+garmin_pack_record ( garmin_data * data, uint8 ** buf )
 {
   uint8 * start;
   uint8 * finish;
   uint8 * marker;
   uint32  bytes = 0;
 
-  if ( garmin_data_size(data) == 0 ) return 0;
-
   /* OK, we must know how to serialize this data.  Let's go for it. */
 
 #define CASE_DATA(x)                        \
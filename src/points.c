@@ -0,0 +1,342 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+
+
+/*
+   A list of track points is mostly the same few fields over and over,
+   each a little different from the one before.  When a file is saved
+   with GARMIN_SAVE_COMPRESS (see garmin_save), such a list is stored as
+   one GARMIN_POINTS_TYPE element (the layout is in garmin.h) instead: the
+   points are stored a field at a time, the position and time as varints
+   of the zigzagged difference from the previous point, the floats as
+   varints of their bits XORed with the previous point's, and the bytes
+   as they are.  Nothing is rounded, so the points unpack exactly as they
+   were.
+
+   Compressing works on the packed list, and expanding gives back exactly
+   the packed list that was compressed, so the rest of the code only ever
+   sees ordinary lists.
+*/
+
+#define ELEMENT_HEADER  12
+
+/* The first three words of every point are the latitude, longitude and time. */
+
+#define DELTA_WORDS     3
+
+
+typedef struct points_layout {
+  uint32  type;
+  int     words;     /* 4 byte fields, which come first */
+  int     bytes;     /* 1 byte fields, which follow     */
+} points_layout;
+
+
+static const points_layout layouts[] = {
+  { data_D300, 3, 1 },
+  { data_D301, 5, 1 },
+  { data_D302, 6, 1 },
+  { data_D303, 4, 1 },
+  { data_D304, 5, 3 }
+};
+
+
+static const points_layout *
+points_find_layout ( uint32 type )
+{
+  unsigned int i;
+
+  for ( i = 0; i < sizeof(layouts)/sizeof(layouts[0]); i++ ) {
+    if ( layouts[i].type == type ) return &layouts[i];
+  }
+
+  return NULL;
+}
+
+
+static uint8 *
+points_put_varint ( uint8 * p, uint32 v )
+{
+  while ( v >= 0x80 ) {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+
+  return p;
+}
+
+
+/* Returns 0 if the varint runs past 'end' (NULL if there is no end). */
+
+static int
+points_get_varint ( const uint8 ** p, const uint8 * end, uint32 * v )
+{
+  int shift;
+
+  *v = 0;
+  for ( shift = 0; shift < 35; shift += 7 ) {
+    if ( end != NULL && *p >= end ) return 0;
+    *v |= (uint32)(**p & 0x7f) << shift;
+    if ( (*(*p)++ & 0x80) == 0 ) return 1;
+  }
+
+  return 0;
+}
+
+
+static uint32
+points_zigzag ( uint32 d )
+{
+  return (d << 1) ^ (uint32)((sint32)d >> 31);
+}
+
+
+static uint32
+points_unzigzag ( uint32 z )
+{
+  return (z >> 1) ^ (uint32)-(sint32)(z & 1);
+}
+
+
+/*
+   Compress the packed list at 'rec' (its type, size and payload, 'bytes'
+   in all) in place, if it is a list of track points and it gets smaller.
+   Returns the new number of bytes, which is 'bytes' if the list was left
+   as it was.
+*/
+
+uint32
+garmin_compress_points ( uint8 * rec, uint32 bytes )
+{
+  const points_layout * layout = NULL;
+  const uint8 *         pos;
+  const uint8 *         end;
+  const uint8 *         first = NULL;
+  uint8 *               out;
+  uint8 *               p;
+  uint32                id;
+  uint32                elements;
+  uint32                head = 0;
+  uint32                hsize;
+  uint32                points;
+  uint32                type;
+  uint32                size;
+  uint32                recsize = 0;
+  uint32                prev;
+  uint32                v;
+  uint32                i;
+  int                   k;
+
+  if ( bytes < 16 || get_uint32(rec) != data_Dlist ) return bytes;
+
+  pos      = rec + 8;
+  end      = rec + bytes;
+  id       = get_uint32(pos);
+  elements = get_uint32(pos + 4);
+  pos += 8;
+
+  /* Anything before the first point (a track header, say) is kept as is. */
+
+  for ( i = 0; i < elements; i++ ) {
+    if ( end - pos < ELEMENT_HEADER ) return bytes;
+    type = get_uint32(pos + 4);
+    size = get_uint32(pos + 8);
+    if ( get_uint32(pos) != id || size > (uint32)(end - pos - ELEMENT_HEADER) ) {
+      return bytes;
+    }
+    if ( layout == NULL ) {
+      if ( (layout = points_find_layout(type)) != NULL ) {
+        recsize = layout->words * 4 + layout->bytes;
+        first   = pos;
+        head    = i;
+      }
+    }
+    if ( layout != NULL && (type != layout->type || size != recsize) ) {
+      return bytes;
+    }
+    pos += ELEMENT_HEADER + size;
+  }
+  if ( layout == NULL || pos != end ) return bytes;
+
+  points = elements - head;
+  hsize  = first - (rec + 16);
+
+  /* A varint takes at most five bytes. */
+
+  size = 12 + hsize + 4 + points * (layout->words * 5 + layout->bytes);
+  if ( (out = malloc(size)) == NULL ) return bytes;
+
+  p = out;
+  put_uint32(p,id);
+  put_uint32(p+4,elements);
+  put_uint32(p+8,head);
+  p += 12;
+  memcpy(p,rec + 16,hsize);
+  p += hsize;
+  put_uint32(p,layout->type);
+  p += 4;
+
+  for ( k = 0; k < layout->words; k++ ) {
+    prev = 0;
+    for ( i = 0, pos = first + ELEMENT_HEADER; i < points;
+          i++, pos += ELEMENT_HEADER + recsize ) {
+      v = get_uint32(pos + k * 4);
+      p = points_put_varint(p,( k < DELTA_WORDS ) ? points_zigzag(v - prev)
+                                                  : v ^ prev);
+      prev = v;
+    }
+  }
+  for ( k = 0; k < layout->bytes; k++ ) {
+    for ( i = 0, pos = first + ELEMENT_HEADER; i < points;
+          i++, pos += ELEMENT_HEADER + recsize ) {
+      *p++ = pos[layout->words * 4 + k];
+    }
+  }
+
+  if ( (uint32)(p - out) + 8 < bytes ) {
+    put_uint32(rec,GARMIN_POINTS_TYPE);
+    put_uint32(rec+4,p - out);
+    memcpy(rec + 8,out,p - out);
+    bytes = p - out + 8;
+  }
+  free(out);
+
+  return bytes;
+}
+
+
+/*
+   Expand the payload of a GARMIN_POINTS_TYPE element at 'pos' back into
+   the payload of the list it came from.  The data must end by 'end', or
+   is trusted if 'end' is NULL.  Returns the list (to be freed), its size
+   and the number of compressed bytes used; or NULL if the data is
+   corrupt or we ran out of memory.
+*/
+
+uint8 *
+garmin_expand_points ( const uint8 *  pos,
+                       const uint8 *  end,
+                       uint32 *       used,
+                       uint32 *       size )
+{
+  const points_layout * layout;
+  const uint8 *         start = pos;
+  const uint8 *         first;
+  uint8 *               out;
+  uint8 *               recs;
+  uint8 *               p;
+  uint32                id;
+  uint32                elements;
+  uint32                head;
+  uint32                hsize;
+  uint32                points;
+  uint32                recsize;
+  uint32                esize;
+  uint32                prev;
+  uint32                v;
+  uint32                i;
+  int                   k;
+
+#define NEED(n) \
+  do { if ( end != NULL && (uint32)(end - pos) < (n) ) return NULL; } while ( 0 )
+
+  NEED(12);
+  id       = get_uint32(pos);
+  elements = get_uint32(pos + 4);
+  head     = get_uint32(pos + 8);
+  pos += 12;
+  if ( head > elements ) return NULL;
+
+  first = pos;
+  for ( i = 0; i < head; i++ ) {
+    NEED(ELEMENT_HEADER);
+    esize = get_uint32(pos + 8);
+    pos += ELEMENT_HEADER;
+    NEED(esize);
+    pos += esize;
+  }
+  hsize = pos - first;
+
+  NEED(4);
+  if ( (layout = points_find_layout(get_uint32(pos))) == NULL ) return NULL;
+  pos += 4;
+
+  /* Every field of every point takes at least a byte. */
+
+  points  = elements - head;
+  recsize = layout->words * 4 + layout->bytes;
+  if ( end != NULL &&
+       points > (uint32)(end - pos) / (layout->words + layout->bytes) ) {
+    return NULL;
+  }
+
+  *size = 8 + hsize + points * (ELEMENT_HEADER + recsize);
+  if ( (out = malloc(*size)) == NULL ) {
+    fprintf(stderr,"garmin_expand_points: out of memory\n");
+    return NULL;
+  }
+
+  put_uint32(out,id);
+  put_uint32(out+4,elements);
+  memcpy(out + 8,first,hsize);
+  recs = out + 8 + hsize;
+
+  for ( i = 0, p = recs; i < points; i++, p += ELEMENT_HEADER + recsize ) {
+    put_uint32(p,id);
+    put_uint32(p+4,layout->type);
+    put_uint32(p+8,recsize);
+  }
+
+  for ( k = 0; k < layout->words; k++ ) {
+    prev = 0;
+    for ( i = 0, p = recs + ELEMENT_HEADER; i < points;
+          i++, p += ELEMENT_HEADER + recsize ) {
+      if ( points_get_varint(&pos,end,&v) == 0 ) {
+        free(out);
+        return NULL;
+      }
+      prev = ( k < DELTA_WORDS ) ? prev + points_unzigzag(v) : prev ^ v;
+      put_uint32(p + k * 4,prev);
+    }
+  }
+
+  if ( end != NULL && (uint32)(end - pos) < points * layout->bytes ) {
+    free(out);
+    return NULL;
+  }
+  for ( k = 0; k < layout->bytes; k++ ) {
+    for ( i = 0, p = recs + ELEMENT_HEADER; i < points;
+          i++, p += ELEMENT_HEADER + recsize ) {
+      p[layout->words * 4 + k] = *pos++;
+    }
+  }
+
+#undef NEED
+
+  *used = pos - start;
+
+  return out;
+}
@@ -49,149 +49,169 @@
 
 #define GARMIN_TAGFMT(w,x,y,z)                       \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s>" w "</%s>\n",y,z,y);            \
+    print_spaces(out,spaces+x);                      \
+    garmin_write_printf(out,"<%s>" w "</%s>\n",y,z,y); \
   } while ( 0 )
 
 #define GARMIN_TAGFUN(w,x,y,z)                       \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s>",y);                            \
-    w(z,fp);                                         \
-    fprintf(fp,"</%s>\n",y);                         \
+    print_spaces(out,spaces+x);                      \
+    garmin_write_char(out,'<');                      \
+    garmin_write_str(out,y);                         \
+    garmin_write_char(out,'>');                      \
+    w(z,out);                                        \
+    garmin_write_lit(out,"</");                      \
+    garmin_write_str(out,y);                         \
+    garmin_write_lit(out,">\n");                     \
   } while ( 0 )
 
 #define GARMIN_TAGPOS(x,y,z)                         \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s lat=\"%.8lf\" lon=\"%.8lf\"/>\n",\
-            y,SEMI2DEG((z).lat),SEMI2DEG((z).lon));  \
+    print_spaces(out,spaces+x);                      \
+    garmin_write_char(out,'<');                      \
+    garmin_write_str(out,y);                         \
+    garmin_write_lit(out," lat=\"");                 \
+    garmin_write_fixed(out,SEMI2DEG((z).lat),8);     \
+    garmin_write_lit(out,"\" lon=\"");               \
+    garmin_write_fixed(out,SEMI2DEG((z).lon),8);     \
+    garmin_write_lit(out,"\"/>\n");                  \
   } while ( 0 )
 
 #define GARMIN_TAGSYM(x,y,z)                         \
   do {                                               \
-    print_spaces(fp,spaces+x);                       \
-    fprintf(fp,"<%s value=\"0x%x\" name=\"%s\"/>\n", \
-            y,z,garmin_symbol_name(z));              \
+    print_spaces(out,spaces+x);                      \
+    garmin_write_printf(out,"<%s value=\"0x%x\" name=\"%s\"/>\n", \
+                        y,z,garmin_symbol_name(z));  \
   } while ( 0 )
 
-#define GARMIN_TAGU8B(x,y,z,l)                             \
+#define GARMIN_TAGU8B(x,y,z,l)                       \
   do {                                               \
     int u8b;                                         \
                                                      \
-    open_tag(y,fp,spaces+x);                         \
-    print_spaces(fp,spaces+x);                       \
+    open_tag(y,out,spaces+x);                        \
+    print_spaces(out,spaces+x);                      \
     for ( u8b = 0; u8b < l; u8b++ ) {                \
-      fprintf(fp," 0x%02x",z[u8b]);                  \
+      garmin_write_printf(out," 0x%02x",z[u8b]);     \
     }                                                \
-    fprintf(fp,"\n");                                \
-    close_tag(y,fp,spaces+x);                        \
+    garmin_write_char(out,'\n');                     \
+    close_tag(y,out,spaces+x);                       \
   } while ( 0 )
 
-#define GARMIN_TAGSTR(x,y,z) GARMIN_TAGFMT("%s",x,y,z)
-#define GARMIN_TAGINT(x,y,z) GARMIN_TAGFMT("%d",x,y,z)
-#define GARMIN_TAGU32(x,y,z) GARMIN_TAGFMT("%u",x,y,z)
+#define GARMIN_TAGSTR(x,y,z) GARMIN_TAGFUN(print_string,x,y,z)
+#define GARMIN_TAGINT(x,y,z) GARMIN_TAGFUN(print_int,x,y,z)
+#define GARMIN_TAGU32(x,y,z) GARMIN_TAGFUN(print_uint,x,y,z)
 #define GARMIN_TAGF32(x,y,z) GARMIN_TAGFUN(garmin_print_float32,x,y,z)
 #define GARMIN_TAGF64(x,y,z) GARMIN_TAGFUN(garmin_print_float64,x,y,z)
 #define GARMIN_TAGHEX(x,y,z) GARMIN_TAGFMT("0x%x",x,y,z)
 
 
+/*
+   Everything goes out through a garmin_writer (see writer.c); the
+   FILE * functions at the end of the file wrap one around the FILE.
+*/
+
 static void
-print_spaces ( FILE * fp, int spaces )
+print_spaces ( garmin_writer * out, int spaces )
 {
-  int i;
-
-  for ( i = 0; i < spaces; i++ ) {
-    fprintf(fp," ");
-  }
+  garmin_write_spaces(out,spaces);
 }
 
 
+/* printf would print a NULL string as "(null)", and so do we. */
+
 static void
-open_tag ( const char * tag, FILE * fp, int spaces )
+print_string ( const char * s, garmin_writer * out )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s>\n",tag);
+  garmin_write_str(out,( s != NULL ) ? s : "(null)");
 }
 
 
 static void
-open_tag_with_type ( const char * tag, uint32 type, FILE * fp, int spaces )
+print_int ( sint32 i, garmin_writer * out )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<%s type=\"%d\">\n",tag,type);
+  garmin_write_int(out,i);
 }
 
 
 static void
-close_tag ( const char * tag, FILE * fp, int spaces )
+print_uint ( uint32 u, garmin_writer * out )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"</%s>\n",tag);
+  garmin_write_uint(out,u);
 }
 
 
 static void
-garmin_print_dlist ( garmin_list * l, FILE * fp, int spaces )
+open_tag ( const char * tag, garmin_writer * out, int spaces )
 {
-  garmin_list_node * n;
-
-  for ( n = l->head; n != NULL; n = n->next ) {
-    garmin_print_data(n->data,fp,spaces);
-  }
+  print_spaces(out,spaces);
+  garmin_write_char(out,'<');
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
 }
 
 
-/* Support function to print a time value in ISO 8601 compliant format */
-
 static void
-garmin_print_dtime ( uint32 t, FILE * fp, const char * label )
+open_tag_with_type ( const char *     tag,
+                     uint32           type,
+                     garmin_writer *  out,
+                     int              spaces )
 {
-  time_t     tval;
-  struct tm  tmval;
-  char       buf[128] = { 0 };
-  int        len;
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<%s type=\"%d\">\n",tag,type);
+}
 
-  /*
-                                  012345678901234567890123
-     This will make, for example, 2007-04-20T23:55:01-0700, but that date
-     isn't quite ISO 8601 compliant.  We need to stick a ':' in the time
-     zone between the hours and the minutes.
-  */
 
-  tval = t + TIME_OFFSET;
-  localtime_r(&tval,&tmval);
-  strftime(buf,sizeof(buf)-1,"%FT%T%z",&tmval);
+static void
+close_tag ( const char * tag, garmin_writer * out, int spaces )
+{
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"</");
+  garmin_write_str(out,tag);
+  garmin_write_lit(out,">\n");
+}
 
-  /*
-     If the last character is a 'Z', don't do anything.  Otherwise, we
-     need to move the last two characters out one and stick a colon in
-     the vacated spot.  Let's not forget the trailing '\0' that needs to
-     be moved as well.
-  */
 
-  len = strlen(buf);
-  if ( len > 0 && buf[len-1] != 'Z' ) {
-    memmove(buf+len-1,buf+len-2,3);
-    buf[len-2] = ':';
+static void
+garmin_print_dlist ( garmin_list * l, garmin_writer * out, int spaces )
+{
+  garmin_list_node * n;
+
+  for ( n = l->head; n != NULL; n = n->next ) {
+    garmin_write_data(n->data,out,spaces);
   }
+}
+
 
-  /* OK.  Done. */
+/*
+   Support function to print a time value in ISO 8601 compliant format,
+   for example 2007-04-20T23:55:01-07:00 (see garmin_format_time).
+*/
 
-  fprintf(fp," %s=\"%s\"",label,buf);
+static void
+garmin_print_dtime ( uint32 t, garmin_writer * out, const char * label )
+{
+  garmin_write_char(out,' ');
+  garmin_write_str(out,label);
+  garmin_write_lit(out,"=\"");
+  garmin_write_time(out,t + TIME_OFFSET,GARMIN_TIME_LOCAL);
+  garmin_write_char(out,'"');
 }
 
 
 /* Support function to print a position type */
 
 static void
-garmin_print_dpos ( position_type * pos, FILE * fp )
+garmin_print_dpos ( position_type * pos, garmin_writer * out )
 {
   if ( pos->lat != 0x7fffffff ) {
-    fprintf(fp," lat=\"%.8lf\"",SEMI2DEG(pos->lat));
+    garmin_write_lit(out," lat=\"");
+    garmin_write_fixed(out,SEMI2DEG(pos->lat),8);
+    garmin_write_char(out,'"');
   }
   if ( pos->lon != 0x7fffffff ) {
-    fprintf(fp," lon=\"%.8lf\"",SEMI2DEG(pos->lon));
+    garmin_write_lit(out," lon=\"");
+    garmin_write_fixed(out,SEMI2DEG(pos->lon),8);
+    garmin_write_char(out,'"');
   }
 }
 
@@ -202,32 +222,32 @@ garmin_print_dpos ( position_type * pos, FILE * fp )
 */
 
 static void
-garmin_print_float32 ( float32 f, FILE * fp )
+garmin_print_float32 ( float32 f, garmin_writer * out )
 {
   if ( f > 100000000.0 || f < -100000000.0 ) {
-    fprintf(fp,"%.9e",f);
+    garmin_write_printf(out,"%.9e",f);
   } else if ( f > 10000000.0 || f < -10000000.0 ) {
-    fprintf(fp,"%.1f",f);
+    garmin_write_fixed(out,f,1);
   } else if ( f > 1000000.0 || f < -1000000.0 ) {
-    fprintf(fp,"%.2f",f);
+    garmin_write_fixed(out,f,2);
   } else if ( f > 100000.0 || f < -100000.0 ) {
-    fprintf(fp,"%.3f",f);
+    garmin_write_fixed(out,f,3);
   } else if ( f > 10000.0 || f < -10000.0 ) {
-    fprintf(fp,"%.4f",f);
+    garmin_write_fixed(out,f,4);
   } else if ( f > 1000.0 || f < -1000.0 ) {
-    fprintf(fp,"%.5f",f);
+    garmin_write_fixed(out,f,5);
   } else if ( f > 100.0 || f < -100.0 ) {
-    fprintf(fp,"%.6f",f);
+    garmin_write_fixed(out,f,6);
   } else if ( f > 10.0 || f < -10.0 ) {
-    fprintf(fp,"%.7f",f);
+    garmin_write_fixed(out,f,7);
   } else if ( f > 1.0 || f < -1.0 ) {
-    fprintf(fp,"%.8f",f);
+    garmin_write_fixed(out,f,8);
   } else if ( f > 0.1 || f < -0.1 ) {
-    fprintf(fp,"%.9f",f);
+    garmin_write_fixed(out,f,9);
   } else if ( f != 0 ) {
-    fprintf(fp,"%.9e",f);
+    garmin_write_printf(out,"%.9e",f);
   } else {
-    fprintf(fp,"%.8f",f);
+    garmin_write_fixed(out,f,8);
   }
 }
 
@@ -238,48 +258,48 @@ garmin_print_float32 ( float32 f, FILE * fp )
 */
 
 static void
-garmin_print_float64 ( float64 f, FILE * fp )
+garmin_print_float64 ( float64 f, garmin_writer * out )
 {
   if ( f > 10000000000000000.0 || f < -10000000000000000.0 ) {
-    fprintf(fp,"%.17e",f);
+    garmin_write_printf(out,"%.17e",f);
   } else if ( f > 1000000000000000.0 || f < -1000000000000000.0 ) {
-    fprintf(fp,"%.1f",f);
+    garmin_write_fixed(out,f,1);
   } else if ( f > 100000000000000.0 || f < -100000000000000.0 ) {
-    fprintf(fp,"%.2f",f);
+    garmin_write_fixed(out,f,2);
   } else if ( f > 10000000000000.0 || f < -10000000000000.0 ) {
-    fprintf(fp,"%.3f",f);
+    garmin_write_fixed(out,f,3);
   } else if ( f > 1000000000000.0 || f < -1000000000000.0 ) {
-    fprintf(fp,"%.4f",f);
+    garmin_write_fixed(out,f,4);
   } else if ( f > 100000000000.0 || f < -100000000000.0 ) {
-    fprintf(fp,"%.5f",f);
+    garmin_write_fixed(out,f,5);
   } else if ( f > 10000000000.0 || f < -10000000000.0 ) {
-    fprintf(fp,"%.6f",f);
+    garmin_write_fixed(out,f,6);
   } else if ( f > 1000000000.0 || f < -1000000000.0 ) {
-    fprintf(fp,"%.7f",f);
+    garmin_write_fixed(out,f,7);
   } else if ( f > 100000000.0 || f < -100000000.0 ) {
-    fprintf(fp,"%.8f",f);
+    garmin_write_fixed(out,f,8);
   } else if ( f > 10000000.0 || f < -10000000.0 ) {
-    fprintf(fp,"%.9f",f);
+    garmin_write_fixed(out,f,9);
   } else if ( f > 1000000.0 || f < -1000000.0 ) {
-    fprintf(fp,"%.10f",f);
+    garmin_write_fixed(out,f,10);
   } else if ( f > 100000.0 || f < -100000.0 ) {
-    fprintf(fp,"%.11f",f);
+    garmin_write_fixed(out,f,11);
   } else if ( f > 10000.0 || f < -10000.0 ) {
-    fprintf(fp,"%.12f",f);
+    garmin_write_fixed(out,f,12);
   } else if ( f > 1000.0 || f < -1000.0 ) {
-    fprintf(fp,"%.13f",f);
+    garmin_write_fixed(out,f,13);
   } else if ( f > 100.0 || f < -100.0 ) {
-    fprintf(fp,"%.14f",f);
+    garmin_write_fixed(out,f,14);
   } else if ( f > 10.0 || f < -10.0 ) {
-    fprintf(fp,"%.15f",f);
+    garmin_write_fixed(out,f,15);
   } else if ( f > 1.0 || f < -1.0 ) {
-    fprintf(fp,"%.16f",f);
+    garmin_write_fixed(out,f,16);
   } else if ( f > 0.1 || f < -0.1 ) {
-    fprintf(fp,"%.17f",f);
+    garmin_write_fixed(out,f,17);
   } else if ( f != 0 ) {
-    fprintf(fp,"%.17e",f);
+    garmin_write_printf(out,"%.17e",f);
   } else {
-    fprintf(fp,"%.16f",f);
+    garmin_write_fixed(out,f,16);
   }
 }
 
@@ -290,12 +310,14 @@ garmin_print_float64 ( float64 f, FILE * fp )
 */
 
 static void
-garmin_print_dfloat32 ( float32 f, FILE * fp, const char * label )
+garmin_print_dfloat32 ( float32 f, garmin_writer * out, const char * label )
 {
   if ( f < 1.0e24 ) {
-    fprintf(fp," %s=\"",label);
-    garmin_print_float32(f,fp);
-    fprintf(fp,"\"");
+    garmin_write_char(out,' ');
+    garmin_write_str(out,label);
+    garmin_write_lit(out,"=\"");
+    garmin_print_float32(f,out);
+    garmin_write_char(out,'"');
   }
 }
 
@@ -303,7 +325,7 @@ garmin_print_dfloat32 ( float32 f, FILE * fp, const char * label )
 /* Print a duration and distance. */
 
 static void
-garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
+garmin_print_ddist ( uint32 dur, float32 dist, garmin_writer * out )
 {
   int  hun;
   int  sec;
@@ -321,9 +343,10 @@ garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
   dur /= 60;
   hrs  = dur;
 
-  fprintf(fp," duration=\"%d:%02d:%02d.%02d\" distance=\"",hrs,min,sec,hun);
-  garmin_print_float32(dist,fp);
-  fprintf(fp,"\"");
+  garmin_write_printf(out," duration=\"%d:%02d:%02d.%02d\" distance=\"",
+                      hrs,min,sec,hun);
+  garmin_print_float32(dist,out);
+  garmin_write_char(out,'"');
 }
 
 
@@ -332,13 +355,13 @@ garmin_print_ddist ( uint32 dur, float32 dist, FILE * fp )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d100 ( D100 * x, FILE * fp, int spaces )
+garmin_print_d100 ( D100 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",100,fp,spaces);
+  open_tag_with_type("waypoint",100,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -347,15 +370,15 @@ garmin_print_d100 ( D100 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d101 ( D101 * x, FILE * fp, int spaces )
+garmin_print_d101 ( D101 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",101,fp,spaces);
+  open_tag_with_type("waypoint",101,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -364,15 +387,15 @@ garmin_print_d101 ( D101 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d102 ( D102 * x, FILE * fp, int spaces )
+garmin_print_d102 ( D102 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",102,fp,spaces);
+  open_tag_with_type("waypoint",102,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -411,15 +434,15 @@ GARMIN_ENUM_NAME(103,dspl) {
 
 
 static void
-garmin_print_d103 ( D103 * x, FILE * fp, int spaces )
+garmin_print_d103 ( D103 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",103,fp,spaces);
+  open_tag_with_type("waypoint",103,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGSTR(1,"symbol",garmin_d103_smbl(x->smbl));
   GARMIN_TAGSTR(1,"display",garmin_d103_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -438,16 +461,16 @@ GARMIN_ENUM_NAME(104,dspl) {
 
 
 static void
-garmin_print_d104 ( D104 * x, FILE * fp, int spaces )
+garmin_print_d104 ( D104 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",104,fp,spaces);
+  open_tag_with_type("waypoint",104,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
   GARMIN_TAGF32(1,"proximity_distance",x->dst);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"display",garmin_d104_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -456,13 +479,13 @@ garmin_print_d104 ( D104 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d105 ( D105 * x, FILE * fp, int spaces )
+garmin_print_d105 ( D105 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",105,fp,spaces);
+  open_tag_with_type("waypoint",105,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->wpt_ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -471,9 +494,9 @@ garmin_print_d105 ( D105 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d106 ( D106 * x, FILE * fp, int spaces )
+garmin_print_d106 ( D106 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",106,fp,spaces);
+  open_tag_with_type("waypoint",106,out,spaces);
   GARMIN_TAGSTR(1,"class",(x->wpt_class)?"non-user":"user");
   if ( x->wpt_class != 0 ) {
     GARMIN_TAGU8B(1,"subclass",x->subclass,13);
@@ -482,7 +505,7 @@ garmin_print_d106 ( D106 * x, FILE * fp, int spaces )
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"link",x->lnk_ident);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -501,9 +524,9 @@ GARMIN_ENUM_NAME(107,clr) {
 
 
 static void
-garmin_print_d107 ( D107 * x, FILE * fp, int spaces )
+garmin_print_d107 ( D107 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",107,fp,spaces);
+  open_tag_with_type("waypoint",107,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->cmnt);
@@ -511,7 +534,7 @@ garmin_print_d107 ( D107 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"symbol",garmin_d103_smbl(x->smbl));
   GARMIN_TAGSTR(1,"display",garmin_d103_dspl(x->dspl));
   GARMIN_TAGSTR(1,"color",garmin_d107_clr(x->color));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -561,9 +584,9 @@ GARMIN_ENUM_NAME(108,color) {
 
 
 static void
-garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
+garmin_print_d108 ( D108 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",108,fp,spaces);
+  open_tag_with_type("waypoint",108,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->comment);
@@ -580,7 +603,7 @@ garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"addr",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -589,13 +612,13 @@ garmin_print_d108 ( D108 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d109 ( D109 * x, FILE * fp, int spaces )
+garmin_print_d109 ( D109 * x, garmin_writer * out, int spaces )
 {
   uint8 color = x->dspl_color & 0x1f;
 
   if ( color == 0x1f ) color = D108_default_color;
 
-  open_tag_with_type("waypoint",109,fp,spaces);
+  open_tag_with_type("waypoint",109,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGPOS(1,"position",x->posn);
   GARMIN_TAGSTR(1,"comment",x->comment);
@@ -614,7 +637,7 @@ garmin_print_d109 ( D109 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"addr",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -672,9 +695,9 @@ GARMIN_ENUM_NAME(110,dspl) {
 
 
 static void
-garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
+garmin_print_d110 ( D110 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",110,fp,spaces);
+  open_tag_with_type("waypoint",110,out,spaces);
   GARMIN_TAGHEX(1,"dtyp",x->dtyp);
   GARMIN_TAGSTR(1,"wpt_class",garmin_d110_wpt_class(x->wpt_class));
   GARMIN_TAGSTR(1,"color",garmin_d110_color((x->dspl_color) & 0x1f));
@@ -697,7 +720,7 @@ garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"city",x->city);
   GARMIN_TAGSTR(1,"address_number",x->addr);
   GARMIN_TAGSTR(1,"cross_road",x->cross_road);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -706,7 +729,7 @@ garmin_print_d110 ( D110 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d120 ( D120 * x, FILE * fp, int spaces )
+garmin_print_d120 ( D120 * x, garmin_writer * out, int spaces )
 {
   GARMIN_TAGSTR(0,"waypoint_category",x->name);
 }
@@ -731,9 +754,9 @@ GARMIN_ENUM_NAME(150,wpt_class) {
 
 
 static void
-garmin_print_d150 ( D150 * x, FILE * fp, int spaces )
+garmin_print_d150 ( D150 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",150,fp,spaces);
+  open_tag_with_type("waypoint",150,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d150_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -747,7 +770,7 @@ garmin_print_d150 ( D150 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D150_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -766,9 +789,9 @@ GARMIN_ENUM_NAME(151,wpt_class) {
 
 
 static void
-garmin_print_d151 ( D151 * x, FILE * fp, int spaces )
+garmin_print_d151 ( D151 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",151,fp,spaces);
+  open_tag_with_type("waypoint",151,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d151_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -783,7 +806,7 @@ garmin_print_d151 ( D151 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D151_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -804,9 +827,9 @@ GARMIN_ENUM_NAME(152,wpt_class) {
 
 
 static void
-garmin_print_d152 ( D152 * x, FILE * fp, int spaces )
+garmin_print_d152 ( D152 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",152,fp,spaces);
+  open_tag_with_type("waypoint",152,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d152_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -821,7 +844,7 @@ garmin_print_d152 ( D152 * x, FILE * fp, int spaces )
   if ( x->wpt_class == D152_apt_wpt_class ) {
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -846,9 +869,9 @@ GARMIN_ENUM_NAME(154,wpt_class) {
 
 
 static void
-garmin_print_d154 ( D154 * x, FILE * fp, int spaces )
+garmin_print_d154 ( D154 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",154,fp,spaces);
+  open_tag_with_type("waypoint",154,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d154_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -864,7 +887,7 @@ garmin_print_d154 ( D154 * x, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"altitude",x->alt);
   }
   GARMIN_TAGSYM(1,"symbol",x->smbl);
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -893,9 +916,9 @@ GARMIN_ENUM_NAME(155,dspl) {
 
 
 static void
-garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
+garmin_print_d155 ( D155 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("waypoint",155,fp,spaces);
+  open_tag_with_type("waypoint",155,out,spaces);
   GARMIN_TAGSTR(1,"ident",x->ident);
   GARMIN_TAGSTR(1,"class",garmin_d155_wpt_class(x->wpt_class));
   GARMIN_TAGPOS(1,"position",x->posn);
@@ -912,7 +935,7 @@ garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
   }
   GARMIN_TAGSYM(1,"symbol",x->smbl);
   GARMIN_TAGSTR(1,"display",garmin_d155_dspl(x->dspl));
-  close_tag("waypoint",fp,spaces);
+  close_tag("waypoint",out,spaces);
 }
 
 
@@ -921,10 +944,10 @@ garmin_print_d155 ( D155 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d200 ( D200 * x, FILE * fp, int spaces )
+garmin_print_d200 ( D200 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"200\" number=\"%d\"/>\n", *x);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<route_header type=\"200\" number=\"%d\"/>\n", *x);
 }
 
 
@@ -933,11 +956,11 @@ garmin_print_d200 ( D200 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d201 ( D201 * x, FILE * fp, int spaces )
+garmin_print_d201 ( D201 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"201\" number=\"%d\">%s</route_header>\n",
-          x->nmbr,x->cmnt);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<route_header type=\"201\" number=\"%d\">"
+                      "%s</route_header>\n",x->nmbr,x->cmnt);
 }
 
 
@@ -946,11 +969,11 @@ garmin_print_d201 ( D201 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d202 ( D202 * x, FILE * fp, int spaces )
+garmin_print_d202 ( D202 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_header type=\"202\" ident=\"%s\"/>\n",
-          x->rte_ident);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<route_header type=\"202\" ident=\"%s\"/>\n",
+                      x->rte_ident);
 }
 
 
@@ -970,13 +993,14 @@ GARMIN_ENUM_NAME(210,class) {
 
 
 static void
-garmin_print_d210 ( D210 * x, FILE * fp, int spaces )
+garmin_print_d210 ( D210 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<route_link type=\"210\" class=\"%s\" ident=\"%s\">\n",
-          garmin_d210_class(x->link_class),x->ident);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<route_link type=\"210\" class=\"%s\" "
+                      "ident=\"%s\">\n",
+                      garmin_d210_class(x->link_class),x->ident);
   GARMIN_TAGU8B(1,"route_link_subclass",x->subclass,18);
-  close_tag("route_link",fp,spaces);
+  close_tag("route_link",out,spaces);
 }
 
 
@@ -985,16 +1009,16 @@ garmin_print_d210 ( D210 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d300 ( D300 * p, FILE * fp, int spaces )
+garmin_print_d300 ( D300 * p, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"300\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<point type=\"300\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    garmin_write_lit(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  garmin_write_lit(out,"/>\n");
 }
 
 
@@ -1003,18 +1027,18 @@ garmin_print_d300 ( D300 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d301 ( D301 * p, FILE * fp, int spaces )
+garmin_print_d301 ( D301 * p, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"301\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->dpth,fp,"depth");
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<point type=\"301\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->dpth,out,"depth");
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    garmin_write_lit(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  garmin_write_lit(out,"/>\n");
 }
 
 
@@ -1023,19 +1047,19 @@ garmin_print_d301 ( D301 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d302 ( D302 * p, FILE * fp, int spaces )
+garmin_print_d302 ( D302 * p, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"302\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->dpth,fp,"depth");
-  garmin_print_dfloat32(p->temp,fp,"temperature");
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<point type=\"302\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->dpth,out,"depth");
+  garmin_print_dfloat32(p->temp,out,"temperature");
   if ( p->new_trk != 0 ) {
-    fprintf(fp," new=\"true\"");
+    garmin_write_lit(out," new=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  garmin_write_lit(out,"/>\n");
 
 }
 
@@ -1045,17 +1069,19 @@ garmin_print_d302 ( D302 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d303 ( D303 * p, FILE * fp, int spaces )
+garmin_print_d303 ( D303 * p, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"303\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<point type=\"303\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
   if ( p->heart_rate != 0 ) {
-    fprintf(fp," hr=\"%d\"",p->heart_rate);
+    garmin_write_lit(out," hr=\"");
+    garmin_write_uint(out,p->heart_rate);
+    garmin_write_char(out,'"');
   }
-  fprintf(fp,"/>\n");
+  garmin_write_lit(out,"/>\n");
 }
 
 
@@ -1064,24 +1090,28 @@ garmin_print_d303 ( D303 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d304 ( D304 * p, FILE * fp, int spaces )
+garmin_print_d304 ( D304 * p, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<point type=\"304\"");
-  garmin_print_dtime(p->time,fp,"time");
-  garmin_print_dpos(&p->posn,fp);
-  garmin_print_dfloat32(p->alt,fp,"alt");
-  garmin_print_dfloat32(p->distance,fp,"distance");
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<point type=\"304\"");
+  garmin_print_dtime(p->time,out,"time");
+  garmin_print_dpos(&p->posn,out);
+  garmin_print_dfloat32(p->alt,out,"alt");
+  garmin_print_dfloat32(p->distance,out,"distance");
   if ( p->heart_rate != 0 ) {
-    fprintf(fp," hr=\"%d\"", p->heart_rate);
+    garmin_write_lit(out," hr=\"");
+    garmin_write_uint(out,p->heart_rate);
+    garmin_write_char(out,'"');
   }
   if ( p->cadence != 0xff ) {
-    fprintf(fp, " cadence=\"%d\"", p->cadence);
+    garmin_write_lit(out," cadence=\"");
+    garmin_write_uint(out,p->cadence);
+    garmin_write_char(out,'"');
   }
   if ( p->sensor != 0 ) {
-    fprintf(fp, " sensor=\"true\"");
+    garmin_write_lit(out," sensor=\"true\"");
   }
-  fprintf(fp,"/>\n");
+  garmin_write_lit(out,"/>\n");
 }
 
 
@@ -1090,13 +1120,13 @@ garmin_print_d304 ( D304 * p, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d310 ( D310 * x, FILE * fp, int spaces )
+garmin_print_d310 ( D310 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"310\" ident=\"%s\" color=\"%s\" "
-          "display=\"%s\"/>\n",
-          x->trk_ident,garmin_d108_color(x->color),
-          (x->dspl) ? "true" : "false");
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<track type=\"310\" ident=\"%s\" color=\"%s\" "
+                      "display=\"%s\"/>\n",
+                      x->trk_ident,garmin_d108_color(x->color),
+                      (x->dspl) ? "true" : "false");
 }
 
 
@@ -1105,10 +1135,10 @@ garmin_print_d310 ( D310 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d311 ( D311 * h, FILE * fp, int spaces )
+garmin_print_d311 ( D311 * h, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"311\" index=\"%d\"/>\n",h->index);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<track type=\"311\" index=\"%d\"/>\n",h->index);
 }
 
 
@@ -1140,16 +1170,16 @@ GARMIN_ENUM_NAME(312,color) {
 
 
 static void
-garmin_print_d312 ( D312 * h,
-                    FILE *              fp,
-                    int                 spaces )
+garmin_print_d312 ( D312 *           h,
+                    garmin_writer *  out,
+                    int              spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<track type=\"312\" ident=\"%s\" color=\"%s\" "
-          "display=\"%s\"/>\n",
-          h->trk_ident,
-          garmin_d312_color(h->color),
-          (h->dspl) ? "true" : "false");
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<track type=\"312\" ident=\"%s\" color=\"%s\" "
+                      "display=\"%s\"/>\n",
+                      h->trk_ident,
+                      garmin_d312_color(h->color),
+                      (h->dspl) ? "true" : "false");
 }
 
 
@@ -1158,12 +1188,12 @@ garmin_print_d312 ( D312 * h,
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d400 ( D400 * x, FILE * fp, int spaces )
+garmin_print_d400 ( D400 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",400,fp,spaces);
-  garmin_print_d100(&x->wpt,fp,spaces+1);
+  open_tag_with_type("proximity_waypoint",400,out,spaces);
+  garmin_print_d100(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 }
 
 
@@ -1172,12 +1202,12 @@ garmin_print_d400 ( D400 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d403 ( D403 * x, FILE * fp, int spaces )
+garmin_print_d403 ( D403 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",403,fp,spaces);
-  garmin_print_d103(&x->wpt,fp,spaces+1);
+  open_tag_with_type("proximity_waypoint",403,out,spaces);
+  garmin_print_d103(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 }
 
 
@@ -1186,13 +1216,13 @@ garmin_print_d403 ( D403 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d450 ( D450 * x, FILE * fp, int spaces )
+garmin_print_d450 ( D450 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("proximity_waypoint",450,fp,spaces);
+  open_tag_with_type("proximity_waypoint",450,out,spaces);
   GARMIN_TAGINT(1,"index",x->idx);
-  garmin_print_d150(&x->wpt,fp,spaces+1);
+  garmin_print_d150(&x->wpt,out,spaces+1);
   GARMIN_TAGF32(1,"distance",x->dst);
-  close_tag("proximity_waypoint",fp,spaces);
+  close_tag("proximity_waypoint",out,spaces);
 
 }
 
@@ -1202,9 +1232,9 @@ garmin_print_d450 ( D450 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
+garmin_print_d500 ( D500 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("almanac",500,fp,spaces);
+  open_tag_with_type("almanac",500,out,spaces);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
   GARMIN_TAGF32(1,"afo",x->af0);
@@ -1216,7 +1246,7 @@ garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"omg0",x->omg0);
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1225,9 +1255,9 @@ garmin_print_d500 ( D500 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
+garmin_print_d501 ( D501 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("almanac",501,fp,spaces);
+  open_tag_with_type("almanac",501,out,spaces);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
   GARMIN_TAGF32(1,"afo",x->af0);
@@ -1240,7 +1270,7 @@ garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
   GARMIN_TAGINT(1,"hlth",x->hlth);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1249,9 +1279,9 @@ garmin_print_d501 ( D501 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
+garmin_print_d550 ( D550 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("almanac",550,fp,spaces);
+  open_tag_with_type("almanac",550,out,spaces);
   GARMIN_TAGINT(1,"svid",x->svid);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
@@ -1264,7 +1294,7 @@ garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"omg0",x->omg0);
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1273,9 +1303,9 @@ garmin_print_d550 ( D550 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
+garmin_print_d551 ( D551 * x, garmin_writer * out, int spaces )
 {
-  open_tag_with_type("almanac",551,fp,spaces);
+  open_tag_with_type("almanac",551,out,spaces);
   GARMIN_TAGINT(1,"svid",x->svid);
   GARMIN_TAGINT(1,"wn",x->wn);
   GARMIN_TAGF32(1,"toa",x->toa);
@@ -1289,7 +1319,7 @@ garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
   GARMIN_TAGF32(1,"odot",x->odot);
   GARMIN_TAGF32(1,"i",x->i);
   GARMIN_TAGINT(1,"hlth",x->hlth);
-  close_tag("almanac",fp,spaces);
+  close_tag("almanac",out,spaces);
 }
 
 
@@ -1298,12 +1328,12 @@ garmin_print_d551 ( D551 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d600 ( D600 * x, FILE * fp, int spaces )
+garmin_print_d600 ( D600 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<date_time type=\"600\">"
-          "%04d-%02d-%02d %02d:%02d:%02d</date_time>\n",
-          x->year,x->month,x->day,x->hour,x->minute,x->second);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<date_time type=\"600\">"
+                      "%04d-%02d-%02d %02d:%02d:%02d</date_time>\n",
+                      x->year,x->month,x->day,x->hour,x->minute,x->second);
 }
 
 
@@ -1312,9 +1342,9 @@ garmin_print_d600 ( D600 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
+garmin_print_d650 ( D650 * x, garmin_writer * out, int spaces )
 {
-  open_tag("flightbook type=\"650\"",fp,spaces);
+  open_tag("flightbook type=\"650\"",out,spaces);
   GARMIN_TAGU32(1,"takeoff_time",x->takeoff_time + TIME_OFFSET);
   GARMIN_TAGU32(1,"landing_time",x->takeoff_time + TIME_OFFSET);
   GARMIN_TAGPOS(1,"takeoff_position",x->takeoff_posn);
@@ -1331,7 +1361,7 @@ garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
   GARMIN_TAGSTR(1,"arrival_name",x->arrival_name);
   GARMIN_TAGSTR(1,"arrival_ident",x->arrival_ident);
   GARMIN_TAGSTR(1,"ac_id",x->ac_id);
-  close_tag("flightbook",fp,spaces);
+  close_tag("flightbook",out,spaces);
 }
 
 
@@ -1340,11 +1370,11 @@ garmin_print_d650 ( D650 * x, FILE * fp, int spaces )
 /* ------------------------------------------------------------------------- */
 
 static void
-garmin_print_d700 ( D700 * x, FILE * fp, int spaces )
+garmin_print_d700 ( D700 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<position type=\"700\" lat=\"%f\" lon=\"%f\"/>\n",
-          RAD2DEG(x->lat),RAD2DEG(x->lon));
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<position type=\"700\" lat=\"%f\" lon=\"%f\"/>\n",
+                      RAD2DEG(x->lat),RAD2DEG(x->lon));
 }
 
 
@@ -1365,28 +1395,28 @@ GARMIN_ENUM_NAME(800,fix) {
 
 
 static void
-garmin_print_d800 ( D800 * x, FILE * fp, int spaces )
+garmin_print_d800 ( D800 * x, garmin_writer * out, int spaces )
 {
-  open_tag("pvt type=\"800\"",fp,spaces);
+  open_tag("pvt type=\"800\"",out,spaces);
   GARMIN_TAGF32(1,"alt",x->alt);
   GARMIN_TAGF32(1,"epe",x->epe);
   GARMIN_TAGF32(1,"eph",x->eph);
   GARMIN_TAGF32(1,"epv",x->epv);
   GARMIN_TAGSTR(1,"position_fix",garmin_d800_fix(x->fix));
-  garmin_print_d700(&x->posn,fp,spaces+1);
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<velocity east=\"");
-  garmin_print_float32(x->east,fp);
-  fprintf(fp,"\" north=\"");
-  garmin_print_float32(x->north,fp);
-  fprintf(fp,"\" up=\"");
-  garmin_print_float32(x->up,fp);
-  fprintf(fp,"\"/>\n");
+  garmin_print_d700(&x->posn,out,spaces+1);
+  print_spaces(out,spaces+1);
+  garmin_write_lit(out,"<velocity east=\"");
+  garmin_print_float32(x->east,out);
+  garmin_write_lit(out,"\" north=\"");
+  garmin_print_float32(x->north,out);
+  garmin_write_lit(out,"\" up=\"");
+  garmin_print_float32(x->up,out);
+  garmin_write_lit(out,"\"/>\n");
   GARMIN_TAGF32(1,"msl_height",x->msl_hght);
   GARMIN_TAGINT(1,"leap_seconds",x->leap_scnds);
   GARMIN_TAGU32(1,"week_number_days",x->wn_days);
   GARMIN_TAGF64(1,"time_of_week",x->tow);
-  close_tag("pvt",fp,spaces);
+  close_tag("pvt",out,spaces);
 }
 
 
@@ -1395,13 +1425,13 @@ garmin_print_d800 ( D800 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
+garmin_print_d906 ( D906 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"906\"");
-  garmin_print_dtime(x->start_time,fp,"start");
-  garmin_print_ddist(x->total_time,x->total_distance,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  garmin_write_lit(out,"<lap type=\"906\"");
+  garmin_print_dtime(x->start_time,out,"start");
+  garmin_print_ddist(x->total_time,x->total_distance,out);
+  garmin_write_lit(out,">\n");
 
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
@@ -1425,7 +1455,7 @@ garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
     break;
   }
 
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
@@ -1434,7 +1464,7 @@ garmin_print_d906 ( D906 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 
-static void garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces );
+static void garmin_print_d1002 ( D1002 * x, garmin_writer * out, int spaces );
 
 
 GARMIN_ENUM_NAME(1000,sport_type) {
@@ -1454,27 +1484,27 @@ GARMIN_ENUM_NAME(1000,program_type) {
 
 
 static void
-garmin_print_d1000 ( D1000 * x, FILE * fp, int spaces )
+garmin_print_d1000 ( D1000 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1000\" track=\"%d\" sport=\"%s\">\n",
-          x->track_index,garmin_d1000_sport_type(x->sport_type));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-          x->first_lap_index, x->last_lap_index);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<run type=\"1000\" track=\"%d\" sport=\"%s\">\n",
+                      x->track_index,garmin_d1000_sport_type(x->sport_type));
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+                      x->first_lap_index, x->last_lap_index);
   GARMIN_TAGSTR(1,"program_type",
                 garmin_d1000_program_type(x->program_type));
   if ( x->program_type == D1000_virtual_partner ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
-            x->virtual_partner.time, x->virtual_partner.distance);
+    print_spaces(out,spaces+1);
+    garmin_write_printf(out,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
+                        x->virtual_partner.time, x->virtual_partner.distance);
   }
   if ( x->program_type == D1000_workout ) {
-    garmin_print_d1002(&x->workout,fp,spaces+1);
+    garmin_print_d1002(&x->workout,out,spaces+1);
   }
-  close_tag("run",fp,spaces);
+  close_tag("run",out,spaces);
 
-  garmin_print_d1002(&x->workout,fp,spaces+1);
+  garmin_print_d1002(&x->workout,out,spaces+1);
 }
 
 
@@ -1491,13 +1521,13 @@ GARMIN_ENUM_NAME(1001,intensity) {
 
 
 static void
-garmin_print_d1001 ( D1001 * x, FILE * fp, int spaces )
+garmin_print_d1001 ( D1001 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1001\" index=\"%d\"",x->index);
-  garmin_print_dtime(x->start_time,fp,"start");
-  garmin_print_ddist(x->total_time,x->total_dist,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<lap type=\"1001\" index=\"%d\"",x->index);
+  garmin_print_dtime(x->start_time,out,"start");
+  garmin_print_ddist(x->total_time,x->total_dist,out);
+  garmin_write_lit(out,">\n");
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
   }
@@ -1513,7 +1543,7 @@ garmin_print_d1001 ( D1001 * x, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"max_hr",x->max_heart_rate);
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(x->intensity));
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
@@ -1535,59 +1565,62 @@ GARMIN_ENUM_NAME(1002,duration_type) {
 
 
 static void
-garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces )
+garmin_print_d1002 ( D1002 * x, garmin_writer * out, int spaces )
 {
   unsigned int i;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<workout type=\"1002\" name=\"%s\" steps=\"%d\" "
-          "sport_type=\"%s\"",
-          x->name,x->num_valid_steps,garmin_d1000_sport_type(x->sport_type));
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<workout type=\"1002\" name=\"%s\" steps=\"%d\" "
+                      "sport_type=\"%s\"",
+                      x->name,x->num_valid_steps,
+                      garmin_d1000_sport_type(x->sport_type));
   if ( x->num_valid_steps > 0 ) {
-    fprintf(fp,">\n");
+    garmin_write_lit(out,">\n");
     for ( i = 0; i < x->num_valid_steps; i++ ) {
-      print_spaces(fp,spaces+1);
-      fprintf(fp,"<step name=\"%s\">\n",x->steps[i].custom_name);
+      print_spaces(out,spaces+1);
+      garmin_write_printf(out,"<step name=\"%s\">\n",x->steps[i].custom_name);
       GARMIN_TAGSTR(1,"intensity",
                     garmin_d1001_intensity(x->steps[i].intensity));
-      print_spaces(fp,spaces+1);
-      fprintf(fp,"<duration type=\"%s\">%d</duration>\n",
-              garmin_d1002_duration_type(x->steps[i].duration_type),
-              x->steps[i].duration_value);
-      print_spaces(fp,spaces+1);
+      print_spaces(out,spaces+1);
+      garmin_write_printf(out,"<duration type=\"%s\">%d</duration>\n",
+                          garmin_d1002_duration_type(x->steps[i].duration_type),
+                          x->steps[i].duration_value);
+      print_spaces(out,spaces+1);
       if ( x->steps[i].duration_type == D1002_repeat ) {
         switch ( x->steps[i].target_type ) {
         case 0:
-          fprintf(fp,"<target type=\"speed_zone\" "
-                  "value=\"%d\" low=\"%f m/s\" high=\"%f m/s\"/>\n",
-                  x->steps[i].target_value,
-                  x->steps[i].target_custom_zone_low,
-                  x->steps[i].target_custom_zone_high);
+          garmin_write_printf(out,"<target type=\"speed_zone\" "
+                              "value=\"%d\" low=\"%f m/s\" high=\"%f m/s\"/>\n",
+                              x->steps[i].target_value,
+                              x->steps[i].target_custom_zone_low,
+                              x->steps[i].target_custom_zone_high);
           break;
         case 1:
-          fprintf(fp,"<target type=\"heart_rate_zone\" "
-                  "value=\"%d\" low=\"%f%s\" high=\"%f%s\"/>\n",
-                  x->steps[i].target_value,
-                  x->steps[i].target_custom_zone_low,
-                  (x->steps[i].target_custom_zone_low <= 100) ? "%" : " bpm",
-                  x->steps[i].target_custom_zone_high,
-                  (x->steps[i].target_custom_zone_high <= 100) ? "%" : " bpm");
+          garmin_write_printf(out,"<target type=\"heart_rate_zone\" "
+                              "value=\"%d\" low=\"%f%s\" high=\"%f%s\"/>\n",
+                              x->steps[i].target_value,
+                              x->steps[i].target_custom_zone_low,
+                              (x->steps[i].target_custom_zone_low <= 100) ?
+                              "%" : " bpm",
+                              x->steps[i].target_custom_zone_high,
+                              (x->steps[i].target_custom_zone_high <= 100) ?
+                              "%" : " bpm");
           break;
         case 2:
-          fprintf(fp,"<target type=\"open\"/>\n");
+          garmin_write_lit(out,"<target type=\"open\"/>\n");
           break;
         default:
           break;
         }
       } else {
-        fprintf(fp,"<target type=\"repetitions\" value=\"%d\"/>\n",
-                x->steps[i].target_value);
+        garmin_write_printf(out,"<target type=\"repetitions\" value=\"%d\"/>\n",
+                            x->steps[i].target_value);
       }
-      close_tag("step",fp,spaces+1);
+      close_tag("step",out,spaces+1);
     }
-    close_tag("workout",fp,spaces);
+    close_tag("workout",out,spaces);
   } else {
-    fprintf(fp,"/>\n");
+    garmin_write_lit(out,"/>\n");
   }
 }
 
@@ -1597,11 +1630,11 @@ garmin_print_d1002 ( D1002 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1003 ( D1003 * x, FILE * fp, int spaces )
+garmin_print_d1003 ( D1003 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<workout_occurrence type=\"1003\" name=\"%s\" day=\"%u\"/>\n",
-          x->workout_name,x->day);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<workout_occurrence type=\"1003\" name=\"%s\" "
+                      "day=\"%u\"/>\n",x->workout_name,x->day);
 }
 
 
@@ -1610,47 +1643,48 @@ garmin_print_d1003 ( D1003 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1004 ( D1004 *  d, FILE * fp, int spaces )
+garmin_print_d1004 ( D1004 *  d, garmin_writer * out, int spaces )
 {
   int i;
   int j;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,
-          "<fitness_user_profile type=\"1004\" weight=\"%f\" "
-          "birth_date=\"%04d-%02d-%02d\" gender=\"%s\">\n",
-          d->weight,
-          d->birth_year,
-          d->birth_month,
-          d->birth_day,
-          (d->gender == D1004_male) ? "male" : "female");
-  open_tag("activities",fp,spaces+1);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,
+                      "<fitness_user_profile type=\"1004\" weight=\"%f\" "
+                      "birth_date=\"%04d-%02d-%02d\" gender=\"%s\">\n",
+                      d->weight,
+                      d->birth_year,
+                      d->birth_month,
+                      d->birth_day,
+                      (d->gender == D1004_male) ? "male" : "female");
+  open_tag("activities",out,spaces+1);
   for ( i = 0; i < 3; i++ ) {
-    print_spaces(fp,spaces+2);
-    fprintf(fp,"<activity gear_weight=\"%f\" max_hr=\"%d\">\n",
-            d->activities[i].gear_weight,
-            d->activities[i].max_heart_rate);
-    open_tag("hr_zones",fp,spaces+3);
+    print_spaces(out,spaces+2);
+    garmin_write_printf(out,"<activity gear_weight=\"%f\" max_hr=\"%d\">\n",
+                        d->activities[i].gear_weight,
+                        d->activities[i].max_heart_rate);
+    open_tag("hr_zones",out,spaces+3);
     for ( j = 0; j < 5; j++ ) {
-      print_spaces(fp,spaces+4);
-      fprintf(fp,"<hr_zone low=\"%d\" high=\"%d\"/>\n",
-              d->activities[i].heart_rate_zones[j].low_heart_rate,
-              d->activities[i].heart_rate_zones[j].high_heart_rate);
+      print_spaces(out,spaces+4);
+      garmin_write_printf(out,"<hr_zone low=\"%d\" high=\"%d\"/>\n",
+                          d->activities[i].heart_rate_zones[j].low_heart_rate,
+                          d->activities[i].heart_rate_zones[j].high_heart_rate);
     }
-    close_tag("hr_zones",fp,spaces+3);
-    open_tag("speed_zones",fp,spaces+3);
+    close_tag("hr_zones",out,spaces+3);
+    open_tag("speed_zones",out,spaces+3);
     for ( j = 0; j < 10; j++ ) {
-      print_spaces(fp,spaces+4);
-      fprintf(fp,"<speed_zone low=\"%f\" high=\"%f\" name=\"%s\"/>\n",
-              d->activities[i].speed_zones[j].low_speed,
-              d->activities[i].speed_zones[j].high_speed,
-              d->activities[i].speed_zones[j].name);
+      print_spaces(out,spaces+4);
+      garmin_write_printf(out,"<speed_zone low=\"%f\" high=\"%f\" "
+                          "name=\"%s\"/>\n",
+                          d->activities[i].speed_zones[j].low_speed,
+                          d->activities[i].speed_zones[j].high_speed,
+                          d->activities[i].speed_zones[j].name);
     }
-    close_tag("speed_zones",fp,spaces+3);
-    close_tag("activity",fp,spaces+2);
+    close_tag("speed_zones",out,spaces+3);
+    close_tag("activity",out,spaces+2);
   }
-  close_tag("activities",fp,spaces+1);
-  close_tag("fitness_user_profile",fp,spaces);
+  close_tag("activities",out,spaces+1);
+  close_tag("fitness_user_profile",out,spaces);
 }
 
 
@@ -1659,15 +1693,15 @@ garmin_print_d1004 ( D1004 *  d, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1005 ( D1005 * limits, FILE * fp, int spaces )
+garmin_print_d1005 ( D1005 * limits, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,
-          "<workout_limits type=\"1005\" workouts=\"%d\" unscheduled=\"%d\" "
-          "occurrences=\"%d\"/>\n",
-          limits->max_workouts,
-          limits->max_unscheduled_workouts,
-          limits->max_occurrences);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,
+                      "<workout_limits type=\"1005\" workouts=\"%d\" "
+                      "unscheduled=\"%d\" occurrences=\"%d\"/>\n",
+                      limits->max_workouts,
+                      limits->max_unscheduled_workouts,
+                      limits->max_occurrences);
 }
 
 
@@ -1676,14 +1710,14 @@ garmin_print_d1005 ( D1005 * limits, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1006 ( D1006 * x, FILE * fp, int spaces )
+garmin_print_d1006 ( D1006 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course type=\"1006\" index=\"%d\" name=\"%s\" "
-          "track_index=\"%d\"/>\n",
-          x->index,
-          x->course_name,
-          x->track_index);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<course type=\"1006\" index=\"%d\" name=\"%s\" "
+                      "track_index=\"%d\"/>\n",
+                      x->index,
+                      x->course_name,
+                      x->track_index);
 }
 
 
@@ -1692,14 +1726,15 @@ garmin_print_d1006 ( D1006 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
+garmin_print_d1007 ( D1007 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_lap type=\"1007\" course_index=\"%d\" lap_index=\"%d\"",
-          x->course_index,
-          x->lap_index);
-  garmin_print_ddist(x->total_time,x->total_dist,fp);
-  fprintf(fp,">\n");
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<course_lap type=\"1007\" course_index=\"%d\" "
+                      "lap_index=\"%d\"",
+                      x->course_index,
+                      x->lap_index);
+  garmin_print_ddist(x->total_time,x->total_dist,out);
+  garmin_write_lit(out,">\n");
   if ( x->begin.lat != 0x7fffffff && x->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",x->begin);
   }
@@ -1711,7 +1746,7 @@ garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
   if ( x->avg_cadence != 0xff ) GARMIN_TAGINT(1,"avg_cadence",x->avg_cadence);
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(x->intensity));
 
-  close_tag("course_lap",fp,spaces);
+  close_tag("course_lap",out,spaces);
 }
 
 
@@ -1721,11 +1756,11 @@ garmin_print_d1007 ( D1007 * x, FILE * fp, int spaces )
 
 
 static void
-garmin_print_d1008 ( D1008 * w, FILE * fp, int spaces )
+garmin_print_d1008 ( D1008 * w, garmin_writer * out, int spaces )
 {
   /* For some reason, D1008 is identical to D1002. */
 
-  garmin_print_d1002((D1002 *)w,fp,spaces);
+  garmin_print_d1002((D1002 *)w,out,spaces);
 }
 
 
@@ -1743,54 +1778,54 @@ GARMIN_ENUM_NAME(1009,multisport) {
 
 
 static void
-garmin_print_d1009 ( D1009 * run, FILE * fp, int spaces )
+garmin_print_d1009 ( D1009 * run, garmin_writer * out, int spaces )
 {
   int npt = 0;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1009\" track=\"%d\" sport=\"%s\" "
-          "multisport=\"%s\">\n",
-          run->track_index,garmin_d1000_sport_type(run->sport_type),
-          garmin_d1009_multisport(run->multisport));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-          run->first_lap_index, run->last_lap_index);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<run type=\"1009\" track=\"%d\" sport=\"%s\" "
+                      "multisport=\"%s\">\n",
+                      run->track_index,garmin_d1000_sport_type(run->sport_type),
+                      garmin_d1009_multisport(run->multisport));
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+                      run->first_lap_index, run->last_lap_index);
 
   if ( run->program_type != 0 ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<program_type>");
+    print_spaces(out,spaces+1);
+    garmin_write_lit(out,"<program_type>");
     if ( run->program_type & 0x01 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "virtual_partner");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "virtual_partner");
     }
     if ( run->program_type & 0x02 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "workout");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "workout");
     }
     if ( run->program_type & 0x04 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "quick_workout");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "quick_workout");
     }
     if ( run->program_type & 0x08 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "course");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "course");
     }
     if ( run->program_type & 0x10 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "interval_workout");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "interval_workout");
     }
     if ( run->program_type & 0x20 ) {
-      fprintf(fp,"%s%s",(npt++) ? ", " : "", "auto_multisport");
+      garmin_write_printf(out,"%s%s",(npt++) ? ", " : "", "auto_multisport");
     }
-    fprintf(fp,"</program_type>\n");
+    garmin_write_lit(out,"</program_type>\n");
   }
 
   if ( run->program_type & 0x02 ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<quick_workout time=\"%u\" distance=\"%f\"/>\n",
-            run->quick_workout.time, run->quick_workout.distance);
+    print_spaces(out,spaces+1);
+    garmin_write_printf(out,"<quick_workout time=\"%u\" distance=\"%f\"/>\n",
+                        run->quick_workout.time, run->quick_workout.distance);
   }
 
   if ( run->program_type & 0x01 ) {
-    garmin_print_d1008(&run->workout,fp,spaces+1);
+    garmin_print_d1008(&run->workout,out,spaces+1);
   }
 
-  close_tag("run",fp,spaces);
+  close_tag("run",out,spaces);
 }
 
 
@@ -1809,25 +1844,25 @@ GARMIN_ENUM_NAME(1010,program_type) {
 
 
 static void
-garmin_print_d1010 ( D1010 * x, FILE * fp, int spaces )
+garmin_print_d1010 ( D1010 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<run type=\"1010\" track=\"%d\" sport=\"%s\" "
-          "multisport=\"%s\">\n",
-          x->track_index,garmin_d1000_sport_type(x->sport_type),
-          garmin_d1009_multisport(x->multisport));
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<laps first=\"%u\" last=\"%u\"/>\n",
-          x->first_lap_index, x->last_lap_index);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<run type=\"1010\" track=\"%d\" sport=\"%s\" "
+                      "multisport=\"%s\">\n",
+                      x->track_index,garmin_d1000_sport_type(x->sport_type),
+                      garmin_d1009_multisport(x->multisport));
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<laps first=\"%u\" last=\"%u\"/>\n",
+                      x->first_lap_index, x->last_lap_index);
   GARMIN_TAGSTR(1,"program_type",
                 garmin_d1010_program_type(x->program_type));
   if ( x->program_type == D1010_virtual_partner ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
-            x->virtual_partner.time, x->virtual_partner.distance);
+    print_spaces(out,spaces+1);
+    garmin_write_printf(out,"<virtual_partner time=\"%u\" distance=\"%f\"/>\n",
+                        x->virtual_partner.time, x->virtual_partner.distance);
   }
-  garmin_print_d1002(&x->workout,fp,spaces+1);
-  close_tag("run",fp,spaces);
+  garmin_print_d1002(&x->workout,out,spaces+1);
+  close_tag("run",out,spaces);
 }
 
 
@@ -1847,14 +1882,14 @@ GARMIN_ENUM_NAME(1011,trigger_method) {
 
 
 static void
-garmin_print_d1011 ( D1011 * lap, FILE * fp, int spaces )
+garmin_print_d1011 ( D1011 * lap, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1011\" index=\"%d\"",lap->index);
-  garmin_print_dtime(lap->start_time,fp,"start");
-  garmin_print_ddist(lap->total_time,lap->total_dist,fp);
-  fprintf(fp," trigger=\"%s\">\n",
-          garmin_d1011_trigger_method(lap->trigger_method));
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<lap type=\"1011\" index=\"%d\"",lap->index);
+  garmin_print_dtime(lap->start_time,out,"start");
+  garmin_print_ddist(lap->total_time,lap->total_dist,out);
+  garmin_write_printf(out," trigger=\"%s\">\n",
+                      garmin_d1011_trigger_method(lap->trigger_method));
   if ( lap->begin.lat != 0x7fffffff && lap->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",lap->begin);
   }
@@ -1873,7 +1908,7 @@ garmin_print_d1011 ( D1011 * lap, FILE * fp, int spaces )
     GARMIN_TAGINT(1,"avg_cadence",lap->avg_cadence);
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(lap->intensity));
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
@@ -1904,15 +1939,15 @@ GARMIN_ENUM_NAME(1012,point_type) {
 
 
 static void
-garmin_print_d1012 ( D1012 * x, FILE * fp, int spaces )
+garmin_print_d1012 ( D1012 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_point type=\"1012\" course_index=\"%d\" "
-          "name=\"%s\" type=\"%s\">\n",
-          x->course_index,x->name,
-          garmin_d1012_point_type(x->point_type));
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<course_point type=\"1012\" course_index=\"%d\" "
+                      "name=\"%s\" type=\"%s\">\n",
+                      x->course_index,x->name,
+                      garmin_d1012_point_type(x->point_type));
   GARMIN_TAGU32(1,"track_point_time",x->track_point_time);
-  close_tag("course_point",fp,spaces);
+  close_tag("course_point",out,spaces);
 }
 
 
@@ -1921,15 +1956,15 @@ garmin_print_d1012 ( D1012 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1013 ( D1013 * x, FILE * fp, int spaces )
+garmin_print_d1013 ( D1013 * x, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<course_limits type=\"1013\" courses=\"%d\" laps=\"%d\" "
-          "points=\"%d\" track_points=\"%d\"/>\n",
-          x->max_courses,
-          x->max_course_laps,
-          x->max_course_pnt,
-          x->max_course_trk_pnt);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<course_limits type=\"1013\" courses=\"%d\" "
+                      "laps=\"%d\" points=\"%d\" track_points=\"%d\"/>\n",
+                      x->max_courses,
+                      x->max_course_laps,
+                      x->max_course_pnt,
+                      x->max_course_trk_pnt);
 }
 
 
@@ -1938,14 +1973,14 @@ garmin_print_d1013 ( D1013 * x, FILE * fp, int spaces )
 /* --------------------------------------------------------------------------*/
 
 static void
-garmin_print_d1015 ( D1015 * lap, FILE * fp, int spaces )
+garmin_print_d1015 ( D1015 * lap, garmin_writer * out, int spaces )
 {
-  print_spaces(fp,spaces);
-  fprintf(fp,"<lap type=\"1015\" index=\"%d\"",lap->index);
-  garmin_print_dtime(lap->start_time,fp,"start");
-  garmin_print_ddist(lap->total_time,lap->total_dist,fp);
-  fprintf(fp," trigger=\"%s\">\n",
-          garmin_d1011_trigger_method(lap->trigger_method));
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<lap type=\"1015\" index=\"%d\"",lap->index);
+  garmin_print_dtime(lap->start_time,out,"start");
+  garmin_print_ddist(lap->total_time,lap->total_dist,out);
+  garmin_write_printf(out," trigger=\"%s\">\n",
+                      garmin_d1011_trigger_method(lap->trigger_method));
   if ( lap->begin.lat != 0x7fffffff && lap->begin.lon != 0x7fffffff ) {
     GARMIN_TAGPOS(1,"begin_pos",lap->begin);
   }
@@ -1965,19 +2000,19 @@ garmin_print_d1015 ( D1015 * lap, FILE * fp, int spaces )
   }
   GARMIN_TAGSTR(1,"intensity",garmin_d1001_intensity(lap->intensity));
   GARMIN_TAGU8B(1,"unknown",lap->unknown,5);
-  close_tag("lap",fp,spaces);
+  close_tag("lap",out,spaces);
 }
 
 
 /* ========================================================================= */
-/* garmin_print_data                                                         */
+/* garmin_write_data                                                         */
 /* ========================================================================= */
 
 void
-garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
+garmin_write_data ( garmin_data * d, garmin_writer * out, int spaces )
 {
 #define CASE_PRINT(x) \
-  case data_D##x: garmin_print_d##x(d->data,fp,spaces); break
+  case data_D##x: garmin_print_d##x(d->data,out,spaces); break
 
   switch ( d->type ) {
   CASE_PRINT(list);
@@ -2038,8 +2073,8 @@ garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
   CASE_PRINT(1013);
   CASE_PRINT(1015);
   default:
-    print_spaces(fp,spaces);
-    fprintf(fp,"<data type=\"%d\"/>\n",d->type);
+    print_spaces(out,spaces);
+    garmin_write_printf(out,"<data type=\"%d\"/>\n",d->type);
     break;
   }
 
@@ -2048,100 +2083,100 @@ garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
 
 
 /* ========================================================================= */
-/* garmin_print_protocols                                                    */
+/* garmin_write_protocols                                                    */
 /* ========================================================================= */
 
 void
-garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
+garmin_write_protocols ( garmin_unit * garmin, garmin_writer * out, int spaces )
 {
 #define PROTO1_AND_DATA(x)                                                \
   do {                                                                    \
     if ( garmin->protocol.x != appl_Anil ) {                              \
-      print_spaces(fp,spaces+1);                                          \
-      fprintf(fp,"<garmin_" #x                                            \
-              " protocol=\"A%03d\" " #x "=\"D%03d\"/>\n",                 \
-              garmin->protocol.x, garmin->datatype.x);                    \
+      print_spaces(out,spaces+1);                                         \
+      garmin_write_printf(out,"<garmin_" #x                               \
+                          " protocol=\"A%03d\" " #x "=\"D%03d\"/>\n",     \
+                          garmin->protocol.x, garmin->datatype.x);        \
     }                                                                     \
   } while ( 0 )
 
 #define PROTO2_AND_DATA(x,y)                                              \
   do {                                                                    \
     if ( garmin->protocol.x.y != appl_Anil ) {                            \
-      print_spaces(fp,spaces+2);                                          \
-      fprintf(fp,"<garmin_" #x "_" #y                                     \
-              " protocol=\"A%03d\" " #y "=\"D%03d\"/>\n",                 \
-              garmin->protocol.x.y, garmin->datatype.x.y);                \
+      print_spaces(out,spaces+2);                                         \
+      garmin_write_printf(out,"<garmin_" #x "_" #y                        \
+                          " protocol=\"A%03d\" " #y "=\"D%03d\"/>\n",     \
+                          garmin->protocol.x.y, garmin->datatype.x.y);    \
     }                                                                     \
   } while ( 0 )
 
-  open_tag("garmin_protocols",fp,spaces);
+  open_tag("garmin_protocols",out,spaces);
 
   /* Physical */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_physical protocol=\"P%03d\"/>\n",
-          garmin->protocol.physical);
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<garmin_physical protocol=\"P%03d\"/>\n",
+                      garmin->protocol.physical);
 
   /* Link */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_link protocol=\"L%03d\"/>\n",
-          garmin->protocol.link);
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<garmin_link protocol=\"L%03d\"/>\n",
+                      garmin->protocol.link);
 
   /* Command */
 
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_command protocol=\"A%03d\"/>\n",
-          garmin->protocol.command);
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<garmin_command protocol=\"A%03d\"/>\n",
+                      garmin->protocol.command);
 
   /* Waypoint */
 
   if ( garmin->protocol.waypoint.waypoint  != appl_Anil ||
        garmin->protocol.waypoint.category  != appl_Anil ||
        garmin->protocol.waypoint.proximity != appl_Anil ) {
-    open_tag("garmin_waypoint",fp,spaces+1);
+    open_tag("garmin_waypoint",out,spaces+1);
     PROTO2_AND_DATA(waypoint,waypoint);
     PROTO2_AND_DATA(waypoint,category);
     PROTO2_AND_DATA(waypoint,proximity);
-    close_tag("garmin_waypoint",fp,spaces+1);
+    close_tag("garmin_waypoint",out,spaces+1);
   }
 
   /* Route */
 
   if ( garmin->protocol.route != appl_Anil ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<garmin_route protocol=\"A%03d\"",
-            garmin->protocol.route);
+    print_spaces(out,spaces+1);
+    garmin_write_printf(out,"<garmin_route protocol=\"A%03d\"",
+                        garmin->protocol.route);
     if ( garmin->datatype.route.header != data_Dnil ) {
-      fprintf(fp," header=\"D%03d\"",
-              garmin->datatype.route.header);
+      garmin_write_printf(out," header=\"D%03d\"",
+                          garmin->datatype.route.header);
     }
     if ( garmin->datatype.route.waypoint != data_Dnil ) {
-      fprintf(fp," waypoint=\"D%03d\"",
-              garmin->datatype.route.waypoint);
+      garmin_write_printf(out," waypoint=\"D%03d\"",
+                          garmin->datatype.route.waypoint);
     }
     if ( garmin->datatype.route.link != data_Dnil ) {
-      fprintf(fp," link=\"D%03d\"",
-              garmin->datatype.route.link);
+      garmin_write_printf(out," link=\"D%03d\"",
+                          garmin->datatype.route.link);
     }
-    fprintf(fp,"/>\n");
+    garmin_write_lit(out,"/>\n");
   }
 
   /* Track */
 
   if ( garmin->protocol.track != appl_Anil ) {
-    print_spaces(fp,spaces+1);
-    fprintf(fp,"<garmin_track protocol=\"A%03d\"",
-            garmin->protocol.track);
+    print_spaces(out,spaces+1);
+    garmin_write_printf(out,"<garmin_track protocol=\"A%03d\"",
+                        garmin->protocol.track);
     if ( garmin->datatype.track.header != data_Dnil ) {
-      fprintf(fp," header=\"D%03d\"",
-              garmin->datatype.track.header);
+      garmin_write_printf(out," header=\"D%03d\"",
+                          garmin->datatype.track.header);
     }
     if ( garmin->datatype.track.data != data_Dnil ) {
-      fprintf(fp," data=\"D%03d\"",
-              garmin->datatype.track.data);
+      garmin_write_printf(out," data=\"D%03d\"",
+                          garmin->datatype.track.data);
     }
-    fprintf(fp,"/>\n");
+    garmin_write_lit(out,"/>\n");
   }
 
   /* Almanac, Date/Time, FlightBook, Position, PVT, Lap, Run */
@@ -2159,11 +2194,11 @@ garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
   if ( garmin->protocol.workout.workout     != appl_Anil ||
        garmin->protocol.workout.occurrence  != appl_Anil ||
        garmin->protocol.workout.limits      != appl_Anil ) {
-    open_tag("garmin_workout",fp,spaces+1);
+    open_tag("garmin_workout",out,spaces+1);
     PROTO2_AND_DATA(workout,workout);
     PROTO2_AND_DATA(workout,occurrence);
     PROTO2_AND_DATA(workout,limits);
-    close_tag("garmin_workout",fp,spaces+1);
+    close_tag("garmin_workout",out,spaces+1);
   }
 
   /* Fitness user profile */
@@ -2177,33 +2212,33 @@ garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
        garmin->protocol.course.track  != appl_Anil ||
        garmin->protocol.course.point  != appl_Anil ||
        garmin->protocol.course.limits != appl_Anil ) {
-    open_tag("garmin_course",fp,spaces+1);
+    open_tag("garmin_course",out,spaces+1);
     PROTO2_AND_DATA(course,course);
     PROTO2_AND_DATA(course,lap);
 
     if ( garmin->protocol.course.track != appl_Anil ) {
-      print_spaces(fp,spaces+2);
-      fprintf(fp,"<garmin_course_track protocol=\"A%03d\"",
-              garmin->protocol.course.track);
+      print_spaces(out,spaces+2);
+      garmin_write_printf(out,"<garmin_course_track protocol=\"A%03d\"",
+                          garmin->protocol.course.track);
       if ( garmin->datatype.course.track.header != data_Dnil ) {
-        fprintf(fp," header=\"D%03d\"",
-                garmin->datatype.course.track.header);
+        garmin_write_printf(out," header=\"D%03d\"",
+                            garmin->datatype.course.track.header);
       }
       if ( garmin->datatype.course.track.data != data_Dnil ) {
-        fprintf(fp," data=\"D%03d\"",
-                garmin->datatype.course.track.data);
+        garmin_write_printf(out," data=\"D%03d\"",
+                            garmin->datatype.course.track.data);
       }
-      close_tag("garmin_course_track",fp,spaces+1);
+      close_tag("garmin_course_track",out,spaces+1);
     }
 
     PROTO2_AND_DATA(course,point);
     PROTO2_AND_DATA(course,limits);
-    close_tag("garmin_course",fp,spaces+1);
+    close_tag("garmin_course",out,spaces+1);
   }
 
   /* All done. */
 
-  close_tag("garmin_protocols",fp,spaces);
+  close_tag("garmin_protocols",out,spaces);
 
 #undef PROTO1_AND_DATA
 #undef PROTO2_AND_DATA
@@ -2211,32 +2246,75 @@ garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
 
 
 void
-garmin_print_info ( garmin_unit * unit, FILE * fp, int spaces )
+garmin_write_info ( garmin_unit * unit, garmin_writer * out, int spaces )
 {
   char ** s;
 
-  print_spaces(fp,spaces);
-  fprintf(fp,"<garmin_unit id=\"%x\">\n",unit->id);
-  print_spaces(fp,spaces+1);
-  fprintf(fp,"<garmin_product id=\"%d\" software_version=\"%.2f\">\n",
-          unit->product.product_id,unit->product.software_version/100.0);
+  print_spaces(out,spaces);
+  garmin_write_printf(out,"<garmin_unit id=\"%x\">\n",unit->id);
+  print_spaces(out,spaces+1);
+  garmin_write_printf(out,"<garmin_product id=\"%d\" "
+                      "software_version=\"%.2f\">\n",
+                      unit->product.product_id,
+                      unit->product.software_version/100.0);
   GARMIN_TAGSTR(2,"product_description",unit->product.product_description);
   if ( unit->product.additional_data != NULL ) {
-    open_tag("additional_data_list",fp,spaces+2);
+    open_tag("additional_data_list",out,spaces+2);
     for ( s = unit->product.additional_data; s != NULL && *s != NULL; s++ ) {
       GARMIN_TAGSTR(3,"additional_data",*s);
     }
-    close_tag("additional_data_list",fp,spaces+2);
+    close_tag("additional_data_list",out,spaces+2);
   }
-  close_tag("garmin_product",fp,spaces+1);
+  close_tag("garmin_product",out,spaces+1);
   if ( unit->extended.ext_data != NULL ) {
-    open_tag("extended_data_list",fp,spaces+1);
+    open_tag("extended_data_list",out,spaces+1);
     for ( s = unit->extended.ext_data; s != NULL && *s != NULL; s++ ) {
       GARMIN_TAGSTR(2,"extended_data",*s);
     }
-    close_tag("extended_data_list",fp,spaces+1);
+    close_tag("extended_data_list",out,spaces+1);
   }
-  garmin_print_protocols(unit,fp,spaces+1);
-  close_tag("garmin_unit",fp,spaces);
+  garmin_write_protocols(unit,out,spaces+1);
+  close_tag("garmin_unit",out,spaces);
+}
+
+
+/* ========================================================================= */
+/* The same, to a FILE                                                       */
+/* ========================================================================= */
+
+#define PRINT_BUFFER  4096
+
+void
+garmin_print_data ( garmin_data * d, FILE * fp, int spaces )
+{
+  garmin_writer  out;
+  char           buf[PRINT_BUFFER];
+
+  garmin_writer_init(&out,fp,buf,sizeof(buf));
+  garmin_write_data(d,&out,spaces);
+  garmin_writer_flush(&out);
 }
 
+
+void
+garmin_print_protocols ( garmin_unit * garmin, FILE * fp, int spaces )
+{
+  garmin_writer  out;
+  char           buf[PRINT_BUFFER];
+
+  garmin_writer_init(&out,fp,buf,sizeof(buf));
+  garmin_write_protocols(garmin,&out,spaces);
+  garmin_writer_flush(&out);
+}
+
+
+void
+garmin_print_info ( garmin_unit * unit, FILE * fp, int spaces )
+{
+  garmin_writer  out;
+  char           buf[PRINT_BUFFER];
+
+  garmin_writer_init(&out,fp,buf,sizeof(buf));
+  garmin_write_info(unit,&out,spaces);
+  garmin_writer_flush(&out);
+}
@@ -219,14 +219,14 @@ garmin_read_singleton ( garmin_unit *     garmin,
                         garmin_datatype   type )
 {
   garmin_data *     d = NULL;
-  garmin_packet     p;
+  garmin_packet *   p;
   link_protocol     link = garmin->protocol.link;
   garmin_pid        ppid;
 
-  if ( garmin_read(garmin,&p) > 0 ) {
-    ppid = garmin_gpid(link,garmin_packet_id(&p));
+  if ( garmin_read_packet(garmin,&p) > 0 ) {
+    ppid = garmin_gpid(link,garmin_packet_id(p));
     if ( ppid == pid ) {
-      d = garmin_unpack_packet(&p,type);
+      d = garmin_unpack_packet(p,type);
     } else {
       /* Expected pid but got something else. */
       printf("garmin_read_singleton: expected %d, got %d\n",pid,ppid);
@@ -240,174 +240,203 @@ garmin_read_singleton ( garmin_unit *     garmin,
 }
 
 
-/* Read a Pid_Records, (pid)+, Pid_Xfer_Cmplt sequence. */
+/*
+   Ask the unit to stop the current transfer, and throw away whatever it
+   had already sent, up to the Pid_Xfer_Cmplt or until the link goes quiet.
+   A unit that can't abort still sends the rest of the transfer, which is
+   drained all the same so the next command doesn't read it.  The reads
+   already queued are used for the drain, and cancelled by the caller.
+*/
 
-static garmin_data *
-garmin_read_records ( garmin_unit *     garmin,
-                      garmin_pid        pid,
-                      garmin_datatype   type )
+static void
+garmin_abort_transfer ( garmin_unit * garmin )
 {
-  garmin_data *     d         = NULL;
-  garmin_list *     l         = NULL;
-  garmin_packet     p;
-  link_protocol     link      = garmin->protocol.link;
-  int               done      = 0;
-  int               expected  = 0;
-  int               got       = 0;
-  garmin_pid        ppid;
-
-  if ( garmin_read(garmin,&p) > 0 ) {
-    ppid = garmin_gpid(link,garmin_packet_id(&p));
-    if ( ppid == Pid_Records ) {
-      expected = get_uint16(p.packet.data);
-
-      if ( garmin->verbose != 0 ) {
-        printf("[garmin] Pid_Records indicates %d packets to follow\n",
-               expected);
-      }
+  garmin_packet * p;
+  link_protocol   link = garmin->protocol.link;
 
-      /* Allocate a list for the records. */
+  if ( garmin_command_supported(garmin,Cmnd_Abort_Transfer) ) {
+    garmin_send_command(garmin,Cmnd_Abort_Transfer);
+  }
+  while ( garmin_read_packet(garmin,&p) > 0 &&
+          garmin_gpid(link,garmin_packet_id(p)) != Pid_Xfer_Cmplt );
+}
 
-      d = garmin_alloc_data(data_Dlist);
-      l = (garmin_list *)d->data;
 
-      /*
-         Now we expect packets with the given packet_id and datatype, up
-         until the final packet, which is a Pid_Xfer_Cmplt.
-      */
+/*
+   Records of a transfer follow a small grammar over up to three packet
+   ids: (pid1)+, (pid1, (pid2)+)+ or (pid1, (pid2, pid3)+)+.  Given the
+   position 'at' of the previous record in the grammar (-1 before the
+   first), return the position of a record with packet id 'ppid', or -1
+   if it may not come next.
+*/
 
-      while ( !done && garmin_read(garmin,&p) > 0 ) {
-        ppid = garmin_gpid(link,garmin_packet_id(&p));
-        if ( ppid == Pid_Xfer_Cmplt ) {
-          if ( got != expected ) {
-            /* Incorrect number of packets received. */
-            printf("garmin_read_records: expected %d packets, got %d\n",
-                   expected,got);
-          } else if ( garmin->verbose != 0 ) {
-            printf("[garmin] all %d expected packets received\n",got);
-          }
-          done = 1;
-        } else if ( ppid == pid ) {
-          garmin_list_append(l,garmin_unpack_packet(&p,type));
-          got++;
-        } else {
-          /* Unexpected packet ID! */
-          done = 1;
-        }
-      }
-    } else {
-      /* Expected Pid_Records but got something else. */
-      printf("garmin_read_records: expected Pid_Records, got %d\n",ppid);
-    }
-  } else {
-    /* Failed to read the Pid_Records packet off the link. */
-    printf("garmin_read_records: failed to read Pid_Records packet\n");
+static int
+garmin_next_position ( int                 n,
+                       int                 at,
+                       garmin_pid          ppid,
+                       const garmin_pid *  pid )
+{
+  if ( at < 0 ) {
+    return ( ppid == pid[0] ) ? 0 : -1;
+  } else if ( at < n - 1 ) {
+    return ( ppid == pid[at+1] ) ? at + 1 : -1;
+  } else if ( n > 1 && ppid == pid[1] ) {
+    return 1;
+  } else if ( ppid == pid[0] ) {
+    return 0;
   }
 
-  return d;
+  return -1;
 }
 
 
-/* Read a Pid_Records, (pid1, (pid2)+)+, Pid_Xfer_Cmplt sequence. */
+/*
+   Read a Pid_Records, (records)+, Pid_Xfer_Cmplt sequence, where the
+   records follow the grammar of the 'n' packet ids in 'pid'.  The records
+   are collected in a list, or handed to garmin->sink one at a time if the
+   unit has a sink installed, in which case the list stays empty.  The
+   sink is also told when the transfer starts, and may skip records or
+   have the transfer aborted (see garmin_sink in garmin.h).
+*/
 
 static garmin_data *
-garmin_read_records2 ( garmin_unit *     garmin,
-                       garmin_pid        pid1,
-                       garmin_datatype   type1,
-                       garmin_pid        pid2,
-                       garmin_datatype   type2 )
+garmin_read_sequence ( garmin_unit *            garmin,
+                       const char *             name,
+                       int                      n,
+                       const garmin_pid *       pid,
+                       const garmin_datatype *  type )
 {
   garmin_data *     d         = NULL;
+  garmin_data *     r;
   garmin_list *     l         = NULL;
-  garmin_packet     p;
+  garmin_packet *   p;
+  garmin_record     rec;
   link_protocol     link      = garmin->protocol.link;
+  garmin_sink       sink      = garmin->sink;
   int               expected  = 0;
   int               got       = 0;
-  int               state     = 0;
+  int               at        = -1;
+  int               action    = GARMIN_SINK_CONTINUE;
   garmin_pid        ppid;
 
-  if ( garmin_read(garmin,&p) > 0 ) {
-    ppid = garmin_gpid(link,garmin_packet_id(&p));
+  if ( garmin_read_packet(garmin,&p) > 0 ) {
+    ppid = garmin_gpid(link,garmin_packet_id(p));
     if ( ppid == Pid_Records ) {
-      expected = get_uint16(p.packet.data);
+      expected = get_uint16(p->packet.data);
 
       if ( garmin->verbose != 0 ) {
         printf("[garmin] Pid_Records indicates %d packets to follow\n",
                expected);
       }
 
+      /*
+         Keep reads for the records (and the final Pid_Xfer_Cmplt) queued
+         so that the unit can send the next packet while we unpack this one.
+      */
+
+      garmin_queue_reads(garmin,expected+1);
+
       /* Allocate a list for the records. */
 
       d = garmin_alloc_data(data_Dlist);
       l = (garmin_list *)d->data;
+      rec.expected = expected;
+      if ( sink == NULL ) garmin_list_reserve(l,expected);
+
+      if ( sink != NULL ) {
+        rec.pid      = pid[0];
+        rec.position = -1;
+        rec.index    = 0;
+        action = sink(NULL,&rec,garmin->sink_data);
+      }
 
-      while ( state >= 0 && garmin_read(garmin,&p) > 0 ) {
-        ppid = garmin_gpid(link,garmin_packet_id(&p));
+      while ( action != GARMIN_SINK_STOP &&
+              garmin_read_packet(garmin,&p) > 0 ) {
+        ppid = garmin_gpid(link,garmin_packet_id(p));
         if ( ppid == Pid_Xfer_Cmplt ) {
           /* transfer complete! */
           if ( got != expected ) {
             /* wrong number of packets received! */
-            printf("garmin_read_records2: expected %d packets, got %d\n",
-                   expected,got);
+            printf("%s: expected %d packets, got %d\n",name,expected,got);
           } else if ( garmin->verbose != 0 ) {
             printf("[garmin] all %d expected packets received\n",got);
           }
           break;
         }
-        switch ( state ) {
-        case 0:  /* want pid1 */
-          if ( ppid == pid1 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type1));
-            state = 1;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        case 1:  /* want pid2 */
-          if ( ppid == pid2 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type2));
-            state = 2;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        case 2: /* want pid2 or pid1 */
-          if ( ppid == pid1 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type1));
-            state = 1;
-            got++;
-          } else if ( ppid == pid2 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type2));
-            state = 2;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        default:
-          state = -1;
+
+        if ( (at = garmin_next_position(n,at,ppid,pid)) < 0 ) {
+          /* Unexpected packet received. */
+          printf("%s: unexpected packet %d received\n",name,ppid);
           break;
         }
+
+        /* Records the sink has skipped are not even unpacked. */
+
+        if ( action == GARMIN_SINK_SKIP && at != 0 ) {
+          got++;
+          continue;
+        }
+
+        r = garmin_unpack_packet(p,type[at]);
+        if ( sink == NULL ) {
+          garmin_list_append(l,r);
+        } else if ( r != NULL ) {
+          rec.pid      = ppid;
+          rec.position = at;
+          rec.index    = got;
+          action = sink(r,&rec,garmin->sink_data);
+        }
+        got++;
       }
-      if ( state < 0 ) {
-        /* Unexpected packet received. */
-        printf("garmin_read_records2: unexpected packet %d received\n",ppid);
+
+      if ( action == GARMIN_SINK_STOP ) {
+        if ( garmin->verbose != 0 ) {
+          printf("[garmin] aborting transfer after %d of %d packets\n",
+                 got,expected);
+        }
+        garmin_abort_transfer(garmin);
       }
+      garmin_cancel_reads(garmin);
     } else {
       /* Expected Pid_Records but got something else. */
-      printf("garmin_read_records2: expected Pid_Records, got %d\n",ppid);
+      printf("%s: expected Pid_Records, got %d\n",name,ppid);
     }
   } else {
     /* Failed to read the Pid_Records packet off the link. */
-    printf("garmin_read_records2: failed to read Pid_Records packet\n");
+    printf("%s: failed to read Pid_Records packet\n",name);
   }
 
   return d;
 }
 
 
+/* Read a Pid_Records, (pid)+, Pid_Xfer_Cmplt sequence. */
+
+static garmin_data *
+garmin_read_records ( garmin_unit *     garmin,
+                      garmin_pid        pid,
+                      garmin_datatype   type )
+{
+  return garmin_read_sequence(garmin,"garmin_read_records",1,&pid,&type);
+}
+
+
+/* Read a Pid_Records, (pid1, (pid2)+)+, Pid_Xfer_Cmplt sequence. */
+
+static garmin_data *
+garmin_read_records2 ( garmin_unit *     garmin,
+                       garmin_pid        pid1,
+                       garmin_datatype   type1,
+                       garmin_pid        pid2,
+                       garmin_datatype   type2 )
+{
+  garmin_pid       pid[2]  = { pid1, pid2 };
+  garmin_datatype  type[2] = { type1, type2 };
+
+  return garmin_read_sequence(garmin,"garmin_read_records2",2,pid,type);
+}
+
+
 /* Read a Pid_Records, (pid1, (pid2, pid3)+)+, Pid_Xfer_Cmplt sequence. */
 
 static garmin_data *
@@ -419,103 +448,10 @@ garmin_read_records3 ( garmin_unit *     garmin,
                        garmin_pid        pid3,
                        garmin_datatype   type3 )
 {
-  garmin_data *     d         = NULL;
-  garmin_list *     l         = NULL;
-  garmin_packet     p;
-  link_protocol     link      = garmin->protocol.link;
-  int               expected  = 0;
-  int               got       = 0;
-  garmin_pid        ppid;
-  int               state     = 0;
-
-  if ( garmin_read(garmin,&p) > 0 ) {
-    ppid = garmin_gpid(link,garmin_packet_id(&p));
-    if ( ppid == Pid_Records ) {
-      expected = get_uint16(p.packet.data);
-
-      if ( garmin->verbose != 0 ) {
-        printf("[garmin] Pid_Records indicates %d packets to follow\n",
-               expected);
-      }
+  garmin_pid       pid[3]  = { pid1, pid2, pid3 };
+  garmin_datatype  type[3] = { type1, type2, type3 };
 
-      /* Allocate a list for the records. */
-
-      d = garmin_alloc_data(data_Dlist);
-      l = (garmin_list *)d->data;
-
-      while ( state >= 0 && garmin_read(garmin,&p) > 0 ) {
-        ppid = garmin_gpid(link,garmin_packet_id(&p));
-        if ( ppid == Pid_Xfer_Cmplt ) {
-          /* transfer complete! */
-          if ( got != expected ) {
-            /* wrong number of packets received! */
-            printf("garmin_read_records3: expected %d packets, got %d\n",
-                   expected,got);
-          } else if ( garmin->verbose != 0 ) {
-            printf("[garmin] all %d expected packets received\n",got);
-          }
-          break;
-        }
-        switch ( state ) {
-        case 0:  /* want pid1 */
-          if ( ppid == pid1 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type1));
-            state = 1;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        case 1:  /* want pid2 */
-          if ( ppid == pid2 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type2));
-            state = 2;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        case 2: /* want pid3 */
-          if ( ppid == pid3 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type3));
-            state = 3;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        case 3: /* want pid2 or pid1 */
-          if ( ppid == pid1 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type1));
-            state = 1;
-            got++;
-          } else if ( ppid == pid2 ) {
-            garmin_list_append(l,garmin_unpack_packet(&p,type2));
-            state = 2;
-            got++;
-          } else {
-            state = -1;
-          }
-          break;
-        default:
-          state = -1;
-          break;
-        }
-      }
-      if ( state < 0 ) {
-        /* Unexpected packet received. */
-        printf("garmin_read_records3: unexpected packet %d received\n",ppid);
-      }
-    } else {
-      /* Expected Pid_Records but got something else. */
-      printf("garmin_read_records3: expected Pid_Records, got %d\n",ppid);
-    }
-  } else {
-    /* Failed to read the Pid_Records packet off the link. */
-    printf("garmin_read_records3: failed to read Pid_Records packet\n");
-  }
-
-  return d;
+  return garmin_read_sequence(garmin,"garmin_read_records3",3,pid,type);
 }
 
 
@@ -1178,27 +1114,119 @@ garmin_get ( garmin_unit * garmin, garmin_get_type what )
 }
 
 
+/*
+   Like garmin_get, but every record of a record transfer is handed to
+   'sink' as soon as it has been unpacked instead of being collected in a
+   list.  The returned data has the same shape as that of garmin_get, with
+   the record lists left empty.
+*/
+
+garmin_data *
+garmin_stream ( garmin_unit *    garmin,
+                garmin_get_type  what,
+                garmin_sink      sink,
+                void *           user )
+{
+  garmin_data * data;
+
+  garmin->sink      = sink;
+  garmin->sink_data = user;
+
+  data = garmin_get(garmin,what);
+
+  garmin->sink      = NULL;
+  garmin->sink_data = NULL;
+
+  return data;
+}
+
+
 /* Initialize a connection with a Garmin unit. */
 
+static int
+garmin_connect_one ( garmin_unit * garmin )
+{
+  if ( garmin_open(garmin) != 0 ) {
+    garmin_start_session(garmin);
+    if ( garmin->usb.unit_id == 0 || garmin->usb.unit_id == garmin->id ) {
+
+      /*
+         Only real units are cached: the handshake is part of a capture,
+         so a replay has to go through it.
+      */
+
+      if ( garmin->transport != NULL &&
+           garmin->transport != &garmin_usb_transport ) {
+        garmin_read_a000_a001(garmin);
+      } else if ( garmin->use_cache == 0 ||
+                  garmin_load_capabilities(garmin) == 0 ) {
+        garmin_read_a000_a001(garmin);
+        garmin_save_capabilities(garmin);
+      }
+      return 1;
+    }
+  }
+
+  /* Release the USB context as well, so a failed attempt leaks nothing. */
+
+  garmin_close(garmin);
+
+  return 0;
+}
+
+
+/*
+   Open and start a session with the unit selected by garmin->usb.bus,
+   garmin->usb.address and garmin->usb.unit_id.  When only a unit id is given,
+   every attached Garmin device is tried until one reports that id.
+   Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_connect ( garmin_unit * garmin )
+{
+  garmin_device  devices[GARMIN_MAX_DEVICES];
+  int            n;
+  int            i;
+
+  if ( garmin->usb.unit_id == 0 ||
+       garmin->usb.bus != 0 || garmin->usb.address != 0 ||
+       (garmin->transport != NULL &&
+        garmin->transport != &garmin_usb_transport) ) {
+    return garmin_connect_one(garmin);
+  }
+
+  n = garmin_enumerate(devices,GARMIN_MAX_DEVICES);
+  for ( i = 0; i < n; i++ ) {
+    garmin->usb.bus     = devices[i].bus;
+    garmin->usb.address = devices[i].address;
+    if ( garmin_connect_one(garmin) != 0 ) return 1;
+  }
+  garmin->usb.bus     = 0;
+  garmin->usb.address = 0;
+
+  return 0;
+}
+
+
 int
 garmin_init ( garmin_unit * garmin, int verbose )
 {
   memset(garmin,0,sizeof(garmin_unit));
   garmin->verbose = verbose;
 
-  if ( garmin_open(garmin) != 0 ) {
-    garmin_start_session(garmin);
-    garmin_read_a000_a001(garmin);
-    return 1;
-  } else {
-    return 0;
-  }
+  return garmin_connect(garmin);
 }
 
 int
 garmin_shutdown (garmin_unit *garmin)
 {
     char **it = NULL;
+
+    if (garmin->transport != NULL && garmin->transport->release != NULL) {
+        garmin->transport->release (garmin);
+    }
+
     free (garmin->product.product_description);
     for (it = garmin->product.additional_data; it && *it; it++) {
         free(*it);
@@ -0,0 +1,279 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "garmin.h"
+
+
+/*
+   Live PVT (A800) streaming.
+
+   Once Cmnd_Start_Pvt_Data has been sent, the unit reports a D800 fix
+   about once a second until it is told to stop.  A reader thread owns the
+   unit while the stream runs and puts each fix into a ring buffer.  There
+   is only one producer and one consumer, so the ring itself needs no
+   lock: the producer alone moves 'head' and the consumer alone moves
+   'tail'.  The mutex and condition variable are only there so that a
+   consumer can sleep until the next fix arrives.
+
+   If the consumer falls behind and the ring fills up, new fixes are
+   dropped (and counted) rather than overwriting ones not yet read.
+*/
+
+#define PVT_RUNNING   0
+#define PVT_STOPPING  1
+#define PVT_DONE      2
+
+#define PVT_DEFAULT_SIZE  16
+
+
+struct garmin_pvt_stream {
+  garmin_unit *     garmin;
+  pthread_t         thread;
+  D800 *            ring;
+  uint32            mask;       /* ring size - 1 (size is a power of 2) */
+  _Atomic uint32    head;       /* fixes written, by the reader thread  */
+  _Atomic uint32    tail;       /* fixes read, by the consumer          */
+  _Atomic uint32    dropped;    /* fixes lost because the ring was full */
+  _Atomic int       state;
+  pthread_mutex_t   lock;
+  pthread_cond_t    ready;
+};
+
+
+/* Wake up a consumer waiting in garmin_pvt_wait. */
+
+static void
+garmin_pvt_signal ( garmin_pvt_stream * s )
+{
+  pthread_mutex_lock(&s->lock);
+  pthread_cond_broadcast(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+}
+
+
+/* Add a fix to the ring.  Only ever called from the reader thread. */
+
+static void
+garmin_pvt_push ( garmin_pvt_stream * s, D800 * fix )
+{
+  uint32 head = atomic_load_explicit(&s->head,memory_order_relaxed);
+  uint32 tail = atomic_load_explicit(&s->tail,memory_order_acquire);
+
+  if ( head - tail > s->mask ) {
+    atomic_fetch_add_explicit(&s->dropped,1,memory_order_relaxed);
+    return;
+  }
+
+  s->ring[head & s->mask] = *fix;
+  atomic_store_explicit(&s->head,head+1,memory_order_release);
+  garmin_pvt_signal(s);
+}
+
+
+static void *
+garmin_pvt_reader ( void * arg )
+{
+  garmin_pvt_stream * s      = arg;
+  garmin_unit *       garmin = s->garmin;
+  garmin_packet *     p;
+  garmin_data *       d;
+  int                 r;
+
+  while ( atomic_load(&s->state) == PVT_RUNNING ) {
+    if ( (r = garmin_read_packet(garmin,&p)) < 0 ) break;
+
+    /* A read that times out just means no fix yet. */
+
+    if ( r == 0 ||
+         garmin_packet_type(p) != GARMIN_PROTOCOL_APP ||
+         garmin_gpid(garmin->protocol.link,
+                     garmin_packet_id(p)) != Pid_Pvt_Data ) {
+      continue;
+    }
+
+    if ( (d = garmin_unpack_packet(p,garmin->datatype.pvt)) != NULL ) {
+      if ( d->type == data_D800 && d->data != NULL ) {
+        garmin_pvt_push(s,d->data);
+      }
+      garmin_free_data(d);
+    }
+  }
+
+  /* Only tell the unit to stop if we were asked to; otherwise it's gone. */
+
+  if ( atomic_load(&s->state) == PVT_STOPPING ) {
+    garmin_send_command(garmin,Cmnd_Stop_Pvt_Data);
+  }
+
+  atomic_store(&s->state,PVT_DONE);
+  garmin_pvt_signal(s);
+
+  return NULL;
+}
+
+
+/*
+   Start streaming PVT data from a connected unit.  Up to 'size' fixes are
+   buffered (0 picks a default), rounded up to a power of two.  The unit
+   must not be used for anything else until garmin_pvt_stop is called.
+   Returns NULL if the unit doesn't do A800/D800 or the stream can't be
+   started.
+*/
+
+garmin_pvt_stream *
+garmin_pvt_start ( garmin_unit * garmin, int size )
+{
+  garmin_pvt_stream * s;
+  uint32              n = 1;
+
+  if ( garmin->protocol.pvt != appl_A800 ||
+       garmin->datatype.pvt != data_D800 ) {
+    printf("garmin_pvt_start: unit does not support PVT data\n");
+    return NULL;
+  }
+
+  if ( size <= 0 ) size = PVT_DEFAULT_SIZE;
+  while ( n < (uint32)size ) n <<= 1;
+
+  if ( (s = calloc(1,sizeof(garmin_pvt_stream))) == NULL ||
+       (s->ring = calloc(n,sizeof(D800))) == NULL ) {
+    free(s);
+    return NULL;
+  }
+
+  s->garmin = garmin;
+  s->mask   = n - 1;
+  pthread_mutex_init(&s->lock,NULL);
+  pthread_cond_init(&s->ready,NULL);
+
+  if ( garmin_send_command(garmin,Cmnd_Start_Pvt_Data) == 0 ||
+       pthread_create(&s->thread,NULL,garmin_pvt_reader,s) != 0 ) {
+    printf("garmin_pvt_start: could not start the PVT stream\n");
+    pthread_cond_destroy(&s->ready);
+    pthread_mutex_destroy(&s->lock);
+    free(s->ring);
+    free(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+
+/*
+   Take the oldest fix from the stream without blocking.  Returns 1 if a
+   fix was copied to 'fix', 0 if none is waiting, or -1 if none is waiting
+   and the stream has ended.
+*/
+
+int
+garmin_pvt_poll ( garmin_pvt_stream * s, D800 * fix )
+{
+  uint32 tail = atomic_load_explicit(&s->tail,memory_order_relaxed);
+  uint32 head = atomic_load_explicit(&s->head,memory_order_acquire);
+
+  if ( head == tail ) {
+    return ( atomic_load(&s->state) == PVT_DONE &&
+             atomic_load_explicit(&s->head,memory_order_acquire) == tail )
+      ? -1 : 0;
+  }
+
+  *fix = s->ring[tail & s->mask];
+  atomic_store_explicit(&s->tail,tail+1,memory_order_release);
+
+  return 1;
+}
+
+
+/*
+   Like garmin_pvt_poll, but wait up to 'timeout' milliseconds for a fix
+   to arrive.  A negative timeout waits for as long as it takes.
+*/
+
+int
+garmin_pvt_wait ( garmin_pvt_stream * s, D800 * fix, int timeout )
+{
+  struct timespec deadline;
+  int             r;
+
+  if ( (r = garmin_pvt_poll(s,fix)) != 0 || timeout == 0 ) return r;
+
+  clock_gettime(CLOCK_REALTIME,&deadline);
+  deadline.tv_sec  += timeout / 1000;
+  deadline.tv_nsec += (timeout % 1000) * 1000000L;
+  if ( deadline.tv_nsec >= 1000000000L ) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  /* The producer signals under the lock, so no wakeup is lost here. */
+
+  pthread_mutex_lock(&s->lock);
+  while ( (r = garmin_pvt_poll(s,fix)) == 0 ) {
+    if ( timeout < 0 ) {
+      pthread_cond_wait(&s->ready,&s->lock);
+    } else if ( pthread_cond_timedwait(&s->ready,&s->lock,
+                                       &deadline) == ETIMEDOUT ) {
+      r = garmin_pvt_poll(s,fix);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return r;
+}
+
+
+/* The number of fixes thrown away so far because the consumer was slow. */
+
+uint32
+garmin_pvt_dropped ( garmin_pvt_stream * s )
+{
+  return atomic_load_explicit(&s->dropped,memory_order_relaxed);
+}
+
+
+/*
+   Stop the stream and free it.  This waits for the reader thread, which
+   notices the request once its current read returns, so it may take up to
+   one read timeout.
+*/
+
+void
+garmin_pvt_stop ( garmin_pvt_stream * s )
+{
+  int running = PVT_RUNNING;
+
+  if ( s == NULL ) return;
+
+  atomic_compare_exchange_strong(&s->state,&running,PVT_STOPPING);
+  pthread_join(s->thread,NULL);
+
+  pthread_cond_destroy(&s->ready);
+  pthread_mutex_destroy(&s->lock);
+  free(s->ring);
+  free(s);
+}
@@ -0,0 +1,145 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include "garmin.h"
+
+
+/*
+   A bounded, blocking FIFO of pointers, for handing work from one thread
+   to another.  A producer that gets too far ahead waits for room, so a
+   fast stage can't pile up an unbounded amount of data in front of a slow
+   one.  Closing the queue lets the consumer drain what is left and then
+   see the end.
+*/
+
+struct garmin_queue {
+  void **           items;
+  int               capacity;
+  int               head;       /* next item to pop     */
+  int               count;      /* items in the queue   */
+  int               closed;
+  pthread_mutex_t   lock;
+  pthread_cond_t    not_empty;
+  pthread_cond_t    not_full;
+};
+
+
+garmin_queue *
+garmin_queue_new ( int capacity )
+{
+  garmin_queue * q;
+
+  if ( capacity <= 0 ) capacity = 1;
+
+  if ( (q = calloc(1,sizeof(garmin_queue))) == NULL ||
+       (q->items = calloc(capacity,sizeof(void *))) == NULL ) {
+    free(q);
+    return NULL;
+  }
+
+  q->capacity = capacity;
+  pthread_mutex_init(&q->lock,NULL);
+  pthread_cond_init(&q->not_empty,NULL);
+  pthread_cond_init(&q->not_full,NULL);
+
+  return q;
+}
+
+
+/*
+   Add an item to the back of the queue, waiting for room if it is full.
+   Returns 1, or 0 if the queue has been closed (the item is not added).
+*/
+
+int
+garmin_queue_push ( garmin_queue * q, void * item )
+{
+  int ok = 0;
+
+  pthread_mutex_lock(&q->lock);
+  while ( q->count == q->capacity && q->closed == 0 ) {
+    pthread_cond_wait(&q->not_full,&q->lock);
+  }
+  if ( q->closed == 0 ) {
+    q->items[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    ok = 1;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return ok;
+}
+
+
+/*
+   Take the item at the front of the queue, waiting for one if it is empty.
+   Returns NULL once the queue is closed and everything has been taken.
+*/
+
+void *
+garmin_queue_pop ( garmin_queue * q )
+{
+  void * item = NULL;
+
+  pthread_mutex_lock(&q->lock);
+  while ( q->count == 0 && q->closed == 0 ) {
+    pthread_cond_wait(&q->not_empty,&q->lock);
+  }
+  if ( q->count > 0 ) {
+    item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return item;
+}
+
+
+/* No more items will be pushed; wake everyone waiting on the queue. */
+
+void
+garmin_queue_close ( garmin_queue * q )
+{
+  pthread_mutex_lock(&q->lock);
+  q->closed = 1;
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_cond_broadcast(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+/* Free the queue.  Items still in it are the caller's problem. */
+
+void
+garmin_queue_free ( garmin_queue * q )
+{
+  if ( q == NULL ) return;
+
+  pthread_cond_destroy(&q->not_full);
+  pthread_cond_destroy(&q->not_empty);
+  pthread_mutex_destroy(&q->lock);
+  free(q->items);
+  free(q);
+}
@@ -0,0 +1,425 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "garmin.h"
+
+
+/*
+   A garmin_reader walks a .gmn file one record at a time, reading it
+   through a stdio buffer.  Only the record being looked at is decoded and
+   kept; lists are not built.  When the reader reaches a list it reports
+   the list itself (with no data, but with its id and element count), and
+   then the elements of the list, one level deeper.  So memory use depends
+   on the nesting and on the largest single record, not on the size of
+   the file.
+
+   Depth 0 is a chunk of the file (normally the one top level list), depth
+   1 an element of that list, and so on.  The index chunk of a version 2
+   file is not data, and reading stops when it is reached.
+
+   garmin_reader_seek_time skips ahead to a track point by time, using the
+   index if the file has one.
+
+   A compressed list of track points (see points.c) is read whole and
+   expanded, and its elements are then read from memory; to the caller it
+   is just a list.
+*/
+
+#define READER_MAX_DEPTH  16
+
+
+typedef struct garmin_reader_list {
+  uint32   id;
+  uint32   left;      /* elements still to come */
+} garmin_reader_list;
+
+
+struct garmin_reader {
+  FILE *               fp;
+  const char *         filename;
+  garmin_reader_list   lists[READER_MAX_DEPTH];
+  int                  depth;     /* lists we are inside of   */
+  uint8 *              buf;       /* the packed current record */
+  uint32               bufsize;
+  garmin_data *        data;      /* the decoded current record */
+  garmin_datatype      type;
+  int                  cur_depth;
+  uint32               list_id;
+  uint32               elements;
+  int                  failed;
+  int                  pending;   /* next returns the current record again */
+  int                  seeked;    /* inside the track list, via the index */
+  uint8 *              mem;       /* an expanded list, being read */
+  uint32               mem_pos;
+  uint32               mem_size;
+};
+
+
+/* Read exactly 'size' bytes.  Returns 0 at the end of the file or on error. */
+
+static int
+garmin_reader_read ( garmin_reader * r, void * buf, uint32 size )
+{
+  if ( size == 0 ) return 1;
+
+  if ( r->mem != NULL ) {
+    if ( size > r->mem_size - r->mem_pos ) return 0;
+    memcpy(buf,r->mem + r->mem_pos,size);
+    if ( (r->mem_pos += size) == r->mem_size ) {
+      free(r->mem);
+      r->mem = NULL;
+    }
+    return 1;
+  }
+
+  if ( fread(buf,size,1,r->fp) != 1 ) {
+    if ( ferror(r->fp) ) {
+      fprintf(stderr,"%s: read: %s\n",r->filename,strerror(errno));
+    }
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/* Open a .gmn file for reading record by record.  Returns NULL on error. */
+
+garmin_reader *
+garmin_reader_open ( const char * filename )
+{
+  garmin_reader * r;
+
+  if ( (r = calloc(1,sizeof(garmin_reader))) == NULL ) return NULL;
+
+  if ( (r->fp = fopen(filename,"rb")) == NULL ) {
+    fprintf(stderr,"%s: open: %s\n",filename,strerror(errno));
+    free(r);
+    return NULL;
+  }
+
+  r->filename = filename;
+  r->type     = data_Dnil;
+
+  return r;
+}
+
+
+/* Make room for a record of 'size' bytes. */
+
+static int
+garmin_reader_reserve ( garmin_reader * r, uint32 size )
+{
+  uint8 * p;
+
+  if ( size > r->bufsize ) {
+    if ( (p = realloc(r->buf,size)) == NULL ) {
+      fprintf(stderr,"garmin_reader_next: %s: out of memory\n",r->filename);
+      return 0;
+    }
+    r->buf     = p;
+    r->bufsize = size;
+  }
+
+  return 1;
+}
+
+
+/*
+   Step into the record whose type and size have just been read.  A list
+   only has its header read; anything else is read whole and unpacked.
+*/
+
+static int
+garmin_reader_record ( garmin_reader * r, uint32 type, uint32 size )
+{
+  uint8    head[8];
+  uint8 *  pos;
+  uint32   used;
+
+  r->type     = type;
+  r->elements = 0;
+
+  if ( type == GARMIN_POINTS_TYPE ) {
+    if ( r->mem != NULL ) {
+      fprintf(stderr,"garmin_reader_next: %s: compressed list in a compressed list\n",
+              r->filename);
+      return 0;
+    }
+    if ( garmin_reader_reserve(r,size) == 0 ||
+         garmin_reader_read(r,r->buf,size) == 0 ) {
+      return 0;
+    }
+    r->mem = garmin_expand_points(r->buf,r->buf + size,&used,&r->mem_size);
+    if ( r->mem == NULL || used != size ) {
+      fprintf(stderr,"garmin_reader_next: %s: corrupt list of track points\n",
+              r->filename);
+      return 0;
+    }
+    r->mem_pos = 0;
+    r->type    = type = data_Dlist;
+    size       = r->mem_size;
+  }
+
+  if ( type == data_Dlist ) {
+    if ( size < 8 || garmin_reader_read(r,head,8) == 0 ) return 0;
+    if ( r->depth == READER_MAX_DEPTH ) {
+      fprintf(stderr,"garmin_reader_next: %s: lists nested too deep\n",r->filename);
+      return 0;
+    }
+    r->list_id  = get_uint32(head);
+    r->elements = get_uint32(head + 4);
+    r->lists[r->depth].id   = r->list_id;
+    r->lists[r->depth].left = r->elements;
+    r->depth++;
+    return 1;
+  }
+
+  if ( garmin_reader_reserve(r,size) == 0 ||
+       garmin_reader_read(r,r->buf,size) == 0 ) {
+    return 0;
+  }
+
+  /* A type we don't know is reported with no data. */
+
+  pos = r->buf;
+  if ( (r->data = garmin_unpack(&pos,type)) != NULL && pos - r->buf != size ) {
+    fprintf(stderr,"garmin_reader_next: %s: unpacked %d bytes (expecting %u)\n",
+            r->filename,(int)(pos - r->buf),size);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+   Move to the next record.  Returns 1 if there is one, 0 at the end of the
+   file and -1 if the file is corrupt.  The record's data (NULL for a list
+   or a type we can't decode) belongs to the reader and is freed by the
+   next call.
+*/
+
+int
+garmin_reader_next ( garmin_reader * r, garmin_data ** data )
+{
+  uint8   head[GARMIN_HEADER + 8];
+  uint32  id;
+  uint32  type;
+  uint32  size;
+  size_t  got;
+
+  if ( r->pending ) {
+    r->pending = 0;
+    *data = r->data;
+    return 1;
+  }
+
+  *data = NULL;
+
+  if ( r->data != NULL ) {
+    garmin_free_data(r->data);
+    r->data = NULL;
+  }
+  if ( r->failed ) return -1;
+
+  /* Leave the lists we have read all of. */
+
+  while ( r->depth > 0 && r->lists[r->depth-1].left == 0 ) r->depth--;
+
+  r->cur_depth = r->depth;
+
+  if ( r->depth == 0 ) {
+
+    /* After a seek through the index, the track list was all there was. */
+
+    if ( r->seeked ) return 0;
+
+    /* The start of a chunk, the index, or the end of the file. */
+
+    if ( (got = fread(head,1,sizeof(head),r->fp)) == 0 && !ferror(r->fp) ) {
+      return 0;
+    }
+    if ( got != sizeof(head) ||
+         memcmp(head,GARMIN_MAGIC,strlen(GARMIN_MAGIC)) != 0 ) {
+      fprintf(stderr,"garmin_reader_next: %s: not a .gmn file\n",r->filename);
+      r->failed = 1;
+      return -1;
+    }
+    type       = get_uint32(head + GARMIN_HEADER);
+    size       = get_uint32(head + GARMIN_HEADER + 4);
+    r->list_id = 0;
+    if ( type == GARMIN_INDEX_TYPE ) return 0;
+
+  } else {
+
+    /* The next element of the innermost list. */
+
+    if ( garmin_reader_read(r,head,12) == 0 ) {
+      fprintf(stderr,"garmin_reader_next: %s: truncated list\n",r->filename);
+      r->failed = 1;
+      return -1;
+    }
+    id   = get_uint32(head);
+    type = get_uint32(head + 4);
+    size = get_uint32(head + 8);
+    r->lists[r->depth-1].left--;
+    r->list_id = r->lists[r->depth-1].id;
+    if ( id != r->list_id ) {
+      fprintf(stderr,"garmin_reader_next: list element had ID %u, expected ID %u\n",
+              id,r->list_id);
+    }
+  }
+
+  if ( garmin_reader_record(r,type,size) == 0 ) {
+    if ( feof(r->fp) ) {
+      fprintf(stderr,"garmin_reader_next: %s: truncated\n",r->filename);
+    }
+    if ( r->data != NULL ) {
+      garmin_free_data(r->data);
+      r->data = NULL;
+    }
+    r->failed = 1;
+    return -1;
+  }
+
+  *data = r->data;
+
+  return 1;
+}
+
+
+/*
+   Move to the first track point whose time is 't' or later; the next call
+   to garmin_reader_next returns it.  Returns 1 if there is such a point,
+   0 if there isn't and -1 if the file is corrupt.
+
+   With the index of a version 2 file this is a binary search over the
+   time samples and a scan of at most GARMIN_INDEX_STRIDE points, and
+   reading then goes on to the end of the track list, whose depth counts
+   as 1.  A version 1 file is read from the start until the point turns
+   up, and reading goes on as if from the start.
+*/
+
+int
+garmin_reader_seek_time ( garmin_reader * r, uint32 t )
+{
+  garmin_index  idx;
+  garmin_data * data;
+  uint32        time;
+  uint32        left;
+  uint32        offset;
+  int           ret;
+
+  if ( r->data != NULL ) {
+    garmin_free_data(r->data);
+    r->data = NULL;
+  }
+  free(r->mem);
+  r->mem     = NULL;
+  r->pending = 0;
+  r->failed  = 0;
+  r->seeked  = 0;
+  r->depth   = 0;
+
+  if ( garmin_index_read(fileno(r->fp),&idx) &&
+       idx.part[GARMIN_PART_TRACK].type == data_Dlist &&
+       garmin_index_find(fileno(r->fp),&idx,t,&time,&left,&offset) ) {
+    if ( fseek(r->fp,offset,SEEK_SET) == -1 ) {
+      fprintf(stderr,"%s: seek: %s\n",r->filename,strerror(errno));
+      return -1;
+    }
+    r->lists[0].id   = idx.track_id;
+    r->lists[0].left = left;
+    r->depth         = 1;
+    r->seeked        = 1;
+  } else if ( fseek(r->fp,0,SEEK_SET) == -1 ) {
+    fprintf(stderr,"%s: seek: %s\n",r->filename,strerror(errno));
+    return -1;
+  }
+
+  /* Every point type starts with the position and then the time. */
+
+  while ( (ret = garmin_reader_next(r,&data)) > 0 ) {
+    if ( r->type >= data_D300 && r->type <= data_D304 &&
+         get_uint32(r->buf + 8) >= t ) {
+      r->pending = 1;
+      return 1;
+    }
+  }
+
+  return ret;
+}
+
+
+/* The datatype of the current record. */
+
+garmin_datatype
+garmin_reader_type ( garmin_reader * r )
+{
+  return r->type;
+}
+
+
+/* How deep the current record is nested: 0 for a chunk of the file. */
+
+int
+garmin_reader_depth ( garmin_reader * r )
+{
+  return r->cur_depth;
+}
+
+
+/*
+   The id of the current list: the record's own if it is a list, otherwise
+   that of the list it is in.
+*/
+
+uint32
+garmin_reader_list_id ( garmin_reader * r )
+{
+  return r->list_id;
+}
+
+
+/* The number of elements of the current record, if it is a list. */
+
+uint32
+garmin_reader_elements ( garmin_reader * r )
+{
+  return r->elements;
+}
+
+
+void
+garmin_reader_close ( garmin_reader * r )
+{
+  if ( r == NULL ) return;
+
+  if ( r->data != NULL ) garmin_free_data(r->data);
+  fclose(r->fp);
+  free(r->mem);
+  free(r->buf);
+  free(r);
+}
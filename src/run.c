@@ -24,6 +24,7 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include <inttypes.h>
 
@@ -135,52 +136,6 @@ get_lap_start_time ( garmin_data * lap, time_type * start_time )
 }
 
 
-static garmin_data *
-get_track ( garmin_list * points, uint32 trk_index )
-{
-  garmin_list_node * n;
-  garmin_data *      track = NULL;
-  D311 *             d311;
-  int                done = 0;
-
-  /* Look for a data_D311 with an index that matches. */
-
-  for ( n = points->head; n != NULL; n = n->next ) {
-    if ( n->data != NULL ) {
-      switch ( n->data->type ) {
-      case data_D311:
-        if ( track == NULL ) {
-          d311 = n->data->data;
-          if ( d311->index == trk_index ) {
-            track = garmin_alloc_data(data_Dlist);
-            garmin_list_append(track->data,n->data);
-          }
-        } else {
-          /* We've reached the end of the track */
-          done = 1;
-        }
-        break;
-      case data_D300:
-      case data_D301:
-      case data_D302:
-      case data_D303:
-      case data_D304:
-        if ( track != NULL ) {
-          garmin_list_append(track->data,n->data);
-        }
-        break;
-      default:
-        printf("get_track: point type %d invalid!\n",n->data->type);
-        break;
-      }
-    }
-
-    if ( done != 0 ) break;
-  }
-
-  return track;
-}
-
 static void
 tcx_device_info(garmin_unit *unit, FILE *fp)
 {
@@ -221,32 +176,679 @@ save_device_info(garmin_unit *unit, const char *filepath, const char *filename)
   }
 }
 
-void
-garmin_save_runs ( garmin_unit * garmin)
-{
+/*
+   garmin_save_runs is a three stage pipeline, so that the USB transfer,
+   sorting the records into runs and writing the files all overlap:
+
+   1. The calling thread reads from the unit.  Runs and laps are kept
+      until the end, and the points of one track are collected at a time.
+      When the next track header arrives, the finished track and the runs
+      on it are handed on as a batch.
+
+   2. The association thread picks the laps of each run in a batch and
+      puts the run, its laps and its track together.
+
+   3. The writer thread packs each run and writes it to its file.
+
+   The queues between the stages are bounded, so the reader waits if the
+   disk falls far behind rather than holding every track in memory.
+
+   Runs that were archived by an earlier download are left alone, and
+   their tracks are skipped without being unpacked.  Once no run is left
+   waiting for its track, the rest of the track log is not transferred.
+
+   Once the runs and laps are in, they are indexed (the laps by lap index
+   and the wanted runs by track index), so that finding the laps of a run
+   or the runs on a track doesn't mean going through the whole list.
+*/
+
+#define RUN_WANTED    0     /* to be saved once its track has arrived */
+#define RUN_ARCHIVED  1     /* saved by an earlier download           */
+#define RUN_FAILED    2     /* cannot be saved                        */
+#define RUN_QUEUED    3     /* handed on to be saved                  */
+
+#define SAVE_QUEUE_SIZE  4  /* batches waiting between two stages     */
+
+
+/* A lap, or a run by its track index, in a sorted index. */
+
+typedef struct run_index_entry {
+  uint32              index;    /* the lap index, or the track index  */
+  int                 order;    /* where it is in its list            */
   garmin_data *       data;
-  garmin_data *       data0;
-  garmin_data *       data1;
-  garmin_data *       data2;
-  garmin_data *       rlaps;
-  garmin_data *       rtracks;
-  garmin_list *       runs   = NULL;
-  garmin_list *       laps   = NULL;
-  garmin_list *       tracks = NULL;
-  garmin_data *       rlist;
-  garmin_list_node *  n;
+} run_index_entry;
+
+
+typedef struct save_runs_state {
+  garmin_unit *       garmin;
+  const char *        filedir;
+  int                 full;     /* ignore the sync state              */
+  time_t              synced;   /* newest run archived before         */
+  garmin_data *       runs;
+  garmin_data *       laps;
+  garmin_data *       track;    /* track being received, header first */
+  uint8 *             status;   /* RUN_* for each run, stage 1 only   */
+  uint8 *             saved;    /* queued runs written, by stage 3    */
+  int                 wanted;   /* runs still waiting for a track     */
+  garmin_queue *      associate;
+  garmin_queue *      write;
+  int                 pipelined; /* the stage 2 and 3 threads run     */
+  run_index_entry *   lap_index;   /* the laps, by lap index          */
+  int                 lap_count;
+  run_index_entry *   track_runs;  /* the wanted runs, by track index */
+  int                 track_count;
+} save_runs_state;
+
+
+/* The runs on one track, on their way through the pipeline. */
+
+typedef struct save_runs_batch {
+  garmin_data *       track;    /* NULL for runs without a track      */
+  int                 count;
+  int *               which;    /* index of each run in the run list  */
+  garmin_data **      run;
+  garmin_data **      rlist;    /* run, laps and track, by stage 2    */
+  time_t *            start;    /* start time of each run, by stage 2 */
+} save_runs_batch;
+
+
+/*
+   The sync state of a unit lives next to its runs, in a small text file
+   of "key value" lines.  Only start_time is used to decide what to fetch;
+   the indices of that run are kept for reference.
+*/
+
+static void
+sync_state_path ( save_runs_state * s, char * path, size_t size )
+{
+  snprintf(path,size,"%s/.garmin_sync_%u",s->filedir,s->garmin->id);
+}
+
+
+static time_t
+read_sync_state ( save_runs_state * s )
+{
+  char          path[BUFSIZ];
+  char          key[64];
+  unsigned long value;
+  time_t        start_time = 0;
+  FILE *        fp;
+
+  sync_state_path(s,path,sizeof(path));
+  if ( (fp = fopen(path,"r")) != NULL ) {
+    while ( fscanf(fp,"%63s %lu",key,&value) == 2 ) {
+      if ( strcmp(key,"start_time") == 0 ) start_time = value;
+    }
+    fclose(fp);
+  }
+
+  return start_time;
+}
+
+
+static void
+write_sync_state ( save_runs_state * s,
+                   time_t            start_time,
+                   uint32            track_index,
+                   uint32            last_lap_index )
+{
+  char   path[BUFSIZ];
+  char   temp[BUFSIZ];
+  FILE * fp;
+
+  sync_state_path(s,path,sizeof(path));
+  snprintf(temp,sizeof(temp),"%s.new",path);
+
+  if ( (fp = fopen(temp,"w")) != NULL ) {
+    fprintf(fp,"unit %u\n",s->garmin->id);
+    fprintf(fp,"start_time %lu\n",(unsigned long)start_time);
+    fprintf(fp,"track_index %u\n",track_index);
+    fprintf(fp,"last_lap_index %u\n",last_lap_index);
+    if ( fclose(fp) == 0 && rename(temp,path) == 0 ) return;
+  }
+  printf("Could not save the sync state in %s: %s\n",path,strerror(errno));
+}
+
+
+static int
+compare_index_entries ( const void * a, const void * b )
+{
+  const run_index_entry * x = a;
+  const run_index_entry * y = b;
+
+  if ( x->index != y->index ) return ( x->index < y->index ) ? -1 : 1;
+
+  return x->order - y->order;
+}
+
+
+/* The first entry whose index is 'index' or more. */
+
+static int
+find_index_entry ( run_index_entry * e, int count, uint32 index )
+{
+  int lo = 0;
+  int hi = count;
+  int mid;
+
+  while ( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if ( e[mid].index < index ) lo = mid + 1;
+    else                        hi = mid;
+  }
+
+  return lo;
+}
+
+
+/* Index the laps by lap index, keeping laps with the same index in order. */
+
+static void
+index_laps ( save_runs_state * s )
+{
+  garmin_list *       laps = s->laps->data;
   garmin_list_node *  m;
+  uint32              l_idx;
+  int                 i;
+
+  s->lap_index = calloc(laps->elements ? laps->elements : 1,
+                        sizeof(run_index_entry));
+  s->lap_count = 0;
+  if ( s->lap_index == NULL ) return;
+
+  for ( m = laps->head, i = 0; m != NULL; m = m->next, i++ ) {
+    if ( get_lap_index(m->data,&l_idx) != 0 ) {
+      s->lap_index[s->lap_count].index = l_idx;
+      s->lap_index[s->lap_count].order = i;
+      s->lap_index[s->lap_count].data  = m->data;
+      s->lap_count++;
+    }
+  }
+
+  qsort(s->lap_index,s->lap_count,sizeof(run_index_entry),
+        compare_index_entries);
+}
+
+
+/* Find the start time of a run, which is that of its first lap. */
+
+static time_t
+run_start_time ( save_runs_state * s, garmin_data * run )
+{
+  uint32              trk;
+  uint32              f_lap;
+  uint32              l_lap;
+  int                 k;
+  time_type           start = 0;
+
+  if ( get_run_track_lap_info(run,&trk,&f_lap,&l_lap) != 0 ) {
+    k = find_index_entry(s->lap_index,s->lap_count,f_lap);
+    if ( k < s->lap_count && s->lap_index[k].index == f_lap ) {
+      get_lap_start_time(s->lap_index[k].data,&start);
+    }
+  }
+
+  return start;
+}
+
+
+/* Work out the directory and file name of a run from its start time. */
+
+static void
+run_file ( save_runs_state * s,
+           time_t            start_time,
+           char *            filepath,
+           size_t            pathsize,
+           char *            filename,
+           size_t            namesize )
+{
+  struct tm tbuf;
+
+  localtime_r(&start_time,&tbuf);
+  snprintf(filepath,pathsize-1,"%s/%d/%02d",
+           s->filedir,tbuf.tm_year+1900,tbuf.tm_mon+1);
+  strftime(filename,namesize,"%Y%m%dT%H%M%S.gmn",&tbuf);
+}
+
+
+/*
+   Stage 2: put each run in a batch together with its laps and track, and
+   work out its start time, which is that of its first lap.
+*/
+
+static void
+associate_batch ( save_runs_state * s, save_runs_batch * b )
+{
+  garmin_unit *       garmin = s->garmin;
+  garmin_data *       rlaps;
   uint32              trk;
   uint32              f_lap;
   uint32              l_lap;
   uint32              l_idx;
   time_type           start;
+  int                 i;
+  int                 k;
+
+  for ( i = 0; i < b->count; i++ ) {
+    get_run_track_lap_info(b->run[i],&trk,&f_lap,&l_lap);
+
+    if ( garmin->verbose != 0 ) {
+      printf("[garmin] run: track [%d], laps [%d:%d]\n",trk,f_lap,l_lap);
+    }
+
+    /* Get the laps. */
+
+    start = 0;
+    rlaps = garmin_alloc_data(data_Dlist);
+    for ( k = find_index_entry(s->lap_index,s->lap_count,f_lap);
+          k < s->lap_count && s->lap_index[k].index <= l_lap;
+          k++ ) {
+      l_idx = s->lap_index[k].index;
+      if ( garmin->verbose != 0 ) {
+        printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
+               l_idx,f_lap,l_lap);
+      }
+
+      garmin_list_append(rlaps->data,s->lap_index[k].data);
+
+      if ( l_idx == f_lap ) {
+        get_lap_start_time(s->lap_index[k].data,&start);
+        if ( garmin->verbose != 0 ) {
+          printf("[garmin] first lap [%d] has start time [%d]\n",
+                 l_idx,(int)start);
+        }
+      }
+    }
+
+    /* Now make a three-element list for this run. */
+
+    b->rlist[i] = garmin_alloc_data(data_Dlist);
+    garmin_list_append(b->rlist[i]->data,b->run[i]);
+    garmin_list_append(b->rlist[i]->data,rlaps);
+    garmin_list_append(b->rlist[i]->data,b->track);
+    b->start[i] = start;
+  }
+}
+
+
+/* Stage 3: write each run in a batch to its file, then free the batch. */
+
+static void
+write_batch ( save_runs_state * s, save_runs_batch * b )
+{
+  garmin_data *       rlaps;
+  char                filename[BUFSIZ] = { 0 };
+  char                filepath[BUFSIZ] = { 0 };
+  int                 written;
+  int                 i;
+
+  for ( i = 0; i < b->count; i++ ) {
+
+    /*
+       Determine the filename based on the start time of the first lap.
+    */
+
+    if ( b->start[i] != 0 ) {
+      run_file(s,b->start[i],filepath,sizeof(filepath),
+               filename,sizeof(filename));
+
+      /*
+         Save rlist to the file.  A run only counts as saved once its file
+         is there, so that a failed write is tried again next time.
+      */
+
+      written = garmin_save(b->rlist[i],filename,filepath,
+                            s->garmin->compress ? GARMIN_SAVE_COMPRESS : 0);
+      if ( written > 0 ) {
+        printf("Wrote:   %s/%s\n",filepath,filename);
+        save_device_info(s->garmin, filepath, filename);
+      } else if ( written == 0 ) {
+        printf("Skipped: %s/%s\n",filepath,filename);
+      } else {
+        printf("Failed:  %s/%s\n",filepath,filename);
+      }
+      if ( written >= 0 ) s->saved[b->which[i]] = 1;
+    } else {
+      printf("Start time of first lap not found!\n");
+    }
+
+    /* Free the temporary lists we were using. */
+
+    rlaps = garmin_list_data(b->rlist[i],1);
+    garmin_free_list_only(rlaps->data);
+    free(rlaps);
+    garmin_free_list_only(b->rlist[i]->data);
+    free(b->rlist[i]);
+  }
+
+  if ( b->track != NULL ) garmin_free_data(b->track);
+  free(b->which);
+  free(b->run);
+  free(b->rlist);
+  free(b->start);
+  free(b);
+}
+
+
+static void *
+associate_thread ( void * arg )
+{
+  save_runs_state * s = arg;
+  save_runs_batch * b;
+
+  while ( (b = garmin_queue_pop(s->associate)) != NULL ) {
+    associate_batch(s,b);
+    garmin_queue_push(s->write,b);
+  }
+  garmin_queue_close(s->write);
+
+  return NULL;
+}
+
+
+static void *
+write_thread ( void * arg )
+{
+  save_runs_state * s = arg;
+  save_runs_batch * b;
+
+  while ( (b = garmin_queue_pop(s->write)) != NULL ) {
+    write_batch(s,b);
+  }
+
+  return NULL;
+}
+
+
+/*
+   Once the runs and laps are in, decide which runs still need to be
+   saved: those newer than the sync state whose file does not exist yet.
+*/
+
+static void
+plan_runs ( save_runs_state * s )
+{
+  garmin_list *       runs = s->runs->data;
+  garmin_list_node *  n;
   time_t              start_time;
+  uint32              trk;
+  uint32              f_lap;
+  uint32              l_lap;
   char                filename[BUFSIZ] = { 0 };
+  char                filepath[BUFSIZ] = { 0 };
+  char                path[BUFSIZ];
+  struct stat         sb;
+  int                 i;
+
+  if ( s->status != NULL ) return;
+
+  index_laps(s);
+
+  s->status = calloc(runs->elements ? runs->elements : 1,sizeof(uint8));
+  s->saved  = calloc(runs->elements ? runs->elements : 1,sizeof(uint8));
+  s->track_runs = calloc(runs->elements ? runs->elements : 1,
+                         sizeof(run_index_entry));
+  s->wanted = 0;
+
+  for ( n = runs->head, i = 0; n != NULL; n = n->next, i++ ) {
+    if ( get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) == 0 ) {
+      s->status[i] = RUN_FAILED;
+      continue;
+    }
+    start_time = run_start_time(s,n->data);
+    if ( s->full == 0 && start_time != 0 ) {
+      run_file(s,start_time,filepath,sizeof(filepath),
+               filename,sizeof(filename));
+      snprintf(path,sizeof(path),"%s/%s",filepath,filename);
+      if ( start_time <= s->synced || stat(path,&sb) != -1 ) {
+        printf("Skipped: %s/%s\n",filepath,filename);
+        s->status[i] = RUN_ARCHIVED;
+        continue;
+      }
+    }
+    s->status[i] = RUN_WANTED;
+    s->wanted++;
+    if ( s->track_runs != NULL ) {
+      s->track_runs[s->track_count].index = trk;
+      s->track_runs[s->track_count].order = i;
+      s->track_runs[s->track_count].data  = n->data;
+      s->track_count++;
+    }
+  }
+
+  if ( s->track_runs != NULL ) {
+    qsort(s->track_runs,s->track_count,sizeof(run_index_entry),
+          compare_index_entries);
+  }
+
+  if ( s->garmin->verbose != 0 ) {
+    printf("[garmin] %d of %d runs to download\n",s->wanted,runs->elements);
+  }
+}
+
+
+/*
+   Count the runs waiting for the track with this index (every run still
+   waiting, if 'd311' is NULL), and put them in 'b' if it isn't NULL.
+*/
+
+static int
+track_runs ( save_runs_state * s, D311 * d311, save_runs_batch * b )
+{
+  garmin_list_node *  n;
+  uint32              trk;
+  uint32              f_lap;
+  uint32              l_lap;
+  int                 count = 0;
+  int                 i;
+  int                 k;
+
+#define ADD_RUN(x,r)                    \
+  do {                                  \
+    if ( b != NULL ) {                  \
+      s->status[x] = RUN_QUEUED;        \
+      b->which[b->count] = x;           \
+      b->run[b->count++] = r;           \
+    }                                   \
+    count++;                            \
+  } while ( 0 )
+
+  if ( d311 != NULL ) {
+    for ( k = find_index_entry(s->track_runs,s->track_count,d311->index);
+          k < s->track_count && s->track_runs[k].index == d311->index;
+          k++ ) {
+      i = s->track_runs[k].order;
+      if ( s->status[i] == RUN_WANTED ) ADD_RUN(i,s->track_runs[k].data);
+    }
+  } else {
+    for ( n = ((garmin_list *)s->runs->data)->head, i = 0;
+          n != NULL;
+          n = n->next, i++ ) {
+      if ( s->status[i] == RUN_WANTED &&
+           get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) != 0 ) {
+        ADD_RUN(i,n->data);
+      }
+    }
+  }
+
+#undef ADD_RUN
+
+  return count;
+}
+
+
+/*
+   Stage 1: hand on the track received so far together with every run on
+   it, or, with no track, every run still waiting to be saved.
+*/
+
+static void
+queue_track_runs ( save_runs_state * s )
+{
+  save_runs_batch *   b;
+  D311 *              d311 = NULL;
+  int                 count;
+
+  plan_runs(s);
+
+  if ( s->track != NULL ) {
+    d311 = garmin_list_data(s->track,0)->data;
+  }
+
+  if ( (count = track_runs(s,d311,NULL)) == 0 ) {
+    if ( s->track != NULL ) garmin_free_data(s->track);
+    s->track = NULL;
+    return;
+  }
+
+  b = calloc(1,sizeof(save_runs_batch));
+  b->track = s->track;
+  b->which = calloc(count,sizeof(int));
+  b->run   = calloc(count,sizeof(garmin_data *));
+  b->rlist = calloc(count,sizeof(garmin_data *));
+  b->start = calloc(count,sizeof(time_t));
+
+  track_runs(s,d311,b);
+
+  s->wanted -= count;
+  s->track   = NULL;
+
+  if ( s->pipelined == 0 || garmin_queue_push(s->associate,b) == 0 ) {
+    associate_batch(s,b);
+    write_batch(s,b);
+  }
+}
+
+
+/*
+   Remember the newest archived run, so the next download can start there.
+   The marker is kept below the oldest run that should have been saved but
+   wasn't, so that the run is tried again next time; if such a run has no
+   start time, there is no telling where it goes and the marker stays put.
+*/
+
+static void
+update_sync_state ( save_runs_state * s )
+{
+  garmin_list_node *  n;
+  garmin_data *       newest = NULL;
+  time_t              newest_time = s->synced;
+  time_t              oldest_unsaved = 0;
+  time_t              start_time;
+  uint32              trk;
+  uint32              f_lap;
+  uint32              l_lap;
+  int                 i;
+
+  for ( n = ((garmin_list *)s->runs->data)->head, i = 0;
+        n != NULL;
+        n = n->next, i++ ) {
+    if ( s->status[i] != RUN_ARCHIVED && s->saved[i] == 0 ) {
+      if ( (start_time = run_start_time(s,n->data)) == 0 ) return;
+      if ( oldest_unsaved == 0 || start_time < oldest_unsaved ) {
+        oldest_unsaved = start_time;
+      }
+    }
+  }
+
+  for ( n = ((garmin_list *)s->runs->data)->head, i = 0;
+        n != NULL;
+        n = n->next, i++ ) {
+    if ( (s->status[i] == RUN_ARCHIVED || s->saved[i] != 0) &&
+         (start_time = run_start_time(s,n->data)) > newest_time &&
+         (oldest_unsaved == 0 || start_time < oldest_unsaved) ) {
+      newest      = n->data;
+      newest_time = start_time;
+    }
+  }
+
+  if ( newest != NULL &&
+       get_run_track_lap_info(newest,&trk,&f_lap,&l_lap) != 0 ) {
+    write_sync_state(s,newest_time,trk,l_lap);
+  }
+}
+
+
+static int
+save_runs_sink ( garmin_data * data, const garmin_record * rec, void * user )
+{
+  save_runs_state * s = user;
+  uint32            l_idx;
+
+  /*
+     At the start of the track log we know which runs are wanted.  If
+     none are, don't bother with the tracks at all.
+  */
+
+  if ( data == NULL ) {
+    if ( rec->pid == Pid_Trk_Hdr ) {
+      plan_runs(s);
+      if ( s->full == 0 && s->wanted == 0 ) return GARMIN_SINK_STOP;
+    }
+    return GARMIN_SINK_CONTINUE;
+  }
+
+  switch ( rec->pid ) {
+  case Pid_Run:
+    garmin_list_append(s->runs->data,data);
+    break;
+
+  case Pid_Lap:
+    if ( s->garmin->verbose != 0 ) {
+      if ( get_lap_index(data,&l_idx) != 0 ) {
+        printf("[garmin] lap: index [%d]\n",l_idx);
+      } else {
+        printf("[garmin] lap: index [??]\n");
+      }
+    }
+    garmin_list_append(s->laps->data,data);
+    break;
+
+  case Pid_Trk_Hdr:
+    if ( s->track != NULL ) queue_track_runs(s);
+    if ( s->full == 0 && s->wanted == 0 ) {
+      garmin_free_data(data);
+      return GARMIN_SINK_STOP;
+    }
+    if ( data->type != data_D311 ) {
+      printf("save_runs_sink: point type %d invalid!\n",data->type);
+      garmin_free_data(data);
+      return GARMIN_SINK_SKIP;
+    }
+    if ( track_runs(s,data->data,NULL) == 0 ) {
+      garmin_free_data(data);
+      return GARMIN_SINK_SKIP;
+    }
+    s->track = garmin_alloc_data(data_Dlist);
+    garmin_list_append(s->track->data,data);
+    break;
+
+  case Pid_Trk_Data:
+    if ( s->track != NULL ) {
+      garmin_list_append(s->track->data,data);
+    } else {
+      garmin_free_data(data);
+    }
+    break;
+
+  default:
+    garmin_free_data(data);
+    break;
+  }
+
+  return GARMIN_SINK_CONTINUE;
+}
+
+
+static void
+save_runs ( garmin_unit * garmin, int full )
+{
+  garmin_data *       data;
+  save_runs_state     s;
+  pthread_t           associate;
+  pthread_t           writer;
   char *              filedir = NULL;
   char *              path = NULL;
-  char                filepath[BUFSIZ] = { 0 };
-  struct tm *         tbuf;
 
   if ( (filedir = getenv("GARMIN_SAVE_RUNS")) != NULL ) {
     filedir = realpath(filedir,NULL);
@@ -263,143 +865,87 @@ garmin_save_runs ( garmin_unit * garmin)
          garmin->product.product_description);
   printf("Files will be saved in '%s'\n",filedir);
 
-  if ( (data = garmin_get(garmin,GET_RUNS)) != NULL ) {
-
-    /*
-       We should have a list with three elements:
-
-       1) The runs (which identify the track and lap indices)
-       2) The laps (which are related to the runs)
-       3) The tracks (which are related to the runs)
-    */
-
-    data0 = garmin_list_data(data,0);
-    data1 = garmin_list_data(data,1);
-    data2 = garmin_list_data(data,2);
+  memset(&s,0,sizeof(s));
+  s.garmin  = garmin;
+  s.filedir = filedir;
+  s.full    = full;
+  s.synced  = full ? 0 : read_sync_state(&s);
+  s.runs    = garmin_alloc_data(data_Dlist);
+  s.laps    = garmin_alloc_data(data_Dlist);
+
+  /*
+     Start the association and writer stages.  If that fails, the reader
+     just does all the work itself.
+  */
+
+  s.associate = garmin_queue_new(SAVE_QUEUE_SIZE);
+  s.write     = garmin_queue_new(SAVE_QUEUE_SIZE);
+  if ( s.associate != NULL && s.write != NULL &&
+       pthread_create(&associate,NULL,associate_thread,&s) == 0 ) {
+    if ( pthread_create(&writer,NULL,write_thread,&s) == 0 ) {
+      s.pipelined = 1;
+    } else {
+      garmin_queue_close(s.associate);
+      pthread_join(associate,NULL);
+    }
+  }
 
-    if ( data0 != NULL && (runs   = data0->data) != NULL &&
-         data1 != NULL && (laps   = data1->data) != NULL &&
-         data2 != NULL && (tracks = data2->data) != NULL ) {
+  /*
+     The runs arrive first, then the laps, then the tracks.  Each run is
+     passed on once its track has been received in full.
+  */
 
-      /* Print some debug output if requested. */
+  if ( (data = garmin_stream(garmin,GET_RUNS,save_runs_sink,&s)) != NULL ) {
+    if ( s.track != NULL ) queue_track_runs(&s);
 
-      if ( garmin->verbose != 0 ) {
-        for ( m = laps->head; m != NULL; m = m->next ) {
-          if ( get_lap_index(m->data,&l_idx) != 0 ) {
-            printf("[garmin] lap: index [%d]\n",l_idx);
-          } else {
-            printf("[garmin] lap: index [??]\n");
-          }
-        }
-      }
+    /* Runs whose track never arrived are saved without one. */
 
-      /* For each run, get its laps and track points. */
-
-      for ( n = runs->head; n != NULL; n = n->next ) {
-        if ( get_run_track_lap_info(n->data,&trk,&f_lap,&l_lap) != 0 ) {
-
-          if ( garmin->verbose != 0 ) {
-            printf("[garmin] run: track [%d], laps [%d:%d]\n",trk,f_lap,l_lap);
-          }
-
-          start = 0;
-
-          /* Get the laps. */
-
-          rlaps = garmin_alloc_data(data_Dlist);
-          for ( m = laps->head; m != NULL; m = m->next ) {
-            if ( get_lap_index(m->data,&l_idx) != 0 ) {
-              if ( l_idx >= f_lap && l_idx <= l_lap ) {
-                if ( garmin->verbose != 0 ) {
-                  printf("[garmin] lap [%d] falls within laps [%d:%d]\n",
-                         l_idx,f_lap,l_lap);
-                }
-
-                garmin_list_append(rlaps->data,m->data);
-
-                if ( l_idx == f_lap ) {
-                  get_lap_start_time(m->data,&start);
-                  if ( garmin->verbose != 0 ) {
-                    printf("[garmin] first lap [%d] has start time [%d]\n",
-                           l_idx,(int)start);
-                  }
-                }
-              }
-            }
-          }
-
-          /* Get the track points. */
-
-          rtracks = get_track(tracks,trk);
-
-          /* Now make a three-element list for this run. */
-
-          rlist = garmin_alloc_data(data_Dlist);
-          garmin_list_append(rlist->data,n->data);
-          garmin_list_append(rlist->data,rlaps);
-          garmin_list_append(rlist->data,rtracks);
-
-          /*
-             Determine the filename based on the start time of the first lap.
-          */
-
-          if ( (start_time = start) != 0 ) {
-            tbuf = localtime(&start_time);
-            snprintf(filepath,sizeof(filepath)-1,"%s/%d/%02d",
-                    filedir,tbuf->tm_year+1900,tbuf->tm_mon+1);
-            strftime(filename,sizeof(filename),"%Y%m%dT%H%M%S.gmn",tbuf);
-
-            /* Save rlist to the file. */
-
-            if ( garmin_save(rlist,filename,filepath) != 0 ) {
-              printf("Wrote:   %s/%s\n",filepath,filename);
-              save_device_info(garmin, filepath, filename);
-            } else {
-              printf("Skipped: %s/%s\n",filepath,filename);
-            }
-          } else {
-            printf("Start time of first lap not found!\n");
-          }
-
-          /* Free the temporary lists we were using. */
-
-          if ( rlaps != NULL ) {
-            garmin_free_list_only(rlaps->data);
-            free(rlaps);
-          }
-
-          if ( rtracks != NULL ) {
-            garmin_free_list_only(rtracks->data);
-            free(rtracks);
-          }
-
-          if ( rlist != NULL ) {
-            garmin_free_list_only(rlist->data);
-            free(rlist);
-          }
-        }
-      }
-    } else {
-      if ( data0 == NULL ) {
-        printf("Toplevel data missing element 0 (runs)\n");
-      } else if ( runs == NULL ) {
-        printf("No runs extracted!\n");
-      }
-      if ( data1 == NULL ) {
-        printf("Toplevel data missing element 1 (laps)\n");
-      } else if ( laps == NULL ) {
-        printf("No laps extracted!\n");
-      }
-      if ( data2 == NULL ) {
-        printf("Toplevel data missing element 2 (tracks)\n");
-      } else if ( tracks == NULL ) {
-        printf("No tracks extracted!\n");
-      }
-    }
+    queue_track_runs(&s);
     garmin_free_data(data);
   } else {
     printf("Unable to extract any data!\n");
+    if ( s.track != NULL ) garmin_free_data(s.track);
   }
 
+  /* Wait for the files to be written. */
+
+  if ( s.pipelined != 0 ) {
+    garmin_queue_close(s.associate);
+    pthread_join(associate,NULL);
+    pthread_join(writer,NULL);
+  }
+  garmin_queue_free(s.associate);
+  garmin_queue_free(s.write);
+  garmin_save_flush();
+
+  if ( data != NULL ) update_sync_state(&s);
+
+  garmin_free_data(s.runs);
+  garmin_free_data(s.laps);
+  free(s.status);
+  free(s.saved);
+  free(s.lap_index);
+  free(s.track_runs);
   free (filedir);
 }
+
+
+/*
+   Save the runs on the unit that have not been downloaded before.  The
+   newest run saved is remembered in the save directory for next time.
+*/
+
+void
+garmin_save_runs ( garmin_unit * garmin )
+{
+  save_runs(garmin,0);
+}
+
+
+/* Like garmin_save_runs, but transfer everything regardless of sync state. */
+
+void
+garmin_save_all_runs ( garmin_unit * garmin )
+{
+  save_runs(garmin,1);
+}
@@ -0,0 +1,376 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "garmin.h"
+
+
+/*
+   A garmin_track holds the D300 to D304 points of a track in columns, one
+   array per field, so that code which only wants (say) the positions or
+   the altitudes walks a single packed array instead of chasing a list of
+   garmin_data wrappers.  A track can be built from decoded data, or
+   decoded straight from a .gmn file without building the garmin_data
+   tree at all.
+*/
+
+#define TRACK_FIRST_SIZE  256
+
+/* Fixed sizes of the point records in a .gmn file (see unpack.c). */
+
+#define D300_SIZE  13
+#define D301_SIZE  21
+#define D302_SIZE  25
+#define D303_SIZE  17
+#define D304_SIZE  23
+
+
+static garmin_track *
+garmin_track_alloc ( void )
+{
+  garmin_track * t = calloc(1,sizeof(garmin_track));
+
+  if ( t != NULL ) t->type = data_Dnil;
+
+  return t;
+}
+
+
+/* Make room for at least 'size' points.  Returns 0 if we ran out of memory. */
+
+static int
+garmin_track_reserve ( garmin_track * t, uint32 size )
+{
+  uint32 n;
+
+  if ( size <= t->capacity ) return 1;
+
+  n = ( t->capacity > 0 ) ? t->capacity : TRACK_FIRST_SIZE;
+  while ( n < size ) n *= 2;
+
+#define GROW(f)                                                   \
+  do {                                                            \
+    void * p = realloc(t->f,n * sizeof(*t->f));                   \
+    if ( p == NULL ) return 0;                                    \
+    t->f = p;                                                     \
+  } while ( 0 )
+
+  GROW(time);
+  GROW(lat);
+  GROW(lon);
+  GROW(alt);
+  GROW(distance);
+  GROW(heart_rate);
+  GROW(cadence);
+
+#undef GROW
+
+  /* The bitmap grows a byte per 8 points; the new bytes start cleared. */
+
+  {
+    void * p = realloc(t->valid,(n + 7) / 8);
+    if ( p == NULL ) return 0;
+    t->valid = p;
+    memset(t->valid + (t->capacity + 7) / 8,0,
+           (n + 7) / 8 - (t->capacity + 7) / 8);
+  }
+
+  t->capacity = n;
+
+  return 1;
+}
+
+
+/*
+   Add a point.  Fields the point type doesn't have are given the values
+   a unit uses for "not available": 1.0e25 for the altitude and distance,
+   0 for the heart rate and 0xff for the cadence.
+*/
+
+static int
+garmin_track_add ( garmin_track *   t,
+                   garmin_datatype  type,
+                   sint32           lat,
+                   sint32           lon,
+                   uint32           time,
+                   float32          alt,
+                   float32          distance,
+                   uint8            heart_rate,
+                   uint8            cadence )
+{
+  uint32 i = t->count;
+
+  if ( garmin_track_reserve(t,i + 1) == 0 ) return 0;
+
+  if ( t->type == data_Dnil ) t->type = type;
+
+  t->time[i]       = time;
+  t->lat[i]        = lat;
+  t->lon[i]        = lon;
+  t->alt[i]        = alt;
+  t->distance[i]   = distance;
+  t->heart_rate[i] = heart_rate;
+  t->cadence[i]    = cadence;
+
+  if ( lat != 0x7fffffff || lon != 0x7fffffff ) {
+    t->valid[i >> 3] |= 1 << (i & 7);
+  }
+
+  t->count++;
+
+  return 1;
+}
+
+
+/* Add every track point in 'data', looking inside lists. */
+
+static int
+garmin_track_add_data ( garmin_track * t, garmin_data * data )
+{
+  garmin_list_node * n;
+  garmin_list *      list;
+  D300 *             d300;
+  D301 *             d301;
+  D302 *             d302;
+  D303 *             d303;
+  D304 *             d304;
+  int                ok = 1;
+
+  if ( data == NULL || data->data == NULL ) return 1;
+
+  switch ( data->type ) {
+  case data_Dlist:
+    list = data->data;
+    if ( garmin_track_reserve(t,t->count + list->elements) == 0 ) return 0;
+    for ( n = list->head; ok && n != NULL; n = n->next ) {
+      ok = garmin_track_add_data(t,n->data);
+    }
+    break;
+  case data_D300:
+    d300 = data->data;
+    ok = garmin_track_add(t,data->type,d300->posn.lat,d300->posn.lon,
+                          d300->time,1.0e25,1.0e25,0,0xff);
+    break;
+  case data_D301:
+    d301 = data->data;
+    ok = garmin_track_add(t,data->type,d301->posn.lat,d301->posn.lon,
+                          d301->time,d301->alt,1.0e25,0,0xff);
+    break;
+  case data_D302:
+    d302 = data->data;
+    ok = garmin_track_add(t,data->type,d302->posn.lat,d302->posn.lon,
+                          d302->time,d302->alt,1.0e25,0,0xff);
+    break;
+  case data_D303:
+    d303 = data->data;
+    ok = garmin_track_add(t,data->type,d303->posn.lat,d303->posn.lon,
+                          d303->time,d303->alt,1.0e25,d303->heart_rate,0xff);
+    break;
+  case data_D304:
+    d304 = data->data;
+    ok = garmin_track_add(t,data->type,d304->posn.lat,d304->posn.lon,
+                          d304->time,d304->alt,d304->distance,
+                          d304->heart_rate,d304->cadence);
+    break;
+  default:
+    break;
+  }
+
+  return ok;
+}
+
+
+/*
+   Build a track from the D300 to D304 points in 'data', which may be a
+   single point or a list (of lists) of them.  Anything else in the lists,
+   such as the track header, is passed over.  Returns NULL if we ran out
+   of memory.
+*/
+
+garmin_track *
+garmin_track_new ( garmin_data * data )
+{
+  garmin_track * t = garmin_track_alloc();
+
+  if ( t != NULL && garmin_track_add_data(t,data) == 0 ) {
+    fprintf(stderr,"garmin_track_new: out of memory\n");
+    garmin_track_free(t);
+    t = NULL;
+  }
+
+  return t;
+}
+
+
+/*
+   Decode one packed element of type 'type' and 'size' bytes at 'pos'
+   into the track.  Points are read straight from the buffer; lists are
+   walked (compressed ones once expanded); everything else is stepped
+   over using its size.  Returns 0 if the data is corrupt or we ran out
+   of memory.
+*/
+
+static int
+garmin_track_scan ( garmin_track *  t,
+                    uint32          type,
+                    const uint8 *   pos,
+                    uint32          size )
+{
+  const uint8 * end = pos + size;
+  uint32        elements;
+  uint32        etype;
+  uint32        esize;
+  uint32        i;
+  sint32        lat;
+  sint32        lon;
+  uint32        time;
+
+  switch ( type ) {
+  case data_Dlist:
+    if ( size < 8 ) return 0;
+    elements = get_uint32(pos + 4);
+    pos += 8;
+
+    /* Don't trust a corrupt count with memory: each element needs 12 bytes. */
+
+    if ( elements <= (uint32)(end - pos) / 12 &&
+         garmin_track_reserve(t,t->count + elements) == 0 ) {
+      return 0;
+    }
+    for ( i = 0; i < elements; i++ ) {
+      if ( end - pos < 12 ) return 0;
+      etype = get_uint32(pos + 4);
+      esize = get_uint32(pos + 8);
+      pos += 12;
+      if ( esize > (uint32)(end - pos) ||
+           garmin_track_scan(t,etype,pos,esize) == 0 ) {
+        return 0;
+      }
+      pos += esize;
+    }
+    return 1;
+  case GARMIN_POINTS_TYPE:
+    {
+      uint8 * list;
+      uint32  used;
+      int     ok;
+
+      list = garmin_expand_points(pos,end,&used,&esize);
+      if ( list == NULL || used != size ) {
+        free(list);
+        return 0;
+      }
+      ok = garmin_track_scan(t,data_Dlist,list,esize);
+      free(list);
+      return ok;
+    }
+  case data_D300:
+  case data_D301:
+  case data_D302:
+  case data_D303:
+  case data_D304:
+    break;
+  default:
+    return 1;
+  }
+
+  /* A track point.  They all start with the position and the time. */
+
+  if ( (type == data_D300 && size < D300_SIZE) ||
+       (type == data_D301 && size < D301_SIZE) ||
+       (type == data_D302 && size < D302_SIZE) ||
+       (type == data_D303 && size < D303_SIZE) ||
+       (type == data_D304 && size < D304_SIZE) ) {
+    return 0;
+  }
+
+  lat  = get_sint32(pos);
+  lon  = get_sint32(pos + 4);
+  time = get_uint32(pos + 8);
+
+  switch ( type ) {
+  case data_D300:
+    return garmin_track_add(t,type,lat,lon,time,1.0e25,1.0e25,0,0xff);
+  case data_D301:
+  case data_D302:
+    return garmin_track_add(t,type,lat,lon,time,get_float32(pos + 12),
+                            1.0e25,0,0xff);
+  case data_D303:
+    return garmin_track_add(t,type,lat,lon,time,get_float32(pos + 12),
+                            1.0e25,pos[16],0xff);
+  default:
+    return garmin_track_add(t,type,lat,lon,time,get_float32(pos + 12),
+                            get_float32(pos + 16),pos[20],pos[21]);
+  }
+}
+
+
+/*
+   Load the track points of a .gmn file (all of them, in file order) into
+   a track, without unpacking the rest of the file.  Returns NULL if the
+   file can't be read or isn't a .gmn file.
+*/
+
+garmin_track *
+garmin_load_track ( const char * filename )
+{
+  garmin_track * t = NULL;
+  garmin_file *  f;
+  garmin_lazy *  h;
+  const uint8 *  pos;
+  uint32         size;
+  int            i;
+
+  if ( (f = garmin_open_file(filename)) == NULL ) return NULL;
+
+  if ( (t = garmin_track_alloc()) != NULL ) {
+    for ( i = 0; (h = garmin_file_chunk(f,i)) != NULL; i++ ) {
+      pos = garmin_lazy_bytes(h,&size);
+      if ( garmin_track_scan(t,garmin_lazy_type(h),pos,size) == 0 ) {
+        fprintf(stderr,"garmin_load_track: %s: failed to unpack\n",filename);
+        garmin_track_free(t);
+        t = NULL;
+        break;
+      }
+    }
+  }
+  garmin_close_file(f);
+
+  return t;
+}
+
+
+void
+garmin_track_free ( garmin_track * t )
+{
+  if ( t == NULL ) return;
+
+  free(t->time);
+  free(t->lat);
+  free(t->lon);
+  free(t->alt);
+  free(t->distance);
+  free(t->heart_rate);
+  free(t->cadence);
+  free(t->valid);
+  free(t);
+}
@@ -0,0 +1,523 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "garmin.h"
+
+
+/*
+   A capture file starts with a 16 byte header laid out like the one of a
+   .gmn file: CAPTURE_MAGIC, then the format version at offset 12.  Each
+   packet follows as a record of
+
+     uint8   direction   GARMIN_DIR_READ or GARMIN_DIR_WRITE
+     uint32  delay       microseconds since the previous record
+     sint32  result      what garmin_read or garmin_write returned
+     uint32  length      number of packet bytes that follow
+     uint8   data[length]
+
+   with all integers little-endian.
+*/
+
+#define CAPTURE_MAGIC    "GARMINCAP"
+#define CAPTURE_VERSION  1
+#define CAPTURE_HEADER   16
+#define CAPTURE_RECORD   13
+
+
+static const garmin_transport *
+garmin_transport_of ( garmin_unit * garmin )
+{
+  return ( garmin->transport != NULL ) ? garmin->transport :
+    &garmin_usb_transport;
+}
+
+
+/* ========================================================================= */
+/* Dispatch to the transport of the unit.                                    */
+/* ========================================================================= */
+
+int
+garmin_open ( garmin_unit * garmin )
+{
+  return garmin_transport_of(garmin)->open(garmin);
+}
+
+
+int
+garmin_close ( garmin_unit * garmin )
+{
+  return garmin_transport_of(garmin)->close(garmin);
+}
+
+
+/*
+   Read the next packet without copying it.  *p points into a buffer of
+   the transport and is only valid until the next read from the unit.
+*/
+
+int
+garmin_read_packet ( garmin_unit * garmin, garmin_packet ** p )
+{
+  int r;
+
+  *p = NULL;
+  r  = garmin_transport_of(garmin)->read(garmin,p);
+
+  if ( garmin->verbose != 0 && r >= 0 && *p != NULL ) {
+    garmin_print_packet(*p,GARMIN_DIR_READ,stdout);
+  }
+
+  return r;
+}
+
+
+int
+garmin_read ( garmin_unit * garmin, garmin_packet * p )
+{
+  garmin_packet * q;
+  int             r = garmin_read_packet(garmin,&q);
+
+  if ( r > (int)sizeof(garmin_packet) ) {
+    printf("garmin_read: %d byte packet is too big\n",r);
+    return -1;
+  }
+  if ( r > 0 ) memcpy(p->data,q->data,r);
+
+  return r;
+}
+
+
+int
+garmin_write ( garmin_unit * garmin, garmin_packet * p )
+{
+  if ( garmin->verbose != 0 ) {
+    garmin_print_packet(p,GARMIN_DIR_WRITE,stdout);
+  }
+
+  return garmin_transport_of(garmin)->write(garmin,p);
+}
+
+
+/*
+   Tell the transport that 'count' packets are about to be read, so it can
+   start reading ahead.  Transports without read-ahead ignore this.
+*/
+
+int
+garmin_queue_reads ( garmin_unit * garmin, int count )
+{
+  const garmin_transport * t = garmin_transport_of(garmin);
+
+  return ( t->queue != NULL ) ? t->queue(garmin,count) : 0;
+}
+
+
+void
+garmin_cancel_reads ( garmin_unit * garmin )
+{
+  const garmin_transport * t = garmin_transport_of(garmin);
+
+  if ( t->cancel != NULL ) t->cancel(garmin);
+}
+
+
+/* ========================================================================= */
+/* Capture: record every packet passing through another transport.           */
+/* ========================================================================= */
+
+typedef struct garmin_capture_state {
+  FILE *                    fp;
+  const garmin_transport *  inner;
+  void *                    inner_data;
+  struct timespec           last;
+} garmin_capture_state;
+
+
+static garmin_capture_state *
+garmin_capture_enter ( garmin_unit * garmin )
+{
+  garmin_capture_state * c = garmin->transport_data;
+
+  garmin->transport_data = c->inner_data;
+
+  return c;
+}
+
+
+static void
+garmin_capture_leave ( garmin_unit * garmin, garmin_capture_state * c )
+{
+  c->inner_data          = garmin->transport_data;
+  garmin->transport_data = c;
+}
+
+
+static void
+garmin_capture_record ( garmin_capture_state * c,
+                        int                    dir,
+                        int                    result,
+                        garmin_packet *        p,
+                        uint32                 length )
+{
+  uint8            hdr[CAPTURE_RECORD];
+  struct timespec  now;
+  uint32           delay;
+
+  clock_gettime(CLOCK_MONOTONIC,&now);
+  delay = (now.tv_sec - c->last.tv_sec) * 1000000 +
+    (now.tv_nsec - c->last.tv_nsec) / 1000;
+  c->last = now;
+
+  if ( length > sizeof(garmin_packet) ) length = sizeof(garmin_packet);
+
+  hdr[0] = dir;
+  put_uint32(hdr+1,delay);
+  put_sint32(hdr+5,result);
+  put_uint32(hdr+9,length);
+
+  if ( fwrite(hdr,sizeof(hdr),1,c->fp) != 1 ||
+       (length > 0 && fwrite(p->data,1,length,c->fp) != length) ) {
+    printf("capture: write failed: %s\n",strerror(errno));
+  }
+}
+
+
+static int
+garmin_capture_open ( garmin_unit * garmin )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+  int                    r = c->inner->open(garmin);
+
+  garmin_capture_leave(garmin,c);
+
+  return r;
+}
+
+
+static int
+garmin_capture_close ( garmin_unit * garmin )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+  int                    r = c->inner->close(garmin);
+
+  garmin_capture_leave(garmin,c);
+  fflush(c->fp);
+
+  return r;
+}
+
+
+static int
+garmin_capture_read ( garmin_unit * garmin, garmin_packet ** p )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+  int                    r = c->inner->read(garmin,p);
+
+  garmin_capture_leave(garmin,c);
+  garmin_capture_record(c,GARMIN_DIR_READ,r,*p,(r > 0) ? r : 0);
+
+  return r;
+}
+
+
+static int
+garmin_capture_write ( garmin_unit * garmin, garmin_packet * p )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+  int                    r = c->inner->write(garmin,p);
+
+  garmin_capture_leave(garmin,c);
+  garmin_capture_record(c,GARMIN_DIR_WRITE,r,p,
+                        garmin_packet_size(p) + PACKET_HEADER_SIZE);
+
+  return r;
+}
+
+
+static int
+garmin_capture_queue ( garmin_unit * garmin, int count )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+  int                    r = 0;
+
+  if ( c->inner->queue != NULL ) r = c->inner->queue(garmin,count);
+  garmin_capture_leave(garmin,c);
+
+  return r;
+}
+
+
+static void
+garmin_capture_cancel ( garmin_unit * garmin )
+{
+  garmin_capture_state * c = garmin_capture_enter(garmin);
+
+  if ( c->inner->cancel != NULL ) c->inner->cancel(garmin);
+  garmin_capture_leave(garmin,c);
+}
+
+
+static void
+garmin_capture_release ( garmin_unit * garmin )
+{
+  garmin_capture_state * c = garmin->transport_data;
+
+  fclose(c->fp);
+  garmin->transport      = c->inner;
+  garmin->transport_data = c->inner_data;
+  free(c);
+
+  if ( garmin->transport->release != NULL ) garmin->transport->release(garmin);
+}
+
+
+static const garmin_transport garmin_capture_transport = {
+  "capture",
+  garmin_capture_open,
+  garmin_capture_close,
+  garmin_capture_read,
+  garmin_capture_write,
+  garmin_capture_queue,
+  garmin_capture_cancel,
+  garmin_capture_release
+};
+
+
+/*
+   Record every packet read from or written to the unit into the file at
+   'path', on top of whatever transport the unit is using.  The file is
+   closed by garmin_shutdown.  Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_capture ( garmin_unit * garmin, const char * path )
+{
+  garmin_capture_state * c;
+  uint8                  hdr[CAPTURE_HEADER] = { 0 };
+
+  if ( (c = calloc(1,sizeof(garmin_capture_state))) == NULL ) return 0;
+
+  if ( (c->fp = fopen(path,"wb")) == NULL ) {
+    printf("capture: %s: %s\n",path,strerror(errno));
+    free(c);
+    return 0;
+  }
+
+  strncpy((char *)hdr,CAPTURE_MAGIC,11);
+  put_uint32(hdr+12,CAPTURE_VERSION);
+  fwrite(hdr,sizeof(hdr),1,c->fp);
+
+  clock_gettime(CLOCK_MONOTONIC,&c->last);
+  c->inner               = garmin_transport_of(garmin);
+  c->inner_data          = garmin->transport_data;
+  garmin->transport      = &garmin_capture_transport;
+  garmin->transport_data = c;
+
+  return 1;
+}
+
+
+/* ========================================================================= */
+/* Replay: play a capture file back as if it came from the unit.             */
+/* ========================================================================= */
+
+typedef struct garmin_replay_state {
+  uint8 *   buf;
+  uint32    size;
+  uint32    pos;
+} garmin_replay_state;
+
+
+/*
+   Return the next record of the capture if it goes in direction 'dir', and
+   step past it.  Packets are replayed strictly in the order they were
+   captured, as fast as they are asked for.
+*/
+
+static uint8 *
+garmin_replay_next ( garmin_unit *  garmin,
+                     int            dir,
+                     sint32 *       result,
+                     uint32 *       length )
+{
+  garmin_replay_state * r = garmin->transport_data;
+  uint8 *               rec;
+
+  if ( r->pos > r->size || r->size - r->pos < CAPTURE_RECORD ) return NULL;
+
+  rec     = r->buf + r->pos;
+  *result = get_sint32(rec+5);
+  *length = get_uint32(rec+9);
+
+  /* A corrupt capture mustn't take us outside the file or a packet. */
+
+  if ( *length > r->size - r->pos - CAPTURE_RECORD ||
+       *length > sizeof(garmin_packet) ) {
+    printf("replay: bad record at offset %u\n",r->pos);
+    return NULL;
+  }
+
+  if ( rec[0] != dir ) {
+    printf("replay: expected a %s at offset %u\n",
+           (dir == GARMIN_DIR_READ) ? "read" : "write",r->pos);
+    return NULL;
+  }
+
+  r->pos += CAPTURE_RECORD + *length;
+
+  return rec + CAPTURE_RECORD;
+}
+
+
+static int
+garmin_replay_open ( garmin_unit * garmin )
+{
+  return 1;
+}
+
+
+static int
+garmin_replay_close ( garmin_unit * garmin )
+{
+  return 0;
+}
+
+
+static int
+garmin_replay_read ( garmin_unit * garmin, garmin_packet ** p )
+{
+  uint8 *  data;
+  sint32   result;
+  uint32   length;
+
+  if ( (data = garmin_replay_next(garmin,GARMIN_DIR_READ,
+                                  &result,&length)) == NULL ) {
+    return -1;
+  }
+
+  if ( result < 0 ) return -1;
+
+  /* Hand out the packet straight from the capture. */
+
+  *p = (garmin_packet *)data;
+
+  return ( result > (sint32)length ) ? (sint32)length : result;
+}
+
+
+static int
+garmin_replay_write ( garmin_unit * garmin, garmin_packet * p )
+{
+  uint8 *  data;
+  sint32   result;
+  uint32   length;
+
+  if ( (data = garmin_replay_next(garmin,GARMIN_DIR_WRITE,
+                                  &result,&length)) == NULL ) {
+    return -1;
+  }
+
+  if ( garmin->verbose != 0 &&
+       (length != garmin_packet_size(p) + PACKET_HEADER_SIZE ||
+        memcmp(p->data,data,length) != 0) ) {
+    printf("[garmin] replay: written packet differs from the capture\n");
+  }
+
+  return result;
+}
+
+
+static void
+garmin_replay_release ( garmin_unit * garmin )
+{
+  garmin_replay_state * r = garmin->transport_data;
+
+  free(r->buf);
+  free(r);
+  garmin->transport      = NULL;
+  garmin->transport_data = NULL;
+}
+
+
+static const garmin_transport garmin_replay_transport = {
+  "replay",
+  garmin_replay_open,
+  garmin_replay_close,
+  garmin_replay_read,
+  garmin_replay_write,
+  NULL,
+  NULL,
+  garmin_replay_release
+};
+
+
+/*
+   Make the unit talk to the capture file at 'path' instead of a device.
+   The whole file is read up front so that replay runs at full speed.
+   Returns 1 on success, 0 on failure.
+*/
+
+int
+garmin_replay ( garmin_unit * garmin, const char * path )
+{
+  garmin_replay_state * r;
+  FILE *                fp;
+  struct stat           sb;
+
+  if ( (fp = fopen(path,"rb")) == NULL || fstat(fileno(fp),&sb) == -1 ) {
+    printf("replay: %s: %s\n",path,strerror(errno));
+    if ( fp != NULL ) fclose(fp);
+    return 0;
+  }
+
+  if ( (r = calloc(1,sizeof(garmin_replay_state))) == NULL ||
+       (r->buf = malloc(sb.st_size)) == NULL ||
+       fread(r->buf,1,sb.st_size,fp) != (size_t)sb.st_size ) {
+    printf("replay: %s: could not read the capture\n",path);
+    if ( r != NULL ) free(r->buf);
+    free(r);
+    fclose(fp);
+    return 0;
+  }
+  fclose(fp);
+
+  r->size = sb.st_size;
+  r->pos  = CAPTURE_HEADER;
+
+  if ( r->size < CAPTURE_HEADER ||
+       strncmp((char *)r->buf,CAPTURE_MAGIC,11) != 0 ||
+       get_uint32(r->buf+12) != CAPTURE_VERSION ) {
+    printf("replay: %s is not a garmintools capture\n",path);
+    free(r->buf);
+    free(r);
+    return 0;
+  }
+
+  garmin->transport      = &garmin_replay_transport;
+  garmin->transport_data = r;
+
+  return 1;
+}
@@ -38,7 +38,7 @@
 #define GETRPT(x) do { GETF64((x).lat); GETF64((x).lon); } while ( 0 )
 #define GETVST(x) x = get_vstring(pos)
 #define GETU8(x)  x = *(*pos)++
-#define SKIP(x)   do { memset(*pos,0,x); *pos += x; }      while ( 0 )
+#define SKIP(x)   do { *pos += x; }                        while ( 0 )
 
 #define GETSTR(x)                                                      \
   do {                                                                 \
@@ -1067,31 +1067,280 @@ garmin_unpack_d1015 ( D1015 * lap, uint8 ** pos )
 }
 
 
+/*
+   A compressed list of track points (see points.c) unpacks as the list it
+   was made from.  Its data ends by 'end', or is trusted if 'end' is NULL.
+*/
+
+static garmin_data *
+garmin_unpack_points ( uint8 ** pos, uint8 * end )
+{
+  garmin_data * d = NULL;
+  uint8 *       list;
+  uint8 *       p;
+  uint32        used;
+  uint32        size;
+
+  if ( (list = garmin_expand_points(*pos,end,&used,&size)) != NULL ) {
+    p = list;
+    d = garmin_unpack(&p,data_Dlist);
+    if ( p - list != size ) {
+      fprintf(stderr,"garmin_unpack_points: unpacked %d bytes (expecting %u)\n",
+              (int)(p - list),size);
+      garmin_free_data(d);
+      d = NULL;
+    }
+    free(list);
+    *pos += used;
+  }
+
+  return d;
+}
+
+
+/*
+   Records that always pack to the same number of bytes: track points and
+   laps.  A list is mostly long runs of one of these (the points of a
+   track, the laps of a run), and such a run is unpacked in one go: the
+   element headers are checked once, there is no switch per record, and
+   when decoding into an arena the records and their garmin_data are each
+   one array instead of two allocations per record.
+*/
+
+typedef void (*garmin_unpack_record) ( void * record, uint8 ** pos );
+
+#define FIXED(x)                                                    \
+  static void                                                       \
+  garmin_unpack_fixed_d##x ( void * record, uint8 ** pos )         \
+  {                                                                 \
+    garmin_unpack_d##x(record,pos);                                 \
+  }
+
+FIXED(300)
+FIXED(301)
+FIXED(302)
+FIXED(303)
+FIXED(304)
+FIXED(1001)
+FIXED(1011)
+FIXED(1015)
+
+#undef FIXED
+
+
+typedef struct garmin_fixed {
+  garmin_datatype       type;
+  uint32                packed;   /* bytes in a .gmn file    */
+  size_t                size;     /* bytes of the structure */
+  garmin_unpack_record  unpack;
+} garmin_fixed;
+
+
+#define FIXED(x,n) { data_D##x, n, sizeof(D##x), garmin_unpack_fixed_d##x }
+
+static const garmin_fixed garmin_fixed_records[] = {
+  FIXED(300,13),
+  FIXED(301,21),
+  FIXED(302,25),
+  FIXED(303,17),
+  FIXED(304,23),
+  FIXED(1001,41),
+  FIXED(1011,43),
+  FIXED(1015,48)
+};
+
+#undef FIXED
+
+
+static const garmin_fixed *
+garmin_fixed_record ( uint32 type, uint32 size )
+{
+  unsigned int i;
+
+  for ( i = 0; i < sizeof(garmin_fixed_records)/sizeof(garmin_fixed_records[0]); i++ ) {
+    if ( garmin_fixed_records[i].type == type ) {
+      return ( garmin_fixed_records[i].packed == size )
+        ? &garmin_fixed_records[i] : NULL;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+   The number of list elements, out of the 'left' at 'pos', that are
+   records like the first one: the same list id, type and size.  The
+   elements must end by 'end', or are trusted if 'end' is NULL.
+*/
+
+static uint32
+garmin_fixed_run ( const uint8 * pos, const uint8 * end, uint32 left )
+{
+  uint32 id;
+  uint32 type;
+  uint32 size;
+  uint32 n;
+
+  if ( left == 0 || (end != NULL && end - pos < 12) ) return 0;
+
+  id   = get_uint32(pos);
+  type = get_uint32(pos + 4);
+  size = get_uint32(pos + 8);
+
+  if ( end != NULL && (uint32)(end - pos) - 12 < size ) return 0;
+
+  for ( n = 1; n < left; n++ ) {
+    pos += 12 + size;
+    if ( end != NULL && (end - pos < 12 || (uint32)(end - pos) - 12 < size) ) {
+      break;
+    }
+    if ( get_uint32(pos)     != id   ||
+         get_uint32(pos + 4) != type ||
+         get_uint32(pos + 8) != size ) {
+      break;
+    }
+  }
+
+  return n;
+}
+
+
+/*
+   Unpack up to 'count' list elements of type 'type' at *pos (each with
+   its list id, type and size in front) into 'array', a C array of that
+   type's structure, and move *pos past them.  Only track points and laps
+   can be unpacked this way.  Unpacking stops at the first element that
+   isn't like the first one, or that doesn't end by 'end' (the data is
+   trusted if 'end' is NULL); returns the number unpacked.
+*/
+
+uint32
+garmin_unpack_array ( uint8 **         pos,
+                      const uint8 *    end,
+                      garmin_datatype  type,
+                      uint32           count,
+                      void *           array )
+{
+  const garmin_fixed * fixed;
+  uint8 *              record = array;
+  uint32               n;
+  uint32               i;
+
+  if ( count == 0 || (end != NULL && end - *pos < 12) ||
+       get_uint32(*pos + 4) != type ||
+       (fixed = garmin_fixed_record(type,get_uint32(*pos + 8))) == NULL ) {
+    return 0;
+  }
+
+  n = garmin_fixed_run(*pos,end,count);
+  for ( i = 0; i < n; i++, record += fixed->size ) {
+    SKIP(12);
+    fixed->unpack(record,pos);
+  }
+
+  return n;
+}
+
+
+/*
+   Unpack the run of fixed size records at the start of what is left of a
+   list, if there is one.  Returns the number of elements unpacked.
+*/
+
+static uint32
+garmin_unpack_dlist_run ( garmin_list * list, uint8 ** pos, uint32 left )
+{
+  const garmin_fixed * fixed;
+  garmin_data *        data;
+  uint8 *              records;
+  uint32               n;
+  uint32               i;
+
+  if ( (int)get_uint32(*pos) != list->id ||
+       (fixed = garmin_fixed_record(get_uint32(*pos + 4),
+                                    get_uint32(*pos + 8))) == NULL ) {
+    return 0;
+  }
+
+  n = garmin_fixed_run(*pos,NULL,left);
+
+  if ( garmin_arena_current() != NULL ) {
+
+    /* Nothing in an arena is freed on its own, so arrays will do. */
+
+    data    = garmin_arena_calloc(n,sizeof(garmin_data));
+    records = garmin_arena_calloc(n,fixed->size);
+    garmin_unpack_array(pos,NULL,fixed->type,n,records);
+    for ( i = 0; i < n; i++ ) {
+      data[i].type  = fixed->type;
+      data[i].data  = records + i * fixed->size;
+      data[i].arena = garmin_arena_current();
+      garmin_list_append(list,&data[i]);
+    }
+
+  } else {
+
+    for ( i = 0; i < n; i++ ) {
+      data = garmin_alloc_data(fixed->type);
+      SKIP(12);
+      fixed->unpack(data->data,pos);
+      garmin_list_append(list,data);
+    }
+
+  }
+
+  return n;
+}
+
+
 /* List */
 
 static void
 garmin_unpack_dlist ( garmin_list * list, uint8 ** pos )
 {
+  uint8 *            start;
   uint32             id;
   uint32             elements;
   uint32             type;
   uint32             size;
+  uint32             n;
   uint32             i;
 
   GETU32(list->id);
   GETU32(elements);
 
+  /* Don't trust a corrupt count with too much memory up front. */
+
+  garmin_list_reserve(list,elements < 65536 ? elements : 65536);
+
   for ( i = 0; i < elements; i++ ) {
+    if ( (n = garmin_unpack_dlist_run(list,pos,elements - i)) > 0 ) {
+      i += n - 1;
+      continue;
+    }
+
     GETU32(id);
     GETU32(type);
     GETU32(size);
-    if ( (int) id == list->id ) {
-      garmin_list_append(list,garmin_unpack(pos,type));
-    } else {
+    start = *pos;
+    if ( (int) id != list->id ) {
       /* list element has wrong list ID */
-      printf("garmin_unpack_dlist: list element had ID %d, expected ID %d, size (%u)\n",
-             id,list->id, size);
+      fprintf(stderr,"garmin_unpack_dlist: list element had ID %d, expected ID %d, size (%u)\n",
+              id,list->id, size);
+    } else if ( type == GARMIN_POINTS_TYPE ) {
+      garmin_list_append(list,garmin_unpack_points(pos,start + size));
+    } else {
+      garmin_list_append(list,garmin_unpack(pos,type));
     }
+
+    /*
+       Every element carries its size, so one we don't know how to unpack
+       (or had to reject) can be stepped over instead of derailing the rest
+       of the list.
+    */
+
+    *pos = start + size;
   }
 }
 
@@ -1117,8 +1366,8 @@ garmin_unpack_chunk ( uint8 ** pos )
 
     if ( version > GARMIN_VERSION ) {
       /* warning: version is more recent than supported. */
-      printf("garmin_unpack_chunk: version %.2f supported, %.2f found\n",
-             GARMIN_VERSION/100.0, version/100.0);
+      fprintf(stderr,"garmin_unpack_chunk: version %.2f supported, %.2f found\n",
+              GARMIN_VERSION/100.0, version/100.0);
     }
 
     /* This is the size of the packed data (not including the header) */
@@ -1140,15 +1389,15 @@ garmin_unpack_chunk ( uint8 ** pos )
 
     if ( unpacked != chunk ) {
       /* unpacked the wrong number of bytes! */
-      printf("garmin_unpack_chunk: unpacked %d bytes (expecting %d) (size %u). Exiting.\n",
-             unpacked,chunk, size);
+      fprintf(stderr,"garmin_unpack_chunk: unpacked %d bytes (expecting %d) (size %u). Exiting.\n",
+              unpacked,chunk, size);
       garmin_free_data(data);
       return NULL;
     }
 
   } else {
     /* unknown file format */
-    printf("garmin_unpack_chunk: not a .gmn file. Exiting.\n");
+    fprintf(stderr,"garmin_unpack_chunk: not a .gmn file. Exiting.\n");
     return NULL;
   }
 
@@ -1181,19 +1430,23 @@ garmin_load ( const char * filename )
           list   = data_l->data;
           pos    = buf;
           while ( pos - buf < bytes ) {
+            if ( bytes - (pos - buf) >= GARMIN_HEADER + 4 &&
+                 get_uint32(pos + GARMIN_HEADER) == GARMIN_INDEX_TYPE ) {
+              /* The index of a version 2 file; the data ends here. */
+              break;
+            }
             start = pos;
             garmin_data *chunk = garmin_unpack_chunk(&pos);
             if (chunk == NULL) {
-              printf("garmin_load:  %s: Failed to unpack\n", filename);
-              garmin_free_list(list);
+              fprintf(stderr,"garmin_load:  %s: Failed to unpack\n", filename);
               garmin_free_data(data_l);
-
-              return NULL;
+              data_l = NULL;
+              break;
             }
             garmin_list_append(list, chunk);
             if ( pos == start ) {
               /* did not unpack anything! */
-              printf("garmin_load:  %s: nothing unpacked!\n",filename);
+              fprintf(stderr,"garmin_load:  %s: nothing unpacked!\n",filename);
               break;
             }
           }
@@ -1203,7 +1456,9 @@ garmin_load ( const char * filename )
              return the list.
           */
 
-          if ( list->elements == 1 ) {
+          if ( data_l == NULL ) {
+            /* nothing to return */
+          } else if ( list->elements == 1 ) {
             data = list->head->data;
             list->head->data = NULL;
             garmin_free_data(data_l);
@@ -1213,27 +1468,45 @@ garmin_load ( const char * filename )
 
         } else {
           /* read failed */
-          printf("%s: read: %s\n",filename,strerror(errno));
+          fprintf(stderr,"%s: read: %s\n",filename,strerror(errno));
         }
         free(buf);
       } else {
         /* malloc failed */
-        printf("%s: malloc: %s\n",filename,strerror(errno));
+        fprintf(stderr,"%s: malloc: %s\n",filename,strerror(errno));
       }
     } else {
       /* fstat failed */
-      printf("%s: fstat: %s\n",filename,strerror(errno));
+      fprintf(stderr,"%s: fstat: %s\n",filename,strerror(errno));
     }
     close(fd);
   } else {
     /* open failed */
-    printf("%s: open: %s\n",filename,strerror(errno));
+    fprintf(stderr,"%s: open: %s\n",filename,strerror(errno));
   }
 
   return data;
 }
 
 
+/*
+   Load a file like garmin_load, but put everything it decodes into the
+   arena, so it can all be released at once with garmin_arena_free.
+*/
+
+garmin_data *
+garmin_load_arena ( const char * filename, garmin_arena * arena )
+{
+  garmin_arena * old = garmin_arena_use(arena);
+  garmin_data *  data;
+
+  data = garmin_load(filename);
+  garmin_arena_use(old);
+
+  return data;
+}
+
+
 /* ========================================================================= */
 /* garmin_unpack_packet                                                      */
 /* ========================================================================= */
@@ -1255,12 +1528,16 @@ garmin_data *
 garmin_unpack ( uint8 **         pos,
                 garmin_datatype  type )
 {
-  garmin_data * d = garmin_alloc_data(type);
+  garmin_data * d;
+
+  if ( type == GARMIN_POINTS_TYPE ) return garmin_unpack_points(pos,NULL);
+
+  d = garmin_alloc_data(type);
 
   /* Early exit if we were asked to allocate an unknown data type. */
 
   if ( d->data == NULL ) {
-    free(d);
+    garmin_free_data(d);
     return NULL;
   }
 
@@ -1328,7 +1605,7 @@ garmin_unpack ( uint8 **         pos,
   CASE_DATA(1013);
   CASE_DATA(1015);
   default:
-    printf("garmin_unpack: data type %d not supported\n",type);
+    fprintf(stderr,"garmin_unpack: data type %d not supported\n",type);
     break;
   }
 
@@ -31,19 +31,261 @@
 #define INTR_TIMEOUT  3000
 #define BULK_TIMEOUT  3000
 
-static libusb_context *ctx = NULL;
+
+static int  garmin_usb_open   ( garmin_unit * garmin );
+static void garmin_usb_cancel ( garmin_unit * garmin );
+
+
+/*
+   Read state.  While a record transfer is in progress we keep up to
+   GARMIN_USB_QUEUE_DEPTH IN transfers submitted at once.  Each transfer
+   reads into its own slot of a ring of packet buffers, and garmin_read
+   hands the slots back in submission order.  This way the unit never
+   waits for us to unpack a record before it can send the next.
+
+   After a Pid_Data_Available the unit sends its data on the bulk
+   endpoint instead.  Bulk transfers of GARMIN_USB_BULK_SIZE bytes carry
+   several packets each, which are handed out in place from 'bulk'.
+
+   Packets are returned by pointer into these buffers, so a slot is only
+   reused once the following read has been asked for.
+*/
+
+struct garmin_usb_io {
+  struct libusb_transfer *  xfer[GARMIN_USB_QUEUE_DEPTH];
+  garmin_packet             packet[GARMIN_USB_QUEUE_DEPTH];
+  int                       done[GARMIN_USB_QUEUE_DEPTH];
+  int                       next;       /* slot of the next packet to return */
+  int                       inflight;   /* transfers submitted, not returned */
+  int                       remaining;  /* packets not yet submitted */
+  int                       held;       /* returned slot not resubmitted yet */
+  garmin_packet             intr;       /* synchronous interrupt read */
+  uint8                     bulk[GARMIN_USB_BULK_SIZE];
+  int                       bulk_len;   /* bytes in the bulk buffer */
+  int                       bulk_pos;   /* offset of the next packet */
+  int                       bulk_end;   /* the last transfer ended the data */
+};
+
+
+static void LIBUSB_CALL
+garmin_read_done ( struct libusb_transfer * xfer )
+{
+  *(int *)xfer->user_data = 1;
+}
+
+
+/* Submit the read for the slot following the ones already in flight. */
+
+static int
+garmin_submit_read ( garmin_unit * garmin )
+{
+  struct garmin_usb_io *  io = garmin->usb.io;
+  struct libusb_transfer * xfer;
+  int                     slot;
+  int                     err;
+
+  slot = (io->next + io->inflight) % GARMIN_USB_QUEUE_DEPTH;
+  xfer = io->xfer[slot];
+  io->done[slot] = 0;
+
+  if ( garmin->usb.read_bulk == 0 ) {
+    libusb_fill_interrupt_transfer(xfer,
+                                   garmin->usb.handle,
+                                   garmin->usb.intr_in,
+                                   (unsigned char *)io->packet[slot].data,
+                                   sizeof(garmin_packet),
+                                   garmin_read_done,
+                                   &io->done[slot],
+                                   INTR_TIMEOUT);
+  } else {
+    libusb_fill_bulk_transfer(xfer,
+                              garmin->usb.handle,
+                              garmin->usb.bulk_in,
+                              (unsigned char *)io->packet[slot].data,
+                              sizeof(garmin_packet),
+                              garmin_read_done,
+                              &io->done[slot],
+                              BULK_TIMEOUT);
+  }
+
+  if ( (err = libusb_submit_transfer(xfer)) != 0 ) {
+    printf("libusb_submit_transfer failed: %s\n",libusb_error_name(err));
+    return 0;
+  }
+
+  io->inflight++;
+  io->remaining--;
+
+  return 1;
+}
+
+
+/* Return the read state, allocating it on first use. */
+
+static struct garmin_usb_io *
+garmin_get_io ( garmin_unit * garmin )
+{
+  struct garmin_usb_io * io;
+  int                    i;
+
+  if ( (io = garmin->usb.io) == NULL ) {
+    if ( (io = calloc(1,sizeof(struct garmin_usb_io))) == NULL ) return NULL;
+    for ( i = 0; i < GARMIN_USB_QUEUE_DEPTH; i++ ) {
+      if ( (io->xfer[i] = libusb_alloc_transfer(0)) == NULL ) {
+        printf("libusb_alloc_transfer failed\n");
+        while ( i-- > 0 ) libusb_free_transfer(io->xfer[i]);
+        free(io);
+        return NULL;
+      }
+    }
+    garmin->usb.io = io;
+  }
+
+  return io;
+}
+
+
+/* Free the read state, cancelling anything still in flight. */
+
+static void
+garmin_free_io ( garmin_unit * garmin )
+{
+  int i;
+
+  if ( garmin->usb.io != NULL ) {
+    garmin_usb_cancel(garmin);
+    for ( i = 0; i < GARMIN_USB_QUEUE_DEPTH; i++ ) {
+      libusb_free_transfer(garmin->usb.io->xfer[i]);
+    }
+    free(garmin->usb.io);
+    garmin->usb.io = NULL;
+  }
+}
+
+
+/*
+   Tell the USB layer that 'count' more packets are expected from the unit.
+   Reads for up to GARMIN_USB_QUEUE_DEPTH of them are submitted right away,
+   and each garmin_read that consumes one submits the next.  Returns the
+   number of reads in flight.
+*/
+
+static int
+garmin_usb_queue ( garmin_unit * garmin, int count )
+{
+  struct garmin_usb_io * io;
+
+  /* Bulk reads already carry many packets per transfer. */
+
+  if ( count <= 0 || garmin->usb.read_bulk != 0 ||
+       garmin_usb_open(garmin) == 0 ||
+       (io = garmin_get_io(garmin)) == NULL ) {
+    return 0;
+  }
+
+  io->remaining += count;
+  while ( io->inflight < GARMIN_USB_QUEUE_DEPTH && io->remaining > 0 ) {
+    if ( garmin_submit_read(garmin) == 0 ) {
+      io->remaining = 0;
+      break;
+    }
+  }
+
+  return io->inflight;
+}
+
+
+/*
+   Cancel any queued reads.  Packets that arrived but were never consumed
+   are dropped, so this should only be called once a transfer is over (or
+   has failed).
+*/
+
+static void
+garmin_usb_cancel ( garmin_unit * garmin )
+{
+  struct garmin_usb_io * io = garmin->usb.io;
+  int                    slot;
+  int                    i;
+
+  if ( io == NULL ) return;
+
+  for ( i = 0; i < io->inflight; i++ ) {
+    slot = (io->next + i) % GARMIN_USB_QUEUE_DEPTH;
+    if ( io->done[slot] == 0 ) {
+      libusb_cancel_transfer(io->xfer[slot]);
+    }
+  }
+
+  for ( i = 0; i < io->inflight; i++ ) {
+    slot = (io->next + i) % GARMIN_USB_QUEUE_DEPTH;
+    while ( io->done[slot] == 0 ) {
+      if ( libusb_handle_events_completed(garmin->usb.ctx,&io->done[slot]) != 0 ) break;
+    }
+  }
+
+  io->next      = 0;
+  io->inflight  = 0;
+  io->remaining = 0;
+  io->held      = 0;
+}
+
+
+/* Return the next queued packet, waiting for it to arrive if necessary. */
+
+static int
+garmin_read_queued ( garmin_unit * garmin, garmin_packet ** p )
+{
+  struct garmin_usb_io *  io   = garmin->usb.io;
+  int                     slot = io->next;
+  struct libusb_transfer * xfer = io->xfer[slot];
+  int                     r    = -1;
+  int                     err;
+
+  while ( io->done[slot] == 0 ) {
+    err = libusb_handle_events_completed(garmin->usb.ctx,&io->done[slot]);
+    if ( err != 0 && err != LIBUSB_ERROR_INTERRUPTED ) {
+      printf("libusb_handle_events failed: %s\n",libusb_error_name(err));
+      garmin_usb_cancel(garmin);
+      return -1;
+    }
+  }
+
+  io->next = (slot + 1) % GARMIN_USB_QUEUE_DEPTH;
+  io->inflight--;
+
+  if ( xfer->status == LIBUSB_TRANSFER_COMPLETED ) {
+    r = xfer->actual_length;
+    *p = &io->packet[slot];
+    io->held = 1;
+  } else {
+    /* A failed or timed out read ends the whole queue. */
+    if ( xfer->status == LIBUSB_TRANSFER_TIMED_OUT ) r = 0;
+    garmin_usb_cancel(garmin);
+  }
+
+  return r;
+}
+
 
 /* Close the USB connection with the Garmin device. */
 
-int
-garmin_close ( garmin_unit * garmin )
+static int
+garmin_usb_close ( garmin_unit * garmin )
 {
+  garmin_free_io(garmin);
+
   if ( garmin->usb.handle != NULL ) {
     libusb_release_interface(garmin->usb.handle,0);
     libusb_close(garmin->usb.handle);
     garmin->usb.handle = NULL;
   }
 
+  if ( garmin->usb.ctx != NULL ) {
+    libusb_exit(garmin->usb.ctx);
+    garmin->usb.ctx = NULL;
+  }
+
   return 0;
 }
 
@@ -75,14 +317,62 @@ check_for_kernel_module (void)
 static bool check_for_kernel_module (void) { return false; };
 #endif
 
+static int
+garmin_is_device ( libusb_device * di )
+{
+  struct libusb_device_descriptor descriptor;
+
+  return ( libusb_get_device_descriptor(di,&descriptor) == 0 &&
+           descriptor.idVendor  == GARMIN_USB_VID &&
+           descriptor.idProduct == GARMIN_USB_PID );
+}
+
+
 /*
-   Open the USB connection with the first Garmin device we find.  Eventually,
-   I'd like to add the ability to select a particular device.  Returns 1 on
-   success, 0 on failure.  Prints diagnostic information and errors to stdout.
+   Fill in the bus and address of up to 'max' attached Garmin devices
+   and return the number of devices found.
 */
 
 int
-garmin_open ( garmin_unit * garmin )
+garmin_enumerate ( garmin_device * devices, int max )
+{
+  libusb_context *     ectx = NULL;
+  libusb_device **     dl;
+  int                  cnt;
+  int                  err;
+  int                  i;
+  int                  n = 0;
+
+  if ( (err = libusb_init(&ectx)) != 0 ) {
+    printf("libusb_init failed: %s\n", libusb_error_name(err));
+    return 0;
+  }
+
+  cnt = libusb_get_device_list(ectx,&dl);
+  for ( i = 0; i < cnt && n < max; i++ ) {
+    if ( garmin_is_device(dl[i]) ) {
+      devices[n].bus     = libusb_get_bus_number(dl[i]);
+      devices[n].address = libusb_get_device_address(dl[i]);
+      n++;
+    }
+  }
+  if ( cnt > 0 ) libusb_free_device_list(dl,1);
+  libusb_exit(ectx);
+
+  return n;
+}
+
+
+/*
+   Open the USB connection with a Garmin device.  If garmin->usb.bus and
+   garmin->usb.address are set, only the device with that address on that
+   bus is considered (a port number is only unique behind a single hub),
+   otherwise the first Garmin device we find is used.  Returns 1 on
+   success, 0 on failure.  Prints diagnostic information and errors to stdout.
+*/
+
+static int
+garmin_usb_open ( garmin_unit * garmin )
 {
   libusb_device **     dl;
   libusb_device *      di;
@@ -96,8 +386,8 @@ garmin_open ( garmin_unit * garmin )
   }
 
   if ( garmin->usb.handle == NULL ) {
-    if ( ctx == NULL ) {
-      err = libusb_init(&ctx);
+    if ( garmin->usb.ctx == NULL ) {
+      err = libusb_init(&garmin->usb.ctx);
       if ( err ) {
         printf("libusb_init failed: %s\n", libusb_error_name(err));
         return ( garmin->usb.handle != NULL );
@@ -105,25 +395,30 @@ garmin_open ( garmin_unit * garmin )
         printf("[garmin] libusb_init succeeded\n");
       }
     }
-    cnt = libusb_get_device_list(ctx,&dl);
+    cnt = libusb_get_device_list(garmin->usb.ctx,&dl);
 
     for (i = 0; i < cnt; ++i) {
-        struct libusb_device_descriptor descriptor;
         struct libusb_config_descriptor *config = NULL;
 
         di = dl[i];
-        err = libusb_get_device_descriptor (di, &descriptor);
 
-        if ( !err &&
-             descriptor.idVendor  == GARMIN_USB_VID &&
-             descriptor.idProduct == GARMIN_USB_PID ) {
+        if ( garmin_is_device(di) &&
+             (garmin->usb.bus  == 0 ||
+              garmin->usb.bus  == libusb_get_bus_number(di)) &&
+             (garmin->usb.address == 0 ||
+              garmin->usb.address == libusb_get_device_address(di)) ) {
 
           if ( garmin->verbose != 0 ) {
-            printf("[garmin] found VID %04x, PID %04x",
-                   descriptor.idVendor,
-                   descriptor.idProduct);
+            printf("[garmin] found VID %04x, PID %04x on bus %d, address %d\n",
+                   GARMIN_USB_VID,
+                   GARMIN_USB_PID,
+                   libusb_get_bus_number(di),
+                   libusb_get_device_address(di));
           }
 
+          garmin->usb.bus     = libusb_get_bus_number(di);
+          garmin->usb.address = libusb_get_device_address(di);
+
           err = libusb_open(di,&garmin->usb.handle);
           garmin->usb.read_bulk = 0;
 
@@ -182,6 +477,7 @@ garmin_open ( garmin_unit * garmin )
               case LIBUSB_TRANSFER_TYPE_BULK:
                 if ( ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK ) {
                   garmin->usb.bulk_in = ep->bEndpointAddress;
+                  garmin->usb.bulk_in_size = ep->wMaxPacketSize;
                   if ( garmin->verbose != 0 ) {
                     printf("[garmin] bulk IN  = 0x%02x\n",garmin->usb.bulk_in);
                   }
@@ -297,67 +593,168 @@ garmin_packetize ( garmin_packet *  p,
 }
 
 
-int
-garmin_read ( garmin_unit * garmin, garmin_packet * p )
+/*
+   Return the next packet from the bulk IN endpoint.  Packets are handed
+   out in place from the bulk buffer; only a packet split across two
+   transfers is moved to the front of the buffer before reading the rest.
+   Returns 0 once the unit has sent all of its data.
+*/
+
+static int
+garmin_read_bulk ( garmin_unit * garmin, garmin_packet ** p )
 {
-  int r = -1;
+  struct garmin_usb_io * io = garmin->usb.io;
+  int                    avail;
+  int                    need;
+  int                    want;
+  int                    got = 0;
+  int                    err;
+
+  while ( 1 ) {
+    avail = io->bulk_len - io->bulk_pos;
+    if ( avail >= PACKET_HEADER_SIZE ) {
+      need = PACKET_HEADER_SIZE +
+        garmin_packet_size((garmin_packet *)(io->bulk + io->bulk_pos));
+      if ( need > (int)sizeof(garmin_packet) ) {
+        printf("garmin_read_bulk: bad packet size %d\n",need);
+        io->bulk_len = io->bulk_pos = 0;
+        return -1;
+      }
+      if ( avail >= need ) {
+        *p = (garmin_packet *)(io->bulk + io->bulk_pos);
+        io->bulk_pos += need;
+        return need;
+      }
+    }
+
+    if ( io->bulk_end != 0 ) {
+      if ( avail > 0 ) {
+        printf("garmin_read_bulk: %d bytes left over\n",avail);
+      }
+      io->bulk_len = io->bulk_pos = io->bulk_end = 0;
+      return 0;
+    }
 
-  garmin_open(garmin);
+    if ( avail > 0 && io->bulk_pos > 0 ) {
+      memmove(io->bulk,io->bulk + io->bulk_pos,avail);
+    }
+    io->bulk_pos = 0;
+    io->bulk_len = avail;
 
-  if ( garmin->usb.handle != NULL ) {
-    if ( garmin->usb.read_bulk == 0 ) {
+    /*
+       Ask for whole packets only: a packet that doesn't fit in what is
+       asked for is an overflow, not a short read.
+    */
+
+    want = GARMIN_USB_BULK_SIZE - avail;
+    if ( garmin->usb.bulk_in_size > 0 ) {
+      want -= want % garmin->usb.bulk_in_size;
+    }
+
+    err = libusb_bulk_transfer(garmin->usb.handle,
+                               garmin->usb.bulk_in,
+                               io->bulk + avail,
+                               want,
+                               &got,
+                               BULK_TIMEOUT);
+    if ( err != 0 ) {
+      printf("libusb_bulk_transfer failed: %s\n",libusb_error_name(err));
+      io->bulk_len = 0;
+      return -1;
+    }
+    io->bulk_len += got;
+
+    /*
+       A transfer ends early on a short packet.  If it ended early on a
+       multiple of the endpoint's packet size, that short packet was the
+       zero-length one that marks the end of the data.  (A timeout is
+       an error, above, so it can't be taken for the end.)
+    */
+
+    if ( got == 0 ||
+         (got < want &&
+          garmin->usb.bulk_in_size > 0 &&
+          got % garmin->usb.bulk_in_size == 0) ) {
+      io->bulk_end = 1;
+    }
+  }
+}
+
+
+static int
+garmin_usb_read ( garmin_unit * garmin, garmin_packet ** p )
+{
+  struct garmin_usb_io * io;
+  int                    r = -1;
+
+  if ( garmin_usb_open(garmin) == 0 || (io = garmin_get_io(garmin)) == NULL ) {
+    return r;
+  }
+
+  /* The caller is done with the last queued packet, so reuse its slot. */
+
+  if ( io->held != 0 ) {
+    io->held = 0;
+    if ( io->remaining > 0 && garmin_submit_read(garmin) == 0 ) {
+      io->remaining = 0;
+    }
+  }
+
+  while ( 1 ) {
+    if ( garmin->usb.read_bulk != 0 ) {
+      if ( (r = garmin_read_bulk(garmin,p)) != 0 ) break;
+
+      /* The bulk data is drained; go back to the interrupt endpoint. */
+
+      garmin->usb.read_bulk = 0;
+      continue;
+    }
+
+    if ( io->inflight > 0 ) {
+      r = garmin_read_queued(garmin,p);
+    } else {
       libusb_interrupt_transfer(garmin->usb.handle,
                                 garmin->usb.intr_in,
-                                (unsigned char *) p->data,
+                                (unsigned char *) io->intr.data,
                                 sizeof(garmin_packet),
                                 &r,
                                 INTR_TIMEOUT);
-      /*
-         If the packet is a "Pid_Data_Available" packet, we need to read
-         from the bulk endpoint until we get an empty packet.
-      */
-
-      if ( garmin_packet_type(p) == GARMIN_PROTOCOL_USB &&
-           garmin_packet_id(p) == Pid_Data_Available ) {
+      *p = &io->intr;
+    }
 
-        /* FIXME!!! */
+    /*
+       If the packet is a "Pid_Data_Available" packet, we need to read
+       from the bulk endpoint until we get an empty packet.
+    */
 
-        printf("Received a Pid_Data_Available from the unit!\n");
+    if ( r > 0 &&
+         garmin_packet_type(*p) == GARMIN_PROTOCOL_USB &&
+         garmin_packet_id(*p) == Pid_Data_Available ) {
+      if ( garmin->verbose != 0 ) {
+        printf("[garmin] data available on the bulk endpoint\n");
       }
-
-    } else {
-      libusb_bulk_transfer(garmin->usb.handle,
-                           garmin->usb.bulk_in,
-                           (unsigned char *) p->data,
-                           sizeof(garmin_packet),
-                           &r,
-                           BULK_TIMEOUT);
+      garmin_usb_cancel(garmin);
+      garmin->usb.read_bulk = 1;
+      continue;
     }
-  }
 
-  if ( garmin->verbose != 0 && r >= 0 ) {
-    garmin_print_packet(p,GARMIN_DIR_READ,stdout);
+    break;
   }
 
   return r;
 }
 
 
-int
-garmin_write ( garmin_unit * garmin, garmin_packet * p )
+static int
+garmin_usb_write ( garmin_unit * garmin, garmin_packet * p )
 {
   int err = 0;
   int r = -1;
   int s = garmin_packet_size(p) + PACKET_HEADER_SIZE;
 
-  garmin_open(garmin);
+  garmin_usb_open(garmin);
 
   if ( garmin->usb.handle != NULL ) {
-
-    if ( garmin->verbose != 0 ) {
-      garmin_print_packet(p,GARMIN_DIR_WRITE,stdout);
-    }
-
     err = libusb_bulk_transfer(garmin->usb.handle,
                                garmin->usb.bulk_out,
                                (unsigned char *) p->data,
@@ -375,6 +772,18 @@ garmin_write ( garmin_unit * garmin, garmin_packet * p )
 }
 
 
+const garmin_transport garmin_usb_transport = {
+  "usb",
+  garmin_usb_open,
+  garmin_usb_close,
+  garmin_usb_read,
+  garmin_usb_write,
+  garmin_usb_queue,
+  garmin_usb_cancel,
+  NULL
+};
+
+
 uint32
 garmin_start_session ( garmin_unit * garmin )
 {
@@ -444,13 +853,3 @@ garmin_print_packet ( garmin_packet * p, int dir, FILE * fp )
     fprintf(fp,"/>\n");
   }
 }
-
-static void garmin_usb_shutdown(void) __attribute__((destructor));
-
-static void
-garmin_usb_shutdown(void) {
-    if (ctx != NULL) {
-        libusb_exit (ctx);
-        ctx = NULL;
-    }
-}
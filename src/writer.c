@@ -0,0 +1,295 @@
+/*
+  Garmintools software package
+  Copyright (C) 2006-2008 Dave Bailey
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "garmin.h"
+
+
+/* The out-of-line copies of the inline write functions in garmin.h. */
+
+extern inline void garmin_write_mem    ( garmin_writer * w,
+                                         const char *    s,
+                                         size_t          n );
+extern inline void garmin_write_str    ( garmin_writer * w, const char * s );
+extern inline void garmin_write_char   ( garmin_writer * w, char c );
+extern inline void garmin_write_spaces ( garmin_writer * w, int n );
+extern inline void garmin_write_uint   ( garmin_writer * w, uint32 v );
+extern inline void garmin_write_int    ( garmin_writer * w, sint32 v );
+
+
+/* Every power of ten up to 10^17 is exact in a double. */
+
+#define WRITER_MAX_PREC  17
+
+static const double writer_scale[WRITER_MAX_PREC + 1] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,
+  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+
+void
+garmin_writer_init ( garmin_writer * w, FILE * fp, char * buf, size_t size )
+{
+  w->fp     = fp;
+  w->buf    = buf;
+  w->size   = size;
+  w->used   = 0;
+  w->failed = 0;
+  w->owned  = 0;
+  memset(w->times,0,sizeof(w->times));
+}
+
+
+/* A writer with a buffer of its own.  Returns NULL if out of memory. */
+
+garmin_writer *
+garmin_writer_open ( FILE * fp )
+{
+  garmin_writer * w;
+
+  if ( (w = malloc(sizeof(garmin_writer))) == NULL ) return NULL;
+  if ( (w->buf = malloc(GARMIN_WRITER_SIZE)) == NULL ) {
+    free(w);
+    return NULL;
+  }
+  garmin_writer_init(w,fp,w->buf,GARMIN_WRITER_SIZE);
+  w->owned = 1;
+
+  return w;
+}
+
+
+/*
+   Hand what is in the buffer to stdio (not to the file itself; that is
+   up to fflush).  Returns 0 if this or any earlier write failed.
+*/
+
+int
+garmin_writer_flush ( garmin_writer * w )
+{
+  if ( w->used > 0 && fwrite(w->buf,w->used,1,w->fp) != 1 ) {
+    w->failed = 1;
+  }
+  w->used = 0;
+
+  return !w->failed;
+}
+
+
+/*
+   Flush the writer and free it if garmin_writer_open made it.  The FILE
+   is left open.  Returns 0 if any write failed.
+*/
+
+int
+garmin_writer_close ( garmin_writer * w )
+{
+  int ok;
+
+  if ( w == NULL ) return 1;
+
+  ok = garmin_writer_flush(w);
+  if ( w->owned ) {
+    free(w->buf);
+    free(w);
+  }
+
+  return ok;
+}
+
+
+/*
+   The slow path of garmin_write_mem: 'n' bytes that don't fit in what is
+   left of the buffer.  Anything as big as the buffer goes straight out.
+*/
+
+void
+garmin_write_spill ( garmin_writer * w, const char * s, size_t n )
+{
+  garmin_writer_flush(w);
+  if ( n < w->size ) {
+    memcpy(w->buf,s,n);
+    w->used = n;
+  } else if ( fwrite(s,n,1,w->fp) != 1 ) {
+    w->failed = 1;
+  }
+}
+
+
+void
+garmin_write_printf ( garmin_writer * w, const char * fmt, ... )
+{
+  va_list  ap;
+  int      n;
+
+  va_start(ap,fmt);
+  n = vsnprintf(w->buf + w->used,w->size - w->used,fmt,ap);
+  va_end(ap);
+
+  if ( n < 0 ) {
+    w->failed = 1;
+  } else if ( (size_t)n < w->size - w->used ) {
+    w->used += n;
+  } else {
+
+    /* It didn't fit (vsnprintf wants room for a '\0' too).  Try again. */
+
+    garmin_writer_flush(w);
+    va_start(ap,fmt);
+    if ( (size_t)n < w->size ) {
+      w->used = vsnprintf(w->buf,w->size,fmt,ap);
+    } else if ( vfprintf(w->fp,fmt,ap) < 0 ) {
+      w->failed = 1;
+    }
+    va_end(ap);
+  }
+}
+
+
+/*
+   Write 'x' with 'prec' digits after the point, exactly as printf's
+   "%.*f" would.  printf rounds the exact binary value of 'x', so the
+   scaled value is rounded to an integer and fma gives the exact
+   remainder; if that is too close to a half for the rounding to be
+   certain (or the number is too big, or not a number), printf does it.
+*/
+
+void
+garmin_write_fixed ( garmin_writer * w, double x, int prec )
+{
+  char      d[48];
+  double    a;
+  double    e;
+  uint64_t  v;
+  int       n = sizeof(d);
+  int       i;
+
+  if ( prec < 0 || prec > WRITER_MAX_PREC || !isfinite(x) ) {
+    garmin_write_printf(w,"%.*f",prec,x);
+    return;
+  }
+
+  a = fabs(x) * writer_scale[prec];
+  if ( a >= 9007199254740992.0 ) {
+    garmin_write_printf(w,"%.*f",prec,x);
+    return;
+  }
+
+  v = (uint64_t)(a + 0.5);
+  e = fma(fabs(x),writer_scale[prec],-(double)v);
+  if ( e > 0.4999 || e < -0.4999 ) {
+    garmin_write_printf(w,"%.*f",prec,x);
+    return;
+  }
+
+  for ( i = 0; i < prec; i++ ) {
+    d[--n] = '0' + v % 10;
+    v /= 10;
+  }
+  if ( prec > 0 ) d[--n] = '.';
+  do {
+    d[--n] = '0' + v % 10;
+    v /= 10;
+  } while ( v != 0 );
+  if ( signbit(x) ) d[--n] = '-';
+
+  garmin_write_mem(w,d + n,sizeof(d) - n);
+}
+
+
+/*
+   The time 't' in the given style.  The text is kept in 'c' and is good
+   until the next call.  Within the minute of the last call only the
+   seconds are rewritten; otherwise the time is broken down again and
+   the text made afresh, the same way strftime's "%FT%T%z" would, with a
+   ':' put into the time zone as ISO 8601 wants.  (Time zones change
+   their offsets on the minute, so the rest of the text holds for the
+   whole minute.)
+*/
+
+const char *
+garmin_format_time ( garmin_time_cache * c, time_t t, garmin_time_style style )
+{
+  static const char * formats[GARMIN_TIME_STYLES] = {
+    "%FT%T%z", "%FT%T%z", "%FT%TZ", "%FT%T"
+  };
+  struct tm  tmval;
+  char *     p;
+  time_t     s;
+
+  if ( c->len > 0 && t >= c->base && (s = t - c->base) < 60 ) {
+    c->text[c->sec]   = '0' + s / 10;
+    c->text[c->sec+1] = '0' + s % 10;
+    return c->text;
+  }
+
+  if ( style == GARMIN_TIME_LOCAL ) {
+    localtime_r(&t,&tmval);
+  } else {
+    gmtime_r(&t,&tmval);
+  }
+
+  c->len = strftime(c->text,sizeof(c->text) - 1,formats[style],&tmval);
+
+  /*
+     Make the -0700 of %z into -07:00, unless it's a 'Z'.  The last two
+     characters (and the '\0') move out one, and the ':' goes in the
+     vacated spot.
+  */
+
+  if ( style <= GARMIN_TIME_UTC && c->len > 2 && c->text[c->len-1] != 'Z' ) {
+    memmove(c->text + c->len - 1,c->text + c->len - 2,3);
+    c->text[c->len-2] = ':';
+    c->len++;
+  }
+
+  /* The seconds are the two digits after "T12:34:". */
+
+  if ( (p = strchr(c->text,'T')) != NULL && p + 9 <= c->text + c->len ) {
+    c->sec  = p + 7 - c->text;
+    c->base = t - tmval.tm_sec;
+  } else {
+    c->len = 0;
+  }
+
+  return c->text;
+}
+
+
+/* Write the time 't' in the given style; see garmin_format_time. */
+
+void
+garmin_write_time ( garmin_writer * w, time_t t, garmin_time_style style )
+{
+  garmin_time_cache * c = &w->times[style];
+  const char *        s = garmin_format_time(c,t,style);
+
+  if ( c->len > 0 ) {
+    garmin_write_mem(w,s,c->len);
+  } else {
+    garmin_write_str(w,s);
+  }
+}
+